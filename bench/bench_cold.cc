@@ -0,0 +1,87 @@
+// Cold store benchmark : RSS and GET latency with values in memory, then
+// moved to the log.
+// usage : bench_cold [values=1000] [size=102400] [log=/tmp/bench_cold.log]
+#include "commands/table.h"
+#include "store/cold_store.h"
+#include <malloc.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <vector>
+
+// resident set size, in MiB
+static double rss() {
+    std::ifstream statm("/proc/self/statm");
+    size_t total = 0, resident = 0;
+    statm >> total >> resident;
+    return static_cast<double>(resident * static_cast<size_t>(sysconf(_SC_PAGESIZE))) / (1 << 20);
+}
+
+// GETs every key once in random order, returns the sorted latencies
+static std::vector<double> get_all(commands::Table& table, const std::vector<std::string>& keys) {
+    std::vector<size_t> order(keys.size());
+    for (size_t k = 0 ; k < order.size() ; ++k) order[k] = k;
+    std::shuffle(order.begin(), order.end(), std::mt19937(42));
+    const commands::Spec& get = *table.lookup("GET");
+    std::vector<double> us;
+    std::string out;
+    for (size_t k : order) {
+        out.clear();
+        auto t = std::chrono::steady_clock::now();
+        table.call(get, {"GET", keys[k]}, out);
+        us.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t).count());
+    }
+    std::sort(us.begin(), us.end());
+    return us;
+}
+
+static void report(const char* what, const std::vector<double>& us) {
+    std::cout << what << " p50 " << us[us.size() / 2] << " us, p99 " << us[us.size() * 99 / 100] << " us\n";
+}
+
+int main(int argc, char** argv) {
+    size_t n = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000;
+    size_t size = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 100 * 1024;
+    std::string log = argc > 3 ? argv[3] : "/tmp/bench_cold.log";
+
+    store::Keyspace ks;
+    commands::Table table(ks);
+    store::ColdStore::Options opts;
+    opts.path = log;
+    opts.min_size = size;
+    // sweeps are run by hand
+    opts.sweep_ms = 3600 * 1000;
+    store::ColdStore cold(ks, table.timers(), opts);
+
+    double base = rss();
+    std::vector<std::string> keys;
+    std::string value(size, 'v');
+    const commands::Spec& set = *table.lookup("SET");
+    for (size_t k = 0 ; k < n ; ++k) {
+        keys.push_back("key:" + std::to_string(k));
+        value[k % size] = static_cast<char>('a' + k % 26);
+        std::string out;
+        table.call(set, {"SET", keys.back(), value}, out);
+    }
+    std::cout << "values               : " << n << " x " << size << " bytes\n"
+              << "RSS empty            : " << base << " MiB\n"
+              << "RSS in memory        : " << rss() << " MiB\n";
+    report("GET in memory        :", get_all(table, keys));
+
+    auto t = std::chrono::steady_clock::now();
+    size_t moved = cold.sweep();
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t).count();
+    malloc_trim(0);
+    std::cout << "sweep                : " << moved / (1 << 20) << " MiB in " << ms << " ms\n"
+              << "RSS cold             : " << rss() << " MiB\n";
+    // the first read of each value brings it back in memory
+    report("GET cold (read back) :", get_all(table, keys));
+    std::cout << "RSS read back        : " << rss() << " MiB\n";
+
+    unlink(log.c_str());
+    return 0;
+}
@@ -0,0 +1,52 @@
+// Memory benchmark : resident bytes per key once the keyspace holds n small
+// keys. One value kind per run, freed memory is not always given back.
+// usage : bench_memory [keys=10000000] [int|short|medium|long]
+#include "commands/table.h"
+#include <unistd.h>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+// resident set size, in bytes
+static double rss() {
+    std::ifstream statm("/proc/self/statm");
+    size_t total = 0, resident = 0;
+    statm >> total >> resident;
+    return static_cast<double>(resident * static_cast<size_t>(sysconf(_SC_PAGESIZE)));
+}
+
+// the value of key k : a counter, a short token, a 24-byte id or a string
+// too long to be kept inline
+static std::string value_of(const std::string& kind, size_t k) {
+    std::string n = std::to_string(k);
+    if (kind == "int") return n;
+    if (kind == "short") return "v:" + n;
+    if (kind == "medium") return "session:" + std::string(16 - n.size() % 16, '0') + n;
+    return "user:" + n + ":" + std::string(40, 'x');
+}
+
+int main(int argc, char** argv) {
+    size_t n = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 10000000;
+    std::string kind = argc > 2 ? argv[2] : "int";
+
+    store::Keyspace ks;
+    commands::Table table(ks);
+    const commands::Spec& set = *table.lookup("SET");
+    double base = rss();
+    auto t = std::chrono::steady_clock::now();
+    std::string out;
+    for (size_t k = 0 ; k < n ; ++k) {
+        std::string key = "key:" + std::to_string(k);
+        std::string value = value_of(kind, k);
+        out.clear();
+        table.call(set, {"SET", key, value}, out);
+    }
+    double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - t).count();
+    std::cout << "keys      : " << n << " (" << kind << " values, e.g. \"" << value_of(kind, n - 1) << "\")\n"
+              << "SET       : " << s << " s\n"
+              << "RSS       : " << (rss() - base) / (1 << 20) << " MiB\n"
+              << "bytes/key : " << (rss() - base) / static_cast<double>(n) << "\n";
+    return 0;
+}
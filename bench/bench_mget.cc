@@ -0,0 +1,89 @@
+// Multi-key benchmark : MGET of batch random keys out of a keyspace much
+// larger than the caches, against the same lookups made one after the
+// other (what MGET did before it prefetched) and against batch GETs.
+// Shards are locked once per command in every case.
+// usage : bench_mget [keys=4000000] [batch=100] [rounds=20000]
+#include "commands/table.h"
+#include "resp/resp_utils.h"
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+// the lookups of MGET without batch() : each key hashed and looked up in
+// turn, shards locked once
+static void naive_mget(commands::Table& table, const commands::Args& argv, std::string& out) {
+    auto& ks = table.keyspace();
+    uint64_t mask = commands::Table::shards(*table.lookup("MGET"), argv);
+    table.lock(mask);
+    data::write_header(out, data::Type::Array, argv.size() - 1);
+    for (size_t k = 1 ; k < argv.size() ; ++k) {
+        auto* v = ks.peek(argv[k]);
+        auto* i = v == nullptr ? nullptr : std::get_if<store::Inline>(v);
+        if (i == nullptr) {
+            out += "_\r\n";
+            continue;
+        }
+        data::write_header(out, data::Type::BulkString, i->size);
+        out.append(i->view());
+        out += "\r\n";
+    }
+    table.unlock(mask);
+}
+
+int main(int argc, char** argv) {
+    size_t n = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 4000000;
+    size_t batch = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 100;
+    size_t rounds = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 20000;
+
+    store::Keyspace ks;
+    commands::Table table(ks);
+    std::vector<std::string> keys;
+    keys.reserve(n);
+    std::string out;
+    for (size_t k = 0 ; k < n ; ++k) {
+        keys.push_back("key:" + std::to_string(k));
+        out.clear();
+        table.call(*table.lookup("SET"), {"SET", keys.back(), "value:" + std::to_string(k % 1000)}, out);
+    }
+
+    std::mt19937_64 rng(1);
+    std::vector<commands::Args> requests(rounds);
+    for (auto& r : requests) {
+        r.push_back("MGET");
+        for (size_t k = 0 ; k < batch ; ++k) r.push_back(keys[rng() % n]);
+    }
+
+    auto run = [&] (const char* name, auto&& fn) {
+        std::string reply;
+        size_t bytes = 0;
+        auto t = std::chrono::steady_clock::now();
+        for (auto& r : requests) {
+            reply.clear();
+            fn(r, reply);
+            bytes += reply.size();
+        }
+        double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - t).count();
+        std::cout << name << static_cast<uint64_t>(rounds * batch / s) << " keys/s, "
+                  << s * 1e9 / (rounds * batch) << " ns/key (" << bytes << " bytes)\n";
+    };
+
+    const commands::Spec& mget = *table.lookup("MGET");
+    const commands::Spec& get = *table.lookup("GET");
+    std::cout << "keys      : " << n << ", MGET of " << batch << " x " << rounds << "\n";
+    // twice each, the first pass warms what can be warmed
+    for (int pass = 0 ; pass < 2 ; ++pass) {
+        run("MGET      : ", [&] (const commands::Args& r, std::string& reply) {
+            table.call(mget, r, reply);
+        });
+        run("naive     : ", [&] (const commands::Args& r, std::string& reply) {
+            naive_mget(table, r, reply);
+        });
+        run("GETs      : ", [&] (const commands::Args& r, std::string& reply) {
+            for (size_t k = 1 ; k < r.size() ; ++k) table.call(get, {"GET", r[k]}, reply);
+        });
+    }
+    return 0;
+}
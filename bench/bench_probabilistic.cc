@@ -0,0 +1,148 @@
+// HyperLogLog and Bloom filter benchmark : the estimation error of PFCOUNT
+// and the false positive rate of the filters against what was asked, then
+// the throughput of their commands. Multi-key PFCOUNT is timed against the
+// byte-at-a-time maximum of the registers it replaces.
+// usage : bench_probabilistic [items=1000000] [keys=16]
+#include "commands/table.h"
+#include "datastructures/bloom.h"
+#include "datastructures/hyperloglog.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace hll = data::hll;
+
+static double since(std::chrono::steady_clock::time_point t) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - t).count();
+}
+
+static std::string item(const char* prefix, size_t k) {
+    return prefix + std::to_string(k);
+}
+
+static void hll_accuracy(size_t n) {
+    std::cout << "HLL error :\n";
+    std::string s = hll::create();
+    size_t added = 0;
+    for (size_t target = 10 ; target <= n ; target *= 10) {
+        for (; added < target ; ++added) hll::add(s, item("visitor:", added));
+        int64_t c = hll::count(s);
+        std::cout << "  " << target << " : " << c << " (" << 100.0 * (c - static_cast<double>(target)) / target
+                  << " %), " << (s[4] == hll::SPARSE ? "sparse, " : "dense, ") << s.size() << " bytes\n";
+    }
+}
+
+static void bloom_accuracy(size_t n) {
+    std::cout << "Bloom false positives :\n";
+    for (double error : {0.01, 0.001}) {
+        data::Bloom b(error, n);
+        for (size_t k = 0 ; k < n ; ++k) b.add(item("in:", k));
+        size_t fp = 0;
+        for (size_t k = 0 ; k < n ; ++k) fp += b.contains(item("out:", k)) ? 1 : 0;
+        std::cout << "  asked " << error << ", got " << static_cast<double>(fp) / n << " at "
+                  << 8.0 * b.bytes() / n << " bits per item\n";
+    }
+}
+
+int main(int argc, char** argv) {
+    size_t n = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000000;
+    size_t keys = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 16;
+
+    hll_accuracy(n);
+    bloom_accuracy(n);
+
+    store::Keyspace ks;
+    commands::Table table(ks);
+    std::string out;
+    auto rate = [] (const char* name, size_t ops, double s) {
+        std::cout << name << static_cast<uint64_t>(ops / s) << " /s, " << s * 1e9 / ops << " ns\n";
+    };
+
+    const commands::Spec& pfadd = *table.lookup("PFADD");
+    auto t = std::chrono::steady_clock::now();
+    for (size_t k = 0 ; k < n ; ++k) {
+        out.clear();
+        std::string e = item("visitor:", k);
+        table.call(pfadd, {"PFADD", item("hll:", k % keys), e}, out);
+    }
+    rate("PFADD            : ", n, since(t));
+
+    // every key is dense by now
+    commands::Args count = {"PFCOUNT"};
+    std::vector<std::string> names;
+    for (size_t k = 0 ; k < keys ; ++k) names.push_back(item("hll:", k));
+    for (auto& name : names) count.push_back(name);
+    size_t rounds = std::max<size_t>(1, 20000 / keys);
+    const commands::Spec& pfcount = *table.lookup("PFCOUNT");
+    t = std::chrono::steady_clock::now();
+    for (size_t r = 0 ; r < rounds ; ++r) {
+        out.clear();
+        table.call(pfcount, count, out);
+    }
+    rate("PFCOUNT x keys   : ", rounds * keys, since(t));
+    std::cout << "  = " << out;
+
+    // the merges of PFCOUNT, then done without SIMD
+    std::vector<hll::Raw> raws(keys);
+    for (size_t k = 0 ; k < keys ; ++k) {
+        raws[k].fill(0);
+        hll::merge(std::get<std::string>(*ks.find(names[k])), raws[k]);
+    }
+    hll::Raw acc;
+    rounds *= 10;
+    t = std::chrono::steady_clock::now();
+    for (size_t r = 0 ; r < rounds ; ++r) {
+        acc.fill(0);
+        for (auto& raw : raws) hll::max(acc, raw);
+    }
+    rate("register max     : ", rounds * keys, since(t));
+    uint64_t sink = acc[0];
+    t = std::chrono::steady_clock::now();
+    for (size_t r = 0 ; r < rounds ; ++r) {
+        acc.fill(0);
+        for (auto& raw : raws) {
+            for (size_t i = 0 ; i < hll::k_registers ; ++i) {
+                // volatile, or the compiler vectorizes it all the same
+                uint8_t v = *static_cast<const volatile uint8_t*>(&raw[i]);
+                acc[i] = std::max(acc[i], v);
+            }
+        }
+    }
+    rate("byte at a time   : ", rounds * keys, since(t));
+    sink += acc[0];
+
+    const commands::Spec& add = *table.lookup("BF.ADD");
+    const commands::Spec& exists = *table.lookup("BF.EXISTS");
+    const commands::Spec& mexists = *table.lookup("BF.MEXISTS");
+    out.clear();
+    table.call(*table.lookup("BF.RESERVE"), {"BF.RESERVE", "bf", "0.01", std::to_string(n)}, out);
+    t = std::chrono::steady_clock::now();
+    for (size_t k = 0 ; k < n ; ++k) {
+        out.clear();
+        std::string e = item("in:", k);
+        table.call(add, {"BF.ADD", "bf", e}, out);
+    }
+    rate("BF.ADD           : ", n, since(t));
+    t = std::chrono::steady_clock::now();
+    for (size_t k = 0 ; k < n ; ++k) {
+        out.clear();
+        std::string e = item(k % 2 ? "in:" : "out:", k);
+        table.call(exists, {"BF.EXISTS", "bf", e}, out);
+    }
+    rate("BF.EXISTS        : ", n, since(t));
+    std::vector<std::string> batch;
+    for (size_t k = 0 ; k < n ; ++k) batch.push_back(item(k % 2 ? "in:" : "out:", k));
+    t = std::chrono::steady_clock::now();
+    for (size_t k = 0 ; k + 100 <= n ; k += 100) {
+        commands::Args argv = {"BF.MEXISTS", "bf"};
+        for (size_t j = k ; j < k + 100 ; ++j) argv.push_back(batch[j]);
+        out.clear();
+        table.call(mexists, argv, out);
+    }
+    rate("BF.MEXISTS / 100 : ", n / 100 * 100, since(t));
+    return sink == 1234567 ? 1 : 0;
+}
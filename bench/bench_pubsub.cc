@@ -0,0 +1,88 @@
+// Fan-out benchmark : one publisher, N subscribers on socketpairs.
+// usage : bench_pubsub [subscribers=10000] [messages=200] [payload=64]
+#include "pubsub/pubsub.h"
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+int main(int argc, char** argv) {
+    size_t n_subs = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 10000;
+    size_t n_msgs = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 200;
+    size_t payload = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 64;
+
+    // two fds per subscriber
+    struct rlimit rl;
+    getrlimit(RLIMIT_NOFILE, &rl);
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+    if (rl.rlim_cur < 2 * n_subs + 64) {
+        n_subs = (rl.rlim_cur - 64) / 2;
+        std::cerr << "fd limit too low, running with " << n_subs << " subscribers\n";
+    }
+
+    pubsub::PubSub ps;
+    std::vector<int> fds;
+    int epfd = epoll_create1(0);
+    for (size_t k = 0 ; k < n_subs ; ++k) {
+        int sv[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) net::die("socketpair()");
+        fds.push_back(sv[0]);
+        fds.push_back(sv[1]);
+        ps.subscribe(sv[0], "bench");
+        epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.fd = sv[1];
+        epoll_ctl(epfd, EPOLL_CTL_ADD, sv[1], &ev);
+    }
+
+    std::string message(payload, 'x');
+    const std::string frame_hdr = ">3\r\n$7\r\nmessage\r\n$5\r\nbench\r\n$" + std::to_string(payload) + "\r\n";
+    const size_t frame_size = frame_hdr.size() + payload + 2;
+    const size_t expected = frame_size * n_msgs * n_subs;
+
+    // drains the client side of every socketpair
+    std::atomic<size_t> received{0};
+    std::thread reader([&] {
+        std::vector<char> buf(1 << 16);
+        epoll_event events[256];
+        while (received.load(std::memory_order_relaxed) < expected) {
+            int n = epoll_wait(epfd, events, 256, 100);
+            for (int k = 0 ; k < n ; ++k) {
+                ssize_t rv;
+                while ((rv = recv(events[k].data.fd, buf.data(), buf.size(), MSG_DONTWAIT)) > 0) {
+                    received.fetch_add(static_cast<size_t>(rv), std::memory_order_relaxed);
+                }
+            }
+        }
+    });
+
+    auto start = std::chrono::steady_clock::now();
+    std::chrono::nanoseconds in_publish{0};
+    for (size_t m = 0 ; m < n_msgs ; ++m) {
+        auto t = std::chrono::steady_clock::now();
+        ps.publish("bench", message);
+        in_publish += std::chrono::steady_clock::now() - t;
+    }
+    reader.join();
+    auto total = std::chrono::steady_clock::now() - start;
+
+    double secs = std::chrono::duration<double>(total).count();
+    double deliveries = static_cast<double>(n_subs * n_msgs);
+    std::cout << "subscribers          : " << n_subs << '\n'
+              << "messages             : " << n_msgs << " x " << payload << " bytes\n"
+              << "publish() avg        : "
+              << std::chrono::duration<double, std::micro>(in_publish).count() / n_msgs << " us\n"
+              << "end-to-end           : " << secs * 1e3 << " ms\n"
+              << "deliveries/s         : " << deliveries / secs << '\n'
+              << "delivered MiB/s      : " << expected / secs / (1 << 20) << '\n';
+
+    for (int fd : fds) close(fd);
+    close(epfd);
+    return 0;
+}
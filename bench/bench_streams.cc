@@ -0,0 +1,135 @@
+// Stream benchmark : XADD into the packed blocks, XRANGE paging through
+// them, a consumer group reading and acknowledging everything, then XREAD
+// BLOCK readers parked on a stream and resumed by each XADD.
+// usage : bench_streams [entries=1000000] [readers=16] [rounds=500]
+#include "commands/blocking.h"
+#include "commands/table.h"
+#include <sys/socket.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+static double since(std::chrono::steady_clock::time_point t) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - t).count();
+}
+
+static void rate(const char* name, size_t ops, double s) {
+    std::cout << name << static_cast<uint64_t>(ops / s) << " /s, " << s * 1e9 / ops << " ns\n";
+}
+
+// the last ID in a page of XRANGE or XREADGROUP, empty when there is none
+static std::string last_id(const std::string& reply) {
+    size_t at = reply.rfind("\r\n*2\r\n$");
+    if (at == std::string::npos) return {};
+    at = reply.find("\r\n", at + 7) + 2;
+    return reply.substr(at, reply.find("\r\n", at) - at);
+}
+
+int main(int argc, char** argv) {
+    size_t n = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000000;
+    size_t readers = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 16;
+    size_t rounds = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 500;
+
+    store::Keyspace ks;
+    commands::Table table(ks);
+    std::string out;
+
+    const commands::Spec& xadd = *table.lookup("XADD");
+    auto t = std::chrono::steady_clock::now();
+    for (size_t k = 0 ; k < n ; ++k) {
+        out.clear();
+        std::string v = std::to_string(k);
+        table.call(xadd, {"XADD", "s", "*", "sensor", "17", "value", v}, out);
+    }
+    rate("XADD             : ", n, since(t));
+    auto& s = *std::get<store::StreamPtr>(*ks.peek("s"));
+    std::cout << "  " << s.blocks() << " blocks, " << n / s.blocks() << " entries each\n";
+
+    const commands::Spec& xrange = *table.lookup("XRANGE");
+    std::string from = "-";
+    size_t got = 0;
+    t = std::chrono::steady_clock::now();
+    for (;;) {
+        out.clear();
+        table.call(xrange, {"XRANGE", "s", from, "+", "COUNT", "100"}, out);
+        std::string last = last_id(out);
+        if (last.empty()) break;
+        got += std::strtoul(out.c_str() + 1, nullptr, 10);
+        from = "(" + last;
+    }
+    rate("XRANGE / 100     : ", got, since(t));
+
+    out.clear();
+    table.call(*table.lookup("XGROUP"), {"XGROUP", "CREATE", "s", "workers", "0"}, out);
+    const commands::Spec& xreadgroup = *table.lookup("XREADGROUP");
+    const commands::Spec& xack = *table.lookup("XACK");
+    got = 0;
+    t = std::chrono::steady_clock::now();
+    for (;;) {
+        out.clear();
+        table.call(xreadgroup, {"XREADGROUP", "GROUP", "workers", "w1", "COUNT", "100", "STREAMS", "s", ">"}, out);
+        std::string last = last_id(out);
+        if (last.empty()) break;
+        // what was delivered, acknowledged in one go
+        commands::Args ack = {"XACK", "s", "workers"};
+        std::vector<std::string> ids;
+        ids.reserve(100);
+        for (size_t at = out.find("*2\r\n$") ; at != std::string::npos ; at = out.find("\r\n*2\r\n$", at + 1)) {
+            size_t p = out.find("\r\n", out.find('$', at)) + 2;
+            ids.push_back(out.substr(p, out.find("\r\n", p) - p));
+        }
+        for (auto& id : ids) ack.push_back(id);
+        std::string acked;
+        table.call(xack, ack, acked);
+        got += ids.size();
+    }
+    rate("XREADGROUP + ACK : ", got, since(t));
+
+    // readers parked on the stream, each round one XADD resumes them all
+    commands::Blocking blocking(table);
+    std::vector<std::pair<int, int>> socks(readers);
+    for (auto& [srv, cli] : socks) {
+        int sv[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) return 1;
+        srv = sv[0];
+        cli = sv[1];
+    }
+    std::atomic<size_t> served{0};
+    std::vector<std::thread> threads;
+    for (size_t k = 0 ; k < readers ; ++k) {
+        threads.emplace_back([&, k] {
+            char buf[4096];
+            for (size_t r = 0 ; r < rounds ; ++r) {
+                (void)blocking.handle(socks[k].first, {{"XREAD", "BLOCK", "0", "STREAMS", "s", "$"}}).run();
+                ssize_t rv = read(socks[k].second, buf, sizeof(buf));
+                (void)rv;
+                served.fetch_add(1, std::memory_order_release);
+            }
+        });
+    }
+    double woken = 0;
+    for (size_t r = 0 ; r < rounds ; ++r) {
+        while (served.load(std::memory_order_acquire) != r * readers || blocking.blocked() != readers) {
+            std::this_thread::yield();
+        }
+        t = std::chrono::steady_clock::now();
+        out.clear();
+        table.call(xadd, {"XADD", "s", "*", "sensor", "17", "value", "wake"}, out);
+        while (served.load(std::memory_order_acquire) != (r + 1) * readers) std::this_thread::yield();
+        woken += since(t);
+    }
+    for (auto& th : threads) th.join();
+    std::cout << "XREAD BLOCK      : " << readers << " readers, " << woken * 1e6 / rounds
+              << " us from XADD to the last reply\n";
+    rate("  wakeups        : ", readers * rounds, woken);
+    for (auto& [srv, cli] : socks) {
+        close(srv);
+        close(cli);
+    }
+    return 0;
+}
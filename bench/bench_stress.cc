@@ -0,0 +1,494 @@
+// Stress and soak harness : the server runs in-process on loopback and
+// hundreds of client threads send it seeded random command mixes, pipelined,
+// written in random fragments, with abrupt disconnects now and then. Every
+// reply is checked against a reference model of the client's own keys,
+// shared counters and the final keyspace are checked once everyone is done.
+//
+// The same seed replays the same commands and ends with the same state
+// digest whatever the scheduling. Prints throughput and RSS over time, then
+// round-trip latency percentiles. Exits with 1 on any mismatch.
+// usage : bench_stress [clients=200] [ops=20000] [seed=1] [pipeline=16] [soak seconds=0]
+//         a soak runs each client until the time is up instead of for ops commands
+#include "commands/connection.h"
+#include "commands/table.h"
+#include <signal.h>
+#include <sys/resource.h>
+#include <algorithm>
+#include <charconv>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <variant>
+#include <vector>
+
+#define PORT      7390
+// 127.0.0.1
+#define IP        ntohl(INADDR_LOOPBACK)
+#define K_MAX_MSG 4096
+
+// keys of each client, and counters every client increments
+static constexpr int k_keys = 64;
+static constexpr int k_shared = 16;
+// out of 1000 batches
+static constexpr int k_fragmented = 200;
+static constexpr int k_disconnects = 2;
+
+static size_t rss() {
+    std::ifstream statm("/proc/self/statm");
+    size_t total = 0, resident = 0;
+    statm >> total >> resident;
+    return resident * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+}
+
+static bool parse_int(const std::string& s, int64_t& v) {
+    auto res = std::from_chars(s.data(), s.data() + s.size(), v);
+    return !s.empty() && res.ec == std::errc() && res.ptr == s.data() + s.size();
+}
+
+static std::string encode(const std::vector<std::string>& argv) {
+    std::string s = "*" + std::to_string(argv.size()) + "\r\n";
+    for (auto& a : argv) s += "$" + std::to_string(a.size()) + "\r\n" + a + "\r\n";
+    return s;
+}
+
+static std::string bulk(const std::string& s) {
+    return "$" + std::to_string(s.size()) + "\r\n" + s + "\r\n";
+}
+
+static std::string integer(int64_t n) {
+    return ":" + std::to_string(n) + "\r\n";
+}
+
+static const std::string k_null = "_\r\n";
+static const std::string k_ok = "+OK\r\n";
+// errors are compared on their code only
+static const std::string k_wrongtype = "-WRONGTYPE";
+static const std::string k_err = "-ERR";
+
+// what the server should hold for one client's keys
+using Value = std::variant<std::string, std::deque<std::string>>;
+using Model = std::unordered_map<std::string, Value>;
+
+// one command and the reply it must get, empty when any integer will do
+struct Op {
+    std::vector<std::string> argv;
+    std::string expected;
+};
+
+// buffered reads of whole RESP replies
+class Replies {
+public:
+    explicit Replies(int fd) : _fd(fd) {}
+
+    // the next reply's bytes, false when the connection broke
+    bool next(std::string& out) {
+        size_t end;
+        while (!complete(_pos, end)) {
+            char buf[65536];
+            ssize_t rv = read(_fd, buf, sizeof(buf));
+            if (rv <= 0) return false;
+            _buf.append(buf, rv);
+        }
+        out.assign(_buf, _pos, end - _pos);
+        _pos = end;
+        if (_pos == _buf.size()) {
+            _buf.clear();
+            _pos = 0;
+        }
+        return true;
+    }
+
+private:
+    // whether a reply starts at from and where it ends
+    bool complete(size_t from, size_t& end) const {
+        size_t eol = _buf.find("\r\n", from);
+        if (eol == std::string::npos) return false;
+        int64_t n = 0;
+        char type = _buf[from];
+        if (type == '$' || type == '*') parse_int(_buf.substr(from + 1, eol - from - 1), n);
+        end = eol + 2;
+        if (type == '$' && n >= 0) {
+            end += n + 2;
+            return end <= _buf.size();
+        }
+        for (int64_t k = 0 ; type == '*' && k < n ; ++k) {
+            if (!complete(end, end)) return false;
+        }
+        return true;
+    }
+
+    int _fd;
+    std::string _buf;
+    size_t _pos = 0;
+};
+
+struct Stats {
+    std::atomic<uint64_t> ops{0};
+    std::atomic<uint64_t> mismatches{0};
+    std::atomic<uint64_t> disconnects{0};
+    std::mutex m;
+    std::vector<uint32_t> latencies_us;
+    int64_t shared[k_shared] = {};
+};
+
+static int connect_client() {
+    for (int tries = 0 ; tries < 100 ; ++tries) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        struct sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(PORT);
+        addr.sin_addr.s_addr = IP;
+        if (connect(fd, (const struct sockaddr*)&addr, sizeof(addr)) == 0
+                && net::write_stream(fd, "HELLO 3\r\n", 9) == 0) {
+            char ok[5];
+            if (net::read_stream(fd, ok, 5) == 0 && std::string(ok, 5) == k_ok) return fd;
+        }
+        close(fd);
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    net::die("cannot reach the server");
+    return -1;
+}
+
+class Client {
+public:
+    Client(int id, uint64_t seed, Stats& stats) : _id(id), _rng(seed * 1000003 + id), _stats(stats) {}
+
+    void run(size_t ops, size_t pipeline, std::chrono::steady_clock::time_point until) {
+        _fd = connect_client();
+        auto replies = std::make_unique<Replies>(_fd);
+        std::vector<Op> batch;
+        std::vector<uint32_t> latencies;
+        int64_t shared[k_shared] = {};
+        bool soak = until != std::chrono::steady_clock::time_point();
+        for (size_t done = 0 ; soak ? std::chrono::steady_clock::now() < until : done < ops ; ) {
+            if (pick(1000) < k_disconnects) {
+                disconnect();
+                _fd = connect_client();
+                replies = std::make_unique<Replies>(_fd);
+            }
+            batch.clear();
+            size_t n = 1 + pick(pipeline);
+            if (!soak) n = std::min(n, ops - done);
+            std::string bytes;
+            for (size_t k = 0 ; k < n ; ++k) {
+                batch.push_back(next(shared));
+                bytes += encode(batch.back().argv);
+            }
+            auto t = std::chrono::steady_clock::now();
+            send(bytes, pick(1000) < k_fragmented);
+            std::string reply;
+            for (size_t k = 0 ; k < n ; ++k) {
+                if (!replies->next(reply)) net::die("connection lost");
+                check(batch[k], reply, done + k);
+            }
+            latencies.push_back(static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - t).count()));
+            done += n;
+            _stats.ops.fetch_add(n, std::memory_order_relaxed);
+        }
+        close(_fd);
+        std::lock_guard<std::mutex> l(_stats.m);
+        _stats.latencies_us.insert(_stats.latencies_us.end(), latencies.begin(), latencies.end());
+        for (int k = 0 ; k < k_shared ; ++k) _stats.shared[k] += shared[k];
+    }
+
+    // compares the server's copy of every key of this client to the model
+    void verify() {
+        int fd = connect_client();
+        Replies replies(fd);
+        std::string reply;
+        for (int k = 0 ; k < k_keys ; ++k) {
+            Op op;
+            std::string key = name(k);
+            auto it = _model.find(key);
+            if (it == _model.end()) {
+                op = {{"EXISTS", key}, integer(0)};
+            } else if (auto* s = std::get_if<std::string>(&it->second)) {
+                op = {{"GET", key}, bulk(*s)};
+            } else {
+                auto& l = std::get<std::deque<std::string>>(it->second);
+                op = {{"LRANGE", key, "0", "-1"}, "*" + std::to_string(l.size()) + "\r\n"};
+                for (auto& e : l) op.expected += bulk(e);
+            }
+            std::string req = encode(op.argv);
+            net::write_stream(fd, req.data(), req.size());
+            if (!replies.next(reply)) net::die("connection lost");
+            check(op, reply, SIZE_MAX);
+        }
+        close(fd);
+    }
+
+    // FNV-1a over the model, in key order
+    uint64_t digest() const {
+        uint64_t h = 1469598103934665603ull;
+        auto mix = [&h] (const std::string& s) {
+            for (unsigned char c : s) h = (h ^ c) * 1099511628211ull;
+            h = (h ^ 0xff) * 1099511628211ull;
+        };
+        for (int k = 0 ; k < k_keys ; ++k) {
+            auto it = _model.find(name(k));
+            if (it == _model.end()) continue;
+            mix(it->first);
+            if (auto* s = std::get_if<std::string>(&it->second)) {
+                mix(*s);
+            } else {
+                for (auto& e : std::get<std::deque<std::string>>(it->second)) mix(e);
+            }
+        }
+        return h;
+    }
+
+private:
+    size_t pick(size_t n) {
+        return std::uniform_int_distribution<size_t>(0, n - 1)(_rng);
+    }
+
+    std::string name(int k) const {
+        return "c" + std::to_string(_id) + ":" + std::to_string(k);
+    }
+
+    // letters never parse as integers, numbers do
+    std::string value() {
+        if (pick(4) == 0) return std::to_string(static_cast<int64_t>(pick(2000000)) - 1000000);
+        std::string v(1 + pick(pick(10) == 0 ? 400 : 24), 'a');
+        for (auto& c : v) c = static_cast<char>('a' + pick(26));
+        return v;
+    }
+
+    // the next command, applied to the model
+    Op next(int64_t (&shared)[k_shared]) {
+        std::string key = name(static_cast<int>(pick(k_keys)));
+        auto it = _model.find(key);
+        auto* s = it == _model.end() ? nullptr : std::get_if<std::string>(&it->second);
+        auto* l = it == _model.end() ? nullptr : std::get_if<std::deque<std::string>>(&it->second);
+        switch (pick(12)) {
+        case 0: {
+            std::string v = value();
+            _model[key] = v;
+            return {{"SET", key, v}, k_ok};
+        }
+        case 1:
+            if (l != nullptr) return {{"GET", key}, k_wrongtype};
+            return {{"GET", key}, s == nullptr ? k_null : bulk(*s)};
+        case 2: {
+            bool found = it != _model.end();
+            if (found) _model.erase(it);
+            return {{"DEL", key}, integer(found)};
+        }
+        case 3: {
+            int64_t by = static_cast<int64_t>(pick(2001)) - 1000;
+            int64_t cur = 0;
+            if (l != nullptr) return {{"INCRBY", key, std::to_string(by)}, k_wrongtype};
+            if (s != nullptr && !parse_int(*s, cur)) return {{"INCRBY", key, std::to_string(by)}, k_err};
+            _model[key] = std::to_string(cur + by);
+            return {{"INCRBY", key, std::to_string(by)}, integer(cur + by)};
+        }
+        case 4: {
+            std::string v = value();
+            if (l != nullptr) return {{"APPEND", key, v}, k_wrongtype};
+            std::string& cur = std::get<std::string>(_model[key] = (s == nullptr ? "" : *s) + v);
+            return {{"APPEND", key, v}, integer(static_cast<int64_t>(cur.size()))};
+        }
+        case 5:
+            return {{"EXISTS", key}, integer(it != _model.end())};
+        case 6: {
+            Op op{{"RPUSH", key}, {}};
+            for (size_t k = 0 ; k < 1 + pick(5) ; ++k) op.argv.push_back(value());
+            if (s != nullptr) return {op.argv, k_wrongtype};
+            if (l == nullptr) l = &std::get<std::deque<std::string>>(_model[key] = std::deque<std::string>());
+            l->insert(l->end(), op.argv.begin() + 2, op.argv.end());
+            op.expected = integer(static_cast<int64_t>(l->size()));
+            return op;
+        }
+        case 7: {
+            if (s != nullptr) return {{"LPOP", key}, k_wrongtype};
+            if (l == nullptr) return {{"LPOP", key}, k_null};
+            std::string front = l->front();
+            l->pop_front();
+            if (l->empty()) _model.erase(it);
+            return {{"LPOP", key}, bulk(front)};
+        }
+        case 8:
+            if (s != nullptr) return {{"LLEN", key}, k_wrongtype};
+            return {{"LLEN", key}, integer(l == nullptr ? 0 : static_cast<int64_t>(l->size()))};
+        case 9: {
+            Op op{{"MGET"}, "*3\r\n"};
+            for (int k = 0 ; k < 3 ; ++k) {
+                std::string other = name(static_cast<int>(pick(k_keys)));
+                auto o = _model.find(other);
+                auto* os = o == _model.end() ? nullptr : std::get_if<std::string>(&o->second);
+                op.argv.push_back(other);
+                op.expected += os == nullptr ? k_null : bulk(*os);
+            }
+            return op;
+        }
+        case 10: {
+            Op op{{"MSET"}, k_ok};
+            for (int k = 0 ; k < 3 ; ++k) {
+                op.argv.push_back(name(static_cast<int>(pick(k_keys))));
+                op.argv.push_back(value());
+                _model[op.argv[op.argv.size() - 2]] = op.argv.back();
+            }
+            return op;
+        }
+        default: {
+            // whatever the others did meanwhile : only the total is known
+            int j = static_cast<int>(pick(k_shared));
+            int64_t by = 1 + static_cast<int64_t>(pick(100));
+            shared[j] += by;
+            return {{"INCRBY", "shared:" + std::to_string(j), std::to_string(by)}, ""};
+        }
+        }
+    }
+
+    void check(const Op& op, const std::string& reply, size_t index) {
+        bool ok = op.expected.empty() ? reply[0] == ':'
+                : op.expected[0] == '-' ? reply.compare(0, op.expected.size(), op.expected) == 0
+                : reply == op.expected;
+        if (ok) return;
+        if (_stats.mismatches.fetch_add(1) < 10) {
+            std::string cmd;
+            for (auto& a : op.argv) cmd += a + " ";
+            std::lock_guard<std::mutex> l(_stats.m);
+            std::cerr << "client " << _id << " op " << (index == SIZE_MAX ? std::string("(final)") : std::to_string(index))
+                      << " : " << cmd << "\n  expected " << (op.expected.empty() ? ":<n>" : op.expected)
+                      << "\n  got      " << reply << "\n";
+        }
+    }
+
+    // writes bytes whole, or in random fragments with pauses between them
+    void send(const std::string& bytes, bool fragmented) {
+        size_t at = 0;
+        while (at < bytes.size()) {
+            size_t n = fragmented ? 1 + pick(std::min<size_t>(bytes.size() - at, 64)) : bytes.size() - at;
+            if (net::write_stream(_fd, bytes.data() + at, n) < 0) net::die("write()");
+            at += n;
+            if (fragmented) std::this_thread::sleep_for(std::chrono::microseconds(pick(50)));
+        }
+    }
+
+    // leaves mid-command, or with reads in flight : the model is unchanged
+    // either way
+    void disconnect() {
+        std::string key = name(static_cast<int>(pick(k_keys)));
+        std::string req = encode({"SET", key, "never"});
+        if (pick(2) == 0) {
+            net::write_stream(_fd, req.data(), 1 + pick(req.size() - 1));
+        } else {
+            req = encode({"GET", key}) + encode({"LLEN", key});
+            net::write_stream(_fd, req.data(), req.size());
+        }
+        // RST instead of FIN
+        struct linger lg = {1, 0};
+        setsockopt(_fd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+        close(_fd);
+        _stats.disconnects.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    int _id;
+    std::mt19937_64 _rng;
+    Stats& _stats;
+    int _fd = -1;
+    Model _model;
+};
+
+static double percentile(const std::vector<uint32_t>& sorted, double p) {
+    if (sorted.empty()) return 0;
+    return sorted[std::min(sorted.size() - 1, static_cast<size_t>(p * sorted.size()))];
+}
+
+int main(int argc, char** argv) {
+    size_t n_clients = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 200;
+    size_t ops = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 20000;
+    uint64_t seed = argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 1;
+    size_t pipeline = argc > 4 ? std::strtoul(argv[4], nullptr, 10) : 16;
+    int64_t soak_s = argc > 5 ? std::strtoll(argv[5], nullptr, 10) : 0;
+
+    // two fds per client, and a few spare ones for reconnects
+    struct rlimit rl;
+    getrlimit(RLIMIT_NOFILE, &rl);
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+    signal(SIGPIPE, SIG_IGN);
+
+    net::resp::Redis redis(IP, htons(PORT), K_MAX_MSG);
+    commands::attach_connection(redis);
+    store::Keyspace ks;
+    commands::Table table(ks);
+    table.attach(redis);
+    std::thread server([&redis] { redis.accept_all(); });
+
+    Stats stats;
+    std::vector<std::unique_ptr<Client>> clients;
+    for (size_t k = 0 ; k < n_clients ; ++k) clients.push_back(std::make_unique<Client>(static_cast<int>(k), seed, stats));
+
+    size_t base = rss();
+    auto start = std::chrono::steady_clock::now();
+    auto until = soak_s > 0 ? start + std::chrono::seconds(soak_s) : std::chrono::steady_clock::time_point();
+    std::vector<std::thread> threads;
+    for (auto& c : clients) threads.emplace_back([&c, ops, pipeline, until] { c->run(ops, pipeline, until); });
+
+    // throughput and memory every half second, a leak shows as a steady climb
+    std::atomic<bool> running{true};
+    std::thread sampler([&] {
+        uint64_t last = 0;
+        auto t = start;
+        while (running) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(500));
+            auto now = std::chrono::steady_clock::now();
+            uint64_t ops_now = stats.ops.load();
+            std::cout << "t=" << std::chrono::duration<double>(now - start).count() << "s"
+                      << "  ops/s=" << static_cast<uint64_t>((ops_now - last) / std::chrono::duration<double>(now - t).count())
+                      << "  rss=" << (rss() - base) / double(1 << 20) << " MiB\n";
+            last = ops_now;
+            t = now;
+        }
+    });
+    for (auto& t : threads) t.join();
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    running = false;
+    sampler.join();
+
+    for (auto& c : clients) c->verify();
+    int fd = connect_client();
+    Replies replies(fd);
+    std::string reply;
+    uint64_t digest = 0;
+    for (auto& c : clients) digest = digest * 31 + c->digest();
+    for (int k = 0 ; k < k_shared ; ++k) {
+        std::string req = encode({"GET", "shared:" + std::to_string(k)});
+        net::write_stream(fd, req.data(), req.size());
+        std::string expected = stats.shared[k] == 0 ? k_null : bulk(std::to_string(stats.shared[k]));
+        if (!replies.next(reply) || reply != expected) {
+            std::cerr << "shared:" << k << " expected " << expected << " got " << reply << "\n";
+            stats.mismatches.fetch_add(1);
+        }
+        digest = digest * 31 + static_cast<uint64_t>(stats.shared[k]);
+    }
+    close(fd);
+    redis.drain(std::chrono::seconds(5));
+    redis.stop();
+    server.join();
+
+    auto& lat = stats.latencies_us;
+    std::sort(lat.begin(), lat.end());
+    std::cout << "clients      : " << n_clients << " (seed " << seed << ", up to " << pipeline << " pipelined)\n"
+              << "commands     : " << stats.ops.load() << " in " << secs << " s, "
+              << static_cast<uint64_t>(stats.ops.load() / secs) << " /s\n"
+              << "round trips  : p50 " << percentile(lat, 0.5) << " us, p99 " << percentile(lat, 0.99)
+              << " us, p999 " << percentile(lat, 0.999) << " us\n"
+              << "disconnects  : " << stats.disconnects.load() << "\n"
+              << "RSS          : " << (rss() - base) / double(1 << 20) << " MiB\n"
+              << "state digest : " << std::hex << digest << std::dec << "\n"
+              << "mismatches   : " << stats.mismatches.load() << "\n";
+    return stats.mismatches.load() == 0 ? 0 : 1;
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "commands/table.h"
+#include "datastructures/fd_table.h"
+#include "utils/sha256.h"
+
+namespace acl {
+
+// what a user may run, compiled from its rules : one bit per command id and
+// the key patterns. Never changed once built, connections share it
+struct Permissions {
+    std::vector<uint64_t> commands;
+    bool all_keys = false;
+    std::vector<std::string> patterns;
+
+    bool allows(uint32_t id) const {
+        return (commands[id >> 6] >> (id & 63)) & 1;
+    }
+};
+
+// Users, AUTH, HELLO 3 AUTH and ACL SETUSER / DELUSER / LIST / USERS / WHOAMI.
+//
+// Rules follow Redis : on, off, >password, <password, nopass, resetpass,
+// ~pattern, allkeys, resetkeys, +command, -command, +@category, -@category,
+// allcommands, nocommands and reset. Categories are read, write, keyspace
+// (every command of the table), pubsub, transaction, blocking, connection,
+// admin and all.
+//
+// Logging in copies a pointer to the user's compiled permissions into the
+// connection's slot : checking a command is a name lookup, a bit test and,
+// for users limited to some keys, a glob match per key. Changing a user
+// applies to the connections that log in afterwards. Commands sent before
+// logging in are refused with NOAUTH when the default user has a password,
+// except AUTH, HELLO and QUIT. Inline PING, ECHO and QUIT are answered by
+// the parser, before anyone checks.
+class Acl {
+public:
+    // the default user can run everything on every key without a password
+    Acl();
+
+    Acl(const Acl&) = delete;
+    Acl& operator=(const Acl&) = delete;
+
+    // applies rules to user, creating it first if needed. Returns an error
+    // reply, empty when every rule was valid (none is applied otherwise)
+    std::string setuser(std::string_view user, const std::vector<std::string_view>& rules);
+
+    // the permissions of user when it is enabled and pass is one of its
+    // passwords, nullptr otherwise
+    std::shared_ptr<const Permissions> login(std::string_view user, std::string_view pass);
+
+    // handles cmd if it is an ACL command or if fd may not run it, returns
+    // whether it did
+    bool handle(int fd, const net::resp::Command& cmd);
+
+    // answers the HELLO opening a connection
+    std::string hello(int fd, const net::resp::Hello& h);
+
+    // must be attached after every other handler so that it runs first
+    void attach(net::resp::Redis& r);
+
+private:
+    // how to find a command's keys, and what it is allowed with
+    struct Info {
+        uint32_t id;
+        uint32_t categories;
+        int first_key;
+        int last_key;
+        int step;
+        // works on the whole keyspace : only for users with every key
+        bool all_keys;
+        // keys after STREAMS (commands::STREAMS_KEYS)
+        bool streams;
+    };
+
+    struct User {
+        bool enabled = false;
+        bool nopass = false;
+        std::vector<utils::Digest> passwords;
+        std::vector<uint64_t> commands;
+        bool all_keys = false;
+        std::vector<std::string> patterns;
+        // rebuilt by every SETUSER
+        std::shared_ptr<const Permissions> compiled;
+    };
+
+    struct Session {
+        std::string user;
+        // nullptr until the connection logs in
+        std::shared_ptr<const Permissions> perms;
+    };
+
+    void add(const char* name, uint32_t categories, int first, int last, int step, bool all_keys, bool streams);
+    const Info* info(std::string_view name) const;
+    // false when rule is not a valid one, u is left half changed then
+    bool apply(User& u, std::string_view rule) const;
+    void allow(User& u, uint32_t categories, bool on) const;
+    // the permissions or NOPERM error of fd running cmd, appended to out
+    bool check(const Session& s, const Info& info, const net::resp::Command& cmd, std::string& out) const;
+    std::string auth(int fd, std::string_view user, std::string_view pass);
+    std::string command(int fd, const net::resp::Command& cmd);
+    std::string describe(const std::string& name, const User& u) const;
+
+    // filled by the constructor, read-only afterwards
+    std::unordered_map<std::string, Info, store::KeyHash, std::equal_to<>> _infos;
+    std::vector<std::string> _names;
+
+    std::mutex _m;
+    std::unordered_map<std::string, User, store::KeyHash, std::equal_to<>> _users;
+    data::FdTable<Session> _sessions;
+};
+
+} // namespace acl
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+#include "commands/table.h"
+#include "datastructures/fd_table.h"
+
+namespace cluster {
+
+static constexpr size_t k_slots = 16384;
+
+// CRC16 of the key, or of its hash tag : the part between the first '{' and
+// the next '}' when not empty, so that related keys share a slot
+uint16_t key_slot(std::string_view key);
+
+struct Node {
+    std::string id;
+    std::string host;
+    unsigned short port;
+    // a slot claimed by two nodes goes to the highest config epoch
+    uint64_t epoch;
+};
+
+// Redis Cluster-compatible slot ownership.
+//
+// Every key belongs to one of k_slots hash slots, every slot to one node.
+// Commands on keys of another node's slot are answered -MOVED, the ones on a
+// slot being migrated -ASK when their keys already left. The check is a
+// Table guard : it runs under the shards' locks, so a key can't be moved
+// between the check and the command.
+//
+// Slots are assigned with CLUSTER ADDSLOTS / SETSLOT. Nodes introduced by
+// CLUSTER MEET then gossip, every interval, their slots, config epoch and
+// the nodes they know to each other over plain client connections.
+//
+// The keyspace indexes its keys by slot (Keyspace::group_by()), the keys of
+// a slot are found without a pass over the others.
+//
+// CLUSTER MOVESLOT <slot> <node-id> [batch] migrates a slot online : the
+// keys are sent to the target (ASKING + SET) and deleted a batch at a time.
+// The shards of a batch are not locked while it travels, its keys refuse
+// writes with -TRYAGAIN instead. Then both sides hand the slot over with
+// SETSLOT NODE.
+class Cluster {
+public:
+    Cluster(commands::Table& table, std::string host, unsigned short port,
+            std::chrono::milliseconds gossip = std::chrono::milliseconds(100));
+    ~Cluster();
+
+    Cluster(const Cluster&) = delete;
+    Cluster& operator=(const Cluster&) = delete;
+
+    const std::string& myid() const {
+        return _myid;
+    }
+
+    // claims [first, last] for this node
+    void add_slots(uint16_t first, uint16_t last);
+
+    // index in the node list of the owner of slot, -1 when unassigned
+    int owner(uint16_t slot) const {
+        return _owner[slot].load(std::memory_order_acquire);
+    }
+
+    // handles cmd if it is a cluster command, returns whether it did
+    bool handle(int fd, const net::resp::Command& cmd);
+
+    // must be attached after the table
+    void attach(net::resp::Redis& r);
+
+private:
+    bool guard(int fd, const commands::Spec& spec, const commands::Args& argv, std::string& out);
+
+    std::string cluster(const net::resp::Command& cmd);
+    std::string slots();
+    std::string shards();
+    std::string nodes();
+    std::string setslot(const net::resp::Command& cmd);
+    // applies what a node gossiped : CLUSTER GOSSIP <id> <host> <port> <epoch> <slots> [<id> <host> <port>]...
+    std::string gossiped(const net::resp::Command& cmd);
+    std::string gossip_message();
+    void gossip();
+
+    // whether a key of argv is being sent to another node
+    bool in_flight(const commands::Args& argv, commands::KeyRange keys);
+    // keys of slot currently stored here
+    std::vector<std::string> keys_in_slot(uint16_t slot, size_t max);
+    size_t count_in_slot(uint16_t slot);
+    // returns the number of keys moved or an error
+    std::string move_slot(uint16_t slot, std::string_view node_id, size_t batch);
+
+    // index of the node, added if unknown. The caller holds _m
+    int node(std::string_view id, std::string_view host, unsigned short port);
+    int find(std::string_view id);
+    std::string address(int idx);
+    // a slot goes to idx, through gossip or SETSLOT
+    void assign(uint16_t slot, int idx);
+
+    commands::Table& _table;
+    const std::string _myid;
+
+    // only ever grows, _nodes[0] is this node
+    std::shared_mutex _m;
+    std::vector<Node> _nodes;
+    std::array<std::atomic<int16_t>, k_slots> _owner;
+    // node the slot is migrating to or importing from, -1 when stable
+    std::array<std::atomic<int16_t>, k_slots> _migrating;
+    std::array<std::atomic<int16_t>, k_slots> _importing;
+
+    // the batch move_slot() is sending, its copies here must not change
+    std::mutex _flight_m;
+    std::unordered_set<std::string, store::KeyHash, std::equal_to<>> _in_flight;
+
+    // ASKING was sent, for the next command only
+    data::FdTable<bool> _asking;
+
+    std::chrono::milliseconds _interval;
+    std::atomic<bool> _stop{false};
+    std::thread _gossip;
+};
+
+} // namespace cluster
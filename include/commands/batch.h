@@ -0,0 +1,60 @@
+#pragma once
+
+#include <memory>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include "commands/table.h"
+
+namespace commands {
+
+// Named batches of commands compiled once and run atomically server-side.
+//
+//   BATCH.DEFINE <name> <source>
+//   BATCH.CALL <name> <numkeys> [key ...] [arg ...]
+//   BATCH.DROP <name>
+//
+// The source holds one statement per line (or separated by ';') :
+//
+//   $v = GET KEYS[1]           run a command, keep its reply in $v
+//   IF $v                      also IF a == b, !=, <, <=, >, >= (numeric)
+//     $n = ADD $v ARGV[1]      ADD, SUB and MUL on integers
+//   ELSE
+//     $n = ARGV[1]             plain copy
+//   END
+//   SET KEYS[1] $n
+//   RETURN $n                  otherwise the reply of the last command
+//
+// Operands are KEYS[i], ARGV[i] (1-based), $registers and literals ("quoted"
+// if they hold spaces). Keys must be passed through KEYS so that every shard
+// involved is known before running : a call locks them all once, runs the
+// flat instruction array and unlocks. A command error stops the batch and is
+// returned, the writes done before it are kept.
+class Batches {
+public:
+    explicit Batches(Table& table);
+    ~Batches();
+
+    // compiles source under name, returns the compile error if any
+    std::optional<std::string> define(std::string_view name, std::string_view source);
+    bool drop(std::string_view name);
+
+    // RESP reply of the batch, fd is the client calling it (-1 for none) :
+    // the table's guard sees its keys first
+    std::string call(std::string_view name, const Args& keys, const Args& args, int fd = -1);
+
+    bool handle(int fd, const net::resp::Command& cmd);
+
+    void attach(net::resp::Redis& r);
+
+    struct Program;
+
+private:
+    Table& _table;
+    std::shared_mutex _m;
+    std::unordered_map<std::string, std::shared_ptr<const Program>, store::KeyHash, std::equal_to<>> _programs;
+};
+
+} // namespace commands
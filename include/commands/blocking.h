@@ -0,0 +1,107 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include "commands/table.h"
+#include "coro/task.h"
+
+namespace commands {
+
+struct Waiter;
+
+using WaiterQueue = std::list<std::pair<std::shared_ptr<Waiter>, size_t>>;
+
+// BLPOP, BRPOP and BLMOVE, and XREAD / XREADGROUP with BLOCK.
+//
+// A client finding its lists empty is parked at the back of a FIFO per key
+// it waits on, kept next to the key's shard and guarded by its lock, and
+// its handler coroutine suspends. The write that fills one of the lists
+// serves the front of that key's FIFO on the spot, under the same locks :
+// the element is popped through the table (replicas see an LPOP / RPOP)
+// and the coroutine resumed. Nothing runs for a parked client until then.
+// BLMOVE runs an LMOVE there, with the destination's shard locked too :
+// when that lock is busy, taking it out of shard order could deadlock, so
+// the element stays and the client's coroutine comes and moves it itself.
+// An element moved wakes the front client waiting on its new list.
+//
+// Stream readers park the same way in FIFOs of their own. Any write to a
+// stream resumes all of its readers, which run their read again without
+// BLOCK and park again if it still finds nothing : several of them may
+// read the same entries, unlike list pops.
+//
+// Timeouts are timers on the table's wheel. One thread watches the
+// sockets of parked clients for hang-ups, their queue entries go away
+// when the peer does.
+class Blocking {
+public:
+    explicit Blocking(Table& table);
+    ~Blocking();
+
+    Blocking(const Blocking&) = delete;
+    Blocking& operator=(const Blocking&) = delete;
+
+    // clients parked right now
+    size_t blocked() const {
+        return _blocked.load(std::memory_order_relaxed);
+    }
+
+    // handles cmd if it is a blocking command, returns whether it did
+    coro::Task<bool> handle(int fd, const net::resp::Command& cmd);
+
+    void attach(net::resp::Redis& r);
+
+private:
+    using Queues = std::unordered_map<std::string, WaiterQueue, store::KeyHash, std::equal_to<>>;
+
+    // the reply, or an empty string once the client is parked on w. The
+    // table's guard checks argv as client fd's command, spec telling where
+    // its keys are
+    std::string pop_or_park(int fd, const Spec& spec, const Args& argv, const std::shared_ptr<Waiter>& w);
+    // the same for XREAD and XREADGROUP, req being the command without
+    // BLOCK and its IDs starting at ids. $ is resolved on the first call
+    std::string read_or_park(int fd, const std::shared_ptr<Waiter>& w, const Spec& spec,
+                             std::vector<std::string>& req, size_t ids, bool& resolved);
+    coro::Task<bool> read_streams(int fd, const net::resp::Command& cmd);
+    // with w's keys locked
+    void park(const std::shared_ptr<Waiter>& w);
+    // until w is served, times out after ms (never when 0) or its client
+    // hangs up. Returns the state it ended in
+    coro::Task<int> wait(int fd, std::shared_ptr<Waiter> w, int64_t ms);
+    // serves the clients waiting on the keys a write touched
+    void written(const Spec& spec, const Args& argv);
+    void serve(Queues& queues, Queues::iterator it);
+    // lets the front client waiting on key know a move filled it, with the
+    // key's shard locked
+    void nudge(std::string_view key);
+    // resumes the stream readers parked on a key
+    void wake(Queues& readers, Queues::iterator it);
+    // takes w out of the FIFOs still holding it
+    void unpark(const std::shared_ptr<Waiter>& w);
+
+    void watch(int fd, const std::shared_ptr<Waiter>& w);
+    void unwatch(int fd);
+    void hangups();
+
+    Table& _table;
+    size_t _hook;
+    // per shard, only touched with the shard locked
+    std::array<Queues, store::Keyspace::k_shards> _queues;
+    // stream readers, per shard as well
+    std::array<Queues, store::Keyspace::k_shards> _readers;
+    std::atomic<size_t> _blocked{0};
+
+    int _epfd = -1;
+    int _evfd = -1;
+    std::mutex _watched_m;
+    std::unordered_map<int, std::weak_ptr<Waiter>> _watched;
+    std::atomic<bool> _stop{false};
+    std::thread _hangups;
+};
+
+} // namespace commands
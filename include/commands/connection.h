@@ -0,0 +1,14 @@
+#pragma once
+
+#include "resp/command.h"
+#include "resp/handle.h"
+
+namespace commands {
+
+// QUIT sent as a RESP array (inline ones never reach the chain), PING and
+// ECHO live in the command table so that they can be queued by MULTI
+bool connection(int fd, const net::resp::Command& cmd);
+
+void attach_connection(net::resp::Redis& r);
+
+} // namespace commands
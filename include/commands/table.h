@@ -0,0 +1,241 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "profile/profile.h"
+#include "resp/command.h"
+#include "resp/handle.h"
+#include "store/keyspace.h"
+#include "store/timers.h"
+
+namespace commands {
+
+using Args = std::vector<std::string_view>;
+
+enum Flag : uint32_t {
+    WRITE    = 1 << 0,
+    READONLY = 1 << 1,
+    // works on the whole keyspace (DBSIZE, FLUSHALL...)
+    ALL_KEYS = 1 << 2,
+    // its keys are the first half of the arguments after STREAMS (XREAD,
+    // XREADGROUP), first_key is only there to say it has some
+    STREAMS_KEYS = 1 << 3
+};
+
+// appends the RESP reply of the command to out
+using Fn = void (*)(store::Keyspace& ks, const Args& argv, std::string& out);
+
+// same conventions as the Redis command table
+struct Spec {
+    const char* name;
+    // > 0 : exact number of arguments (name included), < 0 : at least -arity
+    int arity;
+    uint32_t flags;
+    // position of the first key, 0 when the command takes no key
+    int first_key;
+    // position of the last key, negative ones count from the end
+    int last_key;
+    int step;
+    Fn fn;
+};
+
+// where the keys of a command are : from first to last included, step
+// apart. None when first > last
+struct KeyRange {
+    int first;
+    int last;
+    int step;
+};
+
+// for a command with those key positions and flags
+KeyRange key_range(int first_key, int last_key, int step, uint32_t flags, const Args& argv);
+
+inline KeyRange key_range(const Spec& spec, const Args& argv) {
+    return key_range(spec.first_key, spec.last_key, spec.step, spec.flags, argv);
+}
+
+// sees every write that succeeded, with its shards still locked. raw holds
+// the request as the client sent it, it is empty when the command came from
+// elsewhere (EXEC, a batch, an inline request)
+using WriteHook = std::function<void(const Args& argv, std::string_view raw)>;
+
+// runs after a write succeeded and the write hook saw it, with its shards
+// still locked. Writes issued from there go through the write hook too
+using AfterWrite = std::function<void(const Spec& spec, const Args& argv)>;
+
+// sees every read command a client sent, with its shards still locked
+using ReadHook = std::function<void(int fd, const Spec& spec, const Args& argv)>;
+
+// runs before a command sent by a client, with its shards already locked.
+// Returns false after appending the reason for refusing it to out
+using Guard = std::function<bool(int fd, const Spec& spec, const Args& argv, std::string& out)>;
+
+// Keyspace commands, looked up by name and run under their shards' locks.
+// Keys with a deadline are deleted by a timer when nobody reads them again,
+// the write hooks see a DEL for every key deleted past its deadline.
+class Table {
+public:
+    explicit Table(store::Keyspace& ks);
+    ~Table();
+
+    Table(const Table&) = delete;
+    Table& operator=(const Table&) = delete;
+
+    // case-insensitive, nullptr for unknown commands
+    const Spec* lookup(std::string_view name) const;
+
+    static bool arity_ok(const Spec& spec, size_t argc) {
+        return spec.arity > 0 ? argc == static_cast<size_t>(spec.arity)
+                              : argc >= static_cast<size_t>(-spec.arity);
+    }
+
+    // one bit per shard the command reads or writes
+    static uint64_t shards(const Spec& spec, const Args& argv);
+
+    void lock(uint64_t mask);
+    // without waiting, false when one of them is busy (and none is taken)
+    bool try_lock(uint64_t mask);
+    void unlock(uint64_t mask);
+    // the shards this thread holds through lock() and try_lock()
+    static uint64_t held() {
+        return t_held;
+    }
+
+    // takes the shards' locks around the command
+    void call(const Spec& spec, const Args& argv, std::string& out, std::string_view raw = {});
+    // the caller already holds every shard in shards(spec, argv)
+    void call_locked(const Spec& spec, const Args& argv, std::string& out, std::string_view raw = {}) {
+        size_t at = out.size();
+        {
+            profile::Sample sample("keyspace");
+            spec.fn(_ks, argv, out);
+        }
+        if (!(spec.flags & WRITE) || out[at] == '-') return;
+        if (!t_rewrite.empty()) {
+            // hooks may write too, and rewrite in turn
+            std::vector<std::string> as = std::move(t_rewrite);
+            t_rewrite.clear();
+            written(spec, Args(as.begin(), as.end()), {});
+            return;
+        }
+        written(spec, argv, raw);
+    }
+
+    // called by a write command to have the hooks see argv instead of the
+    // command it ran as : XADD with an ID it picked goes to replicas as
+    // XADD with that ID
+    static void rewrite(std::vector<std::string> argv) {
+        t_rewrite = std::move(argv);
+    }
+
+    // one hook at most, set before serving
+    void on_write(WriteHook h) {
+        _on_write = std::move(h);
+    }
+
+    // run in the order they were added, before serving. Returns the id to
+    // give drop_after_write()
+    size_t after_write(AfterWrite h) {
+        _after_write.push_back(std::move(h));
+        return _after_write.size() - 1;
+    }
+
+    void drop_after_write(size_t id) {
+        _after_write[id] = nullptr;
+    }
+
+    // one hook at most, set before serving
+    void on_read(ReadHook h) {
+        _on_read = std::move(h);
+    }
+
+    // the client whose command this thread is running in serve(), -1 when
+    // the command came from elsewhere
+    static int client();
+
+    // one guard at most, set before serving
+    void guard(Guard g) {
+        _guard = std::move(g);
+    }
+
+    bool guarded() const {
+        return static_cast<bool>(_guard);
+    }
+
+    // whether client fd may run the command, as the guard says. When not,
+    // the reason is appended to out. The caller holds its shards' locks,
+    // every command a client sends goes through here before it runs
+    bool allowed(int fd, const Spec& spec, const Args& argv, std::string& out) {
+        return !_guard || _guard(fd, spec, argv, out);
+    }
+
+    // the same, taking the shards' locks around the guard : for commands
+    // checked now and run later (queued in MULTI)
+    bool check(int fd, const Spec& spec, const Args& argv, std::string& out);
+
+    // runs client fd's command : past the guard, with client() telling fd,
+    // and shown to the read hook. handle() and the reactors run what
+    // clients send through here
+    void serve(int fd, const Spec& spec, const Args& argv, std::string& out, std::string_view raw = {});
+
+    // handles cmd if it is a keyspace command, returns whether it did
+    bool handle(int fd, const net::resp::Command& cmd);
+
+    void attach(net::resp::Redis& r);
+
+    store::Keyspace& keyspace() {
+        return _ks;
+    }
+
+    // shared by key expiry and whoever needs a timeout
+    store::Timers& timers() {
+        return _timers;
+    }
+
+private:
+    void written(const Spec& spec, const Args& argv, std::string_view raw) {
+        if (_on_write) _on_write(argv, raw);
+        for (auto& h : _after_write) {
+            if (h) h(spec, argv);
+        }
+    }
+
+    static inline thread_local std::vector<std::string> t_rewrite;
+    static inline thread_local uint64_t t_held = 0;
+
+    // deletes key if it is past its deadline
+    void reap(const std::string& key);
+    // moves the keyspace's rehashes along until they are done
+    void rehash();
+
+    store::Keyspace& _ks;
+    std::unordered_map<std::string, Spec, store::KeyHash, std::equal_to<>> _specs;
+    WriteHook _on_write;
+    std::vector<AfterWrite> _after_write;
+    ReadHook _on_read;
+    Guard _guard;
+    // last : its callbacks use the rest
+    store::Timers _timers;
+};
+
+// calls emit with the commands that recreate key holding v, with deadline
+// at (-1 for none), to rebuild the keyspace elsewhere
+void recreate(std::string_view key, const store::Value& v, int64_t at,
+              const std::function<void(const Args&)>& emit);
+
+// built-in commands, see strings.cc, lists.cc, probabilistic.cc and
+// streams.cc
+extern const Spec k_string_commands[];
+extern const size_t k_string_commands_len;
+extern const Spec k_list_commands[];
+extern const size_t k_list_commands_len;
+extern const Spec k_probabilistic_commands[];
+extern const size_t k_probabilistic_commands_len;
+extern const Spec k_stream_commands[];
+extern const size_t k_stream_commands_len;
+
+} // namespace commands
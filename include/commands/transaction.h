@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+#include "commands/table.h"
+#include "datastructures/fd_table.h"
+
+namespace commands {
+
+// MULTI / EXEC / DISCARD / WATCH / UNWATCH.
+//
+// Queued commands are appended to one flat buffer per connection (the spec
+// pointer, then every argument as a length and its bytes) and only decoded
+// at EXEC. EXEC locks every shard the queued and watched keys live in, checks
+// the watched versions and runs the whole batch before unlocking.
+//
+// Only keyspace commands (those of the Table) can be queued. Any other one
+// (PUBLISH, CLIENT, CLUSTER...) is refused with an error saying so, and
+// makes EXEC abort like any command that could not be queued.
+class Transactions {
+public:
+    explicit Transactions(Table& table) : _table(table) {}
+
+    // handles cmd if it is a transaction command or if fd is inside MULTI
+    bool handle(int fd, const net::resp::Command& cmd);
+
+    // forgets the transaction state of fd
+    void drop(int fd);
+
+    // must be attached after every other handler so that it runs first
+    void attach(net::resp::Redis& r);
+
+private:
+    struct Tx {
+        bool queuing = false;
+        // a command could not be queued, EXEC refuses to run
+        bool dirty = false;
+        uint32_t count = 0;
+        std::string queued;
+        // hash of the watched key and the version it had
+        std::vector<std::pair<uint64_t, uint64_t>> watched;
+    };
+
+    void queue(Tx& tx, const Spec* spec, const net::resp::Command& cmd);
+    std::string exec(Tx& tx);
+    void reset(Tx& tx);
+
+    Table& _table;
+    data::FdTable<Tx> _txs;
+};
+
+} // namespace commands
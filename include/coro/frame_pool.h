@@ -0,0 +1,57 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+namespace coro {
+
+// Recycles coroutine frames, one pool per thread.
+//
+// Frames up to k_max bytes are rounded to a power of two and kept on the
+// free list of the pool of the thread that allocated them. A frame freed
+// by another thread (a coroutine resumed elsewhere) goes to a lock-free
+// stack its pool takes over in one exchange. A pool outlives its thread
+// until its last frame is back.
+class FramePool {
+public:
+    static constexpr size_t k_min = 64;
+    static constexpr size_t k_max = 4096;
+
+    static void* allocate(size_t n);
+    static void deallocate(void* p) noexcept;
+
+    // frames allocated by this thread and not freed yet
+    static size_t live();
+
+    FramePool(const FramePool&) = delete;
+    FramePool& operator=(const FramePool&) = delete;
+
+private:
+    static constexpr size_t k_classes = 7;
+
+    struct Block {
+        Block* next;
+    };
+
+    // in front of every frame
+    struct alignas(16) Header {
+        FramePool* pool;
+        size_t cls;
+    };
+
+    FramePool() = default;
+    ~FramePool();
+
+    static FramePool& local();
+    // the last reference deletes the pool, the thread holds one
+    void release() noexcept;
+
+    std::array<Block*, k_classes> _free = {};
+    std::array<std::atomic<Block*>, k_classes> _remote = {};
+    std::atomic<size_t> _refs{1};
+
+    friend struct PoolHolder;
+};
+
+} // namespace coro
@@ -0,0 +1,222 @@
+#pragma once
+
+#include <atomic>
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+#include "coro/frame_pool.h"
+#include "datastructures/mpsc_queue.h"
+
+namespace coro {
+
+// Runs the coroutines of one thread : the ones started with run() and the
+// ones woken up by other threads through post().
+class Loop {
+public:
+    Loop() = default;
+    Loop(const Loop&) = delete;
+    Loop& operator=(const Loop&) = delete;
+
+    // the loop of the calling thread
+    static Loop& current();
+
+    // from any thread, h is resumed by the thread running this loop
+    void post(std::coroutine_handle<> h);
+
+    // resumes what was posted until done() holds, sleeps meanwhile
+    template<typename Done>
+    void drive(Done done) {
+        while (!done()) {
+            uint32_t seen = _signal.load(std::memory_order_acquire);
+            bool ran = false;
+            while (auto h = _ready.pop()) {
+                ran = true;
+                h->resume();
+            }
+            if (!ran && !done()) _signal.wait(seen, std::memory_order_acquire);
+        }
+    }
+
+private:
+    data::MPSCQueue<std::coroutine_handle<>> _ready;
+    std::atomic<uint32_t> _signal{0};
+};
+
+template<typename T = void>
+class Task;
+
+namespace detail {
+
+// hands the thread over to whoever awaits the task
+struct FinalAwaiter {
+    bool await_ready() noexcept {
+        return false;
+    }
+
+    template<typename P>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept {
+        return h.promise().continuation;
+    }
+
+    void await_resume() noexcept {}
+};
+
+struct PromiseBase {
+    std::coroutine_handle<> continuation = std::noop_coroutine();
+    std::exception_ptr error;
+
+    std::suspend_always initial_suspend() noexcept {
+        return {};
+    }
+
+    FinalAwaiter final_suspend() noexcept {
+        return {};
+    }
+
+    void unhandled_exception() {
+        error = std::current_exception();
+    }
+
+    static void* operator new(size_t n) {
+        return FramePool::allocate(n);
+    }
+
+    static void operator delete(void* p) noexcept {
+        FramePool::deallocate(p);
+    }
+};
+
+template<typename T>
+struct Promise : PromiseBase {
+    std::optional<T> value;
+
+    Task<T> get_return_object();
+
+    void return_value(T v) {
+        value.emplace(std::move(v));
+    }
+
+    T result() {
+        if (error) std::rethrow_exception(error);
+        return std::move(*value);
+    }
+};
+
+template<>
+struct Promise<void> : PromiseBase {
+    Task<void> get_return_object();
+
+    void return_void() {}
+
+    void result() {
+        if (error) std::rethrow_exception(error);
+    }
+};
+
+} // namespace detail
+
+// Lazy coroutine : it starts when awaited or run, and resumes its awaiter
+// when it completes. Frames come from the FramePool of the thread.
+template<typename T>
+class [[nodiscard]] Task {
+public:
+    using promise_type = detail::Promise<T>;
+    using Handle = std::coroutine_handle<promise_type>;
+
+    explicit Task(Handle h) : _h(h) {}
+
+    Task(Task&& o) noexcept : _h(std::exchange(o._h, {})) {}
+
+    Task& operator=(Task&& o) noexcept {
+        if (this != &o) {
+            if (_h) _h.destroy();
+            _h = std::exchange(o._h, {});
+        }
+        return *this;
+    }
+
+    ~Task() {
+        if (_h) _h.destroy();
+    }
+
+    bool done() const {
+        return _h.done();
+    }
+
+    bool await_ready() const noexcept {
+        return false;
+    }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) noexcept {
+        _h.promise().continuation = awaiter;
+        return _h;
+    }
+
+    T await_resume() {
+        return _h.promise().result();
+    }
+
+    // runs the task to completion on the loop of the calling thread
+    T run() {
+        _h.resume();
+        Loop::current().drive([this] { return _h.done(); });
+        return _h.promise().result();
+    }
+
+private:
+    Handle _h;
+};
+
+namespace detail {
+
+template<typename T>
+Task<T> Promise<T>::get_return_object() {
+    return Task<T>(std::coroutine_handle<Promise<T>>::from_promise(*this));
+}
+
+inline Task<void> Promise<void>::get_return_object() {
+    return Task<void>(std::coroutine_handle<Promise<void>>::from_promise(*this));
+}
+
+} // namespace detail
+
+// One-shot signal between threads. The coroutine awaiting it is resumed on
+// its own loop once set() is called, right away if it already was.
+class Event {
+public:
+    Event() = default;
+    Event(const Event&) = delete;
+    Event& operator=(const Event&) = delete;
+
+    // from any thread, at most once
+    void set();
+
+    bool is_set() const {
+        return _state.load(std::memory_order_acquire) == set_state();
+    }
+
+    bool await_ready() const noexcept {
+        return is_set();
+    }
+
+    bool await_suspend(std::coroutine_handle<> h);
+
+    void await_resume() const noexcept {}
+
+private:
+    struct Waiter {
+        std::coroutine_handle<> h;
+        Loop* loop;
+    };
+
+    void* set_state() const {
+        return const_cast<Event*>(this);
+    }
+
+    // nullptr, the waiter or this once set
+    std::atomic<void*> _state{nullptr};
+    Waiter _waiter;
+};
+
+} // namespace coro
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace data {
+
+// Scalable Bloom filter made of split-block layers.
+//
+// A layer is an array of 64-byte blocks, one cache line each. An item
+// picks one block from the top half of its hash and sets one bit in each
+// of the block's 8 words from the bottom half, multiplied by 8 odd salts :
+// a lookup or an insert touches a single cache line, with no dependent
+// loads and no loop over hash functions.
+//
+// Once the last layer holds its capacity, a new one is added with
+// expansion times the capacity and half the error rate, so that the error
+// rate of the whole filter stays under the one asked for. A filter made
+// with expansion 0 does not scale and refuses items once full.
+//
+// dump() and load() give the filter as one string, in host byte order.
+class Bloom {
+public:
+    static constexpr double k_default_error = 0.01;
+    static constexpr uint64_t k_default_capacity = 100;
+    static constexpr unsigned k_default_expansion = 2;
+
+    // error in (0, 1), capacity > 0
+    Bloom(double error, uint64_t capacity, unsigned expansion = k_default_expansion);
+
+    static uint64_t hash(std::string_view item);
+
+    // 1 when item was added, 0 when it (probably) was there already, -1
+    // when the filter is full and does not scale
+    int add(uint64_t h);
+    int add(std::string_view item) {
+        return add(hash(item));
+    }
+
+    bool contains(uint64_t h) const;
+    bool contains(std::string_view item) const {
+        return contains(hash(item));
+    }
+
+    // brings the blocks of h towards the cache, for a lookup coming soon
+    void prefetch(uint64_t h) const {
+        for (auto& l : _layers) __builtin_prefetch(&l.blocks[index(l, h)]);
+    }
+
+    // items the layers hold before a new one is added
+    uint64_t capacity() const;
+    // items added
+    uint64_t size() const;
+    size_t layers() const {
+        return _layers.size();
+    }
+    // of the blocks
+    size_t bytes() const;
+    unsigned expansion() const {
+        return _expansion;
+    }
+
+    void dump(std::string& out) const;
+    // nullptr when s is not what dump() gives
+    static std::unique_ptr<Bloom> load(std::string_view s);
+
+private:
+    struct alignas(64) Block {
+        uint64_t words[8];
+    };
+
+    struct Layer {
+        std::vector<Block> blocks;
+        uint64_t capacity;
+        uint64_t size;
+        double error;
+    };
+
+    Bloom() = default;
+
+    void grow(uint64_t capacity, double error);
+
+    // the block of h : its top bits scaled to the number of blocks,
+    // without a division
+    static size_t index(const Layer& l, uint64_t h) {
+        return ((h >> 32) * l.blocks.size()) >> 32;
+    }
+
+    static void mask(uint32_t h, uint64_t (&m)[8]);
+
+    std::vector<Layer> _layers;
+    unsigned _expansion = k_default_expansion;
+};
+
+} // namespace data
@@ -0,0 +1,359 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace data {
+
+// Chained hash table keyed by strings, with power-of-two bucket arrays
+// rehashed incrementally.
+//
+// Growing or shrinking allocates the new bucket array only : every insert
+// and erase then moves one bucket over (or skips up to 10 empty ones), so
+// no single call pays for the whole table. Lookups search both arrays while
+// a rehash is going on, rehash() moves it along when writes are scarce.
+//
+// scan() walks the buckets in reverse-binary order of their index, the way
+// Redis does : a bucket's entries end up in the buckets sharing its low bits
+// whatever the size, so a cursor stays meaningful across resizes. Every
+// entry present for the whole scan is seen at least once, some may be seen
+// twice.
+//
+// Nodes never move : references to entries stay valid until they are
+// erased, iterators until the next insert or erase. Not thread-safe.
+template<typename V, typename Hash>
+class Dict {
+    struct Node;
+
+public:
+    using value_type = std::pair<const std::string, V>;
+
+    class iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = Dict::value_type;
+        using difference_type = std::ptrdiff_t;
+        using pointer = value_type*;
+        using reference = value_type&;
+
+        iterator() = default;
+
+        reference operator*() const {
+            return _node->kv;
+        }
+
+        pointer operator->() const {
+            return &_node->kv;
+        }
+
+        iterator& operator++() {
+            _node = _node->next;
+            if (_node == nullptr) settle(_table, _bucket + 1);
+            return *this;
+        }
+
+        bool operator==(const iterator& o) const {
+            return _node == o._node;
+        }
+
+        bool operator!=(const iterator& o) const {
+            return _node != o._node;
+        }
+
+    private:
+        friend class Dict;
+
+        iterator(const Dict* d, int table, size_t bucket, Node* node)
+            : _dict(d), _table(table), _bucket(bucket), _node(node) {}
+
+        // to the first entry from bucket b of table t on
+        void settle(int t, size_t b) {
+            for (; t < 2 ; ++t, b = 0) {
+                auto& buckets = _dict->_tables[t];
+                for (; b < buckets.size() ; ++b) {
+                    if (buckets[b] != nullptr) {
+                        _table = t;
+                        _bucket = b;
+                        _node = buckets[b];
+                        return;
+                    }
+                }
+            }
+            _node = nullptr;
+        }
+
+        const Dict* _dict = nullptr;
+        int _table = 0;
+        size_t _bucket = 0;
+        Node* _node = nullptr;
+    };
+
+    Dict() = default;
+
+    Dict(Dict&& o) noexcept
+        : _tables{std::move(o._tables[0]), std::move(o._tables[1])},
+          _size(std::exchange(o._size, 0)), _rehash(std::exchange(o._rehash, 0)) {
+        o._tables[0].clear();
+        o._tables[1].clear();
+    }
+
+    Dict& operator=(Dict&& o) noexcept {
+        if (this != &o) {
+            clear();
+            std::swap(_tables, o._tables);
+            std::swap(_size, o._size);
+            std::swap(_rehash, o._rehash);
+        }
+        return *this;
+    }
+
+    Dict(const Dict&) = delete;
+    Dict& operator=(const Dict&) = delete;
+
+    ~Dict() {
+        clear();
+    }
+
+    size_t size() const {
+        return _size;
+    }
+
+    bool empty() const {
+        return _size == 0;
+    }
+
+    // slots of both bucket arrays
+    size_t bucket_count() const {
+        return _tables[0].size() + _tables[1].size();
+    }
+
+    iterator begin() const {
+        iterator it(this, 0, 0, nullptr);
+        it.settle(0, 0);
+        return it;
+    }
+
+    iterator end() const {
+        return {};
+    }
+
+    iterator find(std::string_view key) const {
+        return find(key, Hash{}(key));
+    }
+
+    // h is the key's hash, computed already
+    iterator find(std::string_view key, uint64_t h) const {
+        return _size == 0 ? end() : locate(h, key);
+    }
+
+    // brings the bucket slot a key hashing to h falls into towards the
+    // cache, for a lookup coming soon
+    void prefetch_bucket(uint64_t h) const {
+        for (auto& buckets : _tables) {
+            if (!buckets.empty()) __builtin_prefetch(&buckets[h & (buckets.size() - 1)]);
+        }
+    }
+
+    // the same for the first entry of that bucket : reads the slot, it had
+    // better be in cache already
+    void prefetch_entry(uint64_t h) const {
+        for (auto& buckets : _tables) {
+            if (buckets.empty()) continue;
+            const char* n = reinterpret_cast<const char*>(buckets[h & (buckets.size() - 1)]);
+            if (n == nullptr) continue;
+            for (size_t at = 0 ; at < sizeof(Node) ; at += 64) __builtin_prefetch(n + at);
+        }
+    }
+
+    // inserts key unless present, returns where it is and whether it was
+    // inserted
+    std::pair<iterator, bool> emplace(std::string key, V v) {
+        uint64_t h = Hash{}(key);
+        return emplace(h, std::move(key), std::move(v));
+    }
+
+    // h is the key's hash, computed already
+    std::pair<iterator, bool> emplace(uint64_t h, std::string key, V v) {
+        step();
+        if (_size > 0) {
+            auto it = locate(h, key);
+            if (it != end()) return {it, false};
+        }
+        grow();
+        int t = rehashing() ? 1 : 0;
+        auto& buckets = _tables[t];
+        size_t b = h & (buckets.size() - 1);
+        buckets[b] = new Node{buckets[b], value_type(std::move(key), std::move(v))};
+        ++_size;
+        return {iterator(this, t, b, buckets[b]), true};
+    }
+
+    void erase(iterator it) {
+        Node** link = &_tables[it._table][it._bucket];
+        while (*link != it._node) link = &(*link)->next;
+        *link = it._node->next;
+        delete it._node;
+        --_size;
+        step();
+        shrink();
+    }
+
+    bool rehashing() const {
+        return !_tables[1].empty();
+    }
+
+    // moves up to n buckets to the new array, shrinking again when that
+    // finishes with a table too large. Returns whether there is more to do
+    bool rehash(size_t n) {
+        for (; n > 0 ; --n) {
+            if (!rehashing()) shrink();
+            if (!rehashing()) return false;
+            step();
+        }
+        return rehashing();
+    }
+
+    // frees every entry, O(size)
+    void clear() {
+        for (auto& buckets : _tables) {
+            for (Node* n : buckets) {
+                while (n != nullptr) delete std::exchange(n, n->next);
+            }
+            std::vector<Node*>().swap(buckets);
+        }
+        _size = 0;
+        _rehash = 0;
+    }
+
+    // calls fn(value_type&) on the entries of the bucket named by cursor
+    // (and of the buckets of the larger array it maps to while rehashing),
+    // returns the cursor of the next bucket, 0 once they were all visited.
+    // fn must not insert or erase
+    template<typename Fn>
+    uint64_t scan(uint64_t cursor, Fn&& fn) {
+        if (_size == 0) return 0;
+        if (!rehashing()) {
+            uint64_t m0 = _tables[0].size() - 1;
+            visit(_tables[0][cursor & m0], fn);
+            // the bits above the mask are set for the increment to carry
+            // through the masked ones only
+            return next(cursor | ~m0);
+        }
+        auto* small = &_tables[0];
+        auto* large = &_tables[1];
+        if (small->size() > large->size()) std::swap(small, large);
+        uint64_t m0 = small->size() - 1;
+        uint64_t m1 = large->size() - 1;
+        visit((*small)[cursor & m0], fn);
+        // then every bucket of the larger array the small one expands to
+        do {
+            visit((*large)[cursor & m1], fn);
+            cursor = next(cursor | ~m1);
+        } while (cursor & (m0 ^ m1));
+        return cursor;
+    }
+
+private:
+    struct Node {
+        Node* next;
+        value_type kv;
+    };
+
+    static constexpr size_t k_min_buckets = 4;
+    // empty buckets a rehash step may skip
+    static constexpr size_t k_empty_visits = 10;
+
+    static uint64_t reverse(uint64_t v) {
+        v = ((v >> 1) & 0x5555555555555555ull) | ((v & 0x5555555555555555ull) << 1);
+        v = ((v >> 2) & 0x3333333333333333ull) | ((v & 0x3333333333333333ull) << 2);
+        v = ((v >> 4) & 0x0f0f0f0f0f0f0f0full) | ((v & 0x0f0f0f0f0f0f0f0full) << 4);
+        return __builtin_bswap64(v);
+    }
+
+    // increments the reversed cursor
+    static uint64_t next(uint64_t cursor) {
+        return reverse(reverse(cursor) + 1);
+    }
+
+    static size_t pow2_at_least(size_t n) {
+        size_t p = k_min_buckets;
+        while (p < n) p <<= 1;
+        return p;
+    }
+
+    template<typename Fn>
+    static void visit(Node* n, Fn& fn) {
+        for (; n != nullptr ; n = n->next) fn(n->kv);
+    }
+
+    iterator locate(uint64_t h, std::string_view key) const {
+        for (int t = 0 ; t < 2 ; ++t) {
+            auto& buckets = _tables[t];
+            if (buckets.empty()) continue;
+            size_t b = h & (buckets.size() - 1);
+            for (Node* n = buckets[b] ; n != nullptr ; n = n->next) {
+                if (n->kv.first == key) return iterator(this, t, b, n);
+            }
+        }
+        return end();
+    }
+
+    // the next array grows to twice the entries once there are as many
+    // entries as buckets
+    void grow() {
+        if (_tables[0].empty()) {
+            _tables[0].assign(k_min_buckets, nullptr);
+        } else if (!rehashing() && _size + 1 > _tables[0].size()) {
+            resize(pow2_at_least(2 * (_size + 1)));
+        }
+    }
+
+    // and shrinks once they fill less than an eighth of it
+    void shrink() {
+        if (rehashing() || _tables[0].size() <= k_min_buckets || _size * 8 >= _tables[0].size()) return;
+        resize(pow2_at_least(2 * _size));
+    }
+
+    void resize(size_t buckets) {
+        _tables[1].assign(buckets, nullptr);
+        _rehash = 0;
+    }
+
+    // moves the next non-empty bucket to the new array
+    void step() {
+        if (!rehashing()) return;
+        auto& from = _tables[0];
+        auto& to = _tables[1];
+        for (size_t skipped = 0 ; _rehash < from.size() && from[_rehash] == nullptr ; ++_rehash) {
+            if (++skipped == k_empty_visits) return;
+        }
+        if (_rehash < from.size()) {
+            for (Node* n = std::exchange(from[_rehash], nullptr) ; n != nullptr ; ) {
+                Node* rest = n->next;
+                size_t b = Hash{}(n->kv.first) & (to.size() - 1);
+                n->next = to[b];
+                to[b] = n;
+                n = rest;
+            }
+            ++_rehash;
+        }
+        if (_rehash == from.size()) {
+            from.swap(to);
+            std::vector<Node*>().swap(to);
+            _rehash = 0;
+        }
+    }
+
+    // _tables[1] is only there during a rehash, _tables[0] buckets before
+    // _rehash were already moved to it
+    std::vector<Node*> _tables[2];
+    size_t _size = 0;
+    size_t _rehash = 0;
+};
+
+} // namespace data
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <memory>
+
+namespace data {
+
+// Per-connection state indexed by file descriptor.
+// Chunks are allocated on first use and never move, so looking a slot up
+// takes no lock. A slot must only be touched by the thread serving its fd.
+template<typename T>
+class FdTable {
+public:
+    static constexpr int k_chunk = 1024;
+    static constexpr int k_chunks = 1024;
+
+    FdTable() = default;
+    FdTable(const FdTable&) = delete;
+    FdTable& operator=(const FdTable&) = delete;
+
+    ~FdTable() {
+        for (auto& c : _chunks) delete c.load(std::memory_order_acquire);
+    }
+
+    // nullptr when fd has no state yet
+    T* get(int fd) const {
+        if (fd < 0 || fd >= k_chunk * k_chunks) return nullptr;
+        Chunk* c = _chunks[fd / k_chunk].load(std::memory_order_acquire);
+        return c == nullptr ? nullptr : (*c)[fd % k_chunk].get();
+    }
+
+    // the state of fd, created on first use
+    T& at(int fd) {
+        auto& slot = (*chunk(fd))[fd % k_chunk];
+        if (!slot) slot = std::make_unique<T>();
+        return *slot;
+    }
+
+    void reset(int fd) {
+        if (get(fd) != nullptr) (*chunk(fd))[fd % k_chunk].reset();
+    }
+
+private:
+    using Chunk = std::array<std::unique_ptr<T>, k_chunk>;
+
+    Chunk* chunk(int fd) {
+        auto& c = _chunks[fd / k_chunk];
+        Chunk* cur = c.load(std::memory_order_acquire);
+        if (cur != nullptr) return cur;
+        Chunk* fresh = new Chunk();
+        if (c.compare_exchange_strong(cur, fresh, std::memory_order_acq_rel)) return fresh;
+        delete fresh;
+        return cur;
+    }
+
+    std::array<std::atomic<Chunk*>, k_chunks> _chunks = {};
+};
+
+} // namespace data
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// HyperLogLog cardinality estimators, laid out the way Redis lays them out
+// so that they stay plain strings : GET, SET, replication and the cold
+// store move them around like any other.
+//
+// A 16-byte header ("HYLL", the encoding, 3 unused bytes, the cached count
+// little-endian with its top bit set when stale) is followed by 2^14
+// registers, either dense (6 bits each, 12K) or sparse : runs of ZERO
+// (00xxxxxx, up to 64 zero registers), XZERO (01xxxxxx yyyyyyyy, up to
+// 16384) and VAL (1vvvvvxx, up to 4 registers holding 1 to 32). A sparse
+// HLL turns dense once a register goes past 32 or it outgrows k_sparse_max.
+//
+// Merges unpack every source into one byte per register (Raw) and take the
+// per-byte maximum 16 registers at a time.
+namespace data::hll {
+
+constexpr unsigned k_p = 14;
+constexpr size_t k_registers = size_t(1) << k_p;
+constexpr unsigned k_bits = 6;
+constexpr size_t k_header = 16;
+constexpr size_t k_dense_size = k_header + (k_registers * k_bits + 7) / 8;
+// bytes of opcodes past which a sparse HLL turns dense
+constexpr size_t k_sparse_max = 3000;
+
+enum Encoding : uint8_t {
+    DENSE = 0,
+    SPARSE = 1
+};
+
+// one byte per register
+using Raw = std::array<uint8_t, k_registers>;
+
+// an empty HLL, sparse
+std::string create();
+// whether s looks like an HLL : the header and, when dense, the size. The
+// sparse opcodes are checked as they are read
+bool valid(std::string_view s);
+// 1 when a register changed, 0 when none did, -1 when s is corrupted. s
+// must be valid()
+int add(std::string& s, std::string_view element);
+// the estimated cardinality, from the cached one when it is still good.
+// Refreshes the cache, -1 when s is corrupted
+int64_t count(std::string& s);
+// raw[i] = max(raw[i], register i of s), false when s is corrupted
+bool merge(std::string_view s, Raw& raw);
+// the estimated cardinality of raw registers
+uint64_t count(const Raw& raw);
+// a dense HLL of raw registers
+std::string from_raw(const Raw& raw);
+// dst[i] = max(dst[i], src[i])
+void max(Raw& dst, const Raw& src);
+
+} // namespace data::hll
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <atomic>
+#include <optional>
+#include <utility>
+
+namespace data {
+
+// Unbounded lock-free multi-producer single-consumer queue (Vyukov).
+// Producers only do one atomic exchange, the consumer never blocks them.
+// pop() may transiently see the queue as empty while a producer is halfway
+// through push(), so consumers must re-check after a producer signals them.
+template<typename T>
+class MPSCQueue {
+public:
+    MPSCQueue() {
+        Cell* stub = new Cell();
+        _head.store(stub, std::memory_order_relaxed);
+        _tail = stub;
+    }
+
+    MPSCQueue(const MPSCQueue&) = delete;
+    MPSCQueue& operator=(const MPSCQueue&) = delete;
+
+    ~MPSCQueue() {
+        while (pop().has_value()) {}
+        delete _tail;
+    }
+
+    void push(T v) {
+        Cell* c = new Cell();
+        c->value.emplace(std::move(v));
+        Cell* prev = _head.exchange(c, std::memory_order_acq_rel);
+        prev->next.store(c, std::memory_order_release);
+    }
+
+    // consumer side only
+    std::optional<T> pop() {
+        Cell* tail = _tail;
+        Cell* next = tail->next.load(std::memory_order_acquire);
+        if (next == nullptr) return {};
+        std::optional<T> v = std::move(next->value);
+        next->value.reset();
+        _tail = next;
+        delete tail;
+        return v;
+    }
+
+    // consumer side only
+    bool empty() const {
+        return _tail->next.load(std::memory_order_acquire) == nullptr;
+    }
+
+private:
+    struct Cell {
+        std::atomic<Cell*> next{nullptr};
+        std::optional<T> value;
+    };
+
+    std::atomic<Cell*> _head;
+    Cell* _tail;
+};
+
+} // namespace data
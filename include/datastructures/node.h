@@ -1,5 +1,8 @@
 #pragma once
 
+#include <charconv>
+#include <cmath>
+#include <cstdint>
 #include <functional>
 #include <iostream>
 #include <memory>
@@ -9,19 +12,102 @@
 
 namespace data {
 
+// RESP2 and RESP3 types, indexes k_prefix
+enum class Type : uint8_t {
+    SimpleString,
+    SimpleError,
+    Integer,
+    BulkString,
+    Array,
+    Null,
+    Boolean,
+    Double,
+    BigNumber,
+    BulkError,
+    VerbatimString,
+    Map,
+    Attribute,
+    Set,
+    Push
+};
+
+inline constexpr char k_prefix[] = {
+    '+', '-', ':', '$', '*', '_', '#', ',', '(', '!', '=', '%', '|', '~', '>'
+};
+
+constexpr char prefix(Type t) {
+    return k_prefix[static_cast<size_t>(t)];
+}
+
+// appends "<prefix><n>\r\n", the header of every length-prefixed type
+inline void write_header(std::string& out, Type t, int64_t n) {
+    char buf[24];
+    auto res = std::to_chars(buf, buf + sizeof(buf), n);
+    out += prefix(t);
+    out.append(buf, res.ptr);
+    out += "\r\n";
+}
+
 class Node {
 public:
     virtual ~Node() = default;
+    virtual Type type() const = 0;
     virtual std::string to_string() const = 0;
-    virtual std::string to_resp() const = 0;
+    // serializes the node at the end of out, nested nodes write in place
+    virtual void write_resp(std::string& out) const = 0;
+
+    std::string to_resp() const {
+        std::string s;
+        write_resp(s);
+        return s;
+    }
 };
 
 std::ostream& operator<<(std::ostream& out, const Node& n);
 
-class BulkString : public Node {
+// one line of text after the prefix : +OK, -ERR ..., (3492890328409238509
+template<Type T>
+class Line : public Node {
 public:
-    BulkString(std::string s) : _s(s) {}
-    BulkString() {}
+    Line(std::string s) : _s(std::move(s)) {}
+
+    Type type() const override {
+        return T;
+    }
+
+    std::string to_string() const override {
+        return _s;
+    }
+
+    const std::string& get() const {
+        return _s;
+    }
+
+    void write_resp(std::string& out) const override {
+        out += prefix(T);
+        out += _s;
+        out += "\r\n";
+    }
+
+    ~Line() {}
+private:
+    std::string _s;
+};
+
+using String = Line<Type::SimpleString>;
+using SimpleError = Line<Type::SimpleError>;
+using BigNumber = Line<Type::BigNumber>;
+
+// length-prefixed binary safe string, possibly null : $4\r\ntest\r\n, !-1\r\n
+template<Type T>
+class Blob : public Node {
+public:
+    Blob(std::string s) : _s(std::move(s)) {}
+    Blob() {}
+
+    Type type() const override {
+        return T;
+    }
 
     std::string to_string() const override {
         if (_s.has_value()) {
@@ -36,79 +122,185 @@ public:
         return _s;
     }
 
-    std::string to_resp() const override {
+    void write_resp(std::string& out) const override {
         if (_s.has_value()) {
             auto& s = _s.value();
-            size_t n = s.size();
-            return "$" + std::to_string(n) + "\r\n" + s + "\r\n";
+            write_header(out, T, static_cast<int64_t>(s.size()));
+            out += s;
+            out += "\r\n";
         } else {
-            return "$-1\r\n";
+            write_header(out, T, -1);
         }
     }
 
-
-    ~BulkString() {}
+    ~Blob() {}
 private:
     std::optional<std::string> _s;
 };
 
-class String : public Node {
+using BulkString = Blob<Type::BulkString>;
+using BulkError = Blob<Type::BulkError>;
+
+class Integer : public Node {
 public:
-    String(std::string s) : _s(s) {}
+    Integer(int64_t i) : _i(i) {}
+
+    Type type() const override {
+        return Type::Integer;
+    }
 
     std::string to_string() const override {
-        return _s;
+        return std::to_string(_i);
     }
 
-    const std::string& get() const {
-        return _s;
+    const int64_t& get() const {
+        return _i;
     }
 
-    std::string to_resp() const override {
-        return "+" + _s + "\r\n";
+    void write_resp(std::string& out) const override {
+        write_header(out, Type::Integer, _i);
     }
 
-    ~String() {}
 private:
-    std::string _s;
+    int64_t _i;
 };
 
-class Integer : public Node {
+class Null : public Node {
 public:
-    Integer(int64_t i) : _i(i) {}
+    Type type() const override {
+        return Type::Null;
+    }
 
     std::string to_string() const override {
-        return std::to_string(_i);
+        return "\033[31;mnull\033[0m";
     }
 
-    const int64_t& get() const {
-        return _i;
+    void write_resp(std::string& out) const override {
+        out += "_\r\n";
     }
+};
 
-    std::string to_resp() const override {
-        return ":" + std::to_string(_i) + "\r\n";
+class Boolean : public Node {
+public:
+    Boolean(bool b) : _b(b) {}
+
+    Type type() const override {
+        return Type::Boolean;
+    }
+
+    std::string to_string() const override {
+        return _b ? "true" : "false";
+    }
+
+    const bool& get() const {
+        return _b;
+    }
+
+    void write_resp(std::string& out) const override {
+        out += _b ? "#t\r\n" : "#f\r\n";
     }
 
 private:
-    int64_t _i;
+    bool _b;
 };
 
-class Array : public Node {
+class Double : public Node {
 public:
-    explicit Array(int len) {
+    Double(double d) : _d(d) {}
+
+    Type type() const override {
+        return Type::Double;
+    }
+
+    std::string to_string() const override {
+        std::string s;
+        append(s);
+        return s;
+    }
+
+    const double& get() const {
+        return _d;
+    }
+
+    void write_resp(std::string& out) const override {
+        out += ',';
+        append(out);
+        out += "\r\n";
+    }
+
+private:
+    void append(std::string& out) const {
+        if (std::isnan(_d)) {
+            out += "nan";
+        } else if (std::isinf(_d)) {
+            out += _d > 0 ? "inf" : "-inf";
+        } else {
+            // shortest representation that parses back to the same value
+            char buf[32];
+            auto res = std::to_chars(buf, buf + sizeof(buf), _d);
+            out.append(buf, res.ptr);
+        }
+    }
+
+    double _d;
+};
+
+// =15\r\ntxt:Some string\r\n, the format is always 3 characters
+class VerbatimString : public Node {
+public:
+    VerbatimString(std::string format, std::string s) : _format(std::move(format)), _s(std::move(s)) {}
+
+    Type type() const override {
+        return Type::VerbatimString;
+    }
+
+    std::string to_string() const override {
+        return _s;
+    }
+
+    const std::string& format() const {
+        return _format;
+    }
+
+    const std::string& get() const {
+        return _s;
+    }
+
+    void write_resp(std::string& out) const override {
+        write_header(out, Type::VerbatimString, static_cast<int64_t>(_s.size() + 4));
+        out += _format;
+        out += ':';
+        out += _s;
+        out += "\r\n";
+    }
+
+private:
+    std::string _format;
+    std::string _s;
+};
+
+// counted sequence of nodes : arrays (possibly null), sets and pushes
+template<Type T>
+class Aggregate : public Node {
+public:
+    explicit Aggregate(int len) {
         if (len >= 0) {
             _a.emplace();
             _a->reserve(static_cast<size_t>(len));
         }
     }
 
+    Type type() const override {
+        return T;
+    }
+
     std::string to_string() const override {
         if (!_a.has_value()) {
             return "\033[31;mnull\033[0m";
         }
         auto& a = _a.value();
         int n = a.size();
-        std::string s = "[";
+        std::string s = T == Type::Set ? "{" : "[";
         for (int i = 0 ; i < n ; ++i) {
             s += a[i]->to_string();
             if (i == n - 1) {
@@ -116,7 +308,7 @@ public:
             }
             s += ", ";
         }
-        s += "]";
+        s += T == Type::Set ? "}" : "]";
         return s;
     }
 
@@ -129,21 +321,109 @@ public:
         _a.value().push_back(std::move(n));
     }
 
-    std::string to_resp() const override {
-        if (!_a.has_value()) return "*-1\r\n";
+    void write_resp(std::string& out) const override {
+        if (!_a.has_value()) {
+            write_header(out, T, -1);
+            return;
+        }
         auto& a = _a.value();
-        int n = a.size();
-        std::string s = "*" + std::to_string(n) + "\r\n";
+        write_header(out, T, static_cast<int64_t>(a.size()));
         for (auto&& rv : a) {
-            s += rv->to_resp();
+            rv->write_resp(out);
         }
-        return s;
     }
-    
-    ~Array() {}
+
+    ~Aggregate() {}
 
 private:
     std::optional<std::vector<std::unique_ptr<Node>>> _a;
 };
 
-} // namespace data
\ No newline at end of file
+using Array = Aggregate<Type::Array>;
+using Set = Aggregate<Type::Set>;
+using Push = Aggregate<Type::Push>;
+
+// counted sequence of key/value pairs, the count is the number of pairs
+class Map : public Node {
+public:
+    using Pairs = std::vector<std::pair<std::unique_ptr<Node>, std::unique_ptr<Node>>>;
+
+    explicit Map(int len) {
+        _m.reserve(static_cast<size_t>(len > 0 ? len : 0));
+    }
+
+    Type type() const override {
+        return Type::Map;
+    }
+
+    std::string to_string() const override {
+        std::string s = "{";
+        for (size_t i = 0 ; i < _m.size() ; ++i) {
+            s += _m[i].first->to_string();
+            s += ": ";
+            s += _m[i].second->to_string();
+            if (i + 1 < _m.size()) s += ", ";
+        }
+        s += "}";
+        return s;
+    }
+
+    const Pairs& get() const {
+        return _m;
+    }
+
+    void emplace_back(std::unique_ptr<Node> k, std::unique_ptr<Node> v) {
+        _m.emplace_back(std::move(k), std::move(v));
+    }
+
+    void write_resp(std::string& out) const override {
+        write_pairs(out, Type::Map);
+    }
+
+protected:
+    void write_pairs(std::string& out, Type t) const {
+        write_header(out, t, static_cast<int64_t>(_m.size()));
+        for (auto&& [k, v] : _m) {
+            k->write_resp(out);
+            v->write_resp(out);
+        }
+    }
+
+    Pairs _m;
+};
+
+// out-of-band metadata followed by the value it describes
+class Attribute : public Map {
+public:
+    explicit Attribute(int len) : Map(len) {}
+
+    Type type() const override {
+        return Type::Attribute;
+    }
+
+    std::string to_string() const override {
+        std::string s = "|";
+        s += Map::to_string();
+        s += "| ";
+        if (_value) s += _value->to_string();
+        return s;
+    }
+
+    const std::unique_ptr<Node>& value() const {
+        return _value;
+    }
+
+    void set_value(std::unique_ptr<Node> v) {
+        _value = std::move(v);
+    }
+
+    void write_resp(std::string& out) const override {
+        write_pairs(out, Type::Attribute);
+        if (_value) _value->write_resp(out);
+    }
+
+private:
+    std::unique_ptr<Node> _value;
+};
+
+} // namespace data
@@ -0,0 +1,289 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace data {
+
+// Ordered map from byte strings to V, as a radix tree with compressed
+// edges, the way Redis indexes its streams.
+//
+// A node holds the bytes of the edge leading to it, maybe a value, and its
+// children sorted by the first byte of their edge. Keys sharing a prefix
+// share its nodes : the 16-byte big-endian IDs of a stream, all in the same
+// millisecond range, cost a few bytes each past the first. Lookups are
+// O(key length), and so are the seeks to the nearest key above or below a
+// given one that range reads walk the tree with.
+//
+// Values never move until erased. Not thread-safe.
+template<typename V>
+class Radix {
+public:
+    Radix() : _root(std::make_unique<Node>()) {}
+
+    size_t size() const {
+        return _size;
+    }
+
+    bool empty() const {
+        return _size == 0;
+    }
+
+    V* find(std::string_view key) const {
+        Node* n = _root.get();
+        for (;;) {
+            if (key.empty()) return n->has_value ? &n->value : nullptr;
+            Node* c = n->child(static_cast<uint8_t>(key[0]));
+            if (c == nullptr || key.substr(0, c->edge.size()) != c->edge) return nullptr;
+            key.remove_prefix(c->edge.size());
+            n = c;
+        }
+    }
+
+    // inserts key unless present, returns its value and whether it was
+    // inserted
+    std::pair<V*, bool> insert(std::string_view key, V v) {
+        Node* n = _root.get();
+        for (;;) {
+            if (key.empty()) {
+                if (n->has_value) return {&n->value, false};
+                n->has_value = true;
+                n->value = std::move(v);
+                ++_size;
+                return {&n->value, true};
+            }
+            size_t at = n->slot(static_cast<uint8_t>(key[0]));
+            if (at == n->bytes.size() || n->bytes[at] != static_cast<uint8_t>(key[0])) {
+                auto leaf = std::make_unique<Node>();
+                leaf->edge = key;
+                leaf->has_value = true;
+                leaf->value = std::move(v);
+                V* res = &leaf->value;
+                n->bytes.insert(n->bytes.begin() + at, static_cast<uint8_t>(key[0]));
+                n->children.insert(n->children.begin() + at, std::move(leaf));
+                ++_size;
+                return {res, true};
+            }
+            Node* c = n->children[at].get();
+            size_t common = 0;
+            while (common < c->edge.size() && common < key.size() && c->edge[common] == key[common]) ++common;
+            if (common < c->edge.size()) {
+                // the edge splits where key leaves it
+                auto mid = std::make_unique<Node>();
+                mid->edge = c->edge.substr(0, common);
+                c->edge.erase(0, common);
+                mid->bytes.push_back(static_cast<uint8_t>(c->edge[0]));
+                mid->children.push_back(std::move(n->children[at]));
+                n->children[at] = std::move(mid);
+                c = n->children[at].get();
+            }
+            key.remove_prefix(common);
+            n = c;
+        }
+    }
+
+    bool erase(std::string_view key) {
+        // the nodes from the root down, and the slot each one is in
+        std::vector<std::pair<Node*, size_t>> path;
+        Node* n = _root.get();
+        while (!key.empty()) {
+            size_t at = n->slot(static_cast<uint8_t>(key[0]));
+            if (at == n->bytes.size() || n->bytes[at] != static_cast<uint8_t>(key[0])) return false;
+            Node* c = n->children[at].get();
+            if (key.substr(0, c->edge.size()) != c->edge) return false;
+            path.emplace_back(n, at);
+            key.remove_prefix(c->edge.size());
+            n = c;
+        }
+        if (!n->has_value) return false;
+        n->has_value = false;
+        n->value = V();
+        --_size;
+        // drops the node if nothing hangs from it anymore, then joins what
+        // is left of it or of its parent to their only child
+        if (!path.empty() && n->children.empty()) {
+            auto [parent, at] = path.back();
+            path.pop_back();
+            parent->bytes.erase(parent->bytes.begin() + at);
+            parent->children.erase(parent->children.begin() + at);
+            n = parent;
+        }
+        if (n != _root.get() && !n->has_value && n->children.size() == 1) n->absorb();
+        return true;
+    }
+
+    void clear() {
+        _root = std::make_unique<Node>();
+        _size = 0;
+    }
+
+    // the value of the first key at or after key (strictly after when
+    // strict), nullptr when there is none. Its key goes to found
+    V* seek_ge(std::string_view key, bool strict = false, std::string* found = nullptr) const {
+        std::string path;
+        Node* n = ge(_root.get(), key, strict, path);
+        if (n != nullptr && found != nullptr) *found = std::move(path);
+        return n == nullptr ? nullptr : &n->value;
+    }
+
+    // the value of the last key at or before key (strictly before when
+    // strict)
+    V* seek_le(std::string_view key, bool strict = false, std::string* found = nullptr) const {
+        std::string path;
+        Node* n = le(_root.get(), key, strict, path);
+        if (n != nullptr && found != nullptr) *found = std::move(path);
+        return n == nullptr ? nullptr : &n->value;
+    }
+
+    V* first(std::string* found = nullptr) const {
+        return seek_ge({}, false, found);
+    }
+
+    V* last(std::string* found = nullptr) const {
+        if (_size == 0) return nullptr;
+        std::string path;
+        Node* n = max(_root.get(), path);
+        if (found != nullptr) *found = std::move(path);
+        return &n->value;
+    }
+
+    // calls fn(key, value) in key order until it returns false
+    template<typename Fn>
+    void each(Fn&& fn) const {
+        std::string path;
+        walk(_root.get(), path, fn);
+    }
+
+private:
+    struct Node {
+        std::string edge;
+        bool has_value = false;
+        V value{};
+        std::vector<uint8_t> bytes;
+        std::vector<std::unique_ptr<Node>> children;
+
+        // where a child starting with b is or would go
+        size_t slot(uint8_t b) const {
+            return static_cast<size_t>(std::lower_bound(bytes.begin(), bytes.end(), b) - bytes.begin());
+        }
+
+        Node* child(uint8_t b) const {
+            size_t at = slot(b);
+            return at < bytes.size() && bytes[at] == b ? children[at].get() : nullptr;
+        }
+
+        // takes the place of its only child
+        void absorb() {
+            std::unique_ptr<Node> c = std::move(children[0]);
+            edge += c->edge;
+            has_value = c->has_value;
+            value = std::move(c->value);
+            bytes = std::move(c->bytes);
+            children = std::move(c->children);
+        }
+    };
+
+    // the smallest key of the subtree under n, whose path is in path
+    static Node* min(Node* n, std::string& path) {
+        for (;;) {
+            if (n->has_value) return n;
+            n = n->children[0].get();
+            path += n->edge;
+        }
+    }
+
+    static Node* max(Node* n, std::string& path) {
+        while (!n->children.empty()) {
+            n = n->children.back().get();
+            path += n->edge;
+        }
+        return n;
+    }
+
+    // the first key of the subtree under n at or after target, which is
+    // what is left of the key past the path to n
+    static Node* ge(Node* n, std::string_view target, bool strict, std::string& path) {
+        if (target.empty()) {
+            if (n->has_value && !strict) return n;
+            // every key below is longer, so larger
+            if (n->children.empty()) return nullptr;
+            Node* c = n->children[0].get();
+            path += c->edge;
+            return min(c, path);
+        }
+        size_t at = n->slot(static_cast<uint8_t>(target[0]));
+        if (at < n->bytes.size() && n->bytes[at] == static_cast<uint8_t>(target[0])) {
+            Node* c = n->children[at].get();
+            size_t m = std::min(c->edge.size(), target.size());
+            int cmp = std::memcmp(c->edge.data(), target.data(), m);
+            size_t before = path.size();
+            path += c->edge;
+            Node* res = nullptr;
+            if (cmp > 0 || (cmp == 0 && target.size() < c->edge.size())) {
+                res = min(c, path);
+            } else if (cmp == 0) {
+                res = ge(c, target.substr(c->edge.size()), strict, path);
+            }
+            if (res != nullptr) return res;
+            path.resize(before);
+            ++at;
+        }
+        if (at == n->children.size()) return nullptr;
+        Node* c = n->children[at].get();
+        path += c->edge;
+        return min(c, path);
+    }
+
+    static Node* le(Node* n, std::string_view target, bool strict, std::string& path) {
+        if (target.empty()) return n->has_value && !strict ? n : nullptr;
+        size_t at = n->slot(static_cast<uint8_t>(target[0]));
+        if (at < n->bytes.size() && n->bytes[at] == static_cast<uint8_t>(target[0])) {
+            Node* c = n->children[at].get();
+            size_t m = std::min(c->edge.size(), target.size());
+            int cmp = std::memcmp(c->edge.data(), target.data(), m);
+            size_t before = path.size();
+            path += c->edge;
+            Node* res = nullptr;
+            if (cmp < 0) {
+                res = max(c, path);
+            } else if (cmp == 0 && target.size() >= c->edge.size()) {
+                res = le(c, target.substr(c->edge.size()), strict, path);
+            }
+            if (res != nullptr) return res;
+            path.resize(before);
+        }
+        // the children before target's byte, then n itself : a prefix of
+        // target, so smaller
+        if (at > 0) {
+            Node* c = n->children[at - 1].get();
+            path += c->edge;
+            return max(c, path);
+        }
+        return n->has_value ? n : nullptr;
+    }
+
+    template<typename Fn>
+    static bool walk(Node* n, std::string& path, Fn& fn) {
+        if (n->has_value && !fn(std::string_view(path), n->value)) return false;
+        for (auto& c : n->children) {
+            size_t before = path.size();
+            path += c->edge;
+            bool more = walk(c.get(), path, fn);
+            path.resize(before);
+            if (!more) return false;
+        }
+        return true;
+    }
+
+    std::unique_ptr<Node> _root;
+    size_t _size = 0;
+};
+
+} // namespace data
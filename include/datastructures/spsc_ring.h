@@ -0,0 +1,68 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <optional>
+#include <utility>
+
+namespace data {
+
+// Bounded lock-free single-producer single-consumer ring.
+// Each side owns one index and keeps a stale copy of the other one, so the
+// shared cache lines are only read when the ring looks full or empty.
+template<typename T>
+class SPSCRing {
+public:
+    // the capacity is rounded up to a power of two
+    explicit SPSCRing(size_t capacity) {
+        size_t n = 1;
+        while (n < capacity) n <<= 1;
+        _mask = n - 1;
+        _cells = std::make_unique<T[]>(n);
+    }
+
+    SPSCRing(const SPSCRing&) = delete;
+    SPSCRing& operator=(const SPSCRing&) = delete;
+
+    size_t capacity() const {
+        return _mask + 1;
+    }
+
+    // producer side only, false when the ring is full
+    bool push(T v) {
+        size_t head = _head.load(std::memory_order_relaxed);
+        if (head - _tail_cache > _mask) {
+            _tail_cache = _tail.load(std::memory_order_acquire);
+            if (head - _tail_cache > _mask) return false;
+        }
+        _cells[head & _mask] = std::move(v);
+        _head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // consumer side only
+    std::optional<T> pop() {
+        size_t tail = _tail.load(std::memory_order_relaxed);
+        if (tail == _head_cache) {
+            _head_cache = _head.load(std::memory_order_acquire);
+            if (tail == _head_cache) return {};
+        }
+        std::optional<T> v = std::move(_cells[tail & _mask]);
+        _tail.store(tail + 1, std::memory_order_release);
+        return v;
+    }
+
+private:
+    // written by the producer
+    alignas(64) std::atomic<size_t> _head{0};
+    size_t _tail_cache = 0;
+    // written by the consumer
+    alignas(64) std::atomic<size_t> _tail{0};
+    size_t _head_cache = 0;
+
+    alignas(64) size_t _mask;
+    std::unique_ptr<T[]> _cells;
+};
+
+} // namespace data
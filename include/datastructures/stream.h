@@ -0,0 +1,196 @@
+#pragma once
+
+#include <compare>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "datastructures/radix.h"
+
+namespace data {
+
+// ms-seq, ordered as the pair
+struct StreamID {
+    uint64_t ms = 0;
+    uint64_t seq = 0;
+
+    static constexpr size_t k_key_size = 16;
+
+    auto operator<=>(const StreamID&) const = default;
+
+    // big-endian, so that keys sort like the IDs
+    std::string key() const;
+    static StreamID from_key(std::string_view k);
+    std::string str() const;
+};
+
+constexpr StreamID k_max_id{UINT64_MAX, UINT64_MAX};
+
+// An append-only log of entries, each a list of field / value pairs under
+// an ID larger than any before it, with consumer groups on top.
+//
+// Entries are packed one after the other into blocks of up to
+// k_block_entries entries or k_block_bytes bytes : the ID as deltas from
+// the block's first, then the values, and the field names too unless they
+// are those of the block's first entry, which most are. A radix tree maps
+// the first ID of each block to it. Appending writes to the last block,
+// a range read seeks its first block and decodes forward from there.
+// Trimming drops whole blocks, and skips entries at the head of the first.
+//
+// Each group remembers the last ID it delivered and the entries delivered
+// but not acknowledged yet (its PEL), in a radix tree by ID as well.
+class Stream {
+public:
+    static constexpr size_t k_block_entries = 128;
+    static constexpr size_t k_block_bytes = 4096;
+
+    // fields and values, alternating. They point into the stream, and stay
+    // valid until it changes
+    using Fields = std::vector<std::string_view>;
+
+    // an entry delivered to a consumer and not acknowledged yet
+    struct Pending {
+        std::string consumer;
+        // ms since the epoch
+        int64_t delivered = 0;
+        uint64_t deliveries = 0;
+    };
+
+    struct Consumer {
+        // last time it read, ms since the epoch
+        int64_t seen = 0;
+        // its entries in the PEL
+        size_t pending = 0;
+    };
+
+    struct Group {
+        StreamID last;
+        // by StreamID::key()
+        Radix<Pending> pel;
+        std::map<std::string, Consumer, std::less<>> consumers;
+    };
+
+    using Groups = std::map<std::string, Group, std::less<>>;
+
+    size_t size() const {
+        return _size;
+    }
+
+    // the largest ID ever added, or set by last_id(id)
+    StreamID last_id() const {
+        return _last;
+    }
+
+    // id must be at least the ID of the last entry
+    void last_id(StreamID id) {
+        _last = id;
+    }
+
+    // 0-0 when empty
+    StreamID first_id() const;
+
+    // fv holds n fields and values alternating, id is larger than
+    // last_id()
+    void append(StreamID id, const std::string_view* fv, size_t n);
+
+    // calls fn(id, fields) on the entries from start to end included, in
+    // order, until it returns false
+    template<typename Fn>
+    void range(StreamID start, StreamID end, Fn&& fn) const {
+        if (_size == 0 || start > end) return;
+        // the block holding start, or the first one after it
+        auto* b = _blocks.seek_le(start.key());
+        if (b == nullptr) b = _blocks.first();
+        StreamID id;
+        Fields fv;
+        while (b != nullptr) {
+            const Block& blk = **b;
+            if (blk.first > end) return;
+            if (blk.last >= start) {
+                size_t p = blk.head;
+                for (uint32_t k = 0 ; k < blk.live ; ++k) {
+                    decode(blk, p, id, fv);
+                    if (id < start) continue;
+                    if (id > end || !fn(id, fv)) return;
+                }
+            }
+            b = _blocks.seek_ge(blk.first.key(), true);
+        }
+    }
+
+    // the same from end down to start
+    template<typename Fn>
+    void reverse_range(StreamID end, StreamID start, Fn&& fn) const {
+        if (_size == 0 || start > end) return;
+        auto* b = _blocks.seek_le(end.key());
+        StreamID id;
+        Fields fv;
+        std::vector<size_t> at;
+        while (b != nullptr) {
+            const Block& blk = **b;
+            if (blk.last < start) return;
+            // entries only decode forward
+            at.clear();
+            for (size_t p = blk.head, k = 0 ; k < blk.live ; ++k) {
+                at.push_back(p);
+                decode(blk, p, id, fv);
+            }
+            for (size_t k = at.size() ; k-- > 0 ; ) {
+                size_t p = at[k];
+                decode(blk, p, id, fv);
+                if (id > end) continue;
+                if (id < start || !fn(id, fv)) return;
+            }
+            b = _blocks.seek_le(blk.first.key(), true);
+        }
+    }
+
+    // the fields of the entry id, false when there is none
+    bool get(StreamID id, Fields& fv) const;
+
+    // drops the oldest entries until at most maxlen are left, or as close
+    // as whole blocks get when approx. Returns how many went
+    size_t trim(size_t maxlen, bool approx);
+
+    Group* group(std::string_view name);
+    // nullptr when there is one by that name already
+    Group* create_group(std::string_view name, StreamID last);
+    bool destroy_group(std::string_view name);
+
+    const Groups& groups() const {
+        return _groups;
+    }
+
+    size_t blocks() const {
+        return _blocks.size();
+    }
+
+private:
+    struct Block {
+        // its key in _blocks, even once trimmed away
+        StreamID first;
+        StreamID last;
+        // entries from head on
+        uint32_t live = 0;
+        // entries ever appended
+        uint32_t count = 0;
+        size_t head = 0;
+        // the fields of the first entry, shared by those that have the same
+        std::vector<std::string> master;
+        std::string data;
+    };
+
+    // the entry at p in b, p moves past it
+    static void decode(const Block& b, size_t& p, StreamID& id, Fields& fv);
+
+    Radix<std::unique_ptr<Block>> _blocks;
+    Block* _tail = nullptr;
+    size_t _size = 0;
+    StreamID _last;
+    Groups _groups;
+};
+
+} // namespace data
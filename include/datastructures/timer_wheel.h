@@ -0,0 +1,144 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <utility>
+#include <vector>
+
+namespace data {
+
+// Hashed timing wheel, one slot per tick.
+//
+// A timer sits in the slot of its deadline modulo k_slots, further ones
+// just get skipped until their turn comes, so adding and cancelling are
+// O(1) whatever the deadline. Timers live in a slab and are named by their
+// index and a generation : cancelling a timer that already fired is a no-op.
+// Not thread-safe.
+template<typename T>
+class TimerWheel {
+public:
+    using Id = uint64_t;
+    static constexpr size_t k_slots = 4096;
+    static constexpr uint64_t k_never = UINT64_MAX;
+
+    explicit TimerWheel(uint64_t now) : _now(now) {
+        _heads.fill(k_none);
+    }
+
+    size_t size() const {
+        return _size;
+    }
+
+    uint64_t now() const {
+        return _now;
+    }
+
+    // deadlines in the past fire on the next advance()
+    Id add(uint64_t deadline, T v) {
+        uint32_t idx;
+        if (_free.empty()) {
+            idx = static_cast<uint32_t>(_nodes.size());
+            _nodes.emplace_back();
+        } else {
+            idx = _free.back();
+            _free.pop_back();
+        }
+        Node& n = _nodes[idx];
+        n.deadline = deadline > _now ? deadline : _now + 1;
+        n.value.emplace(std::move(v));
+        link(idx);
+        ++_size;
+        return (uint64_t(n.gen) << 32) | idx;
+    }
+
+    // false when the timer already fired or was cancelled
+    bool cancel(Id id) {
+        uint32_t idx = static_cast<uint32_t>(id);
+        if (idx >= _nodes.size()) return false;
+        Node& n = _nodes[idx];
+        if (n.gen != static_cast<uint32_t>(id >> 32) || !n.value.has_value()) return false;
+        release(idx);
+        return true;
+    }
+
+    // fires, oldest tick first, every timer due at or before now
+    template<typename Fire>
+    void advance(uint64_t now, Fire&& fire) {
+        if (now <= _now) return;
+        uint64_t ticks = now - _now < k_slots ? now - _now : k_slots;
+        for (uint64_t t = 1 ; t <= ticks ; ++t) {
+            size_t slot = (_now + t) % k_slots;
+            uint32_t idx = _heads[slot];
+            while (idx != k_none) {
+                uint32_t next = _nodes[idx].next;
+                if (_nodes[idx].deadline <= now) {
+                    T v = std::move(*_nodes[idx].value);
+                    release(idx);
+                    fire(std::move(v));
+                }
+                idx = next;
+            }
+        }
+        _now = now;
+    }
+
+    // the first tick after now() with a timer in its slot, it may only hold
+    // later deadlines. k_never when empty
+    uint64_t next() const {
+        if (_size == 0) return k_never;
+        for (uint64_t t = 1 ; t <= k_slots ; ) {
+            size_t slot = (_now + t) % k_slots;
+            uint64_t word = _used[slot / 64] >> (slot % 64);
+            if (word != 0) return _now + t + static_cast<uint64_t>(__builtin_ctzll(word));
+            t += 64 - slot % 64;
+        }
+        return k_never;
+    }
+
+private:
+    static constexpr uint32_t k_none = UINT32_MAX;
+
+    struct Node {
+        uint64_t deadline = 0;
+        uint32_t gen = 0;
+        uint32_t prev = k_none;
+        uint32_t next = k_none;
+        std::optional<T> value;
+    };
+
+    void link(uint32_t idx) {
+        size_t slot = _nodes[idx].deadline % k_slots;
+        Node& n = _nodes[idx];
+        n.prev = k_none;
+        n.next = _heads[slot];
+        if (n.next != k_none) _nodes[n.next].prev = idx;
+        _heads[slot] = idx;
+        _used[slot / 64] |= uint64_t(1) << (slot % 64);
+    }
+
+    void release(uint32_t idx) {
+        Node& n = _nodes[idx];
+        size_t slot = n.deadline % k_slots;
+        if (n.prev != k_none) {
+            _nodes[n.prev].next = n.next;
+        } else {
+            _heads[slot] = n.next;
+            if (n.next == k_none) _used[slot / 64] &= ~(uint64_t(1) << (slot % 64));
+        }
+        if (n.next != k_none) _nodes[n.next].prev = n.prev;
+        n.value.reset();
+        ++n.gen;
+        _free.push_back(idx);
+        --_size;
+    }
+
+    std::vector<Node> _nodes;
+    std::vector<uint32_t> _free;
+    std::array<uint32_t, k_slots> _heads;
+    std::array<uint64_t, k_slots / 64> _used = {};
+    uint64_t _now;
+    size_t _size = 0;
+};
+
+} // namespace data
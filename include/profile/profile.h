@@ -0,0 +1,147 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <chrono>
+#endif
+
+namespace net::resp {
+struct Command;
+class Redis;
+}
+
+namespace profile {
+
+// Per-command profiling : PROFILE START | STOP | RESET | DUMP [FOLDED [metric] | JSON]
+//
+// While on, each request is sampled where it runs : its parsing from its
+// first byte ("parse;<type>"), its way through the handlers, reply
+// included ("command;<NAME>"), and the keyspace command itself
+// ("command;<NAME>;keyspace"). A sample counts the cycles it took, the heap
+// allocations and bytes operator new saw on its thread, and the syscalls
+// the I/O paths made. Samples nest, a parent's totals include its
+// children's.
+//
+// Totals are kept per thread and merged on DUMP, folded stacks give each
+// frame its own share only (flamegraph.pl ready), JSON the inclusive
+// totals. When off, a sample costs one relaxed load and the allocator one
+// thread-local test.
+
+inline std::atomic<bool> g_enabled{false};
+
+static inline bool enabled() {
+    return g_enabled.load(std::memory_order_relaxed);
+}
+
+// timestamp counter, or nanoseconds where there is none
+static inline uint64_t cycles() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#elif defined(__aarch64__)
+    uint64_t v;
+    asm volatile("mrs %0, cntvct_el0" : "=r"(v));
+    return v;
+#else
+    return static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+}
+
+// what this thread did while depth > 0, constant-initialized : operator new
+// reads it before anything else is set up
+struct Counters {
+    uint32_t depth;
+    uint64_t allocs;
+    uint64_t bytes;
+    uint64_t syscalls;
+};
+
+inline thread_local Counters t_counters = {};
+
+static inline void allocated(size_t n) {
+    if (t_counters.depth == 0) return;
+    ++t_counters.allocs;
+    t_counters.bytes += n;
+}
+
+// called by the I/O paths next to each syscall
+static inline void syscall() {
+    if (t_counters.depth > 0) ++t_counters.syscalls;
+}
+
+// inclusive totals of one stack
+struct Totals {
+    uint64_t calls = 0;
+    uint64_t cycles = 0;
+    uint64_t allocs = 0;
+    uint64_t bytes = 0;
+    uint64_t syscalls = 0;
+};
+
+// a sample named after a command, see command_frame(). The frame is only
+// formatted when the sample is taken
+struct CommandFrame {
+    std::string_view name;
+};
+
+// measures this thread until destroyed, under frame pushed on the thread's
+// current stack. Does nothing when profiling is off at construction, or
+// when on is false
+class Sample {
+public:
+    explicit Sample(std::string_view frame, bool on = true) : _on(on && enabled()) {
+        if (_on) begin(frame, false);
+    }
+
+    explicit Sample(CommandFrame c) : _on(enabled()) {
+        if (_on) begin(c.name, true);
+    }
+
+    ~Sample() {
+        if (_on) end();
+    }
+
+    Sample(const Sample&) = delete;
+    Sample& operator=(const Sample&) = delete;
+
+private:
+    // frame is a command name to format when command is set
+    void begin(std::string_view frame, bool command);
+    void end();
+
+    bool _on;
+    size_t _parent;
+    Counters _start;
+    uint64_t _cycles;
+};
+
+// appends "command;<NAME>" to out for the command name, upper-cased, at most
+// 32 characters and anything else than letters, digits, '_' and '-' as '?'
+void command_frame(std::string_view name, std::string& out);
+
+inline std::string command_frame(std::string_view name) {
+    std::string f;
+    command_frame(name, f);
+    return f;
+}
+
+void start();
+void stop();
+void reset();
+
+// what every thread recorded so far. metric is one of cycles, allocs, bytes,
+// syscalls or calls, false when it is none of them
+bool folded(std::string_view metric, std::string& out);
+std::string json();
+
+// handles cmd if it is PROFILE, returns whether it did
+bool handle(int fd, const net::resp::Command& cmd);
+
+void attach(net::resp::Redis& r);
+
+} // namespace profile
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "resp/command.h"
+#include "resp/handle.h"
+
+namespace pubsub {
+
+// a message serialized once and shared by every subscriber receiving it
+using Frame = std::shared_ptr<const std::string>;
+
+struct Subscriber;
+class Courier;
+
+struct StringHash {
+    using is_transparent = void;
+    size_t operator()(std::string_view s) const {
+        return std::hash<std::string_view>{}(s);
+    }
+};
+
+using Subscribers = std::vector<std::shared_ptr<Subscriber>>;
+using Registry = std::unordered_map<std::string, Subscribers, StringHash, std::equal_to<>>;
+
+// Channel registry with fan-out over RESP3 push frames.
+//
+// PUBLISH encodes the push frame once and appends a reference to it to the
+// lock-free outbox of every receiver. Sockets are written by a single
+// courier thread, so a publisher never blocks on a slow subscriber and only
+// pays one wake-up per publish, whatever the number of receivers.
+// Once a connection has an outbox (it subscribed to something, or open()
+// gave it one), everything net::write_stream() writes to it is queued there
+// too, behind the frames already in it : the courier stays the only writer
+// of the socket and a reply never lands inside a frame it only sent part of.
+class PubSub {
+public:
+    PubSub();
+    ~PubSub();
+
+    PubSub(const PubSub&) = delete;
+    PubSub& operator=(const PubSub&) = delete;
+
+    // all of these return the number of subscriptions of fd afterwards
+    size_t subscribe(int fd, std::string_view channel);
+    size_t unsubscribe(int fd, std::string_view channel);
+    size_t psubscribe(int fd, std::string_view pattern);
+    size_t punsubscribe(int fd, std::string_view pattern);
+
+    std::vector<std::string> channels(int fd);
+    std::vector<std::string> patterns(int fd);
+    size_t subscriptions(int fd);
+
+    // returns the number of clients that received the message
+    size_t publish(std::string_view channel, std::string_view message);
+
+    // sends a reply to fd, ordered after any message queued for it
+    void reply(int fd, std::string frame);
+
+    // gives fd an outbox without any subscription, from the thread serving
+    // fd. drop() forgets it all the same
+    void open(int fd);
+
+    // queues a push frame for fd as if it were a message, from any thread.
+    // Dropped when fd has no outbox
+    void push(int fd, const Frame& f);
+
+    // forgets everything about fd, to be called before it gets closed
+    void drop(int fd);
+
+    // registers the (P)(UN)SUBSCRIBE and PUBLISH commands on the server
+    void attach(net::resp::Redis& r);
+
+    // handles cmd if it is a pub/sub command, returns whether it did
+    bool handle(int fd, const net::resp::Command& cmd);
+
+private:
+    // created with fd's outbox, the caller holds _m exclusively
+    std::shared_ptr<Subscriber> subscriber(int fd);
+    // what net::write_stream() writes to a connection with an outbox
+    void queue(int fd, std::string_view bytes);
+    // net::end_stream() on a connection with an outbox
+    void end(int fd);
+    void deliver(const std::shared_ptr<Subscriber>& sub, const Frame& f, bool& wake);
+
+    std::shared_mutex _m;
+    Registry _channels;
+    Registry _patterns;
+    std::unordered_map<int, std::shared_ptr<Subscriber>> _subscribers;
+    std::unique_ptr<Courier> _courier;
+    const net::Outbox _outbox;
+};
+
+} // namespace pubsub
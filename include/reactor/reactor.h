@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "commands/table.h"
+#include "coro/task.h"
+
+namespace reactor {
+
+class Core;
+
+// Thread-per-core execution of the keyspace commands.
+//
+// Each of the n reactors is a thread pinned to a core that owns the
+// keyspace shards s with s % n == its index : only it runs commands on
+// them, so their locks stay uncontended and their cache lines stay on one
+// core. The locks are still taken, EXEC, batches and the replication
+// snapshot keep using them.
+//
+// A connection hands its commands to its home reactor (fd % n) and
+// suspends until the reply is there. Commands whose keys live on another
+// reactor are forwarded over lock-free SPSC rings, one per pair of
+// reactors, and the answer comes back the same way while the home reactor
+// goes on with other requests. MGET, DEL and EXISTS
+// on several reactors are split per owner and the partial replies merged;
+// the other multi-owner commands run on the home reactor under the locks,
+// and so do all of them once the table has a guard, which must see every
+// key of a command at once.
+class Reactors {
+public:
+    Reactors(commands::Table& table, size_t n);
+    ~Reactors();
+
+    Reactors(const Reactors&) = delete;
+    Reactors& operator=(const Reactors&) = delete;
+
+    size_t size() const {
+        return _cores.size();
+    }
+
+    // the reactor owning a keyspace shard
+    size_t owner(size_t shard) const {
+        return shard % _cores.size();
+    }
+
+    // runs the command through reactor home and appends its reply to out,
+    // as client fd's (-1 for none) : Table::serve() runs it, or each of its
+    // shares.
+    // Everything the task refers to must outlive it
+    coro::Task<> call(size_t home, const commands::Spec& spec, const commands::Args& argv,
+                      std::string& out, std::string_view raw = {}, int fd = -1);
+
+    // same, blocking the calling thread until then
+    void execute(size_t home, const commands::Spec& spec, const commands::Args& argv,
+                 std::string& out, std::string_view raw = {});
+
+    // number of command parts sent to another reactor so far
+    size_t forwarded() const;
+
+    // handles cmd if it is a keyspace command, returns whether it did.
+    // Commands that may block are left to the next handler
+    coro::Task<bool> handle(int fd, const net::resp::Command& cmd);
+
+    // must be attached after the table, and after commands::Blocking
+    void attach(net::resp::Redis& r);
+
+private:
+    commands::Table& _table;
+    std::vector<std::unique_ptr<Core>> _cores;
+};
+
+} // namespace reactor
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include "commands/table.h"
+
+namespace replication {
+
+// Primary / replica replication.
+//
+// Every successful write is appended to a fixed-size circular backlog, as
+// the RESP bytes the client sent when the request came straight from the
+// parser, re-encoded otherwise. The offset of the stream is the number of
+// bytes ever appended to it.
+//
+// A replica sends PSYNC <replid> <offset> where offset is the first byte it
+// has not applied yet. When the master still has that byte in its backlog it
+// replies +CONTINUE and streams from there, otherwise +FULLRESYNC <replid>
+// <offset> followed by a $<len>\r\n snapshot (the keyspace as SET commands,
+// without trailing \r\n) and the stream from that offset. The connection
+// thread of a replica then only copies new backlog ranges to its socket, a
+// replica falling further behind than the backlog is disconnected and will
+// do a full resync.
+//
+// A replica applies the stream to its keyspace, feeds its own backlog with
+// the same bytes (so it can serve replicas of its own) and retries a lost
+// link with the same replid and offset.
+class Replication {
+public:
+    static constexpr size_t k_default_backlog = 1024 * 1024;
+
+    explicit Replication(commands::Table& table, size_t backlog = k_default_backlog);
+    ~Replication();
+
+    Replication(const Replication&) = delete;
+    Replication& operator=(const Replication&) = delete;
+
+    // follows host:port, an empty host turns this server into a master
+    void replicaof(const std::string& host, unsigned short port);
+
+    std::string replid();
+    uint64_t offset();
+    bool is_replica();
+
+    // number of resyncs done by this server as a replica
+    uint64_t full_syncs() const {
+        return _full_syncs.load();
+    }
+    uint64_t partial_syncs() const {
+        return _partial_syncs.load();
+    }
+
+    // hot restart, old process : streams a snapshot then every write to fd as
+    // to a replica, until fd is closed. sent runs once the snapshot is out
+    void hand_over(int fd, const std::function<void()>& sent);
+    // hot restart, new process : loads the snapshot fd carries, then applies
+    // the writes that follow it in the background until the old process
+    // closes fd. Returns false when no snapshot came
+    bool take_over(int fd);
+    // bytes the most lagging follower has yet to receive
+    uint64_t lag();
+
+    // handles cmd if it is a replication command (or a write refused on a
+    // replica), returns whether it did
+    bool handle(int fd, const net::resp::Command& cmd);
+
+    void attach(net::resp::Redis& r);
+
+private:
+    struct Follower {
+        int fd;
+        std::string addr;
+        uint64_t offset;
+    };
+
+    // appends a command to the backlog and wakes the followers up
+    void feed(const commands::Args& argv, std::string_view raw);
+    void feed_raw(std::string_view bytes);
+    // starts a new history at offset, the backlog is emptied
+    void reset(const std::string& replid, uint64_t offset);
+
+    // master side : serves a replica on its connection thread until it leaves
+    void psync(int fd, const net::resp::Command& cmd, const std::function<void()>& sent = {});
+    std::string snapshot(uint64_t& offset);
+    // appends at most max bytes from offset from, false when the backlog no
+    // longer holds them. The caller holds _m
+    bool copy(uint64_t from, size_t max, std::string& out);
+
+    // replica side
+    void link(uint64_t generation, std::string host, unsigned short port);
+    void sync(int fd);
+    void apply(const commands::Args& argv, std::string_view raw);
+    void load(std::string_view payload, const std::string& replid, uint64_t offset);
+    void stop_link();
+    void stop_takeover();
+
+    commands::Table& _table;
+
+    std::mutex _m;
+    std::condition_variable _cv;
+    std::string _replid;
+    std::vector<char> _backlog;
+    // bytes of the current history held by the backlog
+    size_t _backlog_len = 0;
+    uint64_t _offset = 0;
+    // bumped on every reset, followers of an older history are dropped
+    uint64_t _epoch = 0;
+    std::list<Follower> _followers;
+
+    std::atomic<bool> _replica{false};
+    // replica link, guarded by _m
+    std::string _master_host;
+    unsigned short _master_port = 0;
+    const char* _link_state = "connect";
+    int _master_fd = -1;
+    std::atomic<uint64_t> _generation{0};
+    std::thread _link;
+    // applies what the process we took over from still writes, guarded by _m
+    int _takeover_fd = -1;
+    std::thread _takeover;
+
+    std::atomic<uint64_t> _full_syncs{0};
+    std::atomic<uint64_t> _partial_syncs{0};
+};
+
+} // namespace replication
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <optional>
+#include <string_view>
+#include <vector>
+#include "datastructures/node.h"
+
+namespace net {
+
+namespace resp {
+
+// View over a parsed client request (an array of bulk strings).
+// The views point into the parsed nodes, which must outlive the command.
+struct Command {
+    std::vector<std::string_view> argv;
+    // the request as the client sent it, when known
+    std::string_view raw = {};
+
+    // case-insensitive match on the command name
+    bool is(std::string_view name) const {
+        if (argv.empty() || argv[0].size() != name.size()) return false;
+        for (size_t k = 0 ; k < name.size() ; ++k) {
+            char c = argv[0][k];
+            if (c >= 'a' && c <= 'z') c -= 'a' - 'A';
+            if (c != name[k]) return false;
+        }
+        return true;
+    }
+
+    size_t argc() const {
+        return argv.size();
+    }
+};
+
+static inline std::optional<Command> as_command(const data::Node* n) {
+    auto* a = dynamic_cast<const data::Array*>(n);
+    if (a == nullptr || !a->get().has_value() || a->get()->empty()) return {};
+    Command cmd;
+    cmd.argv.reserve(a->get()->size());
+    for (auto&& e : a->get().value()) {
+        if (auto* bs = dynamic_cast<const data::BulkString*>(e.get())) {
+            if (!bs->get().has_value()) return {};
+            cmd.argv.emplace_back(bs->get().value());
+        } else if (auto* s = dynamic_cast<const data::String*>(e.get())) {
+            cmd.argv.emplace_back(s->get());
+        } else {
+            return {};
+        }
+    }
+    return cmd;
+}
+
+} // namespace resp
+
+} // namespace net
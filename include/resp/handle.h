@@ -1,4 +1,8 @@
+#pragma once
+
 #include "resp/server.h"
+#include "coro/task.h"
+#include <chrono>
 #include <list>
 
 #include <functional>
@@ -22,9 +26,11 @@ struct ChainOfResponsibility {
             };
         }
 
+        // the new handler runs first and falls through to this chain
         template<typename Callee>
         Chain attach(Callee c) const {
-            return Chain(wrap_callee(std::move(c)), next);
+            if (!handler) return Chain(wrap_callee(std::move(c)), next);
+            return Chain(wrap_callee(std::move(c)), NextFn(*this));
         }
 
         void operator()(Args... args) const {
@@ -66,39 +72,110 @@ class Redis {
 public:
     using T = std::variant<net::resp::RESPError, std::unique_ptr<data::Node>>;
 
-    Redis(unsigned int s_addr, unsigned short port, const int k_max_msg)
-        : _s(s_addr, port, k_max_msg),
+    // listen_fd >= 0 is a listening socket handed over by another process
+    Redis(unsigned int s_addr, unsigned short port, const int k_max_msg, int listen_fd = -1)
+        : _s(s_addr, port, k_max_msg, listen_fd),
           _chain(std::make_unique<ChainOfResponsibility::Chain<int, T&&>>(
               [](int connfd, T&& n) {
-                  std::string err_msg = "-ERR " +
-                      std::get<net::resp::RESPError>(n).to_string() + "\r\n";
+                  // nobody handled the message
+                  std::string err_msg = "-ERR unknown command\r\n";
+                  if (auto* err = std::get_if<net::resp::RESPError>(&n)) {
+                      err_msg = "-ERR " + err->to_string() + "\r\n";
+                  }
                   net::write_stream(connfd, err_msg.c_str(), err_msg.size());
               }))
     {}
 
+    // handlers attached last are tried first
     void attach(std::function<void(int, T&&, ChainOfResponsibility::Chain<int, T&&>)> c) {
         _chain = std::move(std::make_unique<ChainOfResponsibility::Chain<int, T&&>>(
             _chain->attach(c)
         ));
     }
 
+    // a handler that may suspend (on another reactor, a blocking command,
+    // I/O...) : it returns whether it handled the message, the next handler
+    // gets it otherwise. The connection's thread resumes it when it is
+    // woken up and reads nothing else from the client meanwhile
+    using AsyncHandler = std::function<coro::Task<bool>(int, T&)>;
+
+    void attach_async(AsyncHandler h) {
+        attach([h = std::move(h)] (int connfd, T&& msg, ChainOfResponsibility::Chain<int, T&&> next) {
+            if (!h(connfd, msg).run()) next(connfd, std::move(msg));
+        });
+    }
+
+    // answers the HELLO opening each connection, +OK by default
+    void on_hello(hello_t h) {
+        _s.on_hello(std::move(h));
+    }
+
+    // hooks run when a client disconnects, before its fd is released
+    void on_close(std::function<void(int)> c) {
+        _closers.push_back(std::move(c));
+    }
+
     void accept(int n) {
         auto* chain = _chain.get();
         _s.tcp_accept([chain] (int connfd, T&& msg) {
-            (*chain)(connfd, std::move(msg));
-        }, n);
+            dispatch(*chain, connfd, std::move(msg));
+        }, n, closer());
     }
 
     void accept_all() {
         auto* chain = _chain.get();
         _s.tcp_accept_all([chain] (int connfd, T&& msg) {
-            (*chain)(connfd, std::move(msg));
-        });
+            dispatch(*chain, connfd, std::move(msg));
+        }, closer());
+    }
+
+    // makes accept() / accept_all() return, see TCPServer::stop()
+    void stop() {
+        _s.stop();
+    }
+
+    int listen_fd() const {
+        return _s.listen_fd();
+    }
+
+    // waits for the clients being served to leave, at most timeout. Returns
+    // whether they all did
+    bool drain(std::chrono::milliseconds timeout) {
+        auto until = std::chrono::steady_clock::now() + timeout;
+        while (_s.clients() > 0) {
+            if (std::chrono::steady_clock::now() >= until) return false;
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        return true;
     }
 
 private:
+    // runs msg through the handlers, as a sample named after the command
+    // while profiling. Nothing is looked at when it is off
+    static void dispatch(const ChainOfResponsibility::Chain<int, T&&>& chain, int connfd, T&& msg) {
+        if (!profile::enabled()) {
+            chain(connfd, std::move(msg));
+            return;
+        }
+        std::string_view name;
+        if (auto* node = std::get_if<std::unique_ptr<data::Node>>(&msg)) {
+            auto cmd = as_command(node->get());
+            if (cmd.has_value()) name = cmd->argv[0];
+        }
+        profile::Sample sample(profile::CommandFrame{name});
+        chain(connfd, std::move(msg));
+    }
+
+    std::function<void(int)> closer() {
+        auto* closers = &_closers;
+        return [closers] (int connfd) {
+            for (auto& c : *closers) c(connfd);
+        };
+    }
+
     net::resp::RESPServer _s;
     std::unique_ptr<ChainOfResponsibility::Chain<int, T&&>> _chain;
+    std::list<std::function<void(int)>> _closers;
 };
 
 }
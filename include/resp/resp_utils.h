@@ -1,3 +1,7 @@
+#pragma once
+
+#include <charconv>
+#include <string_view>
 #include "datastructures/node.h"
 
 namespace net {
@@ -12,6 +16,34 @@ static inline std::string err(std::string& s) {
     return "-ERR " + s + "\r\n";
 }
 
+// RESP3 null, handshakes always negotiate protocol 3
+static inline std::string null() {
+    return "_\r\n";
+}
+
+static inline std::string integer(int64_t i) {
+    char buf[24] = {':'};
+    char* end = std::to_chars(buf + 1, buf + sizeof(buf) - 2, i).ptr;
+    *end++ = '\r';
+    *end++ = '\n';
+    return std::string(buf, end);
+}
+
+static inline std::string bulk(std::string_view s) {
+    std::string r;
+    data::write_header(r, data::Type::BulkString, static_cast<int64_t>(s.size()));
+    r.append(s);
+    r += "\r\n";
+    return r;
+}
+
+static inline std::string wrong_arity(std::string_view cmd) {
+    std::string r = "-ERR wrong number of arguments for '";
+    r.append(cmd);
+    r += "' command\r\n";
+    return r;
+}
+
 } // namespace resp
 
-} // namespace net
\ No newline at end of file
+} // namespace net
@@ -1,8 +1,18 @@
+#pragma once
+
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <unistd.h>
+#include <atomic>
+#include <functional>
+#include <string_view>
+#include <thread>
 #include <variant>
 #include "datastructures/node.h"
+#include "profile/profile.h"
+#include "resp/command.h"
 
 namespace net {
 
@@ -11,6 +21,7 @@ static inline int32_t read_stream(int fd, char* buf, size_t n) {
     ssize_t rv;
     while (n > 0) {
         rv = read(fd, buf, n);
+        profile::syscall();
         if (rv <= 0) return -1;
         n -= (size_t)rv;
         buf += rv;
@@ -18,10 +29,35 @@ static inline int32_t read_stream(int fd, char* buf, size_t n) {
     return 0;
 }
 
+// Connections whose bytes all go through a writer of their own (the
+// pub/sub outbox, once a connection has one) : a reply written straight to
+// the socket could land inside a frame that writer only sent part of.
+// write_stream() hands their bytes over to it instead.
+struct Outbox {
+    std::function<void(int fd, std::string_view bytes)> write;
+    // shuts fd down once what was written before is sent
+    std::function<void(int fd)> end;
+};
+
+// fd's bytes go to o from now on, back to the socket with nullptr. Called
+// from the thread serving fd, o outlives the setting
+void use_outbox(int fd, const Outbox* o);
+// nullptr when fd has none
+const Outbox* outbox(int fd);
+
+// shuts fd down once what was written to it is sent, through its outbox if
+// it has one. The serving thread then reads EOF and closes the connection
+void end_stream(int fd);
+
 static inline int32_t write_stream(int fd, const char* buf, size_t n) {
+    if (auto* o = outbox(fd)) {
+        o->write(fd, {buf, n});
+        return 0;
+    }
     ssize_t rv;
     while (n > 0) {
         rv = write(fd, buf, n);
+        profile::syscall();
         if (rv <= 0) return -1;
         n -= (size_t)rv;
         buf += rv;
@@ -29,91 +65,140 @@ static inline int32_t write_stream(int fd, const char* buf, size_t n) {
     return 0;
 }
 
+// connects to host:port, -1 on failure
+int dial(const std::string& host, unsigned short port);
+
 namespace tcp {
 
 // TCP Server interface (using CRTP)
 template<typename Derived, typename Err, typename... Types>
 class TCPServer {
 public:
-    explicit TCPServer(unsigned int s_addr, unsigned short port, const int k_max_msg)
+    // listen_fd >= 0 is a socket already bound by another process, served
+    // instead of binding s_addr:port (see upgrade/upgrade.h)
+    explicit TCPServer(unsigned int s_addr, unsigned short port, const int k_max_msg, int listen_fd = -1)
         : _k_max_msg(k_max_msg) {
-        _fd = socket(AF_INET, SOCK_STREAM, 0);
-        if (_fd < 0) die("socket()");
-        _serverAddress = {};
-        _serverAddress.sin_family = AF_INET;
-        _serverAddress.sin_port = port;
-        _serverAddress.sin_addr.s_addr = s_addr;
-        int rv = bind(_fd, (struct sockaddr*)&_serverAddress, sizeof(_serverAddress));
-        if (rv) die("bind()");
+        if (pipe2(_wake, O_CLOEXEC) < 0) die("pipe()");
+        _fd = listen_fd;
+        if (_fd < 0) {
+            _fd = socket(AF_INET, SOCK_STREAM, 0);
+            if (_fd < 0) die("socket()");
+            _serverAddress = {};
+            _serverAddress.sin_family = AF_INET;
+            _serverAddress.sin_port = port;
+            _serverAddress.sin_addr.s_addr = s_addr;
+            int val = 1;
+            setsockopt(_fd, SOL_SOCKET, SO_REUSEADDR, &val, sizeof(val));
+            int rv = bind(_fd, (struct sockaddr*)&_serverAddress, sizeof(_serverAddress));
+            if (rv) die("bind()");
+        }
+        // two processes may poll it during a hot restart : accept() must not
+        // block when the other one took the client
+        fcntl(_fd, F_SETFL, fcntl(_fd, F_GETFL) | O_NONBLOCK);
     }
 
     using worker_t = std::function<void(int, std::variant<Err, Types...>&&)>;
+    // called once a client is gone, right before its fd is closed
+    using closer_t = std::function<void(int)>;
 
-    int tcp_accept(worker_t w, int n) {
-        // accepting n clients
+    int tcp_accept(worker_t w, int n, closer_t c = {}) {
+        // accepting n clients, served one after the other
         int connfd;
         listen(_fd, n);
-        while (n > 0) {
-            struct sockaddr_in client_addr = {};
-            socklen_t addrlen = sizeof(client_addr);
-            connfd = accept(_fd, (struct sockaddr*)&client_addr, &addrlen);
-            if (connfd < 0) {
-                continue;
-            }
-            auto handshake = static_cast<Derived*>(this)->handshake(connfd);
-            if (handshake.has_value()) {
-                handshake.value()();
-                continue;
-            }
-            while (true) {
-                char body[_k_max_msg];
-                int i = 0;
-                auto res = static_cast<Derived*>(this)->template one_request(connfd, body, i);
-                w(connfd, std::move(res));
-            }
-            close(connfd);
+        while (n > 0 && (connfd = next_client()) >= 0) {
+            ++_clients;
+            serve(connfd, w, c);
             --n;
         }
         return 0;
     }
 
-    int tcp_accept_all(worker_t w) {
-        // accepting all clients
+    int tcp_accept_all(worker_t w, closer_t c = {}) {
+        // accepting all clients until stop(), each one served on its own thread
         int connfd;
-        while (true) {
-            struct sockaddr_in client_addr = {};
-            socklen_t addrlen = sizeof(client_addr);
-            connfd = accept(_fd, (struct sockaddr*)&client_addr, &addrlen);
-            if (connfd < 0) {
-                continue;
-            }
-            auto handshake = static_cast<Derived*>(this)->handshake(connfd);
-            if (handshake.has_value()) {
-                handshake.value()();
-                continue;
-            }
-            while (true) {
-                char body[_k_max_msg];
-                int i = 0;
-                auto res = static_cast<Derived*>(this)->template one_request(connfd, body, i);
-                w(connfd, std::move(res));
-            }
-            close(connfd);
+        listen(_fd, SOMAXCONN);
+        while ((connfd = next_client()) >= 0) {
+            ++_clients;
+            std::thread([this, connfd, w, c] {
+                serve(connfd, w, c);
+            }).detach();
         }
         return 0;
     }
 
+    // makes the accept loop return, clients already accepted are still served
+    void stop() {
+        _stopped = true;
+        char b = 0;
+        if (write(_wake[1], &b, 1) < 0) return;
+    }
+
+    int listen_fd() const {
+        return _fd;
+    }
+
+    // clients being served
+    size_t clients() const {
+        return _clients.load();
+    }
+
     const int k_max_msg() {
         return _k_max_msg;
     }
 
     ~TCPServer() {
         if (_fd >= 0) close(_fd);
+        close(_wake[0]);
+        close(_wake[1]);
     }
 private:
+    // the next client, -1 once stopped
+    int next_client() {
+        while (!_stopped) {
+            struct pollfd p[2] = {{_fd, POLLIN, 0}, {_wake[0], POLLIN, 0}};
+            if (poll(p, 2, -1) < 0 || !(p[0].revents & POLLIN) || _stopped) continue;
+            struct sockaddr_in client_addr = {};
+            socklen_t addrlen = sizeof(client_addr);
+            int connfd = accept(_fd, (struct sockaddr*)&client_addr, &addrlen);
+            if (connfd >= 0) return connfd;
+        }
+        return -1;
+    }
+
+    void serve(int connfd, const worker_t& w, const closer_t& c) {
+        auto handshake = static_cast<Derived*>(this)->handshake(connfd);
+        if (handshake.has_value()) {
+            handshake.value()();
+            close(connfd);
+            --_clients;
+            return;
+        }
+        while (true) {
+            char body[_k_max_msg];
+            int i = 0;
+            auto res = static_cast<Derived*>(this)->template one_request(connfd, body, i);
+            bool last = false;
+            if (auto* err = std::get_if<Err>(&res)) {
+                if (err->closed()) break;
+                if (err->replied()) continue;
+                // answered, then the connection is closed
+                last = err->fatal();
+            }
+            w(connfd, std::move(res));
+            if (last) break;
+        }
+        if (c) c(connfd);
+        close(connfd);
+        --_clients;
+    }
+
     int _fd;
     sockaddr_in _serverAddress;
     const int _k_max_msg;
+    // written to by stop() to wake the accept loop up
+    int _wake[2];
+    std::atomic<bool> _stopped{false};
+    std::atomic<size_t> _clients{0};
 };
 
 enum ErrKind {
@@ -125,6 +210,18 @@ struct TCPError {
 
     TCPError(ErrKind err) : _err(err) {}
 
+    bool closed() const {
+        return _err == READ_FAILURE;
+    }
+
+    bool replied() const {
+        return false;
+    }
+
+    bool fatal() const {
+        return false;
+    }
+
     void operator()() const {
         std::string err_msg;
         switch (_err) {
@@ -179,7 +276,20 @@ enum ErrKind {
     END_OF_STREAM,
     INVALID_TYPE,
     UNHANDLED,
-    SEND_FAILURE
+    SEND_FAILURE,
+    CONNECTION_CLOSED,
+    // an aggregate announcing more elements than a message can hold
+    INVALID_LENGTH,
+    // a bulk longer than a message can hold, its bytes were read and dropped
+    BULK_TOO_LARGE,
+    // a bulk longer than any accepted : the connection is closed once
+    // answered, its payload is not read
+    INVALID_BULK_LENGTH,
+    // a letter where an element of an aggregate should start (inline
+    // commands are top-level only), answered then closed as well
+    UNEXPECTED_INLINE,
+    // not an error : the parser answered the request itself
+    REPLIED
 };
 
 struct RESPError {
@@ -187,6 +297,18 @@ struct RESPError {
 
     RESPError(ErrKind err) : _err(err) {}
 
+    bool closed() const {
+        return _err == CONNECTION_CLOSED;
+    }
+
+    bool replied() const {
+        return _err == REPLIED;
+    }
+
+    bool fatal() const {
+        return _err == INVALID_BULK_LENGTH || _err == UNEXPECTED_INLINE;
+    }
+
     void operator()() const {
         std::string err_msg = to_string();
         std::cerr << "\033[1;31m"
@@ -212,24 +334,92 @@ struct RESPError {
             case SEND_FAILURE:
                 err_msg = "failed to send response";
                 break;
+            case CONNECTION_CLOSED:
+                err_msg = "connection closed by peer";
+                break;
+            case INVALID_LENGTH:
+                err_msg = "Protocol error: invalid aggregate length";
+                break;
+            case BULK_TOO_LARGE:
+                err_msg = "Protocol error: bulk string too large for a request";
+                break;
+            case INVALID_BULK_LENGTH:
+                err_msg = "Protocol error: invalid bulk length";
+                break;
+            case UNEXPECTED_INLINE:
+                err_msg = "Protocol error: expected a RESP type, got an inline command";
+                break;
+            case REPLIED:
+                err_msg = "request already answered";
+                break;
         }
         return err_msg;
     }
 };
 
+// HELLO protover [AUTH username password] [SETNAME clientname], the views
+// point into the command
+struct Hello {
+    std::string_view version;
+    bool auth = false;
+    std::string_view user;
+    std::string_view pass;
+    std::string_view name;
+};
+
+// false on a syntax error
+bool parse_hello(const Command& cmd, Hello& h);
+
+// answers the HELLO that opens connection fd, the protocol version was
+// already checked. The connection is served whatever the reply
+using hello_t = std::function<std::string(int, const Hello&)>;
+
 class RESPServer : public net::tcp::TCPServer<RESPServer, RESPError, std::unique_ptr<data::Node>> {
 public:
-    explicit RESPServer(unsigned int s_addr, unsigned short port, const int k_max_msg) 
-        : net::tcp::TCPServer<RESPServer, RESPError, std::unique_ptr<data::Node>>(s_addr, port, k_max_msg) {}
+    explicit RESPServer(unsigned int s_addr, unsigned short port, const int k_max_msg, int listen_fd = -1)
+        : net::tcp::TCPServer<RESPServer, RESPError, std::unique_ptr<data::Node>>(s_addr, port, k_max_msg, listen_fd) {}
 
     std::variant<RESPError, std::unique_ptr<data::Node>> read_array(int connfd, char* body, int& i);
     std::variant<RESPError, std::unique_ptr<data::Node>> read_bulk_string(int connfd, char* body, int& i);
     std::variant<RESPError, std::unique_ptr<data::Node>> read_int(int connfd, char* body, int& i);
     std::variant<RESPError, std::unique_ptr<data::Node>> read_string(int connfd, char* body, int& i);
+    std::variant<RESPError, std::unique_ptr<data::Node>> read_error(int connfd, char* body, int& i);
+
+    // RESP3
+    std::variant<RESPError, std::unique_ptr<data::Node>> read_null(int connfd, char* body, int& i);
+    std::variant<RESPError, std::unique_ptr<data::Node>> read_boolean(int connfd, char* body, int& i);
+    std::variant<RESPError, std::unique_ptr<data::Node>> read_double(int connfd, char* body, int& i);
+    std::variant<RESPError, std::unique_ptr<data::Node>> read_big_number(int connfd, char* body, int& i);
+    std::variant<RESPError, std::unique_ptr<data::Node>> read_bulk_error(int connfd, char* body, int& i);
+    std::variant<RESPError, std::unique_ptr<data::Node>> read_verbatim(int connfd, char* body, int& i);
+    std::variant<RESPError, std::unique_ptr<data::Node>> read_map(int connfd, char* body, int& i);
+    std::variant<RESPError, std::unique_ptr<data::Node>> read_set(int connfd, char* body, int& i);
+    std::variant<RESPError, std::unique_ptr<data::Node>> read_attribute(int connfd, char* body, int& i);
+    std::variant<RESPError, std::unique_ptr<data::Node>> read_push(int connfd, char* body, int& i);
+
+    // telnet-style command on one line, split on whitespace
+    std::variant<RESPError, std::unique_ptr<data::Node>> read_inline(int connfd, char* body, int& i);
+
+    // a line up to (and without) its \r\n, viewing into body
+    std::variant<RESPError, std::string_view> read_line(int connfd, char* body, int& i);
+    // the count or length that follows the type of aggregates and blobs
+    std::variant<RESPError, int64_t> read_len(int connfd, char* body, int& i);
 
     std::variant<RESPError, std::unique_ptr<data::Node>> one_request(int connfd, char*body, int& i);
 
+    // the RESP bytes of the last request parsed on this thread, while its
+    // handlers run, empty for inline commands
+    static std::string_view last_request();
+
     std::optional<net::resp::RESPError> handshake(int connfd);
+
+    // one hook at most, set before serving
+    void on_hello(hello_t h) {
+        _hello = std::move(h);
+    }
+
+private:
+    hello_t _hello;
 };
 
 } // namespace resp
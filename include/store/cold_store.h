@@ -0,0 +1,103 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include "store/keyspace.h"
+#include "store/timers.h"
+
+namespace store {
+
+// Cold tier for large or idle strings.
+//
+// Values leave memory for an append-only log on local disk, the keyspace
+// keeps a Cold reference (24 bytes) in their place. Appends are plain
+// pwrite()s, so they go to the page cache without ever being mapped in the
+// process. Reads go through one read-only mapping of the whole log,
+// reserved once, that the file grows into : a read back is a memcpy from
+// the page cache, or a page fault when the kernel wrote it out already.
+//
+// A value read back goes hot again, its log space is handed back to the
+// file system (FALLOC_FL_PUNCH_HOLE), values of a page or more start on a
+// page boundary so that all of it can be. Nothing survives a restart, the
+// log is truncated when opened.
+//
+// A sweep runs on the timer thread, walking every shard a bucket batch at a
+// time under its lock : strings of at least min_size bytes go cold as soon
+// as they are swept, smaller ones once unused for idle_ms.
+class ColdStore {
+public:
+    struct Options {
+        std::string path;
+        size_t min_size = 64 * 1024;
+        int64_t idle_ms = 60 * 1000;
+        int64_t sweep_ms = 1000;
+    };
+
+    // below that, a value costs less in memory than its reference does
+    static constexpr size_t k_min_cold = 128;
+
+    ColdStore(Keyspace& ks, Timers& timers, Options opts);
+    // the keyspace must not hold cold values anymore, or never be read again
+    ~ColdStore();
+
+    ColdStore(const ColdStore&) = delete;
+    ColdStore& operator=(const ColdStore&) = delete;
+
+    // valid until c is released
+    std::string_view read(const Cold& c) const {
+        return {_base + c.offset, c.size};
+    }
+
+    // nothing when the disk or the reserved space is full
+    std::optional<Cold> append(std::string_view v);
+    void release(const Cold& c);
+    // forgets every value, with every shard locked
+    void reset();
+
+    // one pass over the keyspace, returns the bytes moved out of memory
+    size_t sweep();
+
+    // values in the log and their size
+    size_t values() const {
+        return _values.load(std::memory_order_relaxed);
+    }
+
+    size_t bytes() const {
+        return _bytes.load(std::memory_order_relaxed);
+    }
+
+private:
+    // per shard : buckets walked per lock hold
+    static constexpr size_t k_batch = 256;
+
+    void schedule();
+
+    Keyspace& _ks;
+    Timers& _timers;
+    const Options _opts;
+    int _fd = -1;
+    char* _base = nullptr;
+
+    std::mutex _m;
+    uint64_t _end = 0;
+
+    std::atomic<size_t> _values{0};
+    std::atomic<size_t> _bytes{0};
+    // where the sweep resumes in each shard
+    std::array<uint64_t, Keyspace::k_shards> _cursors = {};
+
+    // the timer may fire while the store goes away
+    struct Sweeper {
+        std::mutex m;
+        ColdStore* store;
+    };
+    std::shared_ptr<Sweeper> _sweeper;
+};
+
+} // namespace store
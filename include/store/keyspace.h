@@ -0,0 +1,356 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <charconv>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <variant>
+#include "datastructures/bloom.h"
+#include "datastructures/dict.h"
+#include "datastructures/stream.h"
+
+namespace store {
+
+class ColdStore;
+class Reclaimer;
+
+using List = std::deque<std::string>;
+// a deque is 80 bytes, every value would pay for it
+using ListPtr = std::unique_ptr<List>;
+using BloomPtr = std::unique_ptr<data::Bloom>;
+using StreamPtr = std::unique_ptr<data::Stream>;
+
+// a string short enough to live in the value itself, next to its key in
+// the map's node. The longest that does not make Value any bigger
+struct Inline {
+    static constexpr size_t k_capacity = sizeof(std::string) - 1;
+
+    char data[k_capacity];
+    uint8_t size;
+
+    std::string_view view() const {
+        return {data, size};
+    }
+};
+
+// a string moved out of memory : where it lives in the cold store's log.
+// Accessors never hand one out, they read the string back first
+struct Cold {
+    ColdStore* store;
+    uint64_t offset;
+    uint32_t size;
+};
+
+// a string kept compressed (utils/lz.h) and its size once inflated
+struct Compressed {
+    std::unique_ptr<char[]> bytes;
+    uint32_t stored;
+    uint32_t size;
+
+    std::string_view data() const {
+        return {bytes.get(), stored};
+    }
+};
+
+// strings are stored as one of std::string, int64_t (those that read as
+// an integer and print back the same), Inline, Cold or Compressed.
+// HyperLogLogs are strings too (datastructures/hyperloglog.h)
+using Value = std::variant<std::string, int64_t, Inline, ListPtr, Cold, Compressed, BloomPtr, StreamPtr>;
+
+// a value and the keyspace clock when it was last used
+struct Entry {
+    Value value;
+    uint32_t used = 0;
+};
+
+// the text of an integer-encoded string, written to buf
+inline std::string_view format(int64_t n, char (&buf)[20]) {
+    return {buf, static_cast<size_t>(std::to_chars(buf, buf + sizeof(buf), n).ptr - buf)};
+}
+
+struct KeyHash {
+    using is_transparent = void;
+    size_t operator()(std::string_view s) const {
+        return std::hash<std::string_view>{}(s);
+    }
+};
+
+// rehashed incrementally, and scanned with cursors that survive resizes
+using Map = data::Dict<Entry, KeyHash>;
+// deadline of the keys that have one, in ms since the epoch. Looked up with
+// the hash the map was, a key is hashed once per access
+using Expires = data::Dict<int64_t, KeyHash>;
+// the keys of each group, viewing the map's own copy of them
+using Groups = std::unordered_map<uint16_t, std::unordered_set<std::string_view>>;
+
+// Keys are spread over k_shards independently locked shards.
+//
+// Every shard keeps k_slots version counters, a key maps to one of them and
+// any write to the key bumps it. WATCH remembers the version it saw and EXEC
+// compares : two keys sharing a slot may abort a transaction for nothing,
+// but a write never costs more than one increment.
+//
+// A key past its deadline is deleted by the first accessor that finds it,
+// the expire hook lets a timer delete the ones nobody reads again. Either
+// way the reap hook is told.
+//
+// With a grouping (group_by()), every shard also indexes its keys by
+// group : the cluster finds the keys of a hash slot without a pass over the
+// whole keyspace.
+//
+// With a cold store, strings may be swapped for a Cold reference to its
+// log. find() and write() read them back into memory transparently.
+//
+// set() picks the encoding of the strings it stores : integers are kept
+// as int64_t, short strings inline and, with compression on, those of at
+// least min_size bytes compressed when that saves a fifth of their size or
+// more. find() and write() turn them back into a std::string for good,
+// readers that only look at the string go through peek() instead.
+//
+// The accessors below expect the caller to hold the lock of the key's shard.
+class Keyspace {
+public:
+    static constexpr size_t k_shards = 16;
+    static constexpr size_t k_slots = 1024;
+    static constexpr unsigned k_shard_bits = 4;
+    // list elements, or 64K blocks of a string
+    static constexpr size_t k_lazy_effort = 64;
+    static_assert(k_shards == size_t(1) << k_shard_bits);
+
+    struct Shard {
+        std::mutex m;
+        Map map;
+        Expires expires;
+        std::array<uint64_t, k_slots> versions = {};
+        // empty without a grouping
+        Groups groups;
+    };
+
+    // told about every deadline set, with the key's shard locked
+    using ExpireHook = std::function<void(std::string_view key, int64_t at)>;
+    // told about every key deleted because its deadline passed, with its
+    // shard locked
+    using ReapHook = std::function<void(std::string_view key)>;
+    // told once a table starts rehashing, until rehash() catches up
+    using RehashHook = std::function<void()>;
+    using ScanFn = std::function<void(const std::string& key, const Value& v)>;
+    using GroupFn = uint16_t (*)(std::string_view key);
+
+    static uint64_t hash(std::string_view key) {
+        return KeyHash{}(key);
+    }
+
+    static size_t shard_index(uint64_t h) {
+        return static_cast<size_t>(h >> 60) & (k_shards - 1);
+    }
+
+    static size_t slot_index(uint64_t h) {
+        return static_cast<size_t>(h) & (k_slots - 1);
+    }
+
+    Shard& shard(size_t idx) {
+        return _shards[idx];
+    }
+
+    Shard& shard_of(std::string_view key) {
+        return _shards[shard_index(hash(key))];
+    }
+
+    // version of the slot the key hash falls into
+    uint64_t version(uint64_t h) {
+        return _shards[shard_index(h)].versions[slot_index(h)];
+    }
+
+    // counters of the compressed values, kept up to date without any lock
+    struct CompressionStats {
+        std::atomic<uint64_t> values{0};
+        // the size of those values once inflated, and compressed
+        std::atomic<uint64_t> raw_bytes{0};
+        std::atomic<uint64_t> bytes{0};
+        // thread CPU time spent in the codec
+        std::atomic<uint64_t> compress_ns{0};
+        std::atomic<uint64_t> decompress_ns{0};
+        // strings that did not compress well enough and were kept as is
+        std::atomic<uint64_t> rejected{0};
+    };
+
+    Value* find(std::string_view key);
+    // like find(), but leaves strings in their encoding
+    Value* peek(std::string_view key) {
+        return peek(key, hash(key));
+    }
+    // h is hash(key), computed already (see batch())
+    Value* peek(std::string_view key, uint64_t h);
+    // the value stored under key, default constructed if missing. The
+    // deadline of the key stays
+    Value& write(std::string_view key);
+    // like write(), but leaves strings in their encoding
+    Value& poke(std::string_view key);
+    // replaces the value and drops the deadline
+    void set(std::string_view key, Value v) {
+        set(key, hash(key), std::move(v));
+    }
+    void set(std::string_view key, uint64_t h, Value v);
+    // false when key is missing or past its deadline
+    bool erase(std::string_view key) {
+        return erase(key, hash(key));
+    }
+    bool erase(std::string_view key, uint64_t h);
+
+    // keys prefetched ahead of the one being worked on by batch()
+    static constexpr size_t k_ahead = 4;
+
+    // calls fn(k, h) for k in [0, n) in order, h being hash(key(k)). Each
+    // key is hashed once, and the bucket of key k + 2 * k_ahead and the
+    // first entry of key k + k_ahead are prefetched meanwhile : the lookups
+    // of a multi-key command overlap their cache misses instead of waiting
+    // on one after the other. fn may insert and erase, the hints are only
+    // hints
+    template<typename KeyFn, typename Fn>
+    void batch(size_t n, KeyFn&& key, Fn&& fn) {
+        // holds keys k to k + 2 * k_ahead
+        constexpr size_t k_ring = 4 * k_ahead;
+        uint64_t ring[k_ring];
+        auto hint = [&] (size_t k) {
+            uint64_t h = hash(key(k));
+            ring[k % k_ring] = h;
+            _shards[shard_index(h)].map.prefetch_bucket(h);
+        };
+        for (size_t k = 0 ; k < n && k < 2 * k_ahead ; ++k) hint(k);
+        for (size_t k = 0 ; k < n ; ++k) {
+            if (k + k_ahead < n) {
+                uint64_t h = ring[(k + k_ahead) % k_ring];
+                _shards[shard_index(h)].map.prefetch_entry(h);
+            }
+            if (k + 2 * k_ahead < n) hint(k + 2 * k_ahead);
+            fn(k, ring[k % k_ring]);
+        }
+    }
+
+    // false when key is missing
+    bool expire(std::string_view key, int64_t at);
+    // false when key is missing or has no deadline
+    bool persist(std::string_view key);
+    // the deadline of key, -1 without one, -2 when key is missing
+    int64_t deadline(std::string_view key);
+    // deletes key if its deadline passed, returns whether it did
+    bool reap(std::string_view key);
+
+    // one hook at most, set before serving
+    void on_expire(ExpireHook h) {
+        _on_expire = std::move(h);
+    }
+    // one hook at most, set before serving
+    void on_reap(ReapHook h) {
+        _on_reap = std::move(h);
+    }
+    // one hook at most, set before serving
+    void on_rehash(RehashHook h) {
+        _on_rehash = std::move(h);
+    }
+    // moves up to steps buckets of every table being rehashed, taking the
+    // shards' locks. Returns whether one still is
+    bool rehash(size_t steps);
+    // bumps the version of key without changing it
+    void touch(std::string_view key);
+
+    // set before the first key, the keys are indexed by group(key) in
+    // their shard's groups from then on
+    void group_by(GroupFn group) {
+        _group = group;
+    }
+
+    // set before serving, values found cold are read back from it
+    void cold_store(ColdStore* cs) {
+        _cold = cs;
+    }
+
+    ColdStore* cold_store() const {
+        return _cold;
+    }
+
+    // set before serving, values that take more than k_lazy_effort frees
+    // to destroy are handed to it by erase() and set() instead
+    void reclaimer(Reclaimer* r) {
+        _reclaimer = r;
+    }
+
+    Reclaimer* reclaimer() const {
+        return _reclaimer;
+    }
+
+    // set before serving, 0 (the default) turns compression off
+    void compression(size_t min_size) {
+        _compress_min = min_size;
+    }
+
+    const CompressionStats& compression_stats() const {
+        return _compression;
+    }
+
+    // appends the string c holds to out
+    void inflate(const Compressed& c, std::string& out);
+
+    // in seconds, what Entry::used is made of. Only the cold store needs it,
+    // it advances it
+    uint32_t clock() const {
+        return _clock.load(std::memory_order_relaxed);
+    }
+
+    void tick(uint32_t now) {
+        _clock.store(now, std::memory_order_relaxed);
+    }
+
+    // these three need every shard locked
+    size_t size();
+    // lazy hands the shards' tables to the reclaimer whole, when there is one
+    void clear(bool lazy = false);
+    // calls fn with the keys of the buckets from cursor on, until count keys
+    // went through it or 10 times as many buckets were visited. Returns the
+    // cursor to resume from, 0 once every shard was walked. Keys present for
+    // the whole scan are seen at least once, keys past their deadline never
+    uint64_t scan(uint64_t cursor, size_t count, const ScanFn& fn);
+
+private:
+    // deletes key, of hash h, when its deadline passed, returns whether it did
+    bool reap(Shard& s, std::string_view key, uint64_t h);
+    // deletes key, of hash h, whatever its deadline. Returns whether it was there
+    bool remove(Shard& s, std::string_view key, uint64_t h);
+    // marks e used, reading it back into memory if it went cold, and
+    // turning it back into a std::string if decoding is set
+    Value& use(Entry& e, bool decoding);
+    Value& emplace(std::string_view key, bool decoding);
+    // calls the rehash hook if a table of s just started rehashing
+    void resized(Shard& s);
+    // indexes a key just added to s, or about to be erased from it
+    void grouped(Shard& s, std::string_view key);
+    void ungrouped(Shard& s, std::string_view key);
+    // gives back the log space of v if it is cold
+    void release(const Value& v);
+    // destroys v, on the reclaimer's thread when that is worth it
+    void dispose(Value& v);
+    // swaps the std::string v holds for a smaller encoding if there is one
+    void encode(Value& v);
+
+    std::array<Shard, k_shards> _shards;
+    ExpireHook _on_expire;
+    ReapHook _on_reap;
+    RehashHook _on_rehash;
+    std::atomic<bool> _rehash_told{false};
+    GroupFn _group = nullptr;
+    ColdStore* _cold = nullptr;
+    Reclaimer* _reclaimer = nullptr;
+    size_t _compress_min = 0;
+    CompressionStats _compression;
+    std::atomic<uint32_t> _clock{0};
+};
+
+} // namespace store
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <variant>
+#include "datastructures/mpsc_queue.h"
+#include "store/keyspace.h"
+
+namespace store {
+
+// Frees values on a background thread.
+//
+// Destroying a list of millions of elements, or a whole shard table on
+// FLUSHALL ASYNC, would hold the shard's lock for as long as the destructor
+// chain runs. The keyspace moves them here instead : handing one over is a
+// push on a lock-free queue and a futex wake when the thread sleeps, the
+// destructors run off every lock.
+class Reclaimer {
+public:
+    using Garbage = std::variant<Value, Map, Expires>;
+
+    Reclaimer();
+    // frees what is still queued before returning
+    ~Reclaimer();
+
+    Reclaimer(const Reclaimer&) = delete;
+    Reclaimer& operator=(const Reclaimer&) = delete;
+
+    // thread-safe
+    void dispose(Garbage g);
+
+    // handed over but not freed yet
+    uint64_t pending() const {
+        return _disposed.load(std::memory_order_relaxed) - _freed.load(std::memory_order_relaxed);
+    }
+
+    uint64_t freed() const {
+        return _freed.load(std::memory_order_relaxed);
+    }
+
+private:
+    void run();
+
+    data::MPSCQueue<Garbage> _queue;
+    // what the thread waits on, bumped after every push. 32 bits : waits
+    // and wake-ups are plain futex calls on it
+    std::atomic<uint32_t> _pushed{0};
+    std::atomic<uint64_t> _disposed{0};
+    std::atomic<uint64_t> _freed{0};
+    std::atomic<bool> _stop{false};
+    std::thread _t;
+};
+
+} // namespace store
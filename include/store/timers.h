@@ -0,0 +1,57 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include "datastructures/timer_wheel.h"
+
+namespace store {
+
+// milliseconds since the Unix epoch, what expiry deadlines are made of
+static inline int64_t now_ms() {
+    using namespace std::chrono;
+    return duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
+}
+
+// One timer thread for the whole server : key expiry and blocked clients'
+// timeouts share its wheel. It sleeps until the next occupied tick (1ms),
+// and for good while no timer is pending. Callbacks run on the timer
+// thread without its lock held, they may add or cancel timers.
+class Timers {
+public:
+    using Id = data::TimerWheel<std::function<void()>>::Id;
+
+    Timers() = default;
+    ~Timers();
+
+    Timers(const Timers&) = delete;
+    Timers& operator=(const Timers&) = delete;
+
+    // fires fn at deadline, in ms since the epoch
+    Id at(int64_t deadline, std::function<void()> fn);
+
+    // never early : now_ms() is already up to a tick into the current one
+    Id after(std::chrono::milliseconds delay, std::function<void()> fn) {
+        return at(now_ms() + delay.count() + 1, std::move(fn));
+    }
+
+    // false when the timer already fired, it may be running right now
+    bool cancel(Id id);
+
+    size_t pending();
+
+private:
+    void run();
+
+    std::mutex _m;
+    std::condition_variable _cv;
+    data::TimerWheel<std::function<void()>> _wheel{static_cast<uint64_t>(now_ms())};
+    bool _stop = false;
+    // started with the first timer
+    std::thread _t;
+};
+
+} // namespace store
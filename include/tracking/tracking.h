@@ -0,0 +1,100 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "commands/table.h"
+#include "pubsub/pubsub.h"
+
+namespace tracking {
+
+// Client-side caching : CLIENT TRACKING ON|OFF [BCAST] [PREFIX p]... [NOLOOP]
+//
+// In the default mode the server remembers which clients read each key,
+// the first write to the key afterwards pushes them one RESP3 invalidate
+// frame and forgets them until they read it again. The table is split like
+// the keyspace and guarded by its shard locks, reads and writes already
+// hold them. Each shard keeps at most max_keys / k_shards keys : past that
+// the oldest tracked key is invalidated for its readers, as if written, and
+// forgotten.
+//
+// Broadcasting clients track nothing, they get an invalidation for every
+// write to a key starting with one of their prefixes (all of them without
+// a prefix).
+//
+// Frames are encoded once per key and sent through the pub/sub courier, a
+// writer never waits on a slow cache.
+class Tracking {
+public:
+    Tracking(commands::Table& table, pubsub::PubSub& ps, size_t max_keys);
+    ~Tracking();
+
+    Tracking(const Tracking&) = delete;
+    Tracking& operator=(const Tracking&) = delete;
+
+    // keys currently in the tracking table
+    size_t tracked() const {
+        return _tracked.load(std::memory_order_relaxed);
+    }
+
+    // handles cmd if it is CLIENT TRACKING, returns whether it did
+    bool handle(int fd, const net::resp::Command& cmd);
+
+    void attach(net::resp::Redis& r);
+
+private:
+    struct Client {
+        uint32_t id;
+        bool bcast = false;
+        bool noloop = false;
+        std::vector<std::string> prefixes;
+    };
+
+    struct Entry {
+        std::string key;
+        // ids of the clients that read it, a handful at most in practice
+        std::vector<uint32_t> readers;
+    };
+
+    // oldest tracked key first, the index points into the list
+    struct Shard {
+        std::list<Entry> order;
+        std::unordered_map<std::string_view, std::list<Entry>::iterator> index;
+    };
+
+    void read(int fd, const commands::Spec& spec, const commands::Args& argv);
+    void written(const commands::Spec& spec, const commands::Args& argv);
+    void remember(Shard& shard, std::string_view key, uint32_t id);
+    // sends the invalidation of key to the readers in e if any, and to the
+    // broadcasting clients with bcast. The caller holds _m
+    void invalidate(const Entry* e, std::string_view key, int writer, bool bcast);
+    void flushed();
+    // turns tracking off for fd, the caller holds _m
+    bool unlink(int fd);
+    void forget(int fd);
+
+    commands::Table& _table;
+    pubsub::PubSub& _ps;
+    size_t _hook;
+    const size_t _max_per_shard;
+    std::array<Shard, store::Keyspace::k_shards> _shards;
+    std::atomic<size_t> _tracked{0};
+
+    // lock order : shards, then _m
+    std::shared_mutex _m;
+    std::unordered_map<int, Client> _clients;
+    std::unordered_map<uint32_t, int> _ids;
+    std::vector<int> _bcast;
+    uint32_t _next_id = 0;
+    // clients with tracking on, writes skip everything when there is none
+    std::atomic<size_t> _on{0};
+    std::atomic<size_t> _broadcasting{0};
+};
+
+} // namespace tracking
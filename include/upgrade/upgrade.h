@@ -0,0 +1,57 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include "replication/replication.h"
+#include "resp/handle.h"
+
+namespace upgrade {
+
+// Hot restart.
+//
+// A server started with --upgrade-socket <path> listens on that unix socket.
+// A new binary started with --takeover <path> connects to it and receives
+// the listening TCP socket through SCM_RIGHTS. Clients keep connecting to
+// the same socket and the kernel queues them while the keyspace moves, so
+// none is refused.
+//
+// The old process stops accepting as soon as the new one connects, then
+// streams the keyspace to it as it would to a replica : a snapshot taken
+// under every shard lock, then every write its remaining clients make. It
+// serves those clients until they leave or the drain timeout expires,
+// waits for the new process to have every write and exits. The new process
+// loads the snapshot before accepting anyone, so caches stay warm.
+class Handoff {
+public:
+    // listens on path, replacing whatever was there
+    Handoff(net::resp::Redis& r, replication::Replication& repl, const std::string& path);
+    ~Handoff();
+
+    Handoff(const Handoff&) = delete;
+    Handoff& operator=(const Handoff&) = delete;
+
+    // once the accept loop returned : waits at most timeout for the new
+    // process to receive every write, then closes the link to it
+    void finish(std::chrono::milliseconds timeout);
+
+private:
+    void run();
+
+    net::resp::Redis& _r;
+    replication::Replication& _repl;
+    int _listener = -1;
+    // the new process, -1 until it connects
+    std::atomic<int> _link{-1};
+    // the snapshot was sent, writes follow
+    std::atomic<bool> _streaming{false};
+    std::thread _t;
+};
+
+// new process : connects to the server listening on path and returns the
+// listening socket it hands over, -1 on failure. link is the connection the
+// keyspace comes through, for Replication::take_over()
+int take_over(const std::string& path, int& link);
+
+} // namespace upgrade
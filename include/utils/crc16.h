@@ -0,0 +1,12 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+
+namespace utils {
+
+// CRC16-CCITT (XMODEM) : polynomial 0x1021, initial value 0, as used by
+// Redis Cluster to map keys to hash slots
+uint16_t crc16(std::string_view s);
+
+} // namespace utils
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <string_view>
+
+namespace utils {
+
+// glob-style matching as used by Redis (PSUBSCRIBE, KEYS, SCAN MATCH...)
+// supports '*', '?', '[abc]', '[^a-z]' and '\' escapes
+bool glob_match(std::string_view pattern, std::string_view s);
+
+} // namespace utils
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+namespace utils {
+
+// LZ77 codec in the LZ4 block format : a greedy matcher over a 4K-entry
+// hash table, 64K window. Fast both ways rather than tight, text and JSON
+// typically shrink 2-4x.
+
+// appends the compressed form of src to dst
+void lz_compress(std::string_view src, std::string& dst);
+
+// decompresses src into exactly n bytes at dst, false when src is corrupt
+// or does not decompress to n bytes
+bool lz_decompress(std::string_view src, char* dst, size_t n);
+
+} // namespace utils
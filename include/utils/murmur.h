@@ -0,0 +1,12 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+
+namespace utils {
+
+// MurmurHash64A, byte for byte the one Redis hashes HyperLogLog elements
+// with (seed 0xadc83b19), whatever the host's byte order
+uint64_t murmur64(std::string_view s, uint64_t seed);
+
+} // namespace utils
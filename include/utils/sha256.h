@@ -0,0 +1,18 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace utils {
+
+using Digest = std::array<uint8_t, 32>;
+
+// SHA-256 (FIPS 180-4), ACL passwords are only kept hashed
+Digest sha256(std::string_view s);
+
+// lower-case hex, 64 characters
+std::string hex(const Digest& d);
+
+} // namespace utils
@@ -0,0 +1,417 @@
+#include "acl/acl.h"
+#include "resp/resp_utils.h"
+#include "utils/glob.h"
+
+#include <algorithm>
+
+namespace acl {
+
+enum Category : uint32_t {
+    READ        = 1 << 0,
+    WRITE       = 1 << 1,
+    KEYSPACE    = 1 << 2,
+    PUBSUB      = 1 << 3,
+    TRANSACTION = 1 << 4,
+    BLOCKING    = 1 << 5,
+    CONNECTION  = 1 << 6,
+    ADMIN       = 1 << 7,
+    ALL         = ~0u
+};
+
+static const std::pair<const char*, uint32_t> k_categories[] = {
+    {"READ", READ}, {"WRITE", WRITE}, {"KEYSPACE", KEYSPACE}, {"PUBSUB", PUBSUB},
+    {"TRANSACTION", TRANSACTION}, {"BLOCKING", BLOCKING}, {"CONNECTION", CONNECTION},
+    {"ADMIN", ADMIN}, {"ALL", ALL}
+};
+
+// commands served outside the table, with their keys
+struct Extra {
+    const char* name;
+    uint32_t categories;
+    int first_key;
+    int last_key;
+    int step;
+};
+
+static const Extra k_extra[] = {
+    {"BLPOP",        WRITE | KEYSPACE | BLOCKING, 1, -2, 1},
+    {"BRPOP",        WRITE | KEYSPACE | BLOCKING, 1, -2, 1},
+    {"BLMOVE",       WRITE | KEYSPACE | BLOCKING, 1, 2, 1},
+    {"WATCH",        TRANSACTION, 1, -1, 1},
+    {"UNWATCH",      TRANSACTION, 0, 0, 0},
+    {"MULTI",        TRANSACTION, 0, 0, 0},
+    {"EXEC",         TRANSACTION, 0, 0, 0},
+    {"DISCARD",      TRANSACTION, 0, 0, 0},
+    {"SUBSCRIBE",    PUBSUB, 0, 0, 0},
+    {"PSUBSCRIBE",   PUBSUB, 0, 0, 0},
+    {"UNSUBSCRIBE",  PUBSUB, 0, 0, 0},
+    {"PUNSUBSCRIBE", PUBSUB, 0, 0, 0},
+    {"PUBLISH",      PUBSUB, 0, 0, 0},
+    {"AUTH",         CONNECTION, 0, 0, 0},
+    {"HELLO",        CONNECTION, 0, 0, 0},
+    {"QUIT",         CONNECTION, 0, 0, 0},
+    {"CLIENT",       CONNECTION, 0, 0, 0},
+    {"ASKING",       CONNECTION, 0, 0, 0},
+    {"ACL",          ADMIN, 0, 0, 0},
+    {"CLUSTER",      ADMIN, 0, 0, 0},
+    {"REPLICAOF",    ADMIN, 0, 0, 0},
+    {"SLAVEOF",      ADMIN, 0, 0, 0},
+    {"ROLE",         ADMIN, 0, 0, 0},
+    {"PROFILE",      ADMIN, 0, 0, 0},
+    {"SYNC",         ADMIN, 0, 0, 0},
+    {"PSYNC",        ADMIN, 0, 0, 0},
+    {"REPLCONF",     ADMIN, 0, 0, 0}
+};
+
+static const char* k_default = "default";
+static const char* k_noauth = "-NOAUTH Authentication required.\r\n";
+static const char* k_wrongpass = "-WRONGPASS invalid username-password pair or user is disabled.\r\n";
+
+static std::string lower(std::string_view s) {
+    std::string r(s);
+    for (auto& c : r) {
+        if (c >= 'A' && c <= 'Z') c += 'a' - 'A';
+    }
+    return r;
+}
+
+static bool is(std::string_view s, std::string_view upper) {
+    return net::resp::Command{{s}}.is(upper);
+}
+
+// "#" and 64 hex digits, as ACL LIST shows passwords
+static bool parse_digest(std::string_view s, utils::Digest& d) {
+    if (s.size() != 2 * d.size()) return false;
+    auto digit = [] (char c) {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return -1;
+    };
+    for (size_t k = 0 ; k < d.size() ; ++k) {
+        int hi = digit(s[2 * k]);
+        int lo = digit(s[2 * k + 1]);
+        if (hi < 0 || lo < 0) return false;
+        d[k] = static_cast<uint8_t>(hi << 4 | lo);
+    }
+    return true;
+}
+
+// in constant time, a mismatch tells nothing about where it is
+static bool same(const utils::Digest& a, const utils::Digest& b) {
+    uint8_t diff = 0;
+    for (size_t k = 0 ; k < a.size() ; ++k) diff |= a[k] ^ b[k];
+    return diff == 0;
+}
+
+Acl::Acl() {
+    auto specs = [this] (const commands::Spec* s, size_t n) {
+        for (size_t k = 0 ; k < n ; ++k) {
+            bool all_keys = s[k].flags & commands::ALL_KEYS;
+            uint32_t c = (s[k].first_key > 0 || all_keys) ? KEYSPACE : CONNECTION;
+            if (s[k].flags & commands::WRITE) c |= WRITE;
+            if (s[k].flags & commands::READONLY) c |= READ;
+            // XREAD and XREADGROUP, which take BLOCK
+            if (s[k].flags & commands::STREAMS_KEYS) c |= BLOCKING;
+            add(s[k].name, c, s[k].first_key, s[k].last_key, s[k].step, all_keys,
+                s[k].flags & commands::STREAMS_KEYS);
+        }
+    };
+    specs(commands::k_string_commands, commands::k_string_commands_len);
+    specs(commands::k_list_commands, commands::k_list_commands_len);
+    specs(commands::k_probabilistic_commands, commands::k_probabilistic_commands_len);
+    specs(commands::k_stream_commands, commands::k_stream_commands_len);
+    for (auto& e : k_extra) add(e.name, e.categories, e.first_key, e.last_key, e.step, false, false);
+
+    User& u = _users[k_default];
+    apply(u, "on");
+    apply(u, "nopass");
+    apply(u, "allkeys");
+    apply(u, "allcommands");
+    u.compiled = std::make_shared<Permissions>(Permissions{u.commands, u.all_keys, u.patterns});
+}
+
+void Acl::add(const char* name, uint32_t categories, int first, int last, int step, bool all_keys, bool streams) {
+    if (_infos.count(name) > 0) return;
+    uint32_t id = static_cast<uint32_t>(_names.size());
+    _infos.emplace(name, Info{id, categories, first, last, step, all_keys, streams});
+    _names.push_back(lower(name));
+}
+
+const Acl::Info* Acl::info(std::string_view name) const {
+    // upper-case into a stack buffer, command names are short
+    char buf[32] = {};
+    if (name.size() >= sizeof(buf)) return nullptr;
+    for (size_t k = 0 ; k < name.size() ; ++k) {
+        char c = name[k];
+        buf[k] = (c >= 'a' && c <= 'z') ? c - ('a' - 'A') : c;
+    }
+    auto it = _infos.find(std::string_view(buf, name.size()));
+    return it == _infos.end() ? nullptr : &it->second;
+}
+
+void Acl::allow(User& u, uint32_t categories, bool on) const {
+    for (auto& [name, i] : _infos) {
+        if (!(i.categories & categories)) continue;
+        uint64_t bit = uint64_t(1) << (i.id & 63);
+        if (on) {
+            u.commands[i.id >> 6] |= bit;
+        } else {
+            u.commands[i.id >> 6] &= ~bit;
+        }
+    }
+}
+
+bool Acl::apply(User& u, std::string_view rule) const {
+    u.commands.resize((_names.size() + 63) / 64, 0);
+    if (is(rule, "ON")) {
+        u.enabled = true;
+    } else if (is(rule, "OFF")) {
+        u.enabled = false;
+    } else if (is(rule, "NOPASS")) {
+        u.nopass = true;
+        u.passwords.clear();
+    } else if (is(rule, "RESETPASS")) {
+        u.nopass = false;
+        u.passwords.clear();
+    } else if (is(rule, "ALLKEYS") || rule == "~*") {
+        u.all_keys = true;
+        u.patterns.clear();
+    } else if (is(rule, "RESETKEYS")) {
+        u.all_keys = false;
+        u.patterns.clear();
+    } else if (is(rule, "ALLCOMMANDS")) {
+        allow(u, ALL, true);
+    } else if (is(rule, "NOCOMMANDS")) {
+        allow(u, ALL, false);
+    } else if (is(rule, "RESET")) {
+        u = User{};
+        u.commands.resize((_names.size() + 63) / 64, 0);
+    } else if (rule.empty()) {
+        return false;
+    } else if (rule[0] == '>' || rule[0] == '<' || rule[0] == '#') {
+        utils::Digest d;
+        if (rule[0] == '#') {
+            if (!parse_digest(rule.substr(1), d)) return false;
+        } else {
+            d = utils::sha256(rule.substr(1));
+        }
+        auto it = std::find_if(u.passwords.begin(), u.passwords.end(),
+                               [&] (const utils::Digest& p) { return same(p, d); });
+        if (rule[0] == '<') {
+            if (it == u.passwords.end()) return false;
+            u.passwords.erase(it);
+        } else {
+            if (it == u.passwords.end()) u.passwords.push_back(d);
+            u.nopass = false;
+        }
+    } else if (rule[0] == '~') {
+        if (!u.all_keys) u.patterns.emplace_back(rule.substr(1));
+    } else if (rule[0] == '+' || rule[0] == '-') {
+        bool on = rule[0] == '+';
+        if (rule.size() > 1 && rule[1] == '@') {
+            auto cat = std::find_if(std::begin(k_categories), std::end(k_categories),
+                                    [&] (auto& c) { return is(rule.substr(2), c.first); });
+            if (cat == std::end(k_categories)) return false;
+            allow(u, cat->second, on);
+        } else {
+            const Info* i = info(rule.substr(1));
+            if (i == nullptr) return false;
+            uint64_t bit = uint64_t(1) << (i->id & 63);
+            if (on) {
+                u.commands[i->id >> 6] |= bit;
+            } else {
+                u.commands[i->id >> 6] &= ~bit;
+            }
+        }
+    } else {
+        return false;
+    }
+    return true;
+}
+
+std::string Acl::setuser(std::string_view user, const std::vector<std::string_view>& rules) {
+    std::lock_guard<std::mutex> l(_m);
+    auto it = _users.find(user);
+    // on a copy : an invalid rule leaves the user as it was
+    User u = it == _users.end() ? User{} : it->second;
+    for (auto rule : rules) {
+        if (!apply(u, rule)) {
+            return "-ERR Error in ACL SETUSER modifier '" + std::string(rule) + "': Syntax error\r\n";
+        }
+    }
+    u.commands.resize((_names.size() + 63) / 64, 0);
+    u.compiled = std::make_shared<Permissions>(Permissions{u.commands, u.all_keys, u.patterns});
+    if (it == _users.end()) {
+        _users.emplace(std::string(user), std::move(u));
+    } else {
+        it->second = std::move(u);
+    }
+    return "";
+}
+
+std::shared_ptr<const Permissions> Acl::login(std::string_view user, std::string_view pass) {
+    utils::Digest d = utils::sha256(pass);
+    std::lock_guard<std::mutex> l(_m);
+    auto it = _users.find(user);
+    if (it == _users.end() || !it->second.enabled) return nullptr;
+    const User& u = it->second;
+    bool ok = u.nopass;
+    for (auto& p : u.passwords) ok |= same(p, d);
+    return ok ? u.compiled : nullptr;
+}
+
+std::string Acl::auth(int fd, std::string_view user, std::string_view pass) {
+    auto perms = login(user, pass);
+    // a failed attempt leaves the connection as it was
+    if (!perms) return k_wrongpass;
+    Session& s = _sessions.at(fd);
+    s.user = std::string(user);
+    s.perms = std::move(perms);
+    return net::resp::ok();
+}
+
+std::string Acl::hello(int fd, const net::resp::Hello& h) {
+    if (h.auth) return auth(fd, h.user, h.pass);
+    Session& s = _sessions.at(fd);
+    if (!s.perms) {
+        // as the default user, when it needs no password
+        s.user = k_default;
+        s.perms = login(k_default, "");
+    }
+    if (s.perms) return net::resp::ok();
+    return "-NOAUTH HELLO must be called with the client already authenticated, otherwise the "
+           "HELLO <proto> AUTH <user> <pass> option can be used to authenticate the client and "
+           "select the RESP protocol version at the same time\r\n";
+}
+
+bool Acl::check(const Session& s, const Info& i, const net::resp::Command& cmd, std::string& out) const {
+    const Permissions& p = *s.perms;
+    if (!p.allows(i.id)) {
+        out = "-NOPERM User " + s.user + " has no permissions to run the '" + _names[i.id] + "' command\r\n";
+        return false;
+    }
+    if (p.all_keys || (i.first_key == 0 && !i.all_keys)) return true;
+    bool ok = !i.all_keys;
+    commands::KeyRange keys = commands::key_range(i.first_key, i.last_key, i.step,
+                                                  i.streams ? uint32_t(commands::STREAMS_KEYS) : 0u, cmd.argv);
+    for (int k = keys.first ; ok && k <= keys.last ; k += keys.step) {
+        ok = std::any_of(p.patterns.begin(), p.patterns.end(),
+                         [&] (const std::string& pattern) { return utils::glob_match(pattern, cmd.argv[k]); });
+    }
+    if (!ok) out = "-NOPERM No permissions to access a key\r\n";
+    return ok;
+}
+
+std::string Acl::describe(const std::string& name, const User& u) const {
+    std::string s = "user " + name + (u.enabled ? " on" : " off");
+    if (u.nopass) s += " nopass";
+    for (auto& p : u.passwords) s += " #" + utils::hex(p);
+    if (u.all_keys) s += " ~*";
+    for (auto& p : u.patterns) s += " ~" + p;
+    bool all = true;
+    for (size_t id = 0 ; id < _names.size() ; ++id) all &= (u.commands[id >> 6] >> (id & 63)) & 1;
+    if (all) return s + " +@all";
+    s += " -@all";
+    for (size_t id = 0 ; id < _names.size() ; ++id) {
+        if ((u.commands[id >> 6] >> (id & 63)) & 1) s += " +" + _names[id];
+    }
+    return s;
+}
+
+std::string Acl::command(int fd, const net::resp::Command& cmd) {
+    if (cmd.argc() < 2) return net::resp::wrong_arity("acl");
+    std::string_view sub = cmd.argv[1];
+    if (is(sub, "SETUSER") && cmd.argc() >= 3) {
+        std::vector<std::string_view> rules(cmd.argv.begin() + 3, cmd.argv.end());
+        std::string err = setuser(cmd.argv[2], rules);
+        return err.empty() ? net::resp::ok() : err;
+    }
+    if (is(sub, "DELUSER") && cmd.argc() >= 3) {
+        std::lock_guard<std::mutex> l(_m);
+        int64_t n = 0;
+        for (size_t k = 2 ; k < cmd.argc() ; ++k) {
+            if (cmd.argv[k] == k_default) return "-ERR The 'default' user cannot be removed\r\n";
+        }
+        for (size_t k = 2 ; k < cmd.argc() ; ++k) {
+            auto it = _users.find(cmd.argv[k]);
+            if (it == _users.end()) continue;
+            _users.erase(it);
+            ++n;
+        }
+        return net::resp::integer(n);
+    }
+    if ((is(sub, "LIST") || is(sub, "USERS")) && cmd.argc() == 2) {
+        std::vector<std::string> lines;
+        {
+            std::lock_guard<std::mutex> l(_m);
+            for (auto& [name, u] : _users) lines.push_back(is(sub, "LIST") ? describe(name, u) : name);
+        }
+        // by name, "user " prefixes them all alike
+        std::sort(lines.begin(), lines.end());
+        std::string out = "*" + std::to_string(lines.size()) + "\r\n";
+        for (auto& line : lines) out += net::resp::bulk(line);
+        return out;
+    }
+    if (is(sub, "WHOAMI") && cmd.argc() == 2) {
+        return net::resp::bulk(_sessions.at(fd).user);
+    }
+    return "-ERR unknown subcommand '" + std::string(sub) + "'\r\n";
+}
+
+bool Acl::handle(int fd, const net::resp::Command& cmd) {
+    std::string out;
+    if (cmd.is("AUTH")) {
+        if (cmd.argc() == 2) {
+            out = auth(fd, k_default, cmd.argv[1]);
+        } else if (cmd.argc() == 3) {
+            out = auth(fd, cmd.argv[1], cmd.argv[2]);
+        } else {
+            out = net::resp::wrong_arity("auth");
+        }
+    } else if (cmd.is("HELLO")) {
+        net::resp::Hello h;
+        if (!net::resp::parse_hello(cmd, h)) {
+            out = "-ERR syntax error\r\n";
+        } else if (h.version != "3") {
+            out = "-NOPROTO unsupported protocol version\r\n";
+        } else {
+            out = hello(fd, h);
+        }
+    } else {
+        const Session* s = _sessions.get(fd);
+        if (s == nullptr || !s->perms) {
+            if (cmd.is("QUIT")) return false;
+            out = k_noauth;
+        } else {
+            const Info* i = info(cmd.argv[0]);
+            // unknown commands are left to the rest of the chain
+            if (i == nullptr) return false;
+            if (check(*s, *i, cmd, out)) {
+                if (!cmd.is("ACL")) return false;
+                out = command(fd, cmd);
+            }
+        }
+    }
+    net::write_stream(fd, out.c_str(), out.size());
+    return true;
+}
+
+void Acl::attach(net::resp::Redis& r) {
+    using Chain = ChainOfResponsibility::Chain<int, net::resp::Redis::T&&>;
+    r.attach([this] (int connfd, net::resp::Redis::T&& msg, Chain next) {
+        if (auto* node = std::get_if<std::unique_ptr<data::Node>>(&msg)) {
+            auto cmd = net::resp::as_command(node->get());
+            if (cmd.has_value() && handle(connfd, *cmd)) return;
+        }
+        next(connfd, std::move(msg));
+    });
+    r.on_hello([this] (int connfd, const net::resp::Hello& h) {
+        return hello(connfd, h);
+    });
+    r.on_close([this] (int connfd) {
+        _sessions.reset(connfd);
+    });
+}
+
+} // namespace acl
@@ -0,0 +1,639 @@
+#include "cluster/cluster.h"
+#include "resp/resp_utils.h"
+#include "utils/crc16.h"
+
+#include <sys/time.h>
+#include <algorithm>
+#include <charconv>
+#include <mutex>
+#include <random>
+
+namespace cluster {
+
+static constexpr size_t k_default_batch = 100;
+
+uint16_t key_slot(std::string_view key) {
+    size_t open = key.find('{');
+    if (open != std::string_view::npos) {
+        size_t close = key.find('}', open + 1);
+        if (close != std::string_view::npos && close != open + 1) key = key.substr(open + 1, close - open - 1);
+    }
+    return utils::crc16(key) & (k_slots - 1);
+}
+
+static bool parse_int(std::string_view s, int64_t& v) {
+    auto res = std::from_chars(s.data(), s.data() + s.size(), v);
+    return !s.empty() && res.ec == std::errc() && res.ptr == s.data() + s.size();
+}
+
+static bool parse_slot(std::string_view s, uint16_t& slot) {
+    int64_t v;
+    if (!parse_int(s, v) || v < 0 || v >= static_cast<int64_t>(k_slots)) return false;
+    slot = static_cast<uint16_t>(v);
+    return true;
+}
+
+static std::string new_id() {
+    static const char* k_hex = "0123456789abcdef";
+    std::random_device rd;
+    std::mt19937_64 gen((uint64_t(rd()) << 32) | rd());
+    std::string id(40, '0');
+    for (auto& c : id) c = k_hex[gen() & 15];
+    return id;
+}
+
+static void encode(const commands::Args& argv, std::string& out) {
+    out += "*" + std::to_string(argv.size()) + "\r\n";
+    for (auto a : argv) out += net::resp::bulk(a);
+}
+
+// contiguous ranges of the slots for which owned(slot) holds
+template<typename F>
+static std::vector<std::pair<uint16_t, uint16_t>> ranges(F owned) {
+    std::vector<std::pair<uint16_t, uint16_t>> r;
+    for (size_t s = 0 ; s < k_slots ; ++s) {
+        if (!owned(s)) continue;
+        if (!r.empty() && size_t(r.back().second) + 1 == s) {
+            r.back().second = static_cast<uint16_t>(s);
+        } else {
+            r.emplace_back(s, s);
+        }
+    }
+    return r;
+}
+
+// Client connection to another node : requests go out whole, the replies
+// are read one line at a time (only simple ones are expected)
+class Link {
+public:
+    Link(const std::string& host, unsigned short port) {
+        _fd = net::dial(host, port);
+        if (_fd < 0) return;
+        struct timeval tv = {1, 0};
+        setsockopt(_fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        setsockopt(_fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+        std::string reply;
+        const std::string hello = "HELLO 3\r\n";
+        if (!send(hello) || !line(reply) || reply != "+OK") close();
+    }
+
+    ~Link() {
+        close();
+    }
+
+    bool ok() const {
+        return _fd >= 0;
+    }
+
+    bool send(const std::string& req) {
+        return _fd >= 0 && net::write_stream(_fd, req.data(), req.size()) == 0;
+    }
+
+    bool line(std::string& out) {
+        while (true) {
+            size_t p = _buf.find("\r\n");
+            if (p != std::string::npos) {
+                out.assign(_buf, 0, p);
+                _buf.erase(0, p + 2);
+                return true;
+            }
+            char tmp[4096];
+            ssize_t rv = _fd < 0 ? -1 : read(_fd, tmp, sizeof(tmp));
+            if (rv <= 0) return false;
+            _buf.append(tmp, rv);
+        }
+    }
+
+    // sends argv and expects +OK back
+    bool call(const commands::Args& argv) {
+        std::string req, reply;
+        encode(argv, req);
+        return send(req) && line(reply) && reply == "+OK";
+    }
+
+    void close() {
+        if (_fd >= 0) ::close(_fd);
+        _fd = -1;
+    }
+
+private:
+    int _fd = -1;
+    std::string _buf;
+};
+
+Cluster::Cluster(commands::Table& table, std::string host, unsigned short port, std::chrono::milliseconds gossip)
+    : _table(table), _myid(new_id()), _interval(gossip) {
+    _nodes.push_back({_myid, std::move(host), port, 0});
+    for (size_t s = 0 ; s < k_slots ; ++s) {
+        _owner[s] = -1;
+        _migrating[s] = -1;
+        _importing[s] = -1;
+    }
+    _table.keyspace().group_by(key_slot);
+    _table.guard([this] (int fd, const commands::Spec& spec, const commands::Args& argv, std::string& out) {
+        return guard(fd, spec, argv, out);
+    });
+    _gossip = std::thread([this] { this->gossip(); });
+}
+
+Cluster::~Cluster() {
+    _stop = true;
+    _gossip.join();
+    _table.guard({});
+}
+
+void Cluster::add_slots(uint16_t first, uint16_t last) {
+    std::unique_lock<std::shared_mutex> l(_m);
+    for (size_t s = first ; s <= last ; ++s) assign(static_cast<uint16_t>(s), 0);
+}
+
+int Cluster::find(std::string_view id) {
+    for (size_t k = 0 ; k < _nodes.size() ; ++k) {
+        if (_nodes[k].id == id) return static_cast<int>(k);
+    }
+    return -1;
+}
+
+int Cluster::node(std::string_view id, std::string_view host, unsigned short port) {
+    int idx = find(id);
+    if (idx < 0) {
+        _nodes.push_back({std::string(id), std::string(host), port, 0});
+        return static_cast<int>(_nodes.size() - 1);
+    }
+    if (idx > 0) {
+        _nodes[idx].host = host;
+        _nodes[idx].port = port;
+    }
+    return idx;
+}
+
+std::string Cluster::address(int idx) {
+    std::shared_lock<std::shared_mutex> l(_m);
+    return _nodes[idx].host + ":" + std::to_string(_nodes[idx].port);
+}
+
+void Cluster::assign(uint16_t slot, int idx) {
+    _owner[slot] = static_cast<int16_t>(idx);
+    if (idx == 0) {
+        _importing[slot] = -1;
+    } else {
+        _migrating[slot] = -1;
+    }
+}
+
+bool Cluster::guard(int fd, const commands::Spec& spec, const commands::Args& argv, std::string& out) {
+    if (spec.first_key == 0 || (spec.flags & commands::ALL_KEYS)) return true;
+    commands::KeyRange keys = commands::key_range(spec, argv);
+    int slot = -1;
+    for (int k = keys.first ; k <= keys.last ; k += keys.step) {
+        int s = key_slot(argv[k]);
+        if (slot >= 0 && s != slot) {
+            out += "-CROSSSLOT Keys in request don't hash to the same slot\r\n";
+            return false;
+        }
+        slot = s;
+    }
+    if (slot < 0) return true;
+
+    // ASKING only lasts for the next command
+    bool* asking = _asking.get(fd);
+    bool asked = asking != nullptr && *asking;
+    if (asked) *asking = false;
+
+    int o = owner(slot);
+    if (o == 0) {
+        int to = _migrating[slot].load(std::memory_order_acquire);
+        if (to < 0) return true;
+        // the keys that already left are answered by the target
+        int n = 0, missing = 0;
+        for (int k = keys.first ; k <= keys.last ; k += keys.step) {
+            ++n;
+            missing += _table.keyspace().peek(argv[k]) == nullptr ? 1 : 0;
+        }
+        if (missing == 0) {
+            if (!(spec.flags & commands::WRITE) || !in_flight(argv, keys)) return true;
+            out += "-TRYAGAIN Key being migrated to another node\r\n";
+            return false;
+        }
+        if (missing < n) {
+            out += "-TRYAGAIN Multiple keys request during rehashing of slot\r\n";
+        } else {
+            out += "-ASK " + std::to_string(slot) + " " + address(to) + "\r\n";
+        }
+        return false;
+    }
+    if (asked && _importing[slot].load(std::memory_order_acquire) >= 0) return true;
+    if (o < 0) {
+        out += "-CLUSTERDOWN Hash slot not served\r\n";
+    } else {
+        out += "-MOVED " + std::to_string(slot) + " " + address(o) + "\r\n";
+    }
+    return false;
+}
+
+std::string Cluster::slots() {
+    std::shared_lock<std::shared_mutex> l(_m);
+    std::string out;
+    size_t n = 0;
+    for (size_t idx = 0 ; idx < _nodes.size() ; ++idx) {
+        auto& node = _nodes[idx];
+        for (auto [first, last] : ranges([&] (size_t s) { return owner(s) == static_cast<int>(idx); })) {
+            out += "*3\r\n" + net::resp::integer(first) + net::resp::integer(last);
+            out += "*3\r\n" + net::resp::bulk(node.host) + net::resp::integer(node.port) + net::resp::bulk(node.id);
+            ++n;
+        }
+    }
+    return "*" + std::to_string(n) + "\r\n" + out;
+}
+
+std::string Cluster::shards() {
+    std::shared_lock<std::shared_mutex> l(_m);
+    std::string out = "*" + std::to_string(_nodes.size()) + "\r\n";
+    for (size_t idx = 0 ; idx < _nodes.size() ; ++idx) {
+        auto& node = _nodes[idx];
+        auto r = ranges([&] (size_t s) { return owner(s) == static_cast<int>(idx); });
+        out += "%2\r\n" + net::resp::bulk("slots") + "*" + std::to_string(r.size() * 2) + "\r\n";
+        for (auto [first, last] : r) out += net::resp::integer(first) + net::resp::integer(last);
+        out += net::resp::bulk("nodes") + "*1\r\n%6\r\n";
+        out += net::resp::bulk("id") + net::resp::bulk(node.id);
+        out += net::resp::bulk("port") + net::resp::integer(node.port);
+        out += net::resp::bulk("ip") + net::resp::bulk(node.host);
+        out += net::resp::bulk("endpoint") + net::resp::bulk(node.host);
+        out += net::resp::bulk("role") + net::resp::bulk("master");
+        out += net::resp::bulk("health") + net::resp::bulk("online");
+    }
+    return out;
+}
+
+std::string Cluster::nodes() {
+    // <id> <ip:port@cport> <flags> <master> <ping-sent> <pong-recv> <config-epoch> <link-state> <slot>...
+    std::shared_lock<std::shared_mutex> l(_m);
+    std::string text;
+    for (size_t idx = 0 ; idx < _nodes.size() ; ++idx) {
+        auto& node = _nodes[idx];
+        text += node.id + " " + node.host + ":" + std::to_string(node.port) + "@0 ";
+        text += idx == 0 ? "myself,master" : "master";
+        text += " - 0 0 " + std::to_string(node.epoch) + " connected";
+        for (auto [first, last] : ranges([&] (size_t s) { return owner(s) == static_cast<int>(idx); })) {
+            text += ' ';
+            text += std::to_string(first);
+            if (last != first) {
+                text += '-';
+                text += std::to_string(last);
+            }
+        }
+        text += "\n";
+    }
+    return net::resp::bulk(text);
+}
+
+std::string Cluster::setslot(const net::resp::Command& cmd) {
+    // CLUSTER SETSLOT <slot> IMPORTING <id> | MIGRATING <id> | NODE <id> | STABLE
+    uint16_t slot;
+    if (cmd.argc() < 4 || !parse_slot(cmd.argv[2], slot)) return "-ERR Invalid or out of range slot\r\n";
+    net::resp::Command how{{cmd.argv[3]}};
+    std::unique_lock<std::shared_mutex> l(_m);
+    if (how.is("STABLE") && cmd.argc() == 4) {
+        _migrating[slot] = -1;
+        _importing[slot] = -1;
+        return net::resp::ok();
+    }
+    if (cmd.argc() != 5) return "-ERR syntax error\r\n";
+    int idx = find(cmd.argv[4]);
+    if (idx < 0) return "-ERR I don't know about node " + std::string(cmd.argv[4]) + "\r\n";
+    if (how.is("MIGRATING")) {
+        if (owner(slot) != 0) return "-ERR I'm not the owner of hash slot " + std::to_string(slot) + "\r\n";
+        if (idx == 0) return "-ERR I can't migrate to myself\r\n";
+        _migrating[slot] = static_cast<int16_t>(idx);
+    } else if (how.is("IMPORTING")) {
+        if (owner(slot) == 0) return "-ERR I'm already the owner of hash slot " + std::to_string(slot) + "\r\n";
+        if (idx == 0) return "-ERR I can't import from myself\r\n";
+        _importing[slot] = static_cast<int16_t>(idx);
+    } else if (how.is("NODE")) {
+        if (idx == 0 && owner(slot) != 0) {
+            // the new owner's claim has to win over the old one's
+            uint64_t top = 0;
+            for (auto& n : _nodes) top = std::max(top, n.epoch);
+            _nodes[0].epoch = top + 1;
+        }
+        assign(slot, idx);
+    } else {
+        return "-ERR syntax error\r\n";
+    }
+    return net::resp::ok();
+}
+
+std::string Cluster::gossip_message() {
+    std::shared_lock<std::shared_mutex> l(_m);
+    std::string claims;
+    for (auto [first, last] : ranges([&] (size_t s) { return owner(s) == 0; })) {
+        if (!claims.empty()) claims += ",";
+        claims += std::to_string(first);
+        if (last != first) claims += "-" + std::to_string(last);
+    }
+    if (claims.empty()) claims = "-";
+    std::string port = std::to_string(_nodes[0].port);
+    std::string epoch = std::to_string(_nodes[0].epoch);
+    commands::Args argv = {"CLUSTER", "GOSSIP", _myid, _nodes[0].host, port, epoch, claims};
+    std::vector<std::string> ports;
+    ports.reserve(_nodes.size());
+    for (size_t idx = 1 ; idx < _nodes.size() ; ++idx) {
+        ports.push_back(std::to_string(_nodes[idx].port));
+        argv.insert(argv.end(), {_nodes[idx].id, _nodes[idx].host, ports.back()});
+    }
+    std::string out;
+    encode(argv, out);
+    return out;
+}
+
+std::string Cluster::gossiped(const net::resp::Command& cmd) {
+    int64_t port, epoch;
+    if (cmd.argc() < 7 || (cmd.argc() - 7) % 3 != 0 || !parse_int(cmd.argv[4], port)
+        || !parse_int(cmd.argv[5], epoch) || port <= 0 || port > 65535 || epoch < 0) {
+        return "-ERR syntax error\r\n";
+    }
+    std::unique_lock<std::shared_mutex> l(_m);
+    if (cmd.argv[2] == _myid) return net::resp::ok();
+    int idx = node(cmd.argv[2], cmd.argv[3], static_cast<unsigned short>(port));
+    _nodes[idx].epoch = static_cast<uint64_t>(epoch);
+
+    // "0-5460,5461" or "-"
+    std::string_view claims = cmd.argv[6];
+    while (claims != "-" && !claims.empty()) {
+        size_t comma = claims.find(',');
+        std::string_view range = claims.substr(0, comma);
+        claims = comma == std::string_view::npos ? std::string_view() : claims.substr(comma + 1);
+        size_t dash = range.find('-');
+        uint16_t first, last;
+        if (!parse_slot(range.substr(0, dash), first)) break;
+        last = first;
+        if (dash != std::string_view::npos && !parse_slot(range.substr(dash + 1), last)) break;
+        for (size_t s = first ; s <= last ; ++s) {
+            int cur = owner(s);
+            if (cur == idx) continue;
+            if (cur < 0 || _nodes[idx].epoch > _nodes[cur].epoch
+                || (_nodes[idx].epoch == _nodes[cur].epoch && _nodes[idx].id < _nodes[cur].id)) {
+                assign(static_cast<uint16_t>(s), idx);
+            }
+        }
+    }
+    // the nodes the sender knows
+    for (size_t k = 7 ; k + 2 < cmd.argc() ; k += 3) {
+        if (find(cmd.argv[k]) >= 0 || !parse_int(cmd.argv[k + 2], port) || port <= 0 || port > 65535) continue;
+        node(cmd.argv[k], cmd.argv[k + 1], static_cast<unsigned short>(port));
+    }
+    return net::resp::ok();
+}
+
+void Cluster::gossip() {
+    std::vector<std::unique_ptr<Link>> links;
+    auto next = std::chrono::steady_clock::now();
+    while (!_stop) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        if (std::chrono::steady_clock::now() < next) continue;
+        next += _interval;
+
+        std::string msg = gossip_message();
+        std::vector<std::pair<std::string, unsigned short>> peers;
+        {
+            std::shared_lock<std::shared_mutex> l(_m);
+            for (size_t idx = 1 ; idx < _nodes.size() ; ++idx) peers.emplace_back(_nodes[idx].host, _nodes[idx].port);
+        }
+        links.resize(peers.size() + 1);
+        for (size_t idx = 1 ; idx < links.size() ; ++idx) {
+            auto& link = links[idx];
+            if (link == nullptr || !link->ok()) link = std::make_unique<Link>(peers[idx - 1].first, peers[idx - 1].second);
+            std::string reply;
+            if (!link->send(msg) || !link->line(reply)) link->close();
+        }
+    }
+}
+
+bool Cluster::in_flight(const commands::Args& argv, commands::KeyRange keys) {
+    std::lock_guard<std::mutex> l(_flight_m);
+    if (_in_flight.empty()) return false;
+    for (int k = keys.first ; k <= keys.last ; k += keys.step) {
+        if (_in_flight.find(argv[k]) != _in_flight.end()) return true;
+    }
+    return false;
+}
+
+std::vector<std::string> Cluster::keys_in_slot(uint16_t slot, size_t max) {
+    std::vector<std::string> keys;
+    auto& ks = _table.keyspace();
+    for (size_t k = 0 ; k < store::Keyspace::k_shards && keys.size() < max ; ++k) {
+        auto& shard = ks.shard(k);
+        std::lock_guard<std::mutex> l(shard.m);
+        auto g = shard.groups.find(slot);
+        if (g == shard.groups.end()) continue;
+        for (auto key : g->second) {
+            keys.emplace_back(key);
+            if (keys.size() == max) break;
+        }
+    }
+    return keys;
+}
+
+size_t Cluster::count_in_slot(uint16_t slot) {
+    size_t n = 0;
+    auto& ks = _table.keyspace();
+    for (size_t k = 0 ; k < store::Keyspace::k_shards ; ++k) {
+        auto& shard = ks.shard(k);
+        std::lock_guard<std::mutex> l(shard.m);
+        auto g = shard.groups.find(slot);
+        if (g != shard.groups.end()) n += g->second.size();
+    }
+    return n;
+}
+
+std::string Cluster::move_slot(uint16_t slot, std::string_view node_id, size_t batch) {
+    if (owner(slot) != 0) return "-ERR I'm not the owner of hash slot " + std::to_string(slot) + "\r\n";
+    int idx;
+    std::string host;
+    unsigned short port;
+    {
+        std::shared_lock<std::shared_mutex> l(_m);
+        idx = find(node_id);
+        if (idx <= 0) return "-ERR I don't know about node " + std::string(node_id) + "\r\n";
+        host = _nodes[idx].host;
+        port = _nodes[idx].port;
+    }
+    Link target(host, port);
+    std::string slot_s = std::to_string(slot);
+    if (!target.call({"CLUSTER", "SETSLOT", slot_s, "IMPORTING", _myid})) {
+        return "-IOERR target node refused to import the slot\r\n";
+    }
+    // from now on missing keys are asked to the target, no new key shows up
+    // here and one pass over the keyspace finds every key to move
+    _migrating[slot] = static_cast<int16_t>(idx);
+    std::vector<std::string> keys = keys_in_slot(slot, SIZE_MAX);
+
+    const commands::Spec* del = _table.lookup("DEL");
+    int64_t moved = 0;
+    for (size_t from = 0 ; from < keys.size() ; from += batch) {
+        size_t to = std::min(keys.size(), from + batch);
+        uint64_t mask = 0;
+        for (size_t k = from ; k < to ; ++k) {
+            mask |= uint64_t(1) << store::Keyspace::shard_index(store::Keyspace::hash(keys[k]));
+        }
+        // the batch is copied under its shards' locks, and sent without
+        // them : meanwhile its keys are only refused writes
+        _table.lock(mask);
+        std::string req;
+        size_t sent = 0;
+        commands::Args gone = {"DEL"};
+        auto& ks = _table.keyspace();
+        for (size_t k = from ; k < to ; ++k) {
+            auto* v = ks.peek(keys[k]);
+            if (v == nullptr) continue;
+            commands::recreate(keys[k], *v, ks.deadline(keys[k]), [&] (const commands::Args& argv) {
+                encode({"ASKING"}, req);
+                encode(argv, req);
+                sent += 2;
+            });
+            gone.push_back(keys[k]);
+        }
+        {
+            std::lock_guard<std::mutex> l(_flight_m);
+            for (size_t k = 1 ; k < gone.size() ; ++k) _in_flight.emplace(gone[k]);
+        }
+        _table.unlock(mask);
+
+        bool ok = target.send(req);
+        std::string reply;
+        // one reply per command, none of them an error
+        for (size_t k = 0 ; ok && k < sent ; ++k) {
+            ok = target.line(reply) && !reply.empty() && reply[0] != '-';
+        }
+        _table.lock(mask);
+        if (ok && gone.size() > 1) {
+            // through the table, replicas see the keys leave
+            std::string out;
+            _table.call_locked(*del, gone, out);
+            moved += static_cast<int64_t>(gone.size() - 1);
+        }
+        {
+            std::lock_guard<std::mutex> l(_flight_m);
+            for (size_t k = 1 ; k < gone.size() ; ++k) _in_flight.erase(_in_flight.find(gone[k]));
+        }
+        _table.unlock(mask);
+        if (!ok) return "-IOERR error moving keys to the target node, slot " + slot_s + " left migrating\r\n";
+    }
+
+    if (!target.call({"CLUSTER", "SETSLOT", slot_s, "NODE", node_id})) {
+        return "-IOERR target node refused the slot, slot " + slot_s + " left migrating\r\n";
+    }
+    {
+        std::unique_lock<std::shared_mutex> l(_m);
+        assign(slot, idx);
+    }
+    return net::resp::integer(moved);
+}
+
+std::string Cluster::cluster(const net::resp::Command& cmd) {
+    if (cmd.argc() < 2) return net::resp::wrong_arity("cluster");
+    net::resp::Command sub{{cmd.argv[1]}};
+    uint16_t slot;
+    if (sub.is("KEYSLOT") && cmd.argc() == 3) return net::resp::integer(key_slot(cmd.argv[2]));
+    if (sub.is("MYID")) return net::resp::bulk(_myid);
+    if (sub.is("SLOTS")) return slots();
+    if (sub.is("SHARDS")) return shards();
+    if (sub.is("NODES")) return nodes();
+    if (sub.is("INFO")) {
+        size_t assigned = 0;
+        for (size_t s = 0 ; s < k_slots ; ++s) assigned += owner(s) >= 0 ? 1 : 0;
+        size_t known;
+        uint64_t epoch;
+        {
+            std::shared_lock<std::shared_mutex> l(_m);
+            known = _nodes.size();
+            epoch = _nodes[0].epoch;
+        }
+        return net::resp::bulk("cluster_state:" + std::string(assigned == k_slots ? "ok" : "fail") + "\r\n"
+            + "cluster_slots_assigned:" + std::to_string(assigned) + "\r\n"
+            + "cluster_known_nodes:" + std::to_string(known) + "\r\n"
+            + "cluster_my_epoch:" + std::to_string(epoch) + "\r\n");
+    }
+    if (sub.is("ADDSLOTS") || sub.is("ADDSLOTSRANGE")) {
+        bool range = sub.is("ADDSLOTSRANGE");
+        if (cmd.argc() < 3 || (range && cmd.argc() % 2 != 0)) return net::resp::wrong_arity("cluster|addslots");
+        std::vector<std::pair<uint16_t, uint16_t>> wanted;
+        for (size_t k = 2 ; k < cmd.argc() ; k += range ? 2 : 1) {
+            uint16_t first, last;
+            if (!parse_slot(cmd.argv[k], first) || (range && !parse_slot(cmd.argv[k + 1], last))) {
+                return "-ERR Invalid or out of range slot\r\n";
+            }
+            if (!range) last = first;
+            if (last < first) return "-ERR start slot number is greater than end slot number\r\n";
+            for (size_t s = first ; s <= last ; ++s) {
+                if (owner(s) >= 0) return "-ERR Slot " + std::to_string(s) + " is already busy\r\n";
+            }
+            wanted.emplace_back(first, last);
+        }
+        for (auto [first, last] : wanted) add_slots(first, last);
+        return net::resp::ok();
+    }
+    if (sub.is("MEET") && cmd.argc() == 4) {
+        // introduces ourselves, the node gossips back once it knows us
+        int64_t port;
+        if (!parse_int(cmd.argv[3], port) || port <= 0 || port > 65535) return "-ERR Invalid node address\r\n";
+        Link link{std::string(cmd.argv[2]), static_cast<unsigned short>(port)};
+        std::string reply;
+        if (!link.send(gossip_message()) || !link.line(reply) || reply != "+OK") {
+            return "-ERR unable to reach " + std::string(cmd.argv[2]) + ":" + std::to_string(port) + "\r\n";
+        }
+        return net::resp::ok();
+    }
+    if (sub.is("GOSSIP")) return gossiped(cmd);
+    if (sub.is("SETSLOT")) return setslot(cmd);
+    if (sub.is("COUNTKEYSINSLOT") && cmd.argc() == 3) {
+        if (!parse_slot(cmd.argv[2], slot)) return "-ERR Invalid slot\r\n";
+        return net::resp::integer(static_cast<int64_t>(count_in_slot(slot)));
+    }
+    if (sub.is("GETKEYSINSLOT") && cmd.argc() == 4) {
+        int64_t count;
+        if (!parse_slot(cmd.argv[2], slot)) return "-ERR Invalid slot\r\n";
+        if (!parse_int(cmd.argv[3], count) || count < 0) return "-ERR Invalid number of keys\r\n";
+        auto keys = keys_in_slot(slot, static_cast<size_t>(count));
+        std::string out = "*" + std::to_string(keys.size()) + "\r\n";
+        for (auto& k : keys) out += net::resp::bulk(k);
+        return out;
+    }
+    if (sub.is("MOVESLOT") && (cmd.argc() == 4 || cmd.argc() == 5)) {
+        int64_t batch = k_default_batch;
+        if (!parse_slot(cmd.argv[2], slot)) return "-ERR Invalid or out of range slot\r\n";
+        if (cmd.argc() == 5 && (!parse_int(cmd.argv[4], batch) || batch <= 0)) return "-ERR Invalid batch size\r\n";
+        return move_slot(slot, cmd.argv[3], static_cast<size_t>(batch));
+    }
+    return "-ERR unknown subcommand '" + std::string(cmd.argv[1]) + "'\r\n";
+}
+
+bool Cluster::handle(int fd, const net::resp::Command& cmd) {
+    std::string reply;
+    if (cmd.is("CLUSTER")) {
+        reply = cluster(cmd);
+    } else if (cmd.is("ASKING")) {
+        _asking.at(fd) = true;
+        reply = net::resp::ok();
+    } else {
+        return false;
+    }
+    net::write_stream(fd, reply.c_str(), reply.size());
+    return true;
+}
+
+void Cluster::attach(net::resp::Redis& r) {
+    using Chain = ChainOfResponsibility::Chain<int, net::resp::Redis::T&&>;
+    r.attach([this] (int connfd, net::resp::Redis::T&& msg, Chain next) {
+        if (auto* node = std::get_if<std::unique_ptr<data::Node>>(&msg)) {
+            auto cmd = net::resp::as_command(node->get());
+            if (cmd.has_value() && handle(connfd, *cmd)) return;
+        }
+        next(connfd, std::move(msg));
+    });
+    r.on_close([this] (int connfd) {
+        _asking.reset(connfd);
+    });
+}
+
+} // namespace cluster
@@ -0,0 +1,521 @@
+#include "commands/batch.h"
+#include "resp/resp_utils.h"
+
+#include <algorithm>
+#include <charconv>
+#include <mutex>
+
+namespace commands {
+
+namespace {
+
+enum class Op : uint8_t { CALL, MOVE, ADD, SUB, MUL, JUMP_UNLESS, JUMP, RETURN };
+
+// JUMP_UNLESS tests, SET checks that a value is not nil
+enum class Cond : uint8_t { SET, EQ, NE, LT, LE, GT, GE };
+
+struct Operand {
+    enum Kind : uint8_t { LITERAL, KEY, ARG, REG } kind;
+    // literal, KEYS, ARGV (0-based) or register index
+    uint32_t index;
+};
+
+struct Instr {
+    Op op;
+    Cond cond = Cond::SET;
+    // register receiving the result, -1 for none
+    int32_t dst = -1;
+    // operands[first, first + count)
+    uint32_t first = 0;
+    uint32_t count = 0;
+    const Spec* spec = nullptr;
+    // jumps only
+    uint32_t target = 0;
+};
+
+// a register : what a command replied, decoded when it is a scalar
+struct Reg {
+    enum Kind : uint8_t { NIL, INT, STR, RAW } kind = NIL;
+    std::string s;
+};
+
+struct Val {
+    Reg::Kind kind;
+    std::string_view s;
+};
+
+struct Token {
+    std::string text;
+    bool quoted;
+};
+
+bool parse_int(std::string_view s, int64_t& v) {
+    auto res = std::from_chars(s.data(), s.data() + s.size(), v);
+    return !s.empty() && res.ec == std::errc() && res.ptr == s.data() + s.size();
+}
+
+bool is_word(const Token& t, std::string_view w) {
+    return !t.quoted && net::resp::Command{{t.text}}.is(w);
+}
+
+// "KEYS[3]" -> 2
+bool parse_index(std::string_view s, std::string_view prefix, uint32_t& idx) {
+    if (s.size() < prefix.size() + 3 || s.substr(0, prefix.size()) != prefix) return false;
+    if (s[prefix.size()] != '[' || s.back() != ']') return false;
+    int64_t v;
+    if (!parse_int(s.substr(prefix.size() + 1, s.size() - prefix.size() - 2), v)) return false;
+    if (v < 1 || v > UINT32_MAX) return false;
+    idx = static_cast<uint32_t>(v - 1);
+    return true;
+}
+
+// a reply appended by Table::call_locked, false for an error
+bool decode(const std::string& r, Reg& reg) {
+    switch (r[0]) {
+    case '-':
+        return false;
+    case '_':
+        reg.kind = Reg::NIL;
+        reg.s.clear();
+        break;
+    case ':':
+        reg.kind = Reg::INT;
+        reg.s.assign(r, 1, r.size() - 3);
+        break;
+    case '+':
+        reg.kind = Reg::STR;
+        reg.s.assign(r, 1, r.size() - 3);
+        break;
+    case '$': {
+        size_t p = r.find('\r');
+        reg.kind = Reg::STR;
+        reg.s.assign(r, p + 2, r.size() - p - 4);
+        break;
+    }
+    default:
+        reg.kind = Reg::RAW;
+        reg.s = r;
+    }
+    return true;
+}
+
+std::string reply(const Val& v) {
+    switch (v.kind) {
+    case Reg::NIL: return net::resp::null();
+    case Reg::INT: return ":" + std::string(v.s) + "\r\n";
+    case Reg::STR: return net::resp::bulk(v.s);
+    default:       return std::string(v.s);
+    }
+}
+
+bool test(Cond c, const Val& a, const Val* b) {
+    if (c == Cond::SET) return a.kind != Reg::NIL;
+    if (c == Cond::EQ || c == Cond::NE) {
+        bool eq = (a.kind == Reg::NIL) == (b->kind == Reg::NIL) && a.s == b->s;
+        return c == Cond::EQ ? eq : !eq;
+    }
+    int64_t x, y;
+    if (!parse_int(a.s, x) || !parse_int(b->s, y)) return false;
+    switch (c) {
+    case Cond::LT: return x < y;
+    case Cond::LE: return x <= y;
+    case Cond::GT: return x > y;
+    default:       return x >= y;
+    }
+}
+
+} // namespace
+
+struct Batches::Program {
+    std::vector<Instr> code;
+    std::vector<Operand> operands;
+    std::vector<std::string> literals;
+    uint32_t registers = 0;
+    // number of KEYS and ARGV a call has to pass at least
+    uint32_t keys = 0;
+    uint32_t args = 0;
+};
+
+namespace {
+
+class Compiler {
+public:
+    Compiler(const Table& table, Batches::Program& p) : _table(table), _p(p) {}
+
+    std::optional<std::string> compile(std::string_view src) {
+        size_t line = 0;
+        size_t pos = 0;
+        while (pos <= src.size()) {
+            ++line;
+            std::vector<Token> tokens;
+            if (auto e = tokenize(src, pos, tokens)) return at(line, *e);
+            if (tokens.empty()) continue;
+            if (auto e = statement(tokens)) return at(line, *e);
+        }
+        if (!_blocks.empty()) return std::string("IF without END");
+        return std::nullopt;
+    }
+
+private:
+    static std::string at(size_t line, const std::string& e) {
+        return "line " + std::to_string(line) + ": " + e;
+    }
+
+    // one statement, up to a newline or ';' outside quotes
+    static std::optional<std::string> tokenize(std::string_view src, size_t& pos, std::vector<Token>& out) {
+        while (pos < src.size()) {
+            char c = src[pos];
+            if (c == '\n' || c == ';') {
+                ++pos;
+                return std::nullopt;
+            }
+            if (c == ' ' || c == '\t' || c == '\r') {
+                ++pos;
+                continue;
+            }
+            Token t{"", c == '"'};
+            if (t.quoted) {
+                ++pos;
+                while (pos < src.size() && src[pos] != '"') {
+                    if (src[pos] == '\\' && pos + 1 < src.size()) ++pos;
+                    t.text += src[pos++];
+                }
+                if (pos == src.size()) return std::string("unterminated string");
+                ++pos;
+            } else {
+                while (pos < src.size() && std::string_view(" \t\r\n;").find(src[pos]) == std::string_view::npos) {
+                    t.text += src[pos++];
+                }
+            }
+            out.push_back(std::move(t));
+        }
+        ++pos;
+        return std::nullopt;
+    }
+
+    Operand operand(const Token& t) {
+        Operand o{Operand::LITERAL, 0};
+        if (!t.quoted && t.text.size() > 1 && t.text[0] == '$') {
+            auto [it, fresh] = _regs.emplace(t.text.substr(1), _p.registers);
+            if (fresh) ++_p.registers;
+            o = {Operand::REG, it->second};
+        } else if (!t.quoted && parse_index(t.text, "KEYS", o.index)) {
+            o.kind = Operand::KEY;
+            _p.keys = std::max(_p.keys, o.index + 1);
+        } else if (!t.quoted && parse_index(t.text, "ARGV", o.index)) {
+            o.kind = Operand::ARG;
+            _p.args = std::max(_p.args, o.index + 1);
+        } else {
+            o.index = static_cast<uint32_t>(_p.literals.size());
+            _p.literals.push_back(t.text);
+        }
+        return o;
+    }
+
+    Instr emit(Op op, const std::vector<Token>& tokens, size_t from) {
+        Instr in{op};
+        in.first = static_cast<uint32_t>(_p.operands.size());
+        in.count = static_cast<uint32_t>(tokens.size() - from);
+        for (size_t k = from ; k < tokens.size() ; ++k) {
+            _p.operands.push_back(operand(tokens[k]));
+        }
+        return in;
+    }
+
+    std::optional<std::string> condition(const std::vector<Token>& tokens) {
+        static const std::pair<std::string_view, Cond> k_conds[] = {
+            {"==", Cond::EQ}, {"!=", Cond::NE}, {"<", Cond::LT},
+            {"<=", Cond::LE}, {">", Cond::GT}, {">=", Cond::GE},
+        };
+        Instr in{Op::JUMP_UNLESS};
+        in.first = static_cast<uint32_t>(_p.operands.size());
+        if (tokens.size() == 2) {
+            in.count = 1;
+            _p.operands.push_back(operand(tokens[1]));
+        } else if (tokens.size() == 4 && !tokens[2].quoted) {
+            auto it = std::find_if(std::begin(k_conds), std::end(k_conds),
+                                   [&] (auto& c) { return c.first == tokens[2].text; });
+            if (it == std::end(k_conds)) return "unknown comparison '" + tokens[2].text + "'";
+            in.cond = it->second;
+            in.count = 2;
+            _p.operands.push_back(operand(tokens[1]));
+            _p.operands.push_back(operand(tokens[3]));
+        } else {
+            return std::string("IF takes a value or a comparison");
+        }
+        _blocks.push_back({static_cast<uint32_t>(_p.code.size()), false});
+        _p.code.push_back(in);
+        return std::nullopt;
+    }
+
+    std::optional<std::string> command(const std::vector<Token>& tokens, size_t from, int32_t dst) {
+        size_t argc = tokens.size() - from;
+        const Token& name = tokens[from];
+        static const std::pair<std::string_view, Op> k_ops[] = {
+            {"ADD", Op::ADD}, {"SUB", Op::SUB}, {"MUL", Op::MUL},
+        };
+        for (auto& [w, op] : k_ops) {
+            if (!is_word(name, w)) continue;
+            if (dst < 0) return std::string(w) + " needs a register to store into";
+            if (argc != 3) return std::string(w) + " takes two operands";
+            Instr in = emit(op, tokens, from + 1);
+            in.dst = dst;
+            _p.code.push_back(in);
+            return std::nullopt;
+        }
+
+        const Spec* spec = name.quoted ? nullptr : _table.lookup(name.text);
+        if (spec == nullptr) {
+            // $x = <value>
+            if (dst >= 0 && argc == 1) {
+                Instr in = emit(Op::MOVE, tokens, from);
+                in.dst = dst;
+                _p.code.push_back(in);
+                return std::nullopt;
+            }
+            return "unknown command '" + name.text + "'";
+        }
+        // STREAMS_KEYS ones have their keys wherever STREAMS lands
+        if (spec->flags & (ALL_KEYS | STREAMS_KEYS)) return "'" + name.text + "' is not allowed in a batch";
+        if (!Table::arity_ok(*spec, argc)) return "wrong number of arguments for '" + name.text + "'";
+
+        Instr in = emit(Op::CALL, tokens, from);
+        in.spec = spec;
+        in.dst = dst;
+        // every key has to come from KEYS so that its shard is locked
+        if (spec->first_key > 0) {
+            int last = spec->last_key < 0 ? static_cast<int>(argc) + spec->last_key : spec->last_key;
+            for (int k = spec->first_key ; k <= last && k < static_cast<int>(argc) ; k += spec->step) {
+                if (_p.operands[in.first + k].kind != Operand::KEY) {
+                    return "keys of '" + name.text + "' must be given as KEYS[i]";
+                }
+            }
+        }
+        _p.code.push_back(in);
+        return std::nullopt;
+    }
+
+    std::optional<std::string> statement(const std::vector<Token>& tokens) {
+        const Token& first = tokens[0];
+        if (is_word(first, "IF")) return condition(tokens);
+        if (is_word(first, "ELSE")) {
+            if (tokens.size() != 1) return std::string("ELSE takes no argument");
+            if (_blocks.empty() || _blocks.back().second) return std::string("ELSE without IF");
+            // the IF branch jumps over the ELSE one
+            _p.code.push_back(Instr{Op::JUMP});
+            _p.code[_blocks.back().first].target = static_cast<uint32_t>(_p.code.size());
+            _blocks.back() = {static_cast<uint32_t>(_p.code.size() - 1), true};
+            return std::nullopt;
+        }
+        if (is_word(first, "END")) {
+            if (tokens.size() != 1) return std::string("END takes no argument");
+            if (_blocks.empty()) return std::string("END without IF");
+            _p.code[_blocks.back().first].target = static_cast<uint32_t>(_p.code.size());
+            _blocks.pop_back();
+            return std::nullopt;
+        }
+        if (is_word(first, "RETURN")) {
+            if (tokens.size() != 2) return std::string("RETURN takes one value");
+            _p.code.push_back(emit(Op::RETURN, tokens, 1));
+            return std::nullopt;
+        }
+        if (!first.quoted && first.text.size() > 1 && first.text[0] == '$') {
+            if (tokens.size() < 3 || tokens[1].quoted || tokens[1].text != "=") {
+                return "expected '" + first.text + " = ...'";
+            }
+            int32_t dst = static_cast<int32_t>(operand(first).index);
+            return command(tokens, 2, dst);
+        }
+        return command(tokens, 0, -1);
+    }
+
+    const Table& _table;
+    Batches::Program& _p;
+    std::unordered_map<std::string, uint32_t> _regs;
+    // open IFs : index of their pending jump, whether ELSE was seen
+    std::vector<std::pair<uint32_t, bool>> _blocks;
+};
+
+class Runner {
+public:
+    Runner(Table& table, const Batches::Program& p, const Args& keys, const Args& args)
+        : _table(table), _p(p), _keys(keys), _args(args), _regs(p.registers) {}
+
+    // the shards of every key are locked
+    std::string run() {
+        std::string last = net::resp::null();
+        std::string out;
+        Args argv;
+        for (size_t pc = 0 ; pc < _p.code.size() ; ) {
+            const Instr& in = _p.code[pc++];
+            switch (in.op) {
+            case Op::CALL: {
+                argv.clear();
+                for (uint32_t k = 0 ; k < in.count ; ++k) {
+                    Val v = value(in.first + k);
+                    if (v.kind == Reg::NIL) {
+                        return "-ERR batch passed a nil value to '" + std::string(in.spec->name) + "'\r\n";
+                    }
+                    argv.push_back(v.s);
+                }
+                out.clear();
+                _table.call_locked(*in.spec, argv, out);
+                if (in.dst >= 0) {
+                    if (!decode(out, _regs[in.dst])) return out;
+                } else if (out[0] == '-') {
+                    return out;
+                }
+                last.swap(out);
+                break;
+            }
+            case Op::MOVE: {
+                Val v = value(in.first);
+                Reg r{v.kind, std::string(v.s)};
+                _regs[in.dst] = std::move(r);
+                break;
+            }
+            case Op::ADD:
+            case Op::SUB:
+            case Op::MUL: {
+                int64_t a, b, res;
+                if (!parse_int(value(in.first).s, a) || !parse_int(value(in.first + 1).s, b)) {
+                    return "-ERR batch arithmetic on a value that is not an integer\r\n";
+                }
+                bool overflow = in.op == Op::ADD ? __builtin_add_overflow(a, b, &res)
+                              : in.op == Op::SUB ? __builtin_sub_overflow(a, b, &res)
+                                                 : __builtin_mul_overflow(a, b, &res);
+                if (overflow) return "-ERR batch arithmetic would overflow\r\n";
+                _regs[in.dst] = {Reg::INT, std::to_string(res)};
+                break;
+            }
+            case Op::JUMP_UNLESS: {
+                Val a = value(in.first);
+                Val b = in.count == 2 ? value(in.first + 1) : a;
+                if (!test(in.cond, a, &b)) pc = in.target;
+                break;
+            }
+            case Op::JUMP:
+                pc = in.target;
+                break;
+            case Op::RETURN:
+                return reply(value(in.first));
+            }
+        }
+        return last;
+    }
+
+private:
+    Val value(uint32_t idx) const {
+        const Operand& o = _p.operands[idx];
+        switch (o.kind) {
+        case Operand::KEY: return {Reg::STR, _keys[o.index]};
+        case Operand::ARG: return {Reg::STR, _args[o.index]};
+        case Operand::REG: return {_regs[o.index].kind, _regs[o.index].s};
+        default:           return {Reg::STR, _p.literals[o.index]};
+        }
+    }
+
+    Table& _table;
+    const Batches::Program& _p;
+    const Args& _keys;
+    const Args& _args;
+    std::vector<Reg> _regs;
+};
+
+} // namespace
+
+Batches::Batches(Table& table) : _table(table) {}
+
+Batches::~Batches() = default;
+
+std::optional<std::string> Batches::define(std::string_view name, std::string_view source) {
+    auto p = std::make_shared<Program>();
+    if (auto e = Compiler(_table, *p).compile(source)) return e;
+    std::unique_lock<std::shared_mutex> l(_m);
+    _programs.insert_or_assign(std::string(name), std::move(p));
+    return std::nullopt;
+}
+
+bool Batches::drop(std::string_view name) {
+    std::unique_lock<std::shared_mutex> l(_m);
+    auto it = _programs.find(name);
+    if (it == _programs.end()) return false;
+    _programs.erase(it);
+    return true;
+}
+
+std::string Batches::call(std::string_view name, const Args& keys, const Args& args, int fd) {
+    std::shared_ptr<const Program> p;
+    {
+        std::shared_lock<std::shared_mutex> l(_m);
+        auto it = _programs.find(name);
+        if (it != _programs.end()) p = it->second;
+    }
+    if (p == nullptr) return "-ERR no such batch '" + std::string(name) + "'\r\n";
+    if (keys.size() < p->keys || args.size() < p->args) {
+        return "-ERR batch '" + std::string(name) + "' needs " + std::to_string(p->keys) + " keys and "
+             + std::to_string(p->args) + " arguments\r\n";
+    }
+
+    uint64_t mask = 0;
+    for (auto k : keys) {
+        mask |= uint64_t(1) << store::Keyspace::shard_index(store::Keyspace::hash(k));
+    }
+    // the client's call is checked as one command on all those keys
+    // (-MOVED, -CROSSSLOT...)
+    static const Spec k_call = {"BATCH.CALL", -3, WRITE, 1, -1, 1, nullptr};
+    Args argv = {"BATCH.CALL"};
+    argv.insert(argv.end(), keys.begin(), keys.end());
+    std::string out;
+    _table.lock(mask);
+    if (fd < 0 || _table.allowed(fd, k_call, argv, out)) out = Runner(_table, *p, keys, args).run();
+    _table.unlock(mask);
+    return out;
+}
+
+bool Batches::handle(int fd, const net::resp::Command& cmd) {
+    std::string reply;
+    if (cmd.is("BATCH.DEFINE")) {
+        if (cmd.argc() != 3) {
+            reply = net::resp::wrong_arity("batch.define");
+        } else if (auto e = define(cmd.argv[1], cmd.argv[2])) {
+            reply = net::resp::err(*e);
+        } else {
+            reply = net::resp::ok();
+        }
+    } else if (cmd.is("BATCH.CALL")) {
+        int64_t numkeys;
+        if (cmd.argc() < 3) {
+            reply = net::resp::wrong_arity("batch.call");
+        } else if (!parse_int(cmd.argv[2], numkeys) || numkeys < 0) {
+            reply = "-ERR value is not an integer or out of range\r\n";
+        } else if (static_cast<uint64_t>(numkeys) > cmd.argc() - 3) {
+            reply = "-ERR Number of keys can't be greater than number of args\r\n";
+        } else {
+            auto keys_end = cmd.argv.begin() + 3 + numkeys;
+            Args keys(cmd.argv.begin() + 3, keys_end);
+            Args args(keys_end, cmd.argv.end());
+            reply = call(cmd.argv[1], keys, args, fd);
+        }
+    } else if (cmd.is("BATCH.DROP")) {
+        reply = cmd.argc() != 2 ? net::resp::wrong_arity("batch.drop")
+                                : net::resp::integer(drop(cmd.argv[1]) ? 1 : 0);
+    } else {
+        return false;
+    }
+    net::write_stream(fd, reply.c_str(), reply.size());
+    return true;
+}
+
+void Batches::attach(net::resp::Redis& r) {
+    using Chain = ChainOfResponsibility::Chain<int, net::resp::Redis::T&&>;
+    r.attach([this] (int connfd, net::resp::Redis::T&& msg, Chain next) {
+        if (auto* node = std::get_if<std::unique_ptr<data::Node>>(&msg)) {
+            auto cmd = net::resp::as_command(node->get());
+            if (cmd.has_value() && handle(connfd, *cmd)) return;
+        }
+        next(connfd, std::move(msg));
+    });
+}
+
+} // namespace commands
@@ -0,0 +1,452 @@
+#include "commands/blocking.h"
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <optional>
+#include "resp/resp_utils.h"
+
+namespace commands {
+
+enum WaiterState {
+    PARKED,
+    SERVED,
+    TIMED_OUT,
+    // the client hung up
+    GONE,
+    // a BLMOVE whose list filled while its destination's shard was busy :
+    // the client moves the element itself, under both locks
+    AGAIN
+};
+
+struct Waiter {
+    std::vector<std::string> keys;
+    // the end popped from
+    bool left = true;
+    // BLMOVE only
+    bool move = false;
+    // XREAD / XREADGROUP
+    bool stream = false;
+    std::string dst;
+    bool to_left = true;
+
+    std::atomic<int> state{PARKED};
+    // per key, guarded by the key's shard lock
+    std::vector<WaiterQueue::iterator> pos;
+    std::vector<char> linked;
+
+    // filled by whoever served it : the key and element popped, or the
+    // reply of the LMOVE
+    size_t served = 0;
+    std::string value;
+    coro::Event done;
+};
+
+// set while a write serves parked clients, the pops it issues don't
+static thread_local bool t_serving = false;
+
+static bool settle(Waiter& w, int state) {
+    int parked = PARKED;
+    return w.state.compare_exchange_strong(parked, state, std::memory_order_acq_rel);
+}
+
+static std::optional<std::string> parse_timeout(std::string_view s, int64_t& ms) {
+    double secs;
+    auto res = std::from_chars(s.data(), s.data() + s.size(), secs);
+    if (s.empty() || res.ec != std::errc() || res.ptr != s.data() + s.size()
+        || !std::isfinite(secs) || secs > 1e12) {
+        return "-ERR timeout is not a float or out of range\r\n";
+    }
+    if (secs < 0) return "-ERR timeout is negative\r\n";
+    ms = static_cast<int64_t>(std::ceil(secs * 1000));
+    return {};
+}
+
+static bool parse_side(std::string_view s, bool& left) {
+    net::resp::Command side{{s}};
+    left = side.is("LEFT");
+    return left || side.is("RIGHT");
+}
+
+// where the keys of the blocking list commands are, for the table's guard
+static const Spec k_bpop = {"BLPOP", -3, WRITE, 1, -2, 1, nullptr};
+static const Spec k_blmove = {"BLMOVE", 6, WRITE, 1, 2, 1, nullptr};
+
+static uint64_t shard_bit(std::string_view key) {
+    return uint64_t(1) << store::Keyspace::shard_index(store::Keyspace::hash(key));
+}
+
+Blocking::Blocking(Table& table) : _table(table) {
+    _epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (_epfd < 0) net::die("epoll_create1()");
+    _evfd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (_evfd < 0) net::die("eventfd()");
+    epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.fd = _evfd;
+    if (epoll_ctl(_epfd, EPOLL_CTL_ADD, _evfd, &ev) < 0) net::die("epoll_ctl()");
+    _hangups = std::thread([this] { hangups(); });
+    _hook = _table.after_write([this] (const Spec& spec, const Args& argv) {
+        written(spec, argv);
+    });
+}
+
+Blocking::~Blocking() {
+    _table.drop_after_write(_hook);
+    _stop.store(true, std::memory_order_release);
+    uint64_t one = 1;
+    ssize_t rv = write(_evfd, &one, sizeof(one));
+    (void)rv;
+    _hangups.join();
+    close(_evfd);
+    close(_epfd);
+}
+
+std::string Blocking::pop_or_park(int fd, const Spec& spec, const Args& argv, const std::shared_ptr<Waiter>& w) {
+    uint64_t mask = w->move ? shard_bit(w->dst) : 0;
+    for (auto& key : w->keys) mask |= shard_bit(key);
+    auto& ks = _table.keyspace();
+    std::string out;
+    _table.lock(mask);
+    if (!_table.allowed(fd, spec, argv, out)) {
+        _table.unlock(mask);
+        return out;
+    }
+    for (auto& key : w->keys) {
+        auto* v = ks.peek(key);
+        if (v == nullptr) continue;
+        if (!std::holds_alternative<store::ListPtr>(*v)) {
+            out = "-WRONGTYPE Operation against a key holding the wrong kind of value\r\n";
+            break;
+        }
+        // lists are never empty, this one has something for us
+        if (w->move) {
+            _table.call_locked(*_table.lookup("LMOVE"),
+                               {"LMOVE", key, w->dst, w->left ? "LEFT" : "RIGHT", w->to_left ? "LEFT" : "RIGHT"},
+                               out);
+        } else {
+            std::string popped;
+            _table.call_locked(*_table.lookup(w->left ? "LPOP" : "RPOP"), {w->left ? "LPOP" : "RPOP", key}, popped);
+            out = "*2\r\n" + net::resp::bulk(key) + popped;
+        }
+        break;
+    }
+    if (out.empty()) park(w);
+    _table.unlock(mask);
+    return out;
+}
+
+std::string Blocking::read_or_park(int fd, const std::shared_ptr<Waiter>& w, const Spec& spec,
+                                   std::vector<std::string>& req, size_t ids, bool& resolved) {
+    uint64_t mask = 0;
+    for (auto& key : w->keys) mask |= shard_bit(key);
+    auto& ks = _table.keyspace();
+    std::string out;
+    _table.lock(mask);
+    // every time : the slot may have moved while the client waited
+    if (!_table.allowed(fd, spec, Args(req.begin(), req.end()), out)) {
+        _table.unlock(mask);
+        return out;
+    }
+    if (!resolved) {
+        // what was last added when the command came, not when it reads again
+        for (size_t i = 0 ; i < w->keys.size() ; ++i) {
+            if (req[ids + i] != "$") continue;
+            auto* v = ks.peek(w->keys[i]);
+            auto* s = v == nullptr ? nullptr : std::get_if<store::StreamPtr>(v);
+            req[ids + i] = s == nullptr ? "0-0" : (*s)->last_id().str();
+        }
+        resolved = true;
+    }
+    // XREADGROUP writes, the others' reads need not run again for it
+    t_serving = true;
+    _table.call_locked(spec, Args(req.begin(), req.end()), out);
+    t_serving = false;
+    if (out == net::resp::null()) {
+        out.clear();
+        park(w);
+    }
+    _table.unlock(mask);
+    return out;
+}
+
+void Blocking::park(const std::shared_ptr<Waiter>& w) {
+    auto& all = w->stream ? _readers : _queues;
+    w->pos.resize(w->keys.size());
+    w->linked.assign(w->keys.size(), 1);
+    for (size_t i = 0 ; i < w->keys.size() ; ++i) {
+        auto& queues = all[store::Keyspace::shard_index(store::Keyspace::hash(w->keys[i]))];
+        auto& q = queues.try_emplace(w->keys[i]).first->second;
+        q.emplace_back(w, i);
+        w->pos[i] = std::prev(q.end());
+    }
+    _blocked.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Blocking::written(const Spec& spec, const Args& argv) {
+    if (t_serving || _blocked.load(std::memory_order_relaxed) == 0) return;
+    if ((spec.flags & ALL_KEYS) || spec.first_key == 0) return;
+    KeyRange keys = key_range(spec, argv);
+    for (int k = keys.first ; k <= keys.last ; k += keys.step) {
+        size_t shard = store::Keyspace::shard_index(store::Keyspace::hash(argv[k]));
+        auto& readers = _readers[shard];
+        if (!readers.empty()) {
+            auto it = readers.find(argv[k]);
+            if (it != readers.end()) wake(readers, it);
+        }
+        auto& queues = _queues[shard];
+        if (queues.empty()) continue;
+        auto it = queues.find(argv[k]);
+        if (it != queues.end()) serve(queues, it);
+    }
+}
+
+void Blocking::wake(Queues& readers, Queues::iterator it) {
+    for (auto& [w, idx] : it->second) {
+        w->linked[idx] = 0;
+        if (settle(*w, SERVED)) w->done.set();
+    }
+    readers.erase(it);
+}
+
+void Blocking::serve(Queues& queues, Queues::iterator it) {
+    t_serving = true;
+    auto& ks = _table.keyspace();
+    std::string_view key = it->first;
+    auto& q = it->second;
+    // elements left for the clients told to come and move them
+    size_t kept = 0;
+    while (!q.empty()) {
+        auto* v = ks.peek(key);
+        auto* p = v == nullptr ? nullptr : std::get_if<store::ListPtr>(v);
+        if (p == nullptr || p->get()->size() <= kept) break;
+        auto* l = p->get();
+        auto [w, idx] = q.front();
+        q.pop_front();
+        w->linked[idx] = 0;
+        if (!w->move) {
+            // timed out or gone, but not unparked yet
+            if (!settle(*w, SERVED)) continue;
+            w->served = idx;
+            w->value = w->left ? l->front() : l->back();
+            std::string popped;
+            _table.call_locked(*_table.lookup(w->left ? "LPOP" : "RPOP"), {w->left ? "LPOP" : "RPOP", key}, popped);
+            w->done.set();
+            continue;
+        }
+        // the move happens under both shards' locks or not at all. Waiting
+        // for the destination's out of order could deadlock
+        uint64_t dst = shard_bit(w->dst);
+        bool held = (Table::held() & dst) != 0;
+        if (!held && !_table.try_lock(dst)) {
+            if (settle(*w, AGAIN)) {
+                ++kept;
+                w->done.set();
+            }
+            continue;
+        }
+        if (settle(*w, SERVED)) {
+            w->served = idx;
+            _table.call_locked(*_table.lookup("LMOVE"),
+                               {"LMOVE", key, w->dst, w->left ? "LEFT" : "RIGHT", w->to_left ? "LEFT" : "RIGHT"},
+                               w->value);
+            if (w->value[0] != '-' && w->dst != key) nudge(w->dst);
+            w->done.set();
+        }
+        if (!held) _table.unlock(dst);
+    }
+    if (q.empty()) queues.erase(it);
+    t_serving = false;
+}
+
+void Blocking::nudge(std::string_view key) {
+    auto& queues = _queues[store::Keyspace::shard_index(store::Keyspace::hash(key))];
+    auto it = queues.find(key);
+    if (it == queues.end()) return;
+    auto& q = it->second;
+    while (!q.empty()) {
+        auto [w, idx] = q.front();
+        q.pop_front();
+        w->linked[idx] = 0;
+        if (settle(*w, AGAIN)) {
+            w->done.set();
+            break;
+        }
+    }
+    if (q.empty()) queues.erase(it);
+}
+
+void Blocking::unpark(const std::shared_ptr<Waiter>& w) {
+    auto& all = w->stream ? _readers : _queues;
+    for (size_t i = 0 ; i < w->keys.size() ; ++i) {
+        uint64_t bit = shard_bit(w->keys[i]);
+        _table.lock(bit);
+        if (w->linked[i]) {
+            auto& queues = all[store::Keyspace::shard_index(store::Keyspace::hash(w->keys[i]))];
+            auto it = queues.find(w->keys[i]);
+            it->second.erase(w->pos[i]);
+            w->linked[i] = 0;
+            if (it->second.empty()) queues.erase(it);
+        }
+        _table.unlock(bit);
+    }
+    _blocked.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void Blocking::watch(int fd, const std::shared_ptr<Waiter>& w) {
+    std::lock_guard<std::mutex> l(_watched_m);
+    _watched[fd] = w;
+    epoll_event ev = {};
+    // hang-ups only : whatever the client pipelined waits for its turn
+    ev.events = EPOLLRDHUP | EPOLLONESHOT;
+    ev.data.fd = fd;
+    epoll_ctl(_epfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+void Blocking::unwatch(int fd) {
+    std::lock_guard<std::mutex> l(_watched_m);
+    epoll_ctl(_epfd, EPOLL_CTL_DEL, fd, nullptr);
+    _watched.erase(fd);
+}
+
+void Blocking::hangups() {
+    epoll_event events[64];
+    while (!_stop.load(std::memory_order_acquire)) {
+        int n = epoll_wait(_epfd, events, 64, -1);
+        for (int k = 0 ; k < n ; ++k) {
+            if (events[k].data.fd == _evfd) continue;
+            std::shared_ptr<Waiter> w;
+            {
+                std::lock_guard<std::mutex> l(_watched_m);
+                auto it = _watched.find(events[k].data.fd);
+                if (it != _watched.end()) w = it->second.lock();
+            }
+            if (w && settle(*w, GONE)) w->done.set();
+        }
+    }
+}
+
+coro::Task<int> Blocking::wait(int fd, std::shared_ptr<Waiter> w, int64_t ms) {
+    watch(fd, w);
+    store::Timers::Id timer = 0;
+    if (ms > 0) {
+        // the waiter may be long gone when it fires
+        timer = _table.timers().after(std::chrono::milliseconds(ms), [w] {
+            if (settle(*w, TIMED_OUT)) w->done.set();
+        });
+    }
+    co_await w->done;
+    if (ms > 0) _table.timers().cancel(timer);
+    unwatch(fd);
+    unpark(w);
+    co_return w->state.load(std::memory_order_acquire);
+}
+
+coro::Task<bool> Blocking::read_streams(int fd, const net::resp::Command& cmd) {
+    const Spec* spec = _table.lookup(cmd.argv[0]);
+    bool grouped = cmd.is("XREADGROUP");
+    // where BLOCK is among the options before STREAMS
+    size_t block = 0;
+    for (size_t k = 1 ; k < cmd.argc() ;) {
+        net::resp::Command opt{{cmd.argv[k]}};
+        if (opt.is("STREAMS")) break;
+        if (opt.is("BLOCK")) block = k;
+        k += opt.is("GROUP") ? 3 : opt.is("NOACK") ? 1 : 2;
+    }
+    KeyRange keys = key_range(*spec, cmd.argv);
+    int64_t ms;
+    // the table answers those that don't block, and the malformed ones
+    if (block == 0 || keys.first > keys.last || !Table::arity_ok(*spec, cmd.argc())) co_return false;
+    auto res = std::from_chars(cmd.argv[block + 1].data(), cmd.argv[block + 1].data() + cmd.argv[block + 1].size(), ms);
+    if (res.ec != std::errc() || res.ptr != cmd.argv[block + 1].data() + cmd.argv[block + 1].size() || ms < 0) {
+        co_return false;
+    }
+    // a consumer's history is there already
+    for (int k = keys.last + 1 ; grouped && k < static_cast<int>(cmd.argc()) ; ++k) {
+        if (cmd.argv[k] != ">") co_return false;
+    }
+
+    std::vector<std::string> req;
+    for (size_t k = 0 ; k < cmd.argc() ; ++k) {
+        if (k != block && k != block + 1) req.emplace_back(cmd.argv[k]);
+    }
+    // BLOCK came before the keys
+    size_t ids = static_cast<size_t>(keys.last) - 1;
+    int64_t deadline = ms > 0 ? store::now_ms() + ms : 0;
+    bool resolved = false;
+    std::string out;
+    for (;;) {
+        // a fresh one every time, its event only fires once
+        auto w = std::make_shared<Waiter>();
+        w->stream = true;
+        for (int k = keys.first ; k <= keys.last ; ++k) w->keys.emplace_back(cmd.argv[k]);
+        out = read_or_park(fd, w, *spec, req, ids, resolved);
+        if (!out.empty()) break;
+        int64_t left = deadline > 0 ? std::max<int64_t>(deadline - store::now_ms(), 1) : 0;
+        int state = co_await wait(fd, w, left);
+        if (state == GONE) co_return true;
+        if (state == TIMED_OUT) {
+            out = net::resp::null();
+            break;
+        }
+    }
+    net::write_stream(fd, out.c_str(), out.size());
+    co_return true;
+}
+
+coro::Task<bool> Blocking::handle(int fd, const net::resp::Command& cmd) {
+    if (cmd.is("XREAD") || cmd.is("XREADGROUP")) co_return co_await read_streams(fd, cmd);
+    bool blmove = cmd.is("BLMOVE");
+    if (!blmove && !cmd.is("BLPOP") && !cmd.is("BRPOP")) co_return false;
+
+    int64_t ms = 0;
+    bool left = true, to_left = true;
+    std::string out;
+    if (blmove ? cmd.argc() != 6 : cmd.argc() < 3) {
+        out = net::resp::wrong_arity(cmd.argv[0]);
+    } else if (auto err = parse_timeout(cmd.argv.back(), ms)) {
+        out = *err;
+    } else if (blmove && (!parse_side(cmd.argv[3], left) || !parse_side(cmd.argv[4], to_left))) {
+        out = "-ERR syntax error\r\n";
+    }
+    int64_t deadline = ms > 0 ? store::now_ms() + ms : 0;
+    while (out.empty()) {
+        // a fresh one every time, its event only fires once
+        auto w = std::make_shared<Waiter>();
+        if (blmove) {
+            w->keys.emplace_back(cmd.argv[1]);
+            w->move = true;
+            w->dst = cmd.argv[2];
+            w->left = left;
+            w->to_left = to_left;
+        } else {
+            for (size_t k = 1 ; k + 1 < cmd.argc() ; ++k) w->keys.emplace_back(cmd.argv[k]);
+            w->left = cmd.is("BLPOP");
+        }
+        out = pop_or_park(fd, blmove ? k_blmove : k_bpop, cmd.argv, w);
+        if (!out.empty()) break;
+        int64_t left_ms = deadline > 0 ? std::max<int64_t>(deadline - store::now_ms(), 1) : 0;
+        int state = co_await wait(fd, w, left_ms);
+        if (state == GONE) co_return true;
+        if (state == TIMED_OUT) {
+            out = net::resp::null();
+        } else if (state == SERVED) {
+            out = w->move ? w->value : "*2\r\n" + net::resp::bulk(w->keys[w->served]) + net::resp::bulk(w->value);
+        }
+    }
+    net::write_stream(fd, out.c_str(), out.size());
+    co_return true;
+}
+
+void Blocking::attach(net::resp::Redis& r) {
+    r.attach_async([this] (int connfd, net::resp::Redis::T& msg) -> coro::Task<bool> {
+        auto* node = std::get_if<std::unique_ptr<data::Node>>(&msg);
+        if (node == nullptr) co_return false;
+        auto cmd = net::resp::as_command(node->get());
+        if (!cmd.has_value()) co_return false;
+        co_return co_await handle(connfd, *cmd);
+    });
+}
+
+} // namespace commands
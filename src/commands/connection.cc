@@ -0,0 +1,25 @@
+#include "commands/connection.h"
+#include "resp/resp_utils.h"
+
+namespace commands {
+
+bool connection(int fd, const net::resp::Command& cmd) {
+    if (!cmd.is("QUIT")) return false;
+    std::string reply = net::resp::ok();
+    net::write_stream(fd, reply.c_str(), reply.size());
+    net::end_stream(fd);
+    return true;
+}
+
+void attach_connection(net::resp::Redis& r) {
+    using Chain = ChainOfResponsibility::Chain<int, net::resp::Redis::T&&>;
+    r.attach([] (int connfd, net::resp::Redis::T&& msg, Chain next) {
+        if (auto* node = std::get_if<std::unique_ptr<data::Node>>(&msg)) {
+            auto cmd = net::resp::as_command(node->get());
+            if (cmd.has_value() && connection(connfd, *cmd)) return;
+        }
+        next(connfd, std::move(msg));
+    });
+}
+
+} // namespace commands
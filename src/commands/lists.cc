@@ -0,0 +1,227 @@
+#include "commands/table.h"
+#include "resp/resp_utils.h"
+
+#include <charconv>
+
+namespace commands {
+
+static const char* k_wrongtype = "-WRONGTYPE Operation against a key holding the wrong kind of value\r\n";
+static const char* k_not_integer = "-ERR value is not an integer or out of range\r\n";
+static const char* k_syntax = "-ERR syntax error\r\n";
+
+static bool parse_int(std::string_view s, int64_t& v) {
+    auto res = std::from_chars(s.data(), s.data() + s.size(), v);
+    return !s.empty() && res.ec == std::errc() && res.ptr == s.data() + s.size();
+}
+
+// the list under key, nullptr when missing. wrong is set when key holds
+// something else
+static store::List* find_list(store::Keyspace& ks, std::string_view key, bool& wrong) {
+    auto* v = ks.peek(key);
+    wrong = v != nullptr && !std::holds_alternative<store::ListPtr>(*v);
+    return v == nullptr || wrong ? nullptr : std::get<store::ListPtr>(*v).get();
+}
+
+// a list is never left empty, the key goes away with its last element
+static void drop_if_empty(store::Keyspace& ks, std::string_view key, const store::List& l) {
+    if (l.empty()) ks.erase(key);
+}
+
+static void push(store::Keyspace& ks, const Args& argv, bool left, std::string& out) {
+    bool wrong;
+    find_list(ks, argv[1], wrong);
+    if (wrong) {
+        out += k_wrongtype;
+        return;
+    }
+    auto& v = ks.write(argv[1]);
+    if (!std::holds_alternative<store::ListPtr>(v)) v = std::make_unique<store::List>();
+    auto& l = *std::get<store::ListPtr>(v);
+    for (size_t k = 2 ; k < argv.size() ; ++k) {
+        if (left) {
+            l.emplace_front(argv[k]);
+        } else {
+            l.emplace_back(argv[k]);
+        }
+    }
+    out += net::resp::integer(static_cast<int64_t>(l.size()));
+}
+
+static void lpush(store::Keyspace& ks, const Args& argv, std::string& out) {
+    push(ks, argv, true, out);
+}
+
+static void rpush(store::Keyspace& ks, const Args& argv, std::string& out) {
+    push(ks, argv, false, out);
+}
+
+// LPOP / RPOP key [count]
+static void pop(store::Keyspace& ks, const Args& argv, bool left, std::string& out) {
+    int64_t count = 1;
+    if (argv.size() > 3) {
+        out += k_syntax;
+        return;
+    }
+    if (argv.size() == 3 && (!parse_int(argv[2], count) || count < 0)) {
+        out += "-ERR value is out of range, must be positive\r\n";
+        return;
+    }
+    bool wrong;
+    auto* l = find_list(ks, argv[1], wrong);
+    if (wrong) {
+        out += k_wrongtype;
+        return;
+    }
+    if (l == nullptr) {
+        out += net::resp::null();
+        return;
+    }
+    ks.touch(argv[1]);
+    size_t n = std::min(static_cast<size_t>(count), l->size());
+    if (argv.size() == 3) data::write_header(out, data::Type::Array, n);
+    for (size_t k = 0 ; k < n ; ++k) {
+        if (left) {
+            out += net::resp::bulk(l->front());
+            l->pop_front();
+        } else {
+            out += net::resp::bulk(l->back());
+            l->pop_back();
+        }
+    }
+    drop_if_empty(ks, argv[1], *l);
+}
+
+static void lpop(store::Keyspace& ks, const Args& argv, std::string& out) {
+    pop(ks, argv, true, out);
+}
+
+static void rpop(store::Keyspace& ks, const Args& argv, std::string& out) {
+    pop(ks, argv, false, out);
+}
+
+static void llen(store::Keyspace& ks, const Args& argv, std::string& out) {
+    bool wrong;
+    auto* l = find_list(ks, argv[1], wrong);
+    if (wrong) {
+        out += k_wrongtype;
+        return;
+    }
+    out += net::resp::integer(l == nullptr ? 0 : static_cast<int64_t>(l->size()));
+}
+
+// negative indexes count from the end
+static int64_t index_in(int64_t i, size_t size) {
+    return i < 0 ? static_cast<int64_t>(size) + i : i;
+}
+
+static void lindex(store::Keyspace& ks, const Args& argv, std::string& out) {
+    int64_t i;
+    if (!parse_int(argv[2], i)) {
+        out += k_not_integer;
+        return;
+    }
+    bool wrong;
+    auto* l = find_list(ks, argv[1], wrong);
+    if (wrong) {
+        out += k_wrongtype;
+        return;
+    }
+    if (l != nullptr) i = index_in(i, l->size());
+    if (l == nullptr || i < 0 || i >= static_cast<int64_t>(l->size())) {
+        out += net::resp::null();
+        return;
+    }
+    out += net::resp::bulk((*l)[static_cast<size_t>(i)]);
+}
+
+static void lrange(store::Keyspace& ks, const Args& argv, std::string& out) {
+    int64_t start, stop;
+    if (!parse_int(argv[2], start) || !parse_int(argv[3], stop)) {
+        out += k_not_integer;
+        return;
+    }
+    bool wrong;
+    auto* l = find_list(ks, argv[1], wrong);
+    if (wrong) {
+        out += k_wrongtype;
+        return;
+    }
+    if (l == nullptr) {
+        out += "*0\r\n";
+        return;
+    }
+    int64_t size = static_cast<int64_t>(l->size());
+    start = std::max<int64_t>(index_in(start, l->size()), 0);
+    stop = std::min(index_in(stop, l->size()), size - 1);
+    if (start > stop) {
+        out += "*0\r\n";
+        return;
+    }
+    data::write_header(out, data::Type::Array, stop - start + 1);
+    for (int64_t k = start ; k <= stop ; ++k) out += net::resp::bulk((*l)[static_cast<size_t>(k)]);
+}
+
+// LEFT or RIGHT, false when neither
+static bool parse_side(std::string_view s, bool& left) {
+    net::resp::Command side{{s}};
+    left = side.is("LEFT");
+    return left || side.is("RIGHT");
+}
+
+// LMOVE source destination LEFT|RIGHT LEFT|RIGHT
+static void lmove(store::Keyspace& ks, const Args& argv, std::string& out) {
+    bool from_left, to_left;
+    if (!parse_side(argv[3], from_left) || !parse_side(argv[4], to_left)) {
+        out += k_syntax;
+        return;
+    }
+    bool wrong;
+    auto* src = find_list(ks, argv[1], wrong);
+    if (wrong) {
+        out += k_wrongtype;
+        return;
+    }
+    if (src == nullptr) {
+        out += net::resp::null();
+        return;
+    }
+    find_list(ks, argv[2], wrong);
+    if (wrong) {
+        out += k_wrongtype;
+        return;
+    }
+    std::string e;
+    ks.touch(argv[1]);
+    if (from_left) {
+        e = std::move(src->front());
+        src->pop_front();
+    } else {
+        e = std::move(src->back());
+        src->pop_back();
+    }
+    out += net::resp::bulk(e);
+    drop_if_empty(ks, argv[1], *src);
+    auto& v = ks.write(argv[2]);
+    if (!std::holds_alternative<store::ListPtr>(v)) v = std::make_unique<store::List>();
+    auto& dst = *std::get<store::ListPtr>(v);
+    if (to_left) {
+        dst.push_front(std::move(e));
+    } else {
+        dst.push_back(std::move(e));
+    }
+}
+
+const Spec k_list_commands[] = {
+    {"LPUSH",  -3, WRITE,    1, 1, 1, lpush},
+    {"RPUSH",  -3, WRITE,    1, 1, 1, rpush},
+    {"LPOP",   -2, WRITE,    1, 1, 1, lpop},
+    {"RPOP",   -2, WRITE,    1, 1, 1, rpop},
+    {"LLEN",    2, READONLY, 1, 1, 1, llen},
+    {"LINDEX",  3, READONLY, 1, 1, 1, lindex},
+    {"LRANGE",  4, READONLY, 1, 1, 1, lrange},
+    {"LMOVE",   5, WRITE,    1, 2, 1, lmove},
+};
+
+const size_t k_list_commands_len = sizeof(k_list_commands) / sizeof(k_list_commands[0]);
+
+} // namespace commands
@@ -0,0 +1,310 @@
+#include "commands/table.h"
+#include "datastructures/bloom.h"
+#include "datastructures/hyperloglog.h"
+#include "resp/resp_utils.h"
+
+#include <charconv>
+#include <vector>
+
+namespace commands {
+
+namespace hll = data::hll;
+
+static const char* k_wrongtype = "-WRONGTYPE Operation against a key holding the wrong kind of value\r\n";
+static const char* k_syntax = "-ERR syntax error\r\n";
+static const char* k_not_hll = "-WRONGTYPE Key is not a valid HyperLogLog string value.\r\n";
+static const char* k_corrupted = "-INVALIDOBJ Corrupted HLL object detected\r\n";
+static const char* k_not_found = "-ERR not found\r\n";
+static const char* k_full = "-ERR non scaling filter is full\r\n";
+
+// items of BF.MADD and BF.MEXISTS whose blocks are prefetched ahead of the
+// one being looked up
+static constexpr size_t k_ahead = 8;
+
+static bool parse_int(std::string_view s, int64_t& v) {
+    auto res = std::from_chars(s.data(), s.data() + s.size(), v);
+    return !s.empty() && res.ec == std::errc() && res.ptr == s.data() + s.size();
+}
+
+static bool parse_double(std::string_view s, double& v) {
+    auto res = std::from_chars(s.data(), s.data() + s.size(), v);
+    return !s.empty() && res.ec == std::errc() && res.ptr == s.data() + s.size();
+}
+
+// the HLL under key, nullptr when missing. Sets bad and appends the error
+// to out when key holds something else. Strings are turned back into a
+// std::string, HLLs are updated in place
+static std::string* find_hll(store::Keyspace& ks, std::string_view key, bool& bad, std::string& out) {
+    auto* v = ks.find(key);
+    bad = false;
+    if (v == nullptr) return nullptr;
+    auto* s = std::get_if<std::string>(v);
+    bad = s == nullptr || !hll::valid(*s);
+    if (bad) out += s == nullptr ? k_wrongtype : k_not_hll;
+    return bad ? nullptr : s;
+}
+
+static void pfadd(store::Keyspace& ks, const Args& argv, std::string& out) {
+    bool bad;
+    auto* s = find_hll(ks, argv[1], bad, out);
+    if (bad) return;
+    bool changed = s == nullptr;
+    if (s == nullptr) s = &std::get<std::string>(ks.write(argv[1]) = hll::create());
+    for (size_t k = 2 ; k < argv.size() ; ++k) {
+        int res = hll::add(*s, argv[k]);
+        if (res < 0) {
+            out += k_corrupted;
+            return;
+        }
+        changed |= res > 0;
+    }
+    if (changed) ks.touch(argv[1]);
+    out += net::resp::integer(changed ? 1 : 0);
+}
+
+// the cardinality of one HLL comes from (and refreshes) its cache, that of
+// several from the maximum of their registers
+static void pfcount(store::Keyspace& ks, const Args& argv, std::string& out) {
+    bool bad;
+    if (argv.size() == 2) {
+        auto* s = find_hll(ks, argv[1], bad, out);
+        if (bad) return;
+        int64_t n = s == nullptr ? 0 : hll::count(*s);
+        out += n < 0 ? k_corrupted : net::resp::integer(n);
+        return;
+    }
+    hll::Raw raw{};
+    for (size_t k = 1 ; k < argv.size() ; ++k) {
+        auto* s = find_hll(ks, argv[k], bad, out);
+        if (bad) return;
+        if (s != nullptr && !hll::merge(*s, raw)) {
+            out += k_corrupted;
+            return;
+        }
+    }
+    out += net::resp::integer(static_cast<int64_t>(hll::count(raw)));
+}
+
+// PFMERGE destkey [sourcekey ...], destkey is one of the sources and keeps
+// its deadline. The result is dense
+static void pfmerge(store::Keyspace& ks, const Args& argv, std::string& out) {
+    bool bad;
+    hll::Raw raw{};
+    for (size_t k = 1 ; k < argv.size() ; ++k) {
+        auto* s = find_hll(ks, argv[k], bad, out);
+        if (bad) return;
+        if (s != nullptr && !hll::merge(*s, raw)) {
+            out += k_corrupted;
+            return;
+        }
+    }
+    ks.write(argv[1]) = hll::from_raw(raw);
+    out += net::resp::ok();
+}
+
+// the filter under key, nullptr when missing. wrong is set when key holds
+// something else
+static data::Bloom* find_bloom(store::Keyspace& ks, std::string_view key, bool& wrong) {
+    auto* v = ks.peek(key);
+    wrong = v != nullptr && !std::holds_alternative<store::BloomPtr>(*v);
+    return v == nullptr || wrong ? nullptr : std::get<store::BloomPtr>(*v).get();
+}
+
+// the filter under key, made with the defaults when missing. nullptr when
+// key holds something else, with the error appended to out
+static data::Bloom* bloom_for_write(store::Keyspace& ks, std::string_view key, std::string& out) {
+    bool wrong;
+    auto* b = find_bloom(ks, key, wrong);
+    if (wrong) {
+        out += k_wrongtype;
+        return nullptr;
+    }
+    if (b != nullptr) return b;
+    auto& v = ks.write(key) = std::make_unique<data::Bloom>(data::Bloom::k_default_error,
+                                                           data::Bloom::k_default_capacity);
+    return std::get<store::BloomPtr>(v).get();
+}
+
+// BF.RESERVE key error_rate capacity [EXPANSION expansion] [NONSCALING]
+static void bf_reserve(store::Keyspace& ks, const Args& argv, std::string& out) {
+    double error;
+    int64_t capacity, expansion = data::Bloom::k_default_expansion;
+    bool scaling = true, expansion_set = false;
+    if (!parse_double(argv[2], error) || !(error > 0 && error < 1)) {
+        out += "-ERR (0 < error rate range < 1)\r\n";
+        return;
+    }
+    if (!parse_int(argv[3], capacity) || capacity <= 0) {
+        out += "-ERR (capacity should be larger than 0)\r\n";
+        return;
+    }
+    for (size_t k = 4 ; k < argv.size() ; ++k) {
+        net::resp::Command opt{{argv[k]}};
+        if (opt.is("NONSCALING")) {
+            scaling = false;
+        } else if (opt.is("EXPANSION") && k + 1 < argv.size()) {
+            if (!parse_int(argv[++k], expansion) || expansion < 1 || expansion > UINT32_MAX) {
+                out += "-ERR (expansion should be greater or equal to 1)\r\n";
+                return;
+            }
+            expansion_set = true;
+        } else {
+            out += k_syntax;
+            return;
+        }
+    }
+    if (!scaling && expansion_set) {
+        out += "-ERR nonscaling filters cannot expand\r\n";
+        return;
+    }
+    if (ks.peek(argv[1]) != nullptr) {
+        out += "-ERR item exists\r\n";
+        return;
+    }
+    ks.set(argv[1], std::make_unique<data::Bloom>(error, static_cast<uint64_t>(capacity),
+                                                  scaling ? static_cast<unsigned>(expansion) : 0));
+    out += net::resp::ok();
+}
+
+static void bf_add(store::Keyspace& ks, const Args& argv, std::string& out) {
+    auto* b = bloom_for_write(ks, argv[1], out);
+    if (b == nullptr) return;
+    int res = b->add(argv[2]);
+    if (res < 0) {
+        out += k_full;
+        return;
+    }
+    if (res > 0) ks.touch(argv[1]);
+    out += net::resp::integer(res);
+}
+
+// the hashes of argv[2...], and fn(k, h) called on each of them once the
+// blocks of the k_ahead next ones were prefetched
+template<typename Fn>
+static void each_item(const data::Bloom& b, const Args& argv, Fn&& fn) {
+    std::vector<uint64_t> hashes(argv.size() - 2);
+    for (size_t k = 0 ; k < hashes.size() ; ++k) hashes[k] = data::Bloom::hash(argv[k + 2]);
+    for (size_t k = 0 ; k < hashes.size() && k < k_ahead ; ++k) b.prefetch(hashes[k]);
+    for (size_t k = 0 ; k < hashes.size() ; ++k) {
+        if (k + k_ahead < hashes.size()) b.prefetch(hashes[k + k_ahead]);
+        fn(k, hashes[k]);
+    }
+}
+
+static void bf_madd(store::Keyspace& ks, const Args& argv, std::string& out) {
+    auto* b = bloom_for_write(ks, argv[1], out);
+    if (b == nullptr) return;
+    bool changed = false;
+    data::write_header(out, data::Type::Array, argv.size() - 2);
+    each_item(*b, argv, [&] (size_t, uint64_t h) {
+        int res = b->add(h);
+        changed |= res > 0;
+        out += res < 0 ? k_full : net::resp::integer(res);
+    });
+    if (changed) ks.touch(argv[1]);
+}
+
+static void bf_exists(store::Keyspace& ks, const Args& argv, std::string& out) {
+    bool wrong;
+    auto* b = find_bloom(ks, argv[1], wrong);
+    if (wrong) {
+        out += k_wrongtype;
+        return;
+    }
+    out += net::resp::integer(b != nullptr && b->contains(argv[2]) ? 1 : 0);
+}
+
+static void bf_mexists(store::Keyspace& ks, const Args& argv, std::string& out) {
+    bool wrong;
+    auto* b = find_bloom(ks, argv[1], wrong);
+    if (wrong) {
+        out += k_wrongtype;
+        return;
+    }
+    data::write_header(out, data::Type::Array, argv.size() - 2);
+    if (b == nullptr) {
+        for (size_t k = 2 ; k < argv.size() ; ++k) out += net::resp::integer(0);
+        return;
+    }
+    each_item(*b, argv, [&] (size_t, uint64_t h) {
+        out += net::resp::integer(b->contains(h) ? 1 : 0);
+    });
+}
+
+static void bf_info(store::Keyspace& ks, const Args& argv, std::string& out) {
+    bool wrong;
+    auto* b = find_bloom(ks, argv[1], wrong);
+    if (wrong || b == nullptr) {
+        out += wrong ? k_wrongtype : k_not_found;
+        return;
+    }
+    out += "%5\r\n";
+    out += net::resp::bulk("Capacity") + net::resp::integer(static_cast<int64_t>(b->capacity()));
+    out += net::resp::bulk("Size") + net::resp::integer(static_cast<int64_t>(b->bytes()));
+    out += net::resp::bulk("Number of filters") + net::resp::integer(static_cast<int64_t>(b->layers()));
+    out += net::resp::bulk("Number of items inserted") + net::resp::integer(static_cast<int64_t>(b->size()));
+    out += net::resp::bulk("Expansion rate");
+    out += b->expansion() == 0 ? net::resp::null() : net::resp::integer(b->expansion());
+}
+
+// BF.SCANDUMP key iterator : the whole filter comes as one chunk, at
+// iterator 1, and iterator 0 says it was the last
+static void bf_scandump(store::Keyspace& ks, const Args& argv, std::string& out) {
+    int64_t it;
+    if (!parse_int(argv[2], it) || it < 0) {
+        out += "-ERR invalid iterator\r\n";
+        return;
+    }
+    bool wrong;
+    auto* b = find_bloom(ks, argv[1], wrong);
+    if (wrong || b == nullptr) {
+        out += wrong ? k_wrongtype : k_not_found;
+        return;
+    }
+    std::string dump;
+    if (it == 0) b->dump(dump);
+    out += "*2\r\n" + net::resp::integer(it == 0 ? 1 : 0) + net::resp::bulk(dump);
+}
+
+// BF.LOADCHUNK key iterator data : replaces key with the filter of a
+// BF.SCANDUMP chunk
+static void bf_loadchunk(store::Keyspace& ks, const Args& argv, std::string& out) {
+    int64_t it;
+    if (!parse_int(argv[2], it) || it <= 0) {
+        out += "-ERR invalid iterator\r\n";
+        return;
+    }
+    bool wrong;
+    find_bloom(ks, argv[1], wrong);
+    if (wrong) {
+        out += k_wrongtype;
+        return;
+    }
+    auto b = data::Bloom::load(argv[3]);
+    if (b == nullptr) {
+        out += "-ERR received bad data\r\n";
+        return;
+    }
+    ks.set(argv[1], std::move(b));
+    out += net::resp::ok();
+}
+
+const Spec k_probabilistic_commands[] = {
+    {"PFADD",        -2, WRITE,    1, 1, 1, pfadd},
+    // refreshes the cached count of a single HLL, which changes nothing
+    // it holds
+    {"PFCOUNT",      -2, READONLY, 1, -1, 1, pfcount},
+    {"PFMERGE",      -2, WRITE,    1, -1, 1, pfmerge},
+    {"BF.RESERVE",   -4, WRITE,    1, 1, 1, bf_reserve},
+    {"BF.ADD",        3, WRITE,    1, 1, 1, bf_add},
+    {"BF.MADD",      -3, WRITE,    1, 1, 1, bf_madd},
+    {"BF.EXISTS",     3, READONLY, 1, 1, 1, bf_exists},
+    {"BF.MEXISTS",   -3, READONLY, 1, 1, 1, bf_mexists},
+    {"BF.INFO",       2, READONLY, 1, 1, 1, bf_info},
+    {"BF.SCANDUMP",   3, READONLY, 1, 1, 1, bf_scandump},
+    {"BF.LOADCHUNK",  4, WRITE,    1, 1, 1, bf_loadchunk},
+};
+
+const size_t k_probabilistic_commands_len = sizeof(k_probabilistic_commands) / sizeof(k_probabilistic_commands[0]);
+
+} // namespace commands
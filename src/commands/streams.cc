@@ -0,0 +1,865 @@
+#include "commands/table.h"
+#include "datastructures/stream.h"
+#include "resp/resp_utils.h"
+#include "store/timers.h"
+
+#include <charconv>
+#include <string>
+#include <vector>
+
+namespace commands {
+
+using data::Stream;
+using data::StreamID;
+
+static const char* k_wrongtype = "-WRONGTYPE Operation against a key holding the wrong kind of value\r\n";
+static const char* k_not_integer = "-ERR value is not an integer or out of range\r\n";
+static const char* k_syntax = "-ERR syntax error\r\n";
+static const char* k_invalid_id = "-ERR Invalid stream ID specified as stream command argument\r\n";
+static const char* k_no_key = "-ERR The XGROUP subcommand requires the key to exist. Note that for CREATE you may "
+                              "want to use the MKSTREAM option to create an empty stream automatically.\r\n";
+
+static bool parse_int(std::string_view s, int64_t& v) {
+    auto res = std::from_chars(s.data(), s.data() + s.size(), v);
+    return !s.empty() && res.ec == std::errc() && res.ptr == s.data() + s.size();
+}
+
+static bool parse_uint(std::string_view s, uint64_t& v) {
+    auto res = std::from_chars(s.data(), s.data() + s.size(), v);
+    return !s.empty() && res.ec == std::errc() && res.ptr == s.data() + s.size();
+}
+
+// ms-seq, or ms alone meaning ms-missing_seq
+static bool parse_id(std::string_view s, StreamID& id, uint64_t missing_seq) {
+    size_t dash = s.find('-');
+    if (!parse_uint(s.substr(0, dash), id.ms)) return false;
+    if (dash == std::string_view::npos) {
+        id.seq = missing_seq;
+        return true;
+    }
+    return parse_uint(s.substr(dash + 1), id.seq);
+}
+
+// the ID right after id, false past the last possible one
+static bool next(StreamID& id) {
+    if (id.seq < UINT64_MAX) {
+        ++id.seq;
+    } else if (id.ms < UINT64_MAX) {
+        ++id.ms;
+        id.seq = 0;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static bool prev(StreamID& id) {
+    if (id.seq > 0) {
+        --id.seq;
+    } else if (id.ms > 0) {
+        --id.ms;
+        id.seq = UINT64_MAX;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// a bound of a range : - and + for the ends, ms alone for the whole
+// millisecond, and ( in front to leave the ID itself out. empty is set when
+// nothing can be in the range
+static bool parse_bound(std::string_view s, bool start, StreamID& id, bool& empty) {
+    if (s == "-") {
+        id = {};
+        return true;
+    }
+    if (s == "+") {
+        id = data::k_max_id;
+        return true;
+    }
+    bool exclusive = !s.empty() && s[0] == '(';
+    if (exclusive) s.remove_prefix(1);
+    if (!parse_id(s, id, start ? 0 : UINT64_MAX)) return false;
+    if (exclusive && !(start ? next(id) : prev(id))) empty = true;
+    return true;
+}
+
+// the stream under key, nullptr when missing. wrong is set when key holds
+// something else
+static Stream* find_stream(store::Keyspace& ks, std::string_view key, bool& wrong) {
+    auto* v = ks.peek(key);
+    wrong = v != nullptr && !std::holds_alternative<store::StreamPtr>(*v);
+    return v == nullptr || wrong ? nullptr : std::get<store::StreamPtr>(*v).get();
+}
+
+// the stream under key, about to change : its version goes up. The caller
+// made sure it is one
+static Stream& change(store::Keyspace& ks, std::string_view key) {
+    return *std::get<store::StreamPtr>(ks.write(key));
+}
+
+static void entry(StreamID id, const Stream::Fields& fv, std::string& out) {
+    out += "*2\r\n";
+    out += net::resp::bulk(id.str());
+    out += "*" + std::to_string(fv.size()) + "\r\n";
+    for (auto f : fv) out += net::resp::bulk(f);
+}
+
+static Stream::Consumer& consumer(Stream::Group& g, std::string_view name, int64_t now) {
+    auto [it, added] = g.consumers.try_emplace(std::string(name));
+    if (added) it->second.seen = now;
+    return it->second;
+}
+
+// takes p off its consumer's count
+static void release(Stream::Group& g, const Stream::Pending& p) {
+    auto it = g.consumers.find(p.consumer);
+    if (it != g.consumers.end() && it->second.pending > 0) --it->second.pending;
+}
+
+// the pending entry of id, handed to the consumer named name whoever had
+// it before. New ones count one delivery
+static Stream::Pending& assign(Stream::Group& g, StreamID id, std::string_view name, int64_t now) {
+    auto [p, added] = g.pel.insert(id.key(), {});
+    if (!added && p->consumer == name) return *p;
+    if (added) {
+        p->deliveries = 1;
+    } else {
+        release(g, *p);
+    }
+    p->consumer = std::string(name);
+    ++consumer(g, name, now).pending;
+    return *p;
+}
+
+// the ID XADD gives the entry, from * (the clock), ms-* or ms-seq
+static bool pick_id(std::string_view arg, StreamID last, StreamID& id, std::string& out) {
+    if (arg == "*") {
+        uint64_t now = static_cast<uint64_t>(store::now_ms());
+        if (now > last.ms) {
+            id = {now, 0};
+            return true;
+        }
+        // the clock went back, or several entries in the same millisecond
+        id = last;
+        if (!next(id)) {
+            out += "-ERR The stream has exhausted the last possible ID, unable to add more items\r\n";
+            return false;
+        }
+        return true;
+    }
+    bool auto_seq = arg.size() > 2 && arg.substr(arg.size() - 2) == "-*";
+    if (!parse_id(auto_seq ? arg.substr(0, arg.size() - 2) : arg, id, 0)) {
+        out += k_invalid_id;
+        return false;
+    }
+    // past the last ID of its millisecond, smaller ones fail below
+    if (auto_seq && id.ms == last.ms && last.seq < UINT64_MAX) id.seq = last.seq + 1;
+    if (id == StreamID{}) {
+        out += "-ERR The ID specified in XADD must be greater than 0-0\r\n";
+        return false;
+    }
+    if (id <= last) {
+        out += "-ERR The ID specified in XADD is equal or smaller than the target stream top item\r\n";
+        return false;
+    }
+    return true;
+}
+
+// XADD key [NOMKSTREAM] [MAXLEN [=|~] threshold] <* | id> field value [field value ...]
+static void xadd(store::Keyspace& ks, const Args& argv, std::string& out) {
+    bool nomkstream = false;
+    bool approx = false;
+    int64_t maxlen = -1;
+    size_t k = 2;
+    for (; k < argv.size() ; ++k) {
+        net::resp::Command opt{{argv[k]}};
+        if (opt.is("NOMKSTREAM")) {
+            nomkstream = true;
+        } else if (opt.is("MAXLEN") && k + 1 < argv.size()) {
+            std::string_view n = argv[++k];
+            if ((n == "~" || n == "=") && k + 1 < argv.size()) {
+                approx = n == "~";
+                n = argv[++k];
+            }
+            if (!parse_int(n, maxlen)) {
+                out += k_not_integer;
+                return;
+            }
+            if (maxlen < 0) {
+                out += "-ERR The MAXLEN argument must be >= 0.\r\n";
+                return;
+            }
+        } else {
+            break;
+        }
+    }
+    size_t fields = k < argv.size() ? argv.size() - k - 1 : 0;
+    if (fields == 0 || fields % 2 != 0) {
+        out += net::resp::wrong_arity("xadd");
+        return;
+    }
+    bool wrong;
+    Stream* s = find_stream(ks, argv[1], wrong);
+    if (wrong) {
+        out += k_wrongtype;
+        return;
+    }
+    if (s == nullptr && nomkstream) {
+        out += net::resp::null();
+        return;
+    }
+    StreamID id;
+    if (!pick_id(argv[k], s == nullptr ? StreamID{} : s->last_id(), id, out)) return;
+
+    auto& v = ks.write(argv[1]);
+    if (!std::holds_alternative<store::StreamPtr>(v)) v = std::make_unique<Stream>();
+    s = std::get<store::StreamPtr>(v).get();
+    s->append(id, argv.data() + k + 1, fields);
+    if (maxlen >= 0) s->trim(static_cast<size_t>(maxlen), approx);
+    std::string picked = id.str();
+    out += net::resp::bulk(picked);
+    if (argv[k] != picked) {
+        // replicas could not pick the same
+        std::vector<std::string> as(argv.begin(), argv.end());
+        as[k] = std::move(picked);
+        Table::rewrite(std::move(as));
+    }
+}
+
+// XRANGE key start end [COUNT count] / XREVRANGE key end start [COUNT count]
+static void range(store::Keyspace& ks, const Args& argv, bool rev, std::string& out) {
+    StreamID start, end;
+    bool empty = false;
+    if (!parse_bound(argv[rev ? 3 : 2], true, start, empty) || !parse_bound(argv[rev ? 2 : 3], false, end, empty)) {
+        out += k_invalid_id;
+        return;
+    }
+    int64_t count = -1;
+    if (argv.size() == 6 && net::resp::Command{{argv[4]}}.is("COUNT")) {
+        if (!parse_int(argv[5], count)) {
+            out += k_not_integer;
+            return;
+        }
+        if (count < 0) count = 0;
+    } else if (argv.size() != 4) {
+        out += k_syntax;
+        return;
+    }
+    bool wrong;
+    Stream* s = find_stream(ks, argv[1], wrong);
+    if (wrong) {
+        out += k_wrongtype;
+        return;
+    }
+    if (s == nullptr || empty || count == 0) {
+        out += "*0\r\n";
+        return;
+    }
+    std::string body;
+    int64_t n = 0;
+    auto fn = [&] (StreamID id, const Stream::Fields& fv) {
+        entry(id, fv, body);
+        return ++n != count;
+    };
+    if (rev) {
+        s->reverse_range(end, start, fn);
+    } else {
+        s->range(start, end, fn);
+    }
+    out += "*" + std::to_string(n) + "\r\n" + body;
+}
+
+static void xrange(store::Keyspace& ks, const Args& argv, std::string& out) {
+    range(ks, argv, false, out);
+}
+
+static void xrevrange(store::Keyspace& ks, const Args& argv, std::string& out) {
+    range(ks, argv, true, out);
+}
+
+static void xlen(store::Keyspace& ks, const Args& argv, std::string& out) {
+    bool wrong;
+    Stream* s = find_stream(ks, argv[1], wrong);
+    if (wrong) {
+        out += k_wrongtype;
+        return;
+    }
+    out += net::resp::integer(s == nullptr ? 0 : static_cast<int64_t>(s->size()));
+}
+
+// the options of XREAD and XREADGROUP
+struct Read {
+    // 0 for no limit
+    int64_t count = 0;
+    bool noack = false;
+    std::string_view group;
+    std::string_view consumer;
+    // where the keys start and how many there are, their IDs follow
+    size_t keys = 0;
+    size_t n = 0;
+};
+
+// XREAD [COUNT count] [BLOCK ms] STREAMS key [key ...] id [id ...]
+// XREADGROUP GROUP group consumer [COUNT count] [BLOCK ms] [NOACK] STREAMS ...
+//
+// BLOCK is checked but does nothing here : Blocking serves those that
+// have to wait, it sends what they read again without it
+static bool parse_read(const Args& argv, bool grouped, Read& r, std::string& out) {
+    size_t k = 1;
+    for (; k < argv.size() ; ++k) {
+        net::resp::Command opt{{argv[k]}};
+        if (opt.is("STREAMS")) break;
+        if (opt.is("COUNT") && k + 1 < argv.size()) {
+            if (!parse_int(argv[++k], r.count)) {
+                out += k_not_integer;
+                return false;
+            }
+            if (r.count < 0) r.count = 0;
+        } else if (opt.is("BLOCK") && k + 1 < argv.size()) {
+            int64_t ms;
+            if (!parse_int(argv[++k], ms)) {
+                out += "-ERR timeout is not an integer or out of range\r\n";
+                return false;
+            }
+            if (ms < 0) {
+                out += "-ERR timeout is negative\r\n";
+                return false;
+            }
+        } else if (grouped && opt.is("GROUP") && k + 2 < argv.size()) {
+            r.group = argv[k + 1];
+            r.consumer = argv[k + 2];
+            k += 2;
+        } else if (grouped && opt.is("NOACK")) {
+            r.noack = true;
+        } else {
+            out += k_syntax;
+            return false;
+        }
+    }
+    size_t rest = k < argv.size() ? argv.size() - k - 1 : 0;
+    if (rest == 0 || rest % 2 != 0) {
+        if (k == argv.size()) {
+            out += k_syntax;
+        } else {
+            out += std::string("-ERR Unbalanced '") + (grouped ? "xreadgroup" : "xread") +
+                   "' list of streams: for each stream key an ID or '$' must be specified.\r\n";
+        }
+        return false;
+    }
+    if (grouped && r.group.empty()) {
+        out += "-ERR Missing GROUP option for XREADGROUP\r\n";
+        return false;
+    }
+    r.keys = k + 1;
+    r.n = rest / 2;
+    return true;
+}
+
+static void xread(store::Keyspace& ks, const Args& argv, std::string& out) {
+    Read r;
+    if (!parse_read(argv, false, r, out)) return;
+    // every argument is checked before anything is read
+    std::vector<Stream*> streams(r.n);
+    std::vector<StreamID> after(r.n);
+    for (size_t i = 0 ; i < r.n ; ++i) {
+        bool wrong;
+        streams[i] = find_stream(ks, argv[r.keys + i], wrong);
+        if (wrong) {
+            out += k_wrongtype;
+            return;
+        }
+        std::string_view id = argv[r.keys + r.n + i];
+        if (id == "$") {
+            after[i] = streams[i] == nullptr ? StreamID{} : streams[i]->last_id();
+        } else if (id == ">") {
+            out += "-ERR The > ID can be specified only when calling XREADGROUP using the GROUP <group> "
+                   "<consumer> option.\r\n";
+            return;
+        } else if (!parse_id(id, after[i], 0)) {
+            out += k_invalid_id;
+            return;
+        }
+    }
+    std::string body;
+    size_t found = 0;
+    for (size_t i = 0 ; i < r.n ; ++i) {
+        StreamID start = after[i];
+        if (streams[i] == nullptr || !next(start)) continue;
+        std::string entries;
+        int64_t n = 0;
+        streams[i]->range(start, data::k_max_id, [&] (StreamID id, const Stream::Fields& fv) {
+            entry(id, fv, entries);
+            return ++n != r.count;
+        });
+        if (n == 0) continue;
+        body += net::resp::bulk(argv[r.keys + i]);
+        body += "*" + std::to_string(n) + "\r\n" + entries;
+        ++found;
+    }
+    // nothing new is null, which is what Blocking waits on
+    out += found == 0 ? net::resp::null() : "%" + std::to_string(found) + "\r\n" + body;
+}
+
+static void xreadgroup(store::Keyspace& ks, const Args& argv, std::string& out) {
+    Read r;
+    if (!parse_read(argv, true, r, out)) return;
+    std::vector<Stream*> streams(r.n);
+    for (size_t i = 0 ; i < r.n ; ++i) {
+        bool wrong;
+        Stream* s = streams[i] = find_stream(ks, argv[r.keys + i], wrong);
+        if (wrong) {
+            out += k_wrongtype;
+            return;
+        }
+        if (s == nullptr || s->group(r.group) == nullptr) {
+            out += "-NOGROUP No such key '" + std::string(argv[r.keys + i]) + "' or consumer group '" +
+                   std::string(r.group) + "' in XREADGROUP with GROUP option\r\n";
+            return;
+        }
+        std::string_view id = argv[r.keys + r.n + i];
+        StreamID parsed;
+        if (id == "$") {
+            out += "-ERR The $ ID is meaningless in the context of XREADGROUP: you want to read the history "
+                   "of this consumer by specifying a proper ID, or use the > ID to get new messages. The $ ID "
+                   "would just return an empty result set.\r\n";
+            return;
+        }
+        if (id != ">" && !parse_id(id, parsed, 0)) {
+            out += k_invalid_id;
+            return;
+        }
+    }
+    int64_t now = store::now_ms();
+    std::string body;
+    size_t found = 0;
+    for (size_t i = 0 ; i < r.n ; ++i) {
+        std::string_view key = argv[r.keys + i];
+        std::string_view id = argv[r.keys + r.n + i];
+        Stream& s = *streams[i];
+        Stream::Group& g = *s.group(r.group);
+        consumer(g, r.consumer, now).seen = now;
+        std::string entries;
+        int64_t n = 0;
+        if (id == ">") {
+            // what nobody in the group was given yet
+            StreamID start = g.last;
+            if (next(start)) {
+                s.range(start, data::k_max_id, [&] (StreamID at, const Stream::Fields& fv) {
+                    g.last = at;
+                    if (!r.noack) {
+                        Stream::Pending& p = assign(g, at, r.consumer, now);
+                        p.delivered = now;
+                        p.deliveries = 1;
+                    }
+                    entry(at, fv, entries);
+                    return ++n != r.count;
+                });
+            }
+            if (n == 0) continue;
+        } else {
+            // what the consumer was given and did not acknowledge, entries
+            // trimmed since come back without their fields
+            StreamID start;
+            parse_id(id, start, 0);
+            std::string at;
+            Stream::Fields fv;
+            for (auto* p = g.pel.seek_ge(start.key(), false, &at) ; p != nullptr && (r.count == 0 || n < r.count) ;
+                 p = g.pel.seek_ge(at, true, &at)) {
+                if (p->consumer != r.consumer) continue;
+                StreamID pid = StreamID::from_key(at);
+                if (s.get(pid, fv)) {
+                    entry(pid, fv, entries);
+                } else {
+                    entries += "*2\r\n" + net::resp::bulk(pid.str()) + net::resp::null();
+                }
+                p->delivered = now;
+                ++p->deliveries;
+                ++n;
+            }
+        }
+        if (n > 0) ks.touch(key);
+        body += net::resp::bulk(key);
+        body += "*" + std::to_string(n) + "\r\n" + entries;
+        ++found;
+    }
+    out += found == 0 ? net::resp::null() : "%" + std::to_string(found) + "\r\n" + body;
+}
+
+// XACK key group id [id ...]
+static void xack(store::Keyspace& ks, const Args& argv, std::string& out) {
+    std::vector<StreamID> ids(argv.size() - 3);
+    for (size_t k = 3 ; k < argv.size() ; ++k) {
+        if (!parse_id(argv[k], ids[k - 3], 0)) {
+            out += k_invalid_id;
+            return;
+        }
+    }
+    bool wrong;
+    Stream* s = find_stream(ks, argv[1], wrong);
+    if (wrong) {
+        out += k_wrongtype;
+        return;
+    }
+    Stream::Group* g = s == nullptr ? nullptr : s->group(argv[2]);
+    int64_t n = 0;
+    for (size_t k = 0 ; g != nullptr && k < ids.size() ; ++k) {
+        std::string key = ids[k].key();
+        auto* p = g->pel.find(key);
+        if (p == nullptr) continue;
+        release(*g, *p);
+        g->pel.erase(key);
+        ++n;
+    }
+    if (n > 0) change(ks, argv[1]);
+    out += net::resp::integer(n);
+}
+
+static bool xgroup_arity(const Args& argv, size_t min, size_t max, const char* sub, std::string& out) {
+    if (argv.size() >= min && argv.size() <= max) return true;
+    out += std::string("-ERR wrong number of arguments for 'xgroup|") + sub + "' command\r\n";
+    return false;
+}
+
+// XGROUP CREATE key group <id | $> [MKSTREAM]
+// XGROUP SETID key group <id | $>
+// XGROUP DESTROY key group
+// XGROUP CREATECONSUMER / DELCONSUMER key group consumer
+static void xgroup(store::Keyspace& ks, const Args& argv, std::string& out) {
+    net::resp::Command sub{{argv[1]}};
+    bool create = sub.is("CREATE");
+    bool setid = sub.is("SETID");
+    bool destroy = sub.is("DESTROY");
+    bool add = sub.is("CREATECONSUMER");
+    bool del = sub.is("DELCONSUMER");
+    if (!create && !setid && !destroy && !add && !del) {
+        out += "-ERR unknown subcommand '" + std::string(argv[1]) + "'. Try XGROUP HELP.\r\n";
+        return;
+    }
+    if (create && !xgroup_arity(argv, 5, 6, "create", out)) return;
+    if (setid && !xgroup_arity(argv, 5, 5, "setid", out)) return;
+    if (destroy && !xgroup_arity(argv, 4, 4, "destroy", out)) return;
+    if ((add || del) && !xgroup_arity(argv, 5, 5, add ? "createconsumer" : "delconsumer", out)) return;
+
+    bool mkstream = false;
+    if (create && argv.size() == 6) {
+        if (!net::resp::Command{{argv[5]}}.is("MKSTREAM")) {
+            out += k_syntax;
+            return;
+        }
+        mkstream = true;
+    }
+    StreamID id;
+    if ((create || setid) && argv[4] != "$" && !parse_id(argv[4], id, 0)) {
+        out += k_invalid_id;
+        return;
+    }
+    std::string_view key = argv[2];
+    bool wrong;
+    Stream* s = find_stream(ks, key, wrong);
+    if (wrong) {
+        out += k_wrongtype;
+        return;
+    }
+    if (s == nullptr && !mkstream) {
+        out += k_no_key;
+        return;
+    }
+    if (create) {
+        if (s == nullptr) {
+            ks.write(key) = std::make_unique<Stream>();
+        }
+        Stream& st = change(ks, key);
+        if (argv[4] == "$") id = st.last_id();
+        if (st.create_group(argv[3], id) == nullptr) {
+            out += "-BUSYGROUP Consumer Group name already exists\r\n";
+            return;
+        }
+        out += net::resp::ok();
+        return;
+    }
+    if (destroy) {
+        bool gone = s->destroy_group(argv[3]);
+        if (gone) change(ks, key);
+        out += net::resp::integer(gone ? 1 : 0);
+        return;
+    }
+    Stream::Group* g = s->group(argv[3]);
+    if (g == nullptr) {
+        out += "-NOGROUP No such consumer group '" + std::string(argv[3]) + "' for key name '" + std::string(key) +
+               "'\r\n";
+        return;
+    }
+    change(ks, key);
+    if (setid) {
+        g->last = argv[4] == "$" ? s->last_id() : id;
+        out += net::resp::ok();
+    } else if (add) {
+        size_t before = g->consumers.size();
+        consumer(*g, argv[4], store::now_ms());
+        out += net::resp::integer(g->consumers.size() > before ? 1 : 0);
+    } else {
+        // its pending entries go with it
+        std::vector<std::string> owned;
+        g->pel.each([&] (std::string_view k, const Stream::Pending& p) {
+            if (p.consumer == argv[4]) owned.emplace_back(k);
+            return true;
+        });
+        for (auto& k : owned) g->pel.erase(k);
+        g->consumers.erase(std::string(argv[4]));
+        out += net::resp::integer(static_cast<int64_t>(owned.size()));
+    }
+}
+
+static std::string no_group(std::string_view key, std::string_view group) {
+    return "-NOGROUP No such key '" + std::string(key) + "' or consumer group '" + std::string(group) + "'\r\n";
+}
+
+// XPENDING key group [[IDLE min-idle-time] start end count [consumer]]
+static void xpending(store::Keyspace& ks, const Args& argv, std::string& out) {
+    bool wrong;
+    Stream* s = find_stream(ks, argv[1], wrong);
+    if (wrong) {
+        out += k_wrongtype;
+        return;
+    }
+    Stream::Group* g = s == nullptr ? nullptr : s->group(argv[2]);
+    if (g == nullptr) {
+        out += no_group(argv[1], argv[2]);
+        return;
+    }
+    if (argv.size() == 3) {
+        // how many, the smallest and largest IDs, and how many per consumer
+        if (g->pel.empty()) {
+            out += "*4\r\n:0\r\n_\r\n_\r\n_\r\n";
+            return;
+        }
+        std::string first, last;
+        g->pel.first(&first);
+        g->pel.last(&last);
+        out += "*4\r\n" + net::resp::integer(static_cast<int64_t>(g->pel.size()));
+        out += net::resp::bulk(StreamID::from_key(first).str());
+        out += net::resp::bulk(StreamID::from_key(last).str());
+        std::string owners;
+        size_t n = 0;
+        for (auto& [name, c] : g->consumers) {
+            if (c.pending == 0) continue;
+            owners += "*2\r\n" + net::resp::bulk(name) + net::resp::bulk(std::to_string(c.pending));
+            ++n;
+        }
+        out += "*" + std::to_string(n) + "\r\n" + owners;
+        return;
+    }
+    size_t k = 3;
+    int64_t min_idle = 0;
+    if (net::resp::Command{{argv[3]}}.is("IDLE")) {
+        if (argv.size() < 5 || !parse_int(argv[4], min_idle)) {
+            out += k_not_integer;
+            return;
+        }
+        k = 5;
+    }
+    if (argv.size() != k + 3 && argv.size() != k + 4) {
+        out += k_syntax;
+        return;
+    }
+    StreamID start, end;
+    bool empty = false;
+    if (!parse_bound(argv[k], true, start, empty) || !parse_bound(argv[k + 1], false, end, empty)) {
+        out += k_invalid_id;
+        return;
+    }
+    int64_t count;
+    if (!parse_int(argv[k + 2], count)) {
+        out += k_not_integer;
+        return;
+    }
+    std::string_view owner = argv.size() == k + 4 ? argv[k + 3] : std::string_view();
+    int64_t now = store::now_ms();
+    std::string body;
+    int64_t n = 0;
+    std::string at;
+    for (auto* p = empty ? nullptr : g->pel.seek_ge(start.key(), false, &at) ; p != nullptr && n < count ;
+         p = g->pel.seek_ge(at, true, &at)) {
+        StreamID id = StreamID::from_key(at);
+        if (id > end) break;
+        int64_t idle = now - p->delivered;
+        if ((!owner.empty() && p->consumer != owner) || idle < min_idle) continue;
+        body += "*4\r\n" + net::resp::bulk(id.str()) + net::resp::bulk(p->consumer) +
+                net::resp::integer(idle) + net::resp::integer(static_cast<int64_t>(p->deliveries));
+        ++n;
+    }
+    out += "*" + std::to_string(n) + "\r\n" + body;
+}
+
+// XCLAIM key group consumer min-idle-time id [id ...] [IDLE ms]
+//        [TIME unix-time-milliseconds] [RETRYCOUNT count] [FORCE] [JUSTID]
+static void xclaim(store::Keyspace& ks, const Args& argv, std::string& out) {
+    int64_t min_idle;
+    if (!parse_int(argv[4], min_idle)) {
+        out += "-ERR Invalid min-idle-time argument for XCLAIM\r\n";
+        return;
+    }
+    std::vector<StreamID> ids;
+    size_t k = 5;
+    for (StreamID id ; k < argv.size() && parse_id(argv[k], id, 0) ; ++k) ids.push_back(id);
+    int64_t now = store::now_ms();
+    int64_t delivered = now;
+    int64_t retries = -1;
+    bool force = false;
+    bool justid = false;
+    for (; k < argv.size() ; ++k) {
+        net::resp::Command opt{{argv[k]}};
+        int64_t n;
+        if ((opt.is("IDLE") || opt.is("TIME") || opt.is("RETRYCOUNT")) && k + 1 < argv.size()) {
+            if (!parse_int(argv[++k], n)) {
+                out += k_not_integer;
+                return;
+            }
+            if (opt.is("IDLE")) {
+                delivered = now - n;
+            } else if (opt.is("TIME")) {
+                delivered = n;
+            } else {
+                retries = n;
+            }
+        } else if (opt.is("FORCE")) {
+            force = true;
+        } else if (opt.is("JUSTID")) {
+            justid = true;
+        } else {
+            out += k_syntax;
+            return;
+        }
+    }
+    bool wrong;
+    Stream* s = find_stream(ks, argv[1], wrong);
+    if (wrong) {
+        out += k_wrongtype;
+        return;
+    }
+    Stream::Group* g = s == nullptr ? nullptr : s->group(argv[2]);
+    if (g == nullptr) {
+        out += no_group(argv[1], argv[2]);
+        return;
+    }
+    std::string body;
+    size_t n = 0;
+    bool changed = false;
+    Stream::Fields fv;
+    for (StreamID id : ids) {
+        std::string key = id.key();
+        auto* p = g->pel.find(key);
+        if (p == nullptr ? !force : now - p->delivered < min_idle) continue;
+        if (!justid && !s->get(id, fv)) {
+            // trimmed : its delivery goes with it
+            if (p != nullptr) {
+                release(*g, *p);
+                g->pel.erase(key);
+                changed = true;
+            }
+            continue;
+        }
+        Stream::Pending& claimed = assign(*g, id, argv[3], now);
+        claimed.delivered = delivered;
+        if (retries >= 0) {
+            claimed.deliveries = static_cast<uint64_t>(retries);
+        } else if (!justid) {
+            ++claimed.deliveries;
+        }
+        if (justid) {
+            body += net::resp::bulk(id.str());
+        } else {
+            entry(id, fv, body);
+        }
+        ++n;
+        changed = true;
+    }
+    if (changed) change(ks, argv[1]);
+    out += "*" + std::to_string(n) + "\r\n" + body;
+}
+
+// XTRIM key MAXLEN [=|~] threshold
+static void xtrim(store::Keyspace& ks, const Args& argv, std::string& out) {
+    size_t k = 3;
+    bool approx = false;
+    if (argv.size() == 5) {
+        if (argv[3] != "~" && argv[3] != "=") {
+            out += k_syntax;
+            return;
+        }
+        approx = argv[3] == "~";
+        k = 4;
+    } else if (argv.size() != 4) {
+        out += k_syntax;
+        return;
+    }
+    if (!net::resp::Command{{argv[2]}}.is("MAXLEN")) {
+        out += k_syntax;
+        return;
+    }
+    int64_t maxlen;
+    if (!parse_int(argv[k], maxlen) || maxlen < 0) {
+        out += "-ERR The MAXLEN argument must be >= 0.\r\n";
+        return;
+    }
+    bool wrong;
+    Stream* s = find_stream(ks, argv[1], wrong);
+    if (wrong) {
+        out += k_wrongtype;
+        return;
+    }
+    size_t removed = s == nullptr ? 0 : s->trim(static_cast<size_t>(maxlen), approx);
+    if (removed > 0) change(ks, argv[1]);
+    out += net::resp::integer(static_cast<int64_t>(removed));
+}
+
+// XSETID key last-id
+static void xsetid(store::Keyspace& ks, const Args& argv, std::string& out) {
+    StreamID id;
+    if (!parse_id(argv[2], id, 0)) {
+        out += k_invalid_id;
+        return;
+    }
+    bool wrong;
+    Stream* s = find_stream(ks, argv[1], wrong);
+    if (wrong) {
+        out += k_wrongtype;
+        return;
+    }
+    if (s == nullptr) {
+        out += "-ERR no such key\r\n";
+        return;
+    }
+    StreamID top;
+    s->reverse_range(data::k_max_id, {}, [&top] (StreamID at, const Stream::Fields&) {
+        top = at;
+        return false;
+    });
+    if (s->size() > 0 && id < top) {
+        out += "-ERR The ID specified in XSETID is smaller than the target stream top item\r\n";
+        return;
+    }
+    change(ks, argv[1]).last_id(id);
+    out += net::resp::ok();
+}
+
+const Spec k_stream_commands[] = {
+    {"XADD",       -5, WRITE,                   1, 1, 1, xadd},
+    {"XRANGE",     -4, READONLY,                1, 1, 1, xrange},
+    {"XREVRANGE",  -4, READONLY,                1, 1, 1, xrevrange},
+    {"XLEN",        2, READONLY,                1, 1, 1, xlen},
+    {"XREAD",      -4, READONLY | STREAMS_KEYS, 1, -1, 1, xread},
+    // delivering moves the group along
+    {"XREADGROUP", -7, WRITE | STREAMS_KEYS,    1, -1, 1, xreadgroup},
+    {"XACK",       -4, WRITE,                   1, 1, 1, xack},
+    {"XGROUP",     -2, WRITE,                   2, 2, 1, xgroup},
+    {"XPENDING",   -3, READONLY,                1, 1, 1, xpending},
+    {"XCLAIM",     -6, WRITE,                   1, 1, 1, xclaim},
+    {"XTRIM",      -4, WRITE,                   1, 1, 1, xtrim},
+    {"XSETID",      3, WRITE,                   1, 1, 1, xsetid},
+};
+
+const size_t k_stream_commands_len = sizeof(k_stream_commands) / sizeof(k_stream_commands[0]);
+
+} // namespace commands
@@ -0,0 +1,501 @@
+#include "commands/table.h"
+#include "resp/resp_utils.h"
+#include "store/cold_store.h"
+#include "store/reclaimer.h"
+#include "store/timers.h"
+#include "utils/glob.h"
+
+#include <array>
+#include <cctype>
+#include <charconv>
+#include <cstdio>
+#include <vector>
+
+namespace commands {
+
+static const char* k_wrongtype = "-WRONGTYPE Operation against a key holding the wrong kind of value\r\n";
+static const char* k_not_integer = "-ERR value is not an integer or out of range\r\n";
+static const char* k_syntax = "-ERR syntax error\r\n";
+
+static bool parse_int(std::string_view s, int64_t& v) {
+    auto res = std::from_chars(s.data(), s.data() + s.size(), v);
+    return !s.empty() && res.ec == std::errc() && res.ptr == s.data() + s.size();
+}
+
+static void ping(store::Keyspace&, const Args& argv, std::string& out) {
+    if (argv.size() > 2) {
+        out += net::resp::wrong_arity("ping");
+        return;
+    }
+    out += argv.size() == 2 ? net::resp::bulk(argv[1]) : "+PONG\r\n";
+}
+
+static void echo(store::Keyspace&, const Args& argv, std::string& out) {
+    out += net::resp::bulk(argv[1]);
+}
+
+// replies for the small integers most counters hold, made once and shared :
+// integer-encoded values are sent without being formatted
+static constexpr int64_t k_shared_ints = 10000;
+
+struct SharedInts {
+    std::string text;
+    std::array<uint32_t, k_shared_ints + 1> at;
+
+    SharedInts() {
+        for (int64_t n = 0 ; n < k_shared_ints ; ++n) {
+            at[n] = static_cast<uint32_t>(text.size());
+            text += net::resp::bulk(std::to_string(n));
+        }
+        at[k_shared_ints] = static_cast<uint32_t>(text.size());
+    }
+};
+
+static void bulk_int(int64_t n, std::string& out) {
+    static const SharedInts shared;
+    if (n >= 0 && n < k_shared_ints) {
+        out.append(shared.text, shared.at[n], shared.at[n + 1] - shared.at[n]);
+        return;
+    }
+    char buf[20];
+    out += net::resp::bulk(store::format(n, buf));
+}
+
+// the string v holds when it is a std::string, an integer or an inline
+// one, buf holds the text of integers
+static bool text_of(const store::Value& v, std::string_view& s, char (&buf)[20]) {
+    if (auto* str = std::get_if<std::string>(&v)) {
+        s = *str;
+    } else if (auto* n = std::get_if<int64_t>(&v)) {
+        s = store::format(*n, buf);
+    } else if (auto* i = std::get_if<store::Inline>(&v)) {
+        s = i->view();
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// appends the string under key as a bulk reply, null when key is missing.
+// Strings stay in their encoding, compressed ones are inflated straight
+// into out. Returns false, appending nothing, when key holds something else
+static bool get_bulk(store::Keyspace& ks, const store::Value* v, std::string& out) {
+    std::string_view s;
+    char buf[20];
+    if (v == nullptr) {
+        out += net::resp::null();
+    } else if (auto* n = std::get_if<int64_t>(v)) {
+        bulk_int(*n, out);
+    } else if (auto* c = std::get_if<store::Compressed>(v)) {
+        data::write_header(out, data::Type::BulkString, c->size);
+        ks.inflate(*c, out);
+        out += "\r\n";
+    } else if (text_of(*v, s, buf)) {
+        out += net::resp::bulk(s);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static bool get_bulk(store::Keyspace& ks, std::string_view key, std::string& out) {
+    return get_bulk(ks, ks.peek(key), out);
+}
+
+static void get(store::Keyspace& ks, const Args& argv, std::string& out) {
+    if (!get_bulk(ks, argv[1], out)) out += k_wrongtype;
+}
+
+static void set(store::Keyspace& ks, const Args& argv, std::string& out) {
+    // SET key value [NX | XX] [GET] [EX seconds | PX milliseconds]
+    bool nx = false, xx = false, get_old = false;
+    int64_t at = 0;
+    for (size_t k = 3 ; k < argv.size() ; ++k) {
+        net::resp::Command opt{{argv[k]}};
+        if (opt.is("NX") && !xx) {
+            nx = true;
+        } else if (opt.is("XX") && !nx) {
+            xx = true;
+        } else if (opt.is("GET")) {
+            get_old = true;
+        } else if ((opt.is("EX") || opt.is("PX")) && at == 0 && k + 1 < argv.size()) {
+            int64_t n;
+            if (!parse_int(argv[++k], n) || n <= 0 || n > INT64_MAX / 1000) {
+                out += "-ERR invalid expire time in 'set' command\r\n";
+                return;
+            }
+            at = store::now_ms() + (opt.is("EX") ? n * 1000 : n);
+        } else {
+            out += k_syntax;
+            return;
+        }
+    }
+    bool found = ks.peek(argv[1]) != nullptr;
+    std::string reply;
+    if (!get_old) {
+        reply = net::resp::ok();
+    } else if (!get_bulk(ks, argv[1], reply)) {
+        out += k_wrongtype;
+        return;
+    }
+    if ((nx && found) || (xx && !found)) {
+        out += get_old ? reply : net::resp::null();
+        return;
+    }
+    ks.set(argv[1], std::string(argv[2]));
+    if (at != 0) ks.expire(argv[1], at);
+    out += reply;
+}
+
+static void setnx(store::Keyspace& ks, const Args& argv, std::string& out) {
+    if (ks.peek(argv[1]) != nullptr) {
+        out += net::resp::integer(0);
+        return;
+    }
+    ks.set(argv[1], std::string(argv[2]));
+    out += net::resp::integer(1);
+}
+
+static void getset(store::Keyspace& ks, const Args& argv, std::string& out) {
+    if (!get_bulk(ks, argv[1], out)) {
+        out += k_wrongtype;
+        return;
+    }
+    ks.set(argv[1], std::string(argv[2]));
+}
+
+static void append(store::Keyspace& ks, const Args& argv, std::string& out) {
+    auto* v = ks.find(argv[1]);
+    if (v != nullptr && std::get_if<std::string>(v) == nullptr) {
+        out += k_wrongtype;
+        return;
+    }
+    auto& s = std::get<std::string>(ks.write(argv[1]));
+    s.append(argv[2]);
+    out += net::resp::integer(static_cast<int64_t>(s.size()));
+}
+
+static void strlen(store::Keyspace& ks, const Args& argv, std::string& out) {
+    auto* v = ks.peek(argv[1]);
+    std::string_view s;
+    char buf[20];
+    if (v == nullptr) {
+        out += net::resp::integer(0);
+    } else if (auto* c = std::get_if<store::Compressed>(v)) {
+        out += net::resp::integer(c->size);
+    } else if (text_of(*v, s, buf)) {
+        out += net::resp::integer(static_cast<int64_t>(s.size()));
+    } else {
+        out += k_wrongtype;
+    }
+}
+
+static void incr_by(store::Keyspace& ks, std::string_view key, int64_t by, std::string& out) {
+    auto* v = ks.peek(key);
+    int64_t cur = 0;
+    if (auto* n = v == nullptr ? nullptr : std::get_if<int64_t>(v)) {
+        cur = *n;
+    } else if (v != nullptr) {
+        std::string_view s;
+        char buf[20];
+        if (std::holds_alternative<store::ListPtr>(*v) || std::holds_alternative<store::BloomPtr>(*v) ||
+            std::holds_alternative<store::StreamPtr>(*v)) {
+            out += k_wrongtype;
+            return;
+        }
+        // compressed strings are too long to be integers
+        if (!text_of(*v, s, buf) || !parse_int(s, cur)) {
+            out += k_not_integer;
+            return;
+        }
+    }
+    int64_t res;
+    if (__builtin_add_overflow(cur, by, &res)) {
+        out += "-ERR increment or decrement would overflow\r\n";
+        return;
+    }
+    // keeps the deadline, like APPEND
+    ks.poke(key) = res;
+    out += net::resp::integer(res);
+}
+
+static void incr(store::Keyspace& ks, const Args& argv, std::string& out) {
+    incr_by(ks, argv[1], 1, out);
+}
+
+static void decr(store::Keyspace& ks, const Args& argv, std::string& out) {
+    incr_by(ks, argv[1], -1, out);
+}
+
+static void incrby(store::Keyspace& ks, const Args& argv, std::string& out) {
+    int64_t by;
+    if (!parse_int(argv[2], by)) {
+        out += k_not_integer;
+        return;
+    }
+    incr_by(ks, argv[1], by, out);
+}
+
+static void decrby(store::Keyspace& ks, const Args& argv, std::string& out) {
+    int64_t by;
+    if (!parse_int(argv[2], by) || by == INT64_MIN) {
+        out += k_not_integer;
+        return;
+    }
+    incr_by(ks, argv[1], -by, out);
+}
+
+// multi-key commands go through Keyspace::batch(), which prefetches the
+// keys that come next. Their shards are all locked already
+
+static void mget(store::Keyspace& ks, const Args& argv, std::string& out) {
+    data::write_header(out, data::Type::Array, argv.size() - 1);
+    ks.batch(argv.size() - 1, [&argv] (size_t k) { return argv[k + 1]; }, [&] (size_t k, uint64_t h) {
+        if (!get_bulk(ks, ks.peek(argv[k + 1], h), out)) out += net::resp::null();
+    });
+}
+
+static void mset(store::Keyspace& ks, const Args& argv, std::string& out) {
+    if (argv.size() % 2 == 0) {
+        out += net::resp::wrong_arity("mset");
+        return;
+    }
+    ks.batch(argv.size() / 2, [&argv] (size_t k) { return argv[2 * k + 1]; }, [&] (size_t k, uint64_t h) {
+        ks.set(argv[2 * k + 1], h, std::string(argv[2 * k + 2]));
+    });
+    out += net::resp::ok();
+}
+
+static void del(store::Keyspace& ks, const Args& argv, std::string& out) {
+    int64_t n = 0;
+    ks.batch(argv.size() - 1, [&argv] (size_t k) { return argv[k + 1]; }, [&] (size_t k, uint64_t h) {
+        n += ks.erase(argv[k + 1], h) ? 1 : 0;
+    });
+    out += net::resp::integer(n);
+}
+
+static void exists(store::Keyspace& ks, const Args& argv, std::string& out) {
+    int64_t n = 0;
+    ks.batch(argv.size() - 1, [&argv] (size_t k) { return argv[k + 1]; }, [&] (size_t k, uint64_t h) {
+        n += ks.peek(argv[k + 1], h) != nullptr ? 1 : 0;
+    });
+    out += net::resp::integer(n);
+}
+
+static std::string_view type_of(const store::Value& v) {
+    if (std::holds_alternative<store::ListPtr>(v)) return "list";
+    // the name RedisBloom gives its type
+    if (std::holds_alternative<store::BloomPtr>(v)) return "MBbloom--";
+    if (std::holds_alternative<store::StreamPtr>(v)) return "stream";
+    return "string";
+}
+
+static void type(store::Keyspace& ks, const Args& argv, std::string& out) {
+    auto* v = ks.peek(argv[1]);
+    out += '+';
+    out += v == nullptr ? "none" : type_of(*v);
+    out += "\r\n";
+}
+
+// SCAN cursor [MATCH pattern] [COUNT count] [TYPE type]
+static void scan(store::Keyspace& ks, const Args& argv, std::string& out) {
+    uint64_t cursor;
+    auto res = std::from_chars(argv[1].data(), argv[1].data() + argv[1].size(), cursor);
+    if (res.ec != std::errc() || res.ptr != argv[1].data() + argv[1].size()) {
+        out += "-ERR invalid cursor\r\n";
+        return;
+    }
+    std::string_view pattern, type;
+    int64_t count = 10;
+    for (size_t k = 2 ; k < argv.size() ; k += 2) {
+        net::resp::Command opt{{argv[k]}};
+        if (k + 1 == argv.size()) {
+            out += k_syntax;
+            return;
+        } else if (opt.is("MATCH")) {
+            pattern = argv[k + 1];
+        } else if (opt.is("COUNT")) {
+            if (!parse_int(argv[k + 1], count)) {
+                out += k_not_integer;
+                return;
+            }
+            if (count < 1) {
+                out += k_syntax;
+                return;
+            }
+        } else if (opt.is("TYPE")) {
+            type = argv[k + 1];
+        } else {
+            out += k_syntax;
+            return;
+        }
+    }
+    std::string want(type);
+    for (auto& c : want) c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    std::vector<std::string_view> keys;
+    cursor = ks.scan(cursor, static_cast<size_t>(count), [&] (const std::string& key, const store::Value& v) {
+        if (!want.empty() && type_of(v) != want) return;
+        if (!pattern.empty() && !utils::glob_match(pattern, key)) return;
+        keys.push_back(key);
+    });
+    out += "*2\r\n" + net::resp::bulk(std::to_string(cursor)) + "*" + std::to_string(keys.size()) + "\r\n";
+    for (auto key : keys) out += net::resp::bulk(key);
+}
+
+// EXPIRE / PEXPIRE / EXPIREAT / PEXPIREAT, unit is 1000 for seconds
+static void expire_at(store::Keyspace& ks, const Args& argv, int64_t unit, bool relative, std::string& out) {
+    int64_t n;
+    if (!parse_int(argv[2], n) || n > INT64_MAX / unit || n < INT64_MIN / unit) {
+        out += k_not_integer;
+        return;
+    }
+    int64_t at = n * unit;
+    if (relative && __builtin_add_overflow(at, store::now_ms(), &at)) {
+        out += "-ERR invalid expire time\r\n";
+        return;
+    }
+    // a deadline in the past deletes the key right away
+    if (at <= store::now_ms()) {
+        out += net::resp::integer(ks.erase(argv[1]) ? 1 : 0);
+        return;
+    }
+    out += net::resp::integer(ks.expire(argv[1], at) ? 1 : 0);
+}
+
+static void expire(store::Keyspace& ks, const Args& argv, std::string& out) {
+    expire_at(ks, argv, 1000, true, out);
+}
+
+static void pexpire(store::Keyspace& ks, const Args& argv, std::string& out) {
+    expire_at(ks, argv, 1, true, out);
+}
+
+static void expireat(store::Keyspace& ks, const Args& argv, std::string& out) {
+    expire_at(ks, argv, 1000, false, out);
+}
+
+static void pexpireat(store::Keyspace& ks, const Args& argv, std::string& out) {
+    expire_at(ks, argv, 1, false, out);
+}
+
+static void ttl_in(store::Keyspace& ks, const Args& argv, int64_t unit, std::string& out) {
+    int64_t at = ks.deadline(argv[1]);
+    if (at < 0) {
+        out += net::resp::integer(at);
+        return;
+    }
+    int64_t left = at - store::now_ms();
+    // rounded up, a key is never reported with 0 left before it is gone
+    out += net::resp::integer(left <= 0 ? 0 : (left + unit - 1) / unit);
+}
+
+static void ttl(store::Keyspace& ks, const Args& argv, std::string& out) {
+    ttl_in(ks, argv, 1000, out);
+}
+
+static void pttl(store::Keyspace& ks, const Args& argv, std::string& out) {
+    ttl_in(ks, argv, 1, out);
+}
+
+static void persist(store::Keyspace& ks, const Args& argv, std::string& out) {
+    out += net::resp::integer(ks.persist(argv[1]) ? 1 : 0);
+}
+
+static void dbsize(store::Keyspace& ks, const Args&, std::string& out) {
+    out += net::resp::integer(static_cast<int64_t>(ks.size()));
+}
+
+// FLUSHALL [ASYNC | SYNC], ASYNC frees the old keyspace in the background
+static void flushall(store::Keyspace& ks, const Args& argv, std::string& out) {
+    bool lazy = false;
+    if (argv.size() == 2) {
+        net::resp::Command mode{{argv[1]}};
+        lazy = mode.is("ASYNC");
+        if (!lazy && !mode.is("SYNC")) {
+            out += k_syntax;
+            return;
+        }
+    } else if (argv.size() > 2) {
+        out += k_syntax;
+        return;
+    }
+    ks.clear(lazy);
+    out += net::resp::ok();
+}
+
+// INFO [section], only what this server has to say. Takes no lock, it
+// reads counters
+static void info(store::Keyspace& ks, const Args& argv, std::string& out) {
+    if (argv.size() > 2) {
+        out += net::resp::wrong_arity("info");
+        return;
+    }
+    net::resp::Command section{{argv.size() == 2 ? argv[1] : std::string_view("all")}};
+    bool all = section.is("ALL") || section.is("EVERYTHING") || section.is("DEFAULT");
+    std::string s;
+    if (all || section.is("COMPRESSION")) {
+        auto& c = ks.compression_stats();
+        uint64_t raw = c.raw_bytes.load(std::memory_order_relaxed);
+        uint64_t bytes = c.bytes.load(std::memory_order_relaxed);
+        char ratio[32];
+        std::snprintf(ratio, sizeof(ratio), "%.2f", bytes == 0 ? 1.0 : static_cast<double>(raw) / bytes);
+        s += "# Compression\r\n";
+        s += "compressed_values:" + std::to_string(c.values.load(std::memory_order_relaxed)) + "\r\n";
+        s += "compressed_raw_bytes:" + std::to_string(raw) + "\r\n";
+        s += "compressed_bytes:" + std::to_string(bytes) + "\r\n";
+        s += "compression_ratio:" + std::string(ratio) + "\r\n";
+        s += "compression_cpu_us:" + std::to_string(c.compress_ns.load(std::memory_order_relaxed) / 1000) + "\r\n";
+        s += "decompression_cpu_us:" + std::to_string(c.decompress_ns.load(std::memory_order_relaxed) / 1000) + "\r\n";
+        s += "compression_rejected:" + std::to_string(c.rejected.load(std::memory_order_relaxed)) + "\r\n";
+    }
+    if (auto* r = ks.reclaimer() ; r != nullptr && (all || section.is("LAZYFREE"))) {
+        if (!s.empty()) s += "\r\n";
+        s += "# Lazyfree\r\n";
+        s += "lazyfree_pending_objects:" + std::to_string(r->pending()) + "\r\n";
+        s += "lazyfreed_objects:" + std::to_string(r->freed()) + "\r\n";
+    }
+    if (auto* cold = ks.cold_store() ; cold != nullptr && (all || section.is("COLD"))) {
+        if (!s.empty()) s += "\r\n";
+        s += "# Cold\r\n";
+        s += "cold_values:" + std::to_string(cold->values()) + "\r\n";
+        s += "cold_bytes:" + std::to_string(cold->bytes()) + "\r\n";
+    }
+    out += net::resp::bulk(s);
+}
+
+const Spec k_string_commands[] = {
+    {"PING",     -1, READONLY, 0, 0, 0, ping},
+    {"ECHO",      2, READONLY, 0, 0, 0, echo},
+    {"GET",       2, READONLY, 1, 1, 1, get},
+    {"SET",      -3, WRITE,    1, 1, 1, set},
+    {"SETNX",     3, WRITE,    1, 1, 1, setnx},
+    {"GETSET",    3, WRITE,    1, 1, 1, getset},
+    {"APPEND",    3, WRITE,    1, 1, 1, append},
+    {"STRLEN",    2, READONLY, 1, 1, 1, strlen},
+    {"INCR",      2, WRITE,    1, 1, 1, incr},
+    {"DECR",      2, WRITE,    1, 1, 1, decr},
+    {"INCRBY",    3, WRITE,    1, 1, 1, incrby},
+    {"DECRBY",    3, WRITE,    1, 1, 1, decrby},
+    {"MGET",     -2, READONLY, 1, -1, 1, mget},
+    {"MSET",     -3, WRITE,    1, -1, 2, mset},
+    {"DEL",      -2, WRITE,    1, -1, 1, del},
+    // large values are freed in the background by DEL as well
+    {"UNLINK",   -2, WRITE,    1, -1, 1, del},
+    {"EXISTS",   -2, READONLY, 1, -1, 1, exists},
+    {"TYPE",      2, READONLY, 1, 1, 1, type},
+    {"EXPIRE",    3, WRITE,    1, 1, 1, expire},
+    {"PEXPIRE",   3, WRITE,    1, 1, 1, pexpire},
+    {"EXPIREAT",  3, WRITE,    1, 1, 1, expireat},
+    {"PEXPIREAT", 3, WRITE,    1, 1, 1, pexpireat},
+    {"TTL",       2, READONLY, 1, 1, 1, ttl},
+    {"PTTL",      2, READONLY, 1, 1, 1, pttl},
+    {"PERSIST",   2, WRITE,    1, 1, 1, persist},
+    {"DBSIZE",    1, READONLY | ALL_KEYS, 0, 0, 0, dbsize},
+    {"FLUSHALL", -1, WRITE | ALL_KEYS,    0, 0, 0, flushall},
+    {"INFO",     -1, READONLY, 0, 0, 0, info},
+    {"SCAN",     -2, READONLY | ALL_KEYS, 0, 0, 0, scan},
+};
+
+const size_t k_string_commands_len = sizeof(k_string_commands) / sizeof(k_string_commands[0]);
+
+} // namespace commands
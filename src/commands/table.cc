@@ -0,0 +1,254 @@
+#include "commands/table.h"
+#include <algorithm>
+#include "resp/resp_utils.h"
+#include "store/cold_store.h"
+#include "utils/lz.h"
+
+namespace commands {
+
+static thread_local int t_client = -1;
+
+// tables nobody writes to finish their rehash k_rehash_steps buckets at a
+// time, a few microseconds under each shard's lock
+static constexpr size_t k_rehash_steps = 1000;
+static constexpr std::chrono::milliseconds k_rehash_every{10};
+
+int Table::client() {
+    return t_client;
+}
+
+Table::Table(store::Keyspace& ks) : _ks(ks) {
+    for (size_t k = 0 ; k < k_string_commands_len ; ++k) {
+        _specs.emplace(k_string_commands[k].name, k_string_commands[k]);
+    }
+    for (size_t k = 0 ; k < k_list_commands_len ; ++k) {
+        _specs.emplace(k_list_commands[k].name, k_list_commands[k]);
+    }
+    for (size_t k = 0 ; k < k_probabilistic_commands_len ; ++k) {
+        _specs.emplace(k_probabilistic_commands[k].name, k_probabilistic_commands[k]);
+    }
+    for (size_t k = 0 ; k < k_stream_commands_len ; ++k) {
+        _specs.emplace(k_stream_commands[k].name, k_stream_commands[k]);
+    }
+    _ks.on_expire([this] (std::string_view key, int64_t at) {
+        // stale timers find the key gone or with a later deadline
+        _timers.at(at, [this, key = std::string(key)] { reap(key); });
+    });
+    _ks.on_reap([this] (std::string_view key) {
+        // whoever found it past its deadline, replicas and trackers see a DEL
+        written(*lookup("DEL"), {"DEL", key}, {});
+    });
+    _ks.on_rehash([this] {
+        _timers.after(k_rehash_every, [this] { rehash(); });
+    });
+}
+
+Table::~Table() {
+    _ks.on_expire({});
+    _ks.on_reap({});
+    _ks.on_rehash({});
+}
+
+void Table::rehash() {
+    if (_ks.rehash(k_rehash_steps)) _timers.after(k_rehash_every, [this] { rehash(); });
+}
+
+void Table::reap(const std::string& key) {
+    uint64_t mask = uint64_t(1) << store::Keyspace::shard_index(store::Keyspace::hash(key));
+    lock(mask);
+    _ks.reap(key);
+    unlock(mask);
+}
+
+void recreate(std::string_view key, const store::Value& v, int64_t at,
+              const std::function<void(const Args&)>& emit) {
+    if (auto* s = std::get_if<std::string>(&v)) {
+        emit({"SET", key, *s});
+    } else if (auto* n = std::get_if<int64_t>(&v)) {
+        char buf[20];
+        emit({"SET", key, store::format(*n, buf)});
+    } else if (auto* i = std::get_if<store::Inline>(&v)) {
+        emit({"SET", key, i->view()});
+    } else if (auto* c = std::get_if<store::Cold>(&v)) {
+        // straight from the log, without bringing it back in memory
+        emit({"SET", key, c->store->read(*c)});
+    } else if (auto* z = std::get_if<store::Compressed>(&v)) {
+        std::string s(z->size, '\0');
+        utils::lz_decompress(z->data(), s.data(), s.size());
+        emit({"SET", key, s});
+    } else if (auto* l = std::get_if<store::ListPtr>(&v)) {
+        Args argv = {"RPUSH", key};
+        for (auto& e : **l) argv.push_back(e);
+        emit(argv);
+    } else if (auto* b = std::get_if<store::BloomPtr>(&v)) {
+        std::string dump;
+        (*b)->dump(dump);
+        emit({"BF.LOADCHUNK", key, "1", dump});
+    } else if (auto* p = std::get_if<store::StreamPtr>(&v)) {
+        const data::Stream& st = **p;
+        st.range({}, data::k_max_id, [&] (data::StreamID id, const data::Stream::Fields& fv) {
+            std::string at = id.str();
+            Args argv = {"XADD", key, at};
+            argv.insert(argv.end(), fv.begin(), fv.end());
+            emit(argv);
+            return true;
+        });
+        // an empty stream still exists : a group made up for the purpose
+        // brings it back without an entry, and goes right away
+        if (st.size() == 0) {
+            emit({"XGROUP", "CREATE", key, "_", "0", "MKSTREAM"});
+            emit({"XGROUP", "DESTROY", key, "_"});
+        }
+        std::string last = st.last_id().str();
+        emit({"XSETID", key, last});
+        for (auto& [name, g] : st.groups()) {
+            std::string delivered = g.last.str();
+            emit({"XGROUP", "CREATE", key, name, delivered});
+            for (auto& c : g.consumers) emit({"XGROUP", "CREATECONSUMER", key, name, c.first});
+            g.pel.each([&] (std::string_view k, const data::Stream::Pending& pending) {
+                std::string id = data::StreamID::from_key(k).str();
+                std::string time = std::to_string(pending.delivered);
+                std::string count = std::to_string(pending.deliveries);
+                emit({"XCLAIM", key, name, pending.consumer, "0", id, "TIME", time, "RETRYCOUNT", count,
+                      "FORCE", "JUSTID"});
+                return true;
+            });
+        }
+    }
+    if (at >= 0) {
+        std::string ms = std::to_string(at);
+        emit({"PEXPIREAT", key, ms});
+    }
+}
+
+const Spec* Table::lookup(std::string_view name) const {
+    // upper-case into a stack buffer, command names are short
+    char buf[32];
+    if (name.size() >= sizeof(buf)) return nullptr;
+    for (size_t k = 0 ; k < name.size() ; ++k) {
+        char c = name[k];
+        buf[k] = (c >= 'a' && c <= 'z') ? c - ('a' - 'A') : c;
+    }
+    auto it = _specs.find(std::string_view(buf, name.size()));
+    return it == _specs.end() ? nullptr : &it->second;
+}
+
+KeyRange key_range(int first_key, int last_key, int step, uint32_t flags, const Args& argv) {
+    int argc = static_cast<int>(argv.size());
+    KeyRange none{1, 0, 1};
+    if (first_key == 0) return none;
+    if (!(flags & STREAMS_KEYS)) {
+        int last = last_key < 0 ? argc + last_key : last_key;
+        return {first_key, std::min(last, argc - 1), step};
+    }
+    // the options before STREAMS and their arguments, the command itself
+    // tells about those it does not know
+    int k = 1;
+    for (;;) {
+        if (k >= argc) return none;
+        net::resp::Command opt{{argv[k]}};
+        if (opt.is("STREAMS")) break;
+        if (opt.is("GROUP")) {
+            k += 3;
+        } else if (opt.is("COUNT") || opt.is("BLOCK")) {
+            k += 2;
+        } else if (opt.is("NOACK")) {
+            k += 1;
+        } else {
+            return none;
+        }
+    }
+    int rest = argc - k - 1;
+    if (rest == 0 || rest % 2 != 0) return none;
+    return {k + 1, k + rest / 2, 1};
+}
+
+uint64_t Table::shards(const Spec& spec, const Args& argv) {
+    if (spec.flags & ALL_KEYS) return (uint64_t(1) << store::Keyspace::k_shards) - 1;
+    KeyRange keys = key_range(spec, argv);
+    uint64_t mask = 0;
+    for (int k = keys.first ; k <= keys.last ; k += keys.step) {
+        mask |= uint64_t(1) << store::Keyspace::shard_index(store::Keyspace::hash(argv[k]));
+    }
+    return mask;
+}
+
+void Table::lock(uint64_t mask) {
+    // always in shard order, so that two multi-shard commands cannot deadlock
+    for (size_t k = 0 ; k < store::Keyspace::k_shards ; ++k) {
+        if (mask & (uint64_t(1) << k)) _ks.shard(k).m.lock();
+    }
+    t_held |= mask;
+}
+
+bool Table::try_lock(uint64_t mask) {
+    for (size_t k = 0 ; k < store::Keyspace::k_shards ; ++k) {
+        if (!(mask & (uint64_t(1) << k)) || _ks.shard(k).m.try_lock()) continue;
+        unlock(mask & ((uint64_t(1) << k) - 1));
+        return false;
+    }
+    t_held |= mask;
+    return true;
+}
+
+void Table::unlock(uint64_t mask) {
+    for (size_t k = 0 ; k < store::Keyspace::k_shards ; ++k) {
+        if (mask & (uint64_t(1) << k)) _ks.shard(k).m.unlock();
+    }
+    t_held &= ~mask;
+}
+
+void Table::call(const Spec& spec, const Args& argv, std::string& out, std::string_view raw) {
+    uint64_t mask = shards(spec, argv);
+    lock(mask);
+    call_locked(spec, argv, out, raw);
+    unlock(mask);
+}
+
+bool Table::check(int fd, const Spec& spec, const Args& argv, std::string& out) {
+    if (!_guard) return true;
+    uint64_t mask = shards(spec, argv);
+    lock(mask);
+    bool ok = _guard(fd, spec, argv, out);
+    unlock(mask);
+    return ok;
+}
+
+void Table::serve(int fd, const Spec& spec, const Args& argv, std::string& out, std::string_view raw) {
+    uint64_t mask = shards(spec, argv);
+    lock(mask);
+    t_client = fd;
+    if (allowed(fd, spec, argv, out)) {
+        call_locked(spec, argv, out, raw);
+        if (_on_read && (spec.flags & READONLY)) _on_read(fd, spec, argv);
+    }
+    t_client = -1;
+    unlock(mask);
+}
+
+bool Table::handle(int fd, const net::resp::Command& cmd) {
+    const Spec* spec = lookup(cmd.argv[0]);
+    if (spec == nullptr) return false;
+    std::string out;
+    if (!arity_ok(*spec, cmd.argc())) {
+        out = net::resp::wrong_arity(cmd.argv[0]);
+    } else {
+        serve(fd, *spec, cmd.argv, out, cmd.raw);
+    }
+    net::write_stream(fd, out.c_str(), out.size());
+    return true;
+}
+
+void Table::attach(net::resp::Redis& r) {
+    using Chain = ChainOfResponsibility::Chain<int, net::resp::Redis::T&&>;
+    r.attach([this] (int connfd, net::resp::Redis::T&& msg, Chain next) {
+        if (auto* node = std::get_if<std::unique_ptr<data::Node>>(&msg)) {
+            auto cmd = net::resp::as_command(node->get());
+            if (cmd.has_value()) cmd->raw = net::resp::RESPServer::last_request();
+            if (cmd.has_value() && handle(connfd, *cmd)) return;
+        }
+        next(connfd, std::move(msg));
+    });
+}
+
+} // namespace commands
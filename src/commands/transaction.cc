@@ -0,0 +1,174 @@
+#include "commands/transaction.h"
+#include "resp/resp_utils.h"
+
+#include <cstring>
+
+namespace commands {
+
+template<typename T>
+static void put(std::string& buf, T v) {
+    buf.append(reinterpret_cast<const char*>(&v), sizeof(v));
+}
+
+template<typename T>
+static T take(const char*& p) {
+    T v;
+    std::memcpy(&v, p, sizeof(v));
+    p += sizeof(v);
+    return v;
+}
+
+void Transactions::queue(Tx& tx, const Spec* spec, const net::resp::Command& cmd) {
+    // [spec][argc]([len][bytes])*
+    put(tx.queued, spec);
+    put(tx.queued, static_cast<uint32_t>(cmd.argc()));
+    for (auto& a : cmd.argv) {
+        put(tx.queued, static_cast<uint32_t>(a.size()));
+        tx.queued.append(a);
+    }
+    ++tx.count;
+}
+
+void Transactions::reset(Tx& tx) {
+    tx.queuing = false;
+    tx.dirty = false;
+    tx.count = 0;
+    tx.queued.clear();
+    tx.watched.clear();
+}
+
+std::string Transactions::exec(Tx& tx) {
+    // decode everything first, the views point into tx.queued
+    std::vector<std::pair<const Spec*, Args>> cmds;
+    cmds.reserve(tx.count);
+    uint64_t mask = 0;
+    const char* p = tx.queued.data();
+    for (uint32_t k = 0 ; k < tx.count ; ++k) {
+        auto* spec = take<const Spec*>(p);
+        uint32_t argc = take<uint32_t>(p);
+        Args argv;
+        argv.reserve(argc);
+        for (uint32_t a = 0 ; a < argc ; ++a) {
+            uint32_t len = take<uint32_t>(p);
+            argv.emplace_back(p, len);
+            p += len;
+        }
+        mask |= Table::shards(*spec, argv);
+        cmds.emplace_back(spec, std::move(argv));
+    }
+    for (auto& [h, version] : tx.watched) {
+        mask |= uint64_t(1) << store::Keyspace::shard_index(h);
+    }
+
+    std::string out;
+    _table.lock(mask);
+    bool aborted = false;
+    for (auto& [h, version] : tx.watched) {
+        if (_table.keyspace().version(h) != version) {
+            aborted = true;
+            break;
+        }
+    }
+    if (!aborted) {
+        data::write_header(out, data::Type::Array, cmds.size());
+        for (auto& [spec, argv] : cmds) {
+            _table.call_locked(*spec, argv, out);
+        }
+    }
+    _table.unlock(mask);
+    return aborted ? net::resp::null() : out;
+}
+
+bool Transactions::handle(int fd, const net::resp::Command& cmd) {
+    Tx* tx = _txs.get(fd);
+    bool queuing = tx != nullptr && tx->queuing;
+    std::string reply;
+
+    if (cmd.is("MULTI")) {
+        if (queuing) {
+            reply = "-ERR MULTI calls can not be nested\r\n";
+        } else {
+            _txs.at(fd).queuing = true;
+            reply = net::resp::ok();
+        }
+    } else if (cmd.is("EXEC")) {
+        if (!queuing) {
+            reply = "-ERR EXEC without MULTI\r\n";
+        } else if (tx->dirty) {
+            reply = "-EXECABORT Transaction discarded because of previous errors.\r\n";
+            reset(*tx);
+        } else {
+            reply = exec(*tx);
+            reset(*tx);
+        }
+    } else if (cmd.is("DISCARD")) {
+        if (!queuing) {
+            reply = "-ERR DISCARD without MULTI\r\n";
+        } else {
+            reset(*tx);
+            reply = net::resp::ok();
+        }
+    } else if (cmd.is("WATCH")) {
+        if (queuing) {
+            reply = "-ERR WATCH inside MULTI is not allowed\r\n";
+        } else if (cmd.argc() < 2) {
+            reply = net::resp::wrong_arity("watch");
+        } else {
+            auto& t = _txs.at(fd);
+            for (size_t k = 1 ; k < cmd.argc() ; ++k) {
+                uint64_t h = store::Keyspace::hash(cmd.argv[k]);
+                auto& shard = _table.keyspace().shard(store::Keyspace::shard_index(h));
+                std::lock_guard<std::mutex> l(shard.m);
+                t.watched.emplace_back(h, shard.versions[store::Keyspace::slot_index(h)]);
+            }
+            reply = net::resp::ok();
+        }
+    } else if (cmd.is("UNWATCH")) {
+        if (tx != nullptr && !queuing) tx->watched.clear();
+        reply = net::resp::ok();
+    } else if (queuing) {
+        // QUIT still quits
+        if (cmd.is("QUIT")) return false;
+        const Spec* spec = _table.lookup(cmd.argv[0]);
+        if (spec == nullptr) {
+            // Pub/Sub, CLIENT, CLUSTER... answer their client themselves,
+            // and not under the shards' locks EXEC holds
+            tx->dirty = true;
+            reply = "-ERR '" + std::string(cmd.argv[0]) + "' is not a keyspace command, only those can be queued "
+                    "inside MULTI\r\n";
+        } else if (!Table::arity_ok(*spec, cmd.argc())) {
+            tx->dirty = true;
+            reply = net::resp::wrong_arity(cmd.argv[0]);
+        } else if (!_table.check(fd, *spec, cmd.argv, reply)) {
+            // -MOVED, -CROSSSLOT... now, as Redis does, not at EXEC
+            tx->dirty = true;
+        } else {
+            queue(*tx, spec, cmd);
+            reply = "+QUEUED\r\n";
+        }
+    } else {
+        return false;
+    }
+    net::write_stream(fd, reply.c_str(), reply.size());
+    return true;
+}
+
+void Transactions::drop(int fd) {
+    _txs.reset(fd);
+}
+
+void Transactions::attach(net::resp::Redis& r) {
+    using Chain = ChainOfResponsibility::Chain<int, net::resp::Redis::T&&>;
+    r.attach([this] (int connfd, net::resp::Redis::T&& msg, Chain next) {
+        if (auto* node = std::get_if<std::unique_ptr<data::Node>>(&msg)) {
+            auto cmd = net::resp::as_command(node->get());
+            if (cmd.has_value() && handle(connfd, *cmd)) return;
+        }
+        next(connfd, std::move(msg));
+    });
+    r.on_close([this] (int connfd) {
+        drop(connfd);
+    });
+}
+
+} // namespace commands
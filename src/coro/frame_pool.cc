@@ -0,0 +1,93 @@
+#include "coro/frame_pool.h"
+#include <new>
+
+namespace coro {
+
+// releases the pool of a thread when it exits
+struct PoolHolder {
+    FramePool* pool = new FramePool();
+
+    ~PoolHolder() {
+        pool->release();
+    }
+};
+
+static thread_local PoolHolder t_pool;
+
+FramePool& FramePool::local() {
+    return *t_pool.pool;
+}
+
+static size_t size_class(size_t n) {
+    size_t cls = 0;
+    for (size_t s = FramePool::k_min ; s < n ; s <<= 1) ++cls;
+    return cls;
+}
+
+void* FramePool::allocate(size_t n) {
+    n += sizeof(Header);
+    if (n > k_max) {
+        auto* h = static_cast<Header*>(::operator new(n));
+        *h = {nullptr, 0};
+        return h + 1;
+    }
+    FramePool& pool = local();
+    size_t cls = size_class(n);
+    Block* b = pool._free[cls];
+    if (b == nullptr) b = pool._remote[cls].exchange(nullptr, std::memory_order_acquire);
+    void* mem;
+    if (b != nullptr) {
+        pool._free[cls] = b->next;
+        mem = b;
+    } else {
+        mem = ::operator new(k_min << cls);
+    }
+    pool._refs.fetch_add(1, std::memory_order_relaxed);
+    auto* h = static_cast<Header*>(mem);
+    *h = {&pool, cls};
+    return h + 1;
+}
+
+void FramePool::deallocate(void* p) noexcept {
+    auto* h = static_cast<Header*>(p) - 1;
+    FramePool* pool = h->pool;
+    if (pool == nullptr) {
+        ::operator delete(h);
+        return;
+    }
+    size_t cls = h->cls;
+    auto* b = reinterpret_cast<Block*>(h);
+    if (pool == t_pool.pool) {
+        b->next = pool->_free[cls];
+        pool->_free[cls] = b;
+    } else {
+        b->next = pool->_remote[cls].load(std::memory_order_relaxed);
+        while (!pool->_remote[cls].compare_exchange_weak(b->next, b, std::memory_order_release,
+                                                         std::memory_order_relaxed)) {}
+    }
+    pool->release();
+}
+
+size_t FramePool::live() {
+    return local()._refs.load(std::memory_order_relaxed) - 1;
+}
+
+void FramePool::release() noexcept {
+    if (_refs.fetch_sub(1, std::memory_order_acq_rel) == 1) delete this;
+}
+
+FramePool::~FramePool() {
+    auto drop = [] (Block* b) {
+        while (b != nullptr) {
+            Block* next = b->next;
+            ::operator delete(b);
+            b = next;
+        }
+    };
+    for (size_t cls = 0 ; cls < k_classes ; ++cls) {
+        drop(_free[cls]);
+        drop(_remote[cls].load(std::memory_order_acquire));
+    }
+}
+
+} // namespace coro
@@ -0,0 +1,28 @@
+#include "coro/task.h"
+
+namespace coro {
+
+Loop& Loop::current() {
+    static thread_local Loop loop;
+    return loop;
+}
+
+void Loop::post(std::coroutine_handle<> h) {
+    _ready.push(h);
+    _signal.fetch_add(1, std::memory_order_release);
+    _signal.notify_one();
+}
+
+void Event::set() {
+    void* old = _state.exchange(set_state(), std::memory_order_acq_rel);
+    if (old == &_waiter) _waiter.loop->post(_waiter.h);
+}
+
+bool Event::await_suspend(std::coroutine_handle<> h) {
+    _waiter = {h, &Loop::current()};
+    void* expected = nullptr;
+    // false : set() came first, the awaiter goes on right away
+    return _state.compare_exchange_strong(expected, &_waiter, std::memory_order_acq_rel);
+}
+
+} // namespace coro
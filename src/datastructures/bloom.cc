@@ -0,0 +1,141 @@
+#include "datastructures/bloom.h"
+#include "utils/murmur.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace data {
+
+static constexpr uint64_t k_seed = 0x5bd1e9955bd1e995ull;
+// the odd constants of the Parquet split-block filter, one per word
+static constexpr uint32_t k_salts[8] = {
+    0x47b6137bu, 0x44974d91u, 0x8824ad5bu, 0xa2b7289du,
+    0x705495c7u, 0x2df1424bu, 0x9efc4947u, 0x5c6bfb31u
+};
+// what each layer's error rate is multiplied by
+static constexpr double k_tightening = 0.5;
+// blocks fill unevenly and 8 bits per item is fewer than the best number
+// for low error rates : layers are sized for the error rate divided by
+// this, which keeps the measured one under the one asked for down to 1e-4
+// (bench/bench_probabilistic)
+static constexpr double k_block_penalty = 2;
+static constexpr char k_magic[4] = {'B', 'L', 'M', '1'};
+
+uint64_t Bloom::hash(std::string_view item) {
+    return utils::murmur64(item, k_seed);
+}
+
+Bloom::Bloom(double error, uint64_t capacity, unsigned expansion) : _expansion(expansion) {
+    grow(capacity, error);
+}
+
+void Bloom::grow(uint64_t capacity, double error) {
+    // one bit in each of the 8 words : bits = -8n / ln(1 - p^(1/8))
+    double p = error / k_block_penalty;
+    double bits = -8.0 * static_cast<double>(capacity) / std::log(1 - std::pow(p, 1.0 / 8));
+    auto blocks = static_cast<size_t>(std::ceil(bits / (8 * sizeof(Block))));
+    _layers.push_back({std::vector<Block>(std::max<size_t>(blocks, 1), Block{}), capacity, 0, error});
+}
+
+void Bloom::mask(uint32_t h, uint64_t (&m)[8]) {
+    for (int k = 0 ; k < 8 ; ++k) m[k] = uint64_t(1) << ((h * k_salts[k]) >> 26);
+}
+
+int Bloom::add(uint64_t h) {
+    if (contains(h)) return 0;
+    Layer* l = &_layers.back();
+    if (l->size >= l->capacity) {
+        if (_expansion == 0) return -1;
+        grow(l->capacity * _expansion, l->error * k_tightening);
+        l = &_layers.back();
+    }
+    uint64_t m[8];
+    mask(static_cast<uint32_t>(h), m);
+    Block& b = l->blocks[index(*l, h)];
+    for (int k = 0 ; k < 8 ; ++k) b.words[k] |= m[k];
+    ++l->size;
+    return 1;
+}
+
+bool Bloom::contains(uint64_t h) const {
+    uint64_t m[8];
+    mask(static_cast<uint32_t>(h), m);
+    // newest first, it is the largest
+    for (auto l = _layers.rbegin() ; l != _layers.rend() ; ++l) {
+        const Block& b = l->blocks[index(*l, h)];
+        uint64_t miss = 0;
+        for (int k = 0 ; k < 8 ; ++k) miss |= m[k] & ~b.words[k];
+        if (miss == 0) return true;
+    }
+    return false;
+}
+
+uint64_t Bloom::capacity() const {
+    uint64_t n = 0;
+    for (auto& l : _layers) n += l.capacity;
+    return n;
+}
+
+uint64_t Bloom::size() const {
+    uint64_t n = 0;
+    for (auto& l : _layers) n += l.size;
+    return n;
+}
+
+size_t Bloom::bytes() const {
+    size_t n = 0;
+    for (auto& l : _layers) n += l.blocks.size() * sizeof(Block);
+    return n;
+}
+
+template<typename T>
+static void put(std::string& out, T v) {
+    out.append(reinterpret_cast<const char*>(&v), sizeof(v));
+}
+
+template<typename T>
+static bool get(std::string_view& s, T& v) {
+    if (s.size() < sizeof(v)) return false;
+    std::memcpy(&v, s.data(), sizeof(v));
+    s.remove_prefix(sizeof(v));
+    return true;
+}
+
+// "BLM1", the expansion and the number of layers (uint32_t), then each
+// layer's capacity, size (uint64_t), error (double), number of blocks
+// (uint64_t) and blocks
+void Bloom::dump(std::string& out) const {
+    out.append(k_magic, sizeof(k_magic));
+    put(out, static_cast<uint32_t>(_expansion));
+    put(out, static_cast<uint32_t>(_layers.size()));
+    for (auto& l : _layers) {
+        put(out, l.capacity);
+        put(out, l.size);
+        put(out, l.error);
+        put(out, static_cast<uint64_t>(l.blocks.size()));
+        out.append(reinterpret_cast<const char*>(l.blocks.data()), l.blocks.size() * sizeof(Block));
+    }
+}
+
+std::unique_ptr<Bloom> Bloom::load(std::string_view s) {
+    if (s.size() < sizeof(k_magic) || std::memcmp(s.data(), k_magic, sizeof(k_magic)) != 0) return nullptr;
+    s.remove_prefix(sizeof(k_magic));
+    std::unique_ptr<Bloom> b(new Bloom());
+    uint32_t expansion, layers;
+    if (!get(s, expansion) || !get(s, layers) || layers == 0) return nullptr;
+    b->_expansion = expansion;
+    for (uint32_t k = 0 ; k < layers ; ++k) {
+        Layer l;
+        uint64_t blocks;
+        if (!get(s, l.capacity) || !get(s, l.size) || !get(s, l.error) || !get(s, blocks)) return nullptr;
+        if (blocks == 0 || blocks > s.size() / sizeof(Block) || !(l.error > 0 && l.error < 1)) return nullptr;
+        l.blocks.resize(blocks);
+        std::memcpy(l.blocks.data(), s.data(), blocks * sizeof(Block));
+        s.remove_prefix(blocks * sizeof(Block));
+        b->_layers.push_back(std::move(l));
+    }
+    return s.empty() ? std::move(b) : nullptr;
+}
+
+} // namespace data
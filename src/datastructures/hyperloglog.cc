@@ -0,0 +1,320 @@
+#include "datastructures/hyperloglog.h"
+#include "utils/murmur.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace data::hll {
+
+static constexpr uint64_t k_seed = 0xadc83b19ull;
+// bits of the hash left once the register index is taken out
+static constexpr unsigned k_q = 64 - k_p;
+// the largest value a sparse VAL opcode holds
+static constexpr uint8_t k_sparse_val_max = 32;
+static constexpr double k_alpha_inf = 0.721347520444481703680;
+
+using Histogram = std::array<uint32_t, 64>;
+
+static uint8_t at(std::string_view s, size_t p) {
+    return static_cast<uint8_t>(s[p]);
+}
+
+static void invalidate(std::string& s) {
+    s[15] = static_cast<char>(at(s, 15) | 0x80);
+}
+
+static std::string header(Encoding e) {
+    std::string s(k_header, '\0');
+    std::memcpy(s.data(), "HYLL", 4);
+    s[4] = static_cast<char>(e);
+    invalidate(s);
+    return s;
+}
+
+// the register an element falls into and the value it offers : one more
+// than the trailing zeros of the rest of its hash
+static void locate(std::string_view element, size_t& index, uint8_t& count) {
+    uint64_t h = utils::murmur64(element, k_seed);
+    index = h & (k_registers - 1);
+    h >>= k_p;
+    h |= uint64_t(1) << k_q;
+    count = static_cast<uint8_t>(__builtin_ctzll(h) + 1);
+}
+
+// dense registers are packed little-endian, register i from bit 6 * i on
+
+static uint8_t get_dense(const uint8_t* p, size_t i) {
+    size_t bit = i * k_bits;
+    unsigned b = bit / 8, fb = bit & 7;
+    unsigned v = p[b] >> fb;
+    if (fb > 8 - k_bits) v |= unsigned(p[b + 1]) << (8 - fb);
+    return v & 63;
+}
+
+static void set_dense(uint8_t* p, size_t i, uint8_t v) {
+    size_t bit = i * k_bits;
+    unsigned b = bit / 8, fb = bit & 7;
+    p[b] = static_cast<uint8_t>((p[b] & ~(63u << fb)) | (unsigned(v) << fb));
+    // the last register ends on the last byte, nothing is written past it
+    if (fb > 8 - k_bits) p[b + 1] = static_cast<uint8_t>((p[b + 1] & ~(63u >> (8 - fb))) | (v >> (8 - fb)));
+}
+
+// every 3 bytes hold 4 registers
+static void unpack(const uint8_t* p, Raw& raw) {
+    for (size_t i = 0 ; i < k_registers ; i += 4, p += 3) {
+        raw[i] = p[0] & 63;
+        raw[i + 1] = static_cast<uint8_t>((p[0] >> 6) | ((p[1] & 15) << 2));
+        raw[i + 2] = static_cast<uint8_t>((p[1] >> 4) | ((p[2] & 3) << 4));
+        raw[i + 3] = p[2] >> 2;
+    }
+}
+
+static void pack(const Raw& raw, uint8_t* p) {
+    for (size_t i = 0 ; i < k_registers ; i += 4, p += 3) {
+        p[0] = static_cast<uint8_t>(raw[i] | (raw[i + 1] << 6));
+        p[1] = static_cast<uint8_t>((raw[i + 1] >> 2) | (raw[i + 2] << 4));
+        p[2] = static_cast<uint8_t>((raw[i + 2] >> 4) | (raw[i + 3] << 2));
+    }
+}
+
+static const uint8_t* dense_registers(std::string_view s) {
+    return reinterpret_cast<const uint8_t*>(s.data()) + k_header;
+}
+
+// a sparse opcode : len registers holding value, span bytes long
+struct Op {
+    uint8_t value;
+    uint32_t len;
+    uint8_t span;
+};
+
+static bool decode(std::string_view s, size_t p, Op& op) {
+    uint8_t b = at(s, p);
+    if (b & 0x80) {
+        op = {static_cast<uint8_t>(((b >> 2) & 0x1f) + 1), (b & 3u) + 1, 1};
+    } else if (b & 0x40) {
+        if (p + 1 >= s.size()) return false;
+        op = {0, (((b & 0x3fu) << 8) | at(s, p + 1)) + 1, 2};
+    } else {
+        op = {0, (b & 0x3fu) + 1, 1};
+    }
+    return true;
+}
+
+// n registers holding value, as few opcodes as it takes
+static void put_run(std::string& out, uint8_t value, size_t n) {
+    while (n > 0) {
+        size_t len;
+        if (value > 0) {
+            len = std::min<size_t>(n, 4);
+            out += static_cast<char>(0x80 | ((value - 1) << 2) | (len - 1));
+        } else if (n > 64) {
+            len = std::min(n, k_registers);
+            out += static_cast<char>(0x40 | ((len - 1) >> 8));
+            out += static_cast<char>((len - 1) & 0xff);
+        } else {
+            len = n;
+            out += static_cast<char>(len - 1);
+        }
+        n -= len;
+    }
+}
+
+// calls fn(first, op) on each sparse opcode, false when they do not cover
+// exactly every register
+template<typename Fn>
+static bool walk(std::string_view s, Fn&& fn) {
+    size_t first = 0;
+    Op op;
+    for (size_t p = k_header ; p < s.size() ; p += op.span) {
+        if (!decode(s, p, op) || first + op.len > k_registers) return false;
+        fn(first, op);
+        first += op.len;
+    }
+    return first == k_registers;
+}
+
+// joins the VAL opcodes of the same value that follow each other between
+// from and to
+static void squash(std::string& s, size_t from, size_t to) {
+    Op op, next;
+    for (size_t p = from ; p < to && p < s.size() ; ) {
+        if (!decode(s, p, op)) return;
+        if (op.value > 0 && p + 1 < s.size() && decode(s, p + 1, next) && next.value == op.value
+            && op.len + next.len <= 4) {
+            s[p] = static_cast<char>(0x80 | ((op.value - 1) << 2) | (op.len + next.len - 1));
+            s.erase(p + 1, 1);
+            --to;
+            continue;
+        }
+        p += op.span;
+    }
+}
+
+static bool to_dense(std::string& s) {
+    Raw raw{};
+    if (!merge(s, raw)) return false;
+    s = from_raw(raw);
+    return true;
+}
+
+static double sigma(double x) {
+    if (x == 1.) return INFINITY;
+    double y = 1, z = x, prev;
+    do {
+        x *= x;
+        prev = z;
+        z += x * y;
+        y += y;
+    } while (prev != z);
+    return z;
+}
+
+static double tau(double x) {
+    if (x == 0. || x == 1.) return 0.;
+    double y = 1, z = 1 - x, prev;
+    do {
+        x = std::sqrt(x);
+        prev = z;
+        y *= 0.5;
+        z -= std::pow(1 - x, 2) * y;
+    } while (prev != z);
+    return z / 3;
+}
+
+// Ertl's improved estimator ("New cardinality estimation algorithms for
+// HyperLogLog sketches"), from how many registers hold each value
+static uint64_t estimate(const Histogram& h) {
+    double m = k_registers;
+    double z = m * tau((m - h[k_q + 1]) / m);
+    for (unsigned j = k_q ; j >= 1 ; --j) {
+        z += h[j];
+        z *= 0.5;
+    }
+    z += m * sigma(h[0] / m);
+    return static_cast<uint64_t>(std::llround(k_alpha_inf * m * m / z));
+}
+
+std::string create() {
+    std::string s = header(SPARSE);
+    put_run(s, 0, k_registers);
+    return s;
+}
+
+bool valid(std::string_view s) {
+    if (s.size() <= k_header || std::memcmp(s.data(), "HYLL", 4) != 0) return false;
+    if (s[4] == DENSE) return s.size() == k_dense_size;
+    return s[4] == SPARSE;
+}
+
+int add(std::string& s, std::string_view element) {
+    size_t index;
+    uint8_t count;
+    locate(element, index, count);
+    if (s[4] == DENSE) {
+        auto* p = reinterpret_cast<uint8_t*>(s.data()) + k_header;
+        if (get_dense(p, index) >= count) return 0;
+        set_dense(p, index, count);
+        invalidate(s);
+        return 1;
+    }
+    // the opcode covering index, and the one before for squash()
+    size_t first = 0, p = k_header, prev = k_header;
+    Op op;
+    for (;; p += op.span) {
+        if (p >= s.size() || !decode(s, p, op)) return -1;
+        if (index < first + op.len) break;
+        first += op.len;
+        prev = p;
+    }
+    if (op.value >= count) return 0;
+    if (count > k_sparse_val_max) {
+        if (!to_dense(s)) return -1;
+        set_dense(reinterpret_cast<uint8_t*>(s.data()) + k_header, index, count);
+        return 1;
+    }
+    // the run split around index
+    std::string runs;
+    put_run(runs, op.value, index - first);
+    put_run(runs, count, 1);
+    put_run(runs, op.value, first + op.len - index - 1);
+    s.replace(p, op.span, runs);
+    squash(s, prev, p + runs.size() + 1);
+    if (s.size() - k_header > k_sparse_max && !to_dense(s)) return -1;
+    invalidate(s);
+    return 1;
+}
+
+int64_t count(std::string& s) {
+    if (!(at(s, 15) & 0x80)) {
+        uint64_t n = 0;
+        for (int k = 7 ; k >= 0 ; --k) n = (n << 8) | at(s, 8 + k);
+        return static_cast<int64_t>(n);
+    }
+    Histogram h{};
+    if (s[4] == DENSE) {
+        auto* p = dense_registers(s);
+        for (size_t i = 0 ; i < k_registers ; i += 4, p += 3) {
+            ++h[p[0] & 63];
+            ++h[(p[0] >> 6) | ((p[1] & 15) << 2)];
+            ++h[(p[1] >> 4) | ((p[2] & 3) << 4)];
+            ++h[p[2] >> 2];
+        }
+    } else if (!walk(s, [&h] (size_t, const Op& op) { h[op.value] += op.len; })) {
+        return -1;
+    }
+    uint64_t n = estimate(h);
+    for (int k = 0 ; k < 8 ; ++k) s[8 + k] = static_cast<char>((n >> (8 * k)) & 0xff);
+    return static_cast<int64_t>(n);
+}
+
+bool merge(std::string_view s, Raw& raw) {
+    if (s[4] == DENSE) {
+        Raw r;
+        unpack(dense_registers(s), r);
+        max(raw, r);
+        return true;
+    }
+    return walk(s, [&raw] (size_t first, const Op& op) {
+        if (op.value == 0) return;
+        for (size_t i = first ; i < first + op.len ; ++i) raw[i] = std::max(raw[i], op.value);
+    });
+}
+
+uint64_t count(const Raw& raw) {
+    Histogram h{};
+    for (uint8_t r : raw) ++h[r];
+    return estimate(h);
+}
+
+std::string from_raw(const Raw& raw) {
+    std::string s = header(DENSE);
+    s.resize(k_dense_size);
+    pack(raw, reinterpret_cast<uint8_t*>(s.data()) + k_header);
+    return s;
+}
+
+void max(Raw& dst, const Raw& src) {
+    uint8_t* d = dst.data();
+    const uint8_t* p = src.data();
+#if defined(__SSE2__)
+    for (size_t i = 0 ; i < k_registers ; i += 16) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(d + i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(d + i), _mm_max_epu8(a, b));
+    }
+#elif defined(__ARM_NEON)
+    for (size_t i = 0 ; i < k_registers ; i += 16) vst1q_u8(d + i, vmaxq_u8(vld1q_u8(d + i), vld1q_u8(p + i)));
+#else
+    for (size_t i = 0 ; i < k_registers ; ++i) d[i] = std::max(d[i], p[i]);
+#endif
+}
+
+} // namespace data::hll
@@ -0,0 +1,162 @@
+#include "datastructures/stream.h"
+
+namespace data {
+
+// an entry whose fields are those of its block's first
+static constexpr uint8_t k_same_fields = 1;
+
+std::string StreamID::key() const {
+    std::string k(k_key_size, '\0');
+    for (int i = 0 ; i < 8 ; ++i) {
+        k[i] = static_cast<char>(ms >> (56 - 8 * i));
+        k[8 + i] = static_cast<char>(seq >> (56 - 8 * i));
+    }
+    return k;
+}
+
+StreamID StreamID::from_key(std::string_view k) {
+    StreamID id;
+    for (int i = 0 ; i < 8 ; ++i) {
+        id.ms = (id.ms << 8) | static_cast<uint8_t>(k[i]);
+        id.seq = (id.seq << 8) | static_cast<uint8_t>(k[8 + i]);
+    }
+    return id;
+}
+
+std::string StreamID::str() const {
+    return std::to_string(ms) + "-" + std::to_string(seq);
+}
+
+static void put_varint(std::string& out, uint64_t v) {
+    while (v >= 0x80) {
+        out += static_cast<char>((v & 0x7f) | 0x80);
+        v >>= 7;
+    }
+    out += static_cast<char>(v);
+}
+
+static uint64_t get_varint(const std::string& s, size_t& p) {
+    uint64_t v = 0;
+    for (unsigned shift = 0 ;; shift += 7) {
+        uint8_t b = static_cast<uint8_t>(s[p++]);
+        v |= uint64_t(b & 0x7f) << shift;
+        if (!(b & 0x80)) return v;
+    }
+}
+
+static void put_string(std::string& out, std::string_view s) {
+    put_varint(out, s.size());
+    out.append(s);
+}
+
+static std::string_view get_string(const std::string& s, size_t& p) {
+    size_t n = get_varint(s, p);
+    std::string_view v(s.data() + p, n);
+    p += n;
+    return v;
+}
+
+StreamID Stream::first_id() const {
+    StreamID id;
+    if (_size == 0) return id;
+    range({}, k_max_id, [&id] (StreamID first, const Fields&) {
+        id = first;
+        return false;
+    });
+    return id;
+}
+
+void Stream::append(StreamID id, const std::string_view* fv, size_t n) {
+    if (_tail == nullptr || _tail->count >= k_block_entries || _tail->data.size() >= k_block_bytes) {
+        auto b = std::make_unique<Block>();
+        b->first = id;
+        for (size_t k = 0 ; k < n ; k += 2) b->master.emplace_back(fv[k]);
+        _tail = _blocks.insert(id.key(), std::move(b)).first->get();
+    }
+    Block& b = *_tail;
+    bool same = b.master.size() * 2 == n;
+    for (size_t k = 0 ; same && k < n ; k += 2) same = b.master[k / 2] == fv[k];
+    put_varint(b.data, id.ms - b.first.ms);
+    put_varint(b.data, id.seq);
+    b.data += static_cast<char>(same ? k_same_fields : 0);
+    put_varint(b.data, n / 2);
+    for (size_t k = 0 ; k < n ; k += 2) {
+        if (!same) put_string(b.data, fv[k]);
+        put_string(b.data, fv[k + 1]);
+    }
+    b.last = id;
+    ++b.count;
+    ++b.live;
+    ++_size;
+    _last = id;
+}
+
+void Stream::decode(const Block& b, size_t& p, StreamID& id, Fields& fv) {
+    id.ms = b.first.ms + get_varint(b.data, p);
+    id.seq = get_varint(b.data, p);
+    bool same = static_cast<uint8_t>(b.data[p++]) & k_same_fields;
+    size_t n = get_varint(b.data, p);
+    fv.clear();
+    for (size_t k = 0 ; k < n ; ++k) {
+        fv.push_back(same ? std::string_view(b.master[k]) : get_string(b.data, p));
+        fv.push_back(get_string(b.data, p));
+    }
+}
+
+bool Stream::get(StreamID id, Fields& fv) const {
+    auto* b = _blocks.seek_le(id.key());
+    if (b == nullptr || (*b)->last < id) return false;
+    const Block& blk = **b;
+    StreamID at;
+    size_t p = blk.head;
+    for (uint32_t k = 0 ; k < blk.live ; ++k) {
+        decode(blk, p, at, fv);
+        if (at >= id) return at == id;
+    }
+    return false;
+}
+
+size_t Stream::trim(size_t maxlen, bool approx) {
+    size_t removed = 0;
+    Fields fv;
+    while (_size > maxlen) {
+        auto* first = _blocks.first();
+        Block& b = **first;
+        size_t extra = _size - maxlen;
+        if (b.live <= extra) {
+            _size -= b.live;
+            removed += b.live;
+            if (&b == _tail) _tail = nullptr;
+            _blocks.erase(b.first.key());
+            continue;
+        }
+        if (approx) break;
+        StreamID id;
+        for (size_t k = 0 ; k < extra ; ++k) decode(b, b.head, id, fv);
+        b.live -= static_cast<uint32_t>(extra);
+        _size -= extra;
+        removed += extra;
+    }
+    return removed;
+}
+
+Stream::Group* Stream::group(std::string_view name) {
+    auto it = _groups.find(name);
+    return it == _groups.end() ? nullptr : &it->second;
+}
+
+Stream::Group* Stream::create_group(std::string_view name, StreamID last) {
+    auto [it, added] = _groups.try_emplace(std::string(name));
+    if (!added) return nullptr;
+    it->second.last = last;
+    return &it->second;
+}
+
+bool Stream::destroy_group(std::string_view name) {
+    auto it = _groups.find(name);
+    if (it == _groups.end()) return false;
+    _groups.erase(it);
+    return true;
+}
+
+} // namespace data
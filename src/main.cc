@@ -1,26 +1,163 @@
+#include <csignal>
+#include <memory>
 #include <string>
 #include <iostream>
 #include "resp/handle.h"
 #include "resp/resp_utils.h"
+#include "acl/acl.h"
+#include "cluster/cluster.h"
+#include "commands/batch.h"
+#include "commands/blocking.h"
+#include "commands/connection.h"
+#include "commands/table.h"
+#include "commands/transaction.h"
+#include "profile/profile.h"
+#include "pubsub/pubsub.h"
+#include "reactor/reactor.h"
+#include "replication/replication.h"
+#include "store/cold_store.h"
+#include "store/reclaimer.h"
+#include "tracking/tracking.h"
+#include "upgrade/upgrade.h"
 
-#define PORT      ntohs(1337)
+#define PORT      1337
 // 127.0.0.1
 #define IP        ntohl(INADDR_LOOPBACK)
 #define K_MAX_MSG 4096
 
-int main() {
-    net::resp::RESPServer serv(IP, PORT, K_MAX_MSG);
-    using Output = std::unique_ptr<data::Node>;
-    while (serv.tcp_accept([] (int fd, std::variant<net::resp::RESPError, Output>&& res) {
-        if (auto* err = std::get_if<net::resp::RESPError>(&res)) {
-            std::string err_msg = err->to_string();
-            std::string response = net::resp::err(err_msg);
-            std::cout << response << '\n';
-            net::write_stream(fd, response.c_str(), response.size());
+static void usage() {
+    std::cerr << "usage: ridics [--port <port>] [--replicaof <host> <port>] [--cluster] [--cores <n>]"
+                 " [--tracking-max-keys <n>] [--cold-log <path> [--cold-min-size <bytes>] [--cold-idle <s>]]"
+                 " [--compress-min-size <bytes>] [--requirepass <password>]"
+                 " [--upgrade-socket <path>] [--takeover <path>] [--drain-timeout <s>] [--profile]\n";
+    exit(1);
+}
+
+int main(int argc, char** argv) {
+    // a client vanishing mid-reply must not take the server down
+    signal(SIGPIPE, SIG_IGN);
+
+    unsigned short port = PORT;
+    std::string master_host;
+    unsigned short master_port = 0;
+    bool cluster_mode = false;
+    size_t cores = 0;
+    // keys remembered for client-side caches, the oldest go past that
+    size_t tracking_max_keys = 1 << 20;
+    // large or idle strings go to that file when set
+    store::ColdStore::Options cold;
+    // strings of at least that many bytes are kept compressed, 0 for none
+    size_t compress_min_size = 0;
+    // the default user's password, it needs none when empty
+    std::string requirepass;
+    // hot restart : where a new binary asks for the listening socket, where
+    // this one asks for it, and how long clients may stay on the old process
+    std::string upgrade_socket;
+    std::string takeover;
+    int64_t drain_timeout_ms = 30000;
+    // samples every request from the start, PROFILE START does it later
+    bool profiling = false;
+    for (int k = 1 ; k < argc ; ++k) {
+        std::string arg = argv[k];
+        if (arg == "--port" && k + 1 < argc) {
+            port = static_cast<unsigned short>(std::stoi(argv[++k]));
+        } else if (arg == "--replicaof" && k + 2 < argc) {
+            master_host = argv[++k];
+            master_port = static_cast<unsigned short>(std::stoi(argv[++k]));
+        } else if (arg == "--cluster") {
+            cluster_mode = true;
+        } else if (arg == "--cores" && k + 1 < argc) {
+            cores = static_cast<size_t>(std::stoul(argv[++k]));
+        } else if (arg == "--tracking-max-keys" && k + 1 < argc) {
+            tracking_max_keys = static_cast<size_t>(std::stoul(argv[++k]));
+        } else if (arg == "--cold-log" && k + 1 < argc) {
+            cold.path = argv[++k];
+        } else if (arg == "--cold-min-size" && k + 1 < argc) {
+            cold.min_size = static_cast<size_t>(std::stoul(argv[++k]));
+        } else if (arg == "--cold-idle" && k + 1 < argc) {
+            cold.idle_ms = std::stoll(argv[++k]) * 1000;
+        } else if (arg == "--compress-min-size" && k + 1 < argc) {
+            compress_min_size = static_cast<size_t>(std::stoul(argv[++k]));
+        } else if (arg == "--requirepass" && k + 1 < argc) {
+            requirepass = argv[++k];
+        } else if (arg == "--upgrade-socket" && k + 1 < argc) {
+            upgrade_socket = argv[++k];
+        } else if (arg == "--takeover" && k + 1 < argc) {
+            takeover = argv[++k];
+        } else if (arg == "--drain-timeout" && k + 1 < argc) {
+            drain_timeout_ms = std::stoll(argv[++k]) * 1000;
+        } else if (arg == "--profile") {
+            profiling = true;
         } else {
-            std::string ok_msg = net::resp::ok();
-            net::write_stream(fd, ok_msg.c_str(), ok_msg.size());
+            usage();
         }
-    }, 10)) {}
-    return 0;
-}
\ No newline at end of file
+    }
+
+    // the running server's listening socket, and the link its keyspace comes through
+    int listen_fd = -1;
+    int takeover_link = -1;
+    if (!takeover.empty()) {
+        listen_fd = upgrade::take_over(takeover, takeover_link);
+        if (listen_fd < 0) net::die("takeover : no server at " + takeover);
+    }
+    net::resp::Redis redis(IP, htons(port), K_MAX_MSG, listen_fd);
+    commands::attach_connection(redis);
+    profile::attach(redis);
+    if (profiling) profile::start();
+    pubsub::PubSub ps;
+    ps.attach(redis);
+    // frees large values off the shards' locks, declared first : it outlives
+    // the keyspace
+    store::Reclaimer reclaimer;
+    store::Keyspace ks;
+    ks.compression(compress_min_size);
+    ks.reclaimer(&reclaimer);
+    commands::Table table(ks);
+    table.attach(redis);
+    std::unique_ptr<store::ColdStore> cold_store;
+    if (!cold.path.empty()) cold_store = std::make_unique<store::ColdStore>(ks, table.timers(), cold);
+    // parks BLPOP / BRPOP / BLMOVE clients until a write fills their lists
+    commands::Blocking blocking(table);
+    blocking.attach(redis);
+    tracking::Tracking tracking(table, ps, tracking_max_keys);
+    tracking.attach(redis);
+    // keyspace commands run on the reactor owning their keys instead
+    std::unique_ptr<reactor::Reactors> reactors;
+    if (cores > 0) {
+        reactors = std::make_unique<reactor::Reactors>(table, cores);
+        reactors->attach(redis);
+    }
+    // slots are assigned with CLUSTER ADDSLOTS, nodes introduced with CLUSTER MEET
+    std::unique_ptr<cluster::Cluster> cl;
+    if (cluster_mode) {
+        cl = std::make_unique<cluster::Cluster>(table, "127.0.0.1", port);
+        cl->attach(redis);
+    }
+    commands::Batches batches(table);
+    batches.attach(redis);
+    // runs before the table : a replica refuses writes from its clients
+    replication::Replication repl(table);
+    repl.attach(redis);
+    if (!master_host.empty()) repl.replicaof(master_host, master_port);
+    // runs first : it has to see every command of a connection inside MULTI
+    commands::Transactions txs(table);
+    txs.attach(redis);
+    // runs before everything : it refuses what the connection's user may not run
+    acl::Acl acl;
+    if (!requirepass.empty()) acl.setuser("default", {"resetpass", ">" + requirepass});
+    acl.attach(redis);
+    // the keyspace before the first client
+    if (takeover_link >= 0 && !repl.take_over(takeover_link)) net::die("takeover : no snapshot received");
+    std::unique_ptr<upgrade::Handoff> handoff;
+    if (!upgrade_socket.empty()) handoff = std::make_unique<upgrade::Handoff>(redis, repl, upgrade_socket);
+    redis.accept_all();
+    // only a hot restart stops the accept loop : the clients left finish on
+    // this process, then the new one gets the last writes
+    if (!redis.drain(std::chrono::milliseconds(drain_timeout_ms))) {
+        std::cerr << "hot restart : drain timeout, dropping the clients left\n";
+    }
+    // null without --upgrade, should anything else ever stop the accept loop
+    if (handoff) handoff->finish(std::chrono::seconds(5));
+    // connection threads may still run : no destructors
+    exit(0);
+}
@@ -0,0 +1,311 @@
+#include "profile/profile.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <vector>
+#include "resp/handle.h"
+#include "resp/resp_utils.h"
+
+// every allocation goes through here, counted when a sample runs on the
+// calling thread. Aligned ones keep the library's versions
+void* operator new(std::size_t n) {
+    profile::allocated(n);
+    if (n == 0) n = 1;
+    while (true) {
+        if (void* p = std::malloc(n)) return p;
+        std::new_handler h = std::get_new_handler();
+        if (h == nullptr) throw std::bad_alloc();
+        h();
+    }
+}
+
+void* operator new[](std::size_t n) {
+    return ::operator new(n);
+}
+
+void* operator new(std::size_t n, const std::nothrow_t&) noexcept {
+    try {
+        return ::operator new(n);
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+void* operator new[](std::size_t n, const std::nothrow_t&) noexcept {
+    return ::operator new(n, std::nothrow);
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+namespace profile {
+
+using Stacks = std::map<std::string, Totals, std::less<>>;
+
+// past that many stacks on a thread, new ones are counted under "other"
+static constexpr size_t k_max_stacks = 1024;
+
+static void merge(Stacks& into, const Stacks& from) {
+    for (auto& [stack, t] : from) {
+        auto& to = into[stack];
+        to.calls += t.calls;
+        to.cycles += t.cycles;
+        to.allocs += t.allocs;
+        to.bytes += t.bytes;
+        to.syscalls += t.syscalls;
+    }
+}
+
+struct Local;
+
+// the threads alive, and what the others left behind. Never destroyed :
+// threads may still end after exit() started
+struct Registry {
+    std::mutex m;
+    std::vector<Local*> threads;
+    Stacks retired;
+    // timestamp counter ticks per microsecond, measured on the first START
+    std::atomic<double> ticks_per_us{0};
+};
+
+static Registry& registry() {
+    static auto* r = new Registry;
+    return *r;
+}
+
+// a thread's totals, locked by its thread on each sample and by DUMP
+struct Local {
+    std::mutex m;
+    Stacks stacks;
+
+    Local() {
+        auto& r = registry();
+        std::lock_guard<std::mutex> l(r.m);
+        r.threads.push_back(this);
+    }
+
+    ~Local() {
+        auto& r = registry();
+        std::lock_guard<std::mutex> l(r.m);
+        merge(r.retired, stacks);
+        r.threads.erase(std::find(r.threads.begin(), r.threads.end(), this));
+    }
+
+    void add(std::string_view stack, const Totals& t) {
+        std::lock_guard<std::mutex> l(m);
+        auto it = stacks.find(stack);
+        if (it == stacks.end()) {
+            if (stacks.size() >= k_max_stacks) stack = "other";
+            it = stacks.try_emplace(std::string(stack)).first;
+        }
+        it->second.calls += t.calls;
+        it->second.cycles += t.cycles;
+        it->second.allocs += t.allocs;
+        it->second.bytes += t.bytes;
+        it->second.syscalls += t.syscalls;
+    }
+};
+
+static Local& local() {
+    static thread_local Local l;
+    return l;
+}
+
+// frames of the samples running on this thread, ';' separated
+static thread_local std::string t_stack;
+
+void Sample::begin(std::string_view frame, bool command) {
+    // the bookkeeping counts for nobody
+    uint32_t depth = t_counters.depth;
+    t_counters.depth = 0;
+    local();
+    _parent = t_stack.size();
+    if (_parent > 0) t_stack += ';';
+    if (command) {
+        command_frame(frame, t_stack);
+    } else {
+        t_stack.append(frame);
+    }
+    t_counters.depth = depth + 1;
+    _start = t_counters;
+    _cycles = cycles();
+}
+
+void Sample::end() {
+    uint64_t c = cycles() - _cycles;
+    Counters now = t_counters;
+    t_counters.depth = 0;
+    local().add(t_stack, {1, c, now.allocs - _start.allocs, now.bytes - _start.bytes,
+                          now.syscalls - _start.syscalls});
+    t_stack.resize(_parent);
+    t_counters.depth = now.depth - 1;
+}
+
+void start() {
+    auto& r = registry();
+    if (r.ticks_per_us.load() == 0) {
+        auto t = std::chrono::steady_clock::now();
+        uint64_t c = cycles();
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t).count();
+        r.ticks_per_us = static_cast<double>(cycles() - c) / us;
+    }
+    g_enabled = true;
+}
+
+void stop() {
+    g_enabled = false;
+}
+
+void reset() {
+    auto& r = registry();
+    std::lock_guard<std::mutex> l(r.m);
+    r.retired.clear();
+    for (auto* t : r.threads) {
+        std::lock_guard<std::mutex> lt(t->m);
+        t->stacks.clear();
+    }
+}
+
+static Stacks merged() {
+    auto& r = registry();
+    std::lock_guard<std::mutex> l(r.m);
+    Stacks all = r.retired;
+    for (auto* t : r.threads) {
+        std::lock_guard<std::mutex> lt(t->m);
+        merge(all, t->stacks);
+    }
+    return all;
+}
+
+bool folded(std::string_view metric, std::string& out) {
+    static const std::pair<std::string_view, uint64_t Totals::*> k_metrics[] = {
+        {"cycles", &Totals::cycles}, {"allocs", &Totals::allocs}, {"bytes", &Totals::bytes},
+        {"syscalls", &Totals::syscalls}, {"calls", &Totals::calls}
+    };
+    uint64_t Totals::* field = nullptr;
+    for (auto& [name, f] : k_metrics) {
+        if (metric.size() == name.size() && std::equal(metric.begin(), metric.end(), name.begin(),
+                [] (char a, char b) { return (a | 0x20) == b; })) {
+            field = f;
+        }
+    }
+    if (field == nullptr) return false;
+    // a frame's own share : its total less its children's
+    Stacks all = merged();
+    std::map<std::string_view, uint64_t> self;
+    for (auto& [stack, t] : all) self[stack] = t.*field;
+    for (auto& [stack, t] : all) {
+        size_t cut = stack.rfind(';');
+        if (cut == std::string::npos) continue;
+        auto parent = self.find(std::string_view(stack).substr(0, cut));
+        if (parent != self.end()) parent->second -= std::min(parent->second, t.*field);
+    }
+    for (auto& [stack, v] : self) {
+        if (v == 0) continue;
+        out.append(stack);
+        out += ' ';
+        out += std::to_string(v);
+        out += '\n';
+    }
+    return true;
+}
+
+std::string json() {
+    char ticks[32];
+    std::snprintf(ticks, sizeof(ticks), "%.1f", registry().ticks_per_us.load());
+    std::string s = "{\"enabled\":";
+    s += enabled() ? "true" : "false";
+    s += ",\"ticks_per_us\":";
+    s += ticks;
+    s += ",\"stacks\":[";
+    bool first = true;
+    for (auto& [stack, t] : merged()) {
+        if (!first) s += ',';
+        first = false;
+        // frames hold letters, digits and _-;? only, nothing to escape
+        s += "{\"stack\":\"" + stack + "\"";
+        s += ",\"calls\":" + std::to_string(t.calls);
+        s += ",\"cycles\":" + std::to_string(t.cycles);
+        s += ",\"allocs\":" + std::to_string(t.allocs);
+        s += ",\"bytes\":" + std::to_string(t.bytes);
+        s += ",\"syscalls\":" + std::to_string(t.syscalls) + "}";
+    }
+    s += "]}";
+    return s;
+}
+
+void command_frame(std::string_view name, std::string& out) {
+    out += "command;";
+    if (name.empty()) {
+        out += '?';
+        return;
+    }
+    for (char c : name.substr(0, 32)) {
+        if (c >= 'a' && c <= 'z') c -= 'a' - 'A';
+        bool kept = (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c == '-';
+        out += kept ? c : '?';
+    }
+}
+
+bool handle(int fd, const net::resp::Command& cmd) {
+    if (!cmd.is("PROFILE")) return false;
+    std::string out;
+    net::resp::Command sub{{cmd.argc() > 1 ? cmd.argv[1] : std::string_view()}};
+    if (cmd.argc() < 2) {
+        out = net::resp::wrong_arity("profile");
+    } else if (sub.is("START") && cmd.argc() == 2) {
+        start();
+        out = net::resp::ok();
+    } else if (sub.is("STOP") && cmd.argc() == 2) {
+        stop();
+        out = net::resp::ok();
+    } else if (sub.is("RESET") && cmd.argc() == 2) {
+        reset();
+        out = net::resp::ok();
+    } else if (sub.is("DUMP") && cmd.argc() <= 4) {
+        net::resp::Command format{{cmd.argc() > 2 ? cmd.argv[2] : std::string_view("FOLDED")}};
+        std::string s;
+        if (format.is("JSON") && cmd.argc() == 3) {
+            out = net::resp::bulk(json());
+        } else if (format.is("FOLDED") && folded(cmd.argc() == 4 ? cmd.argv[3] : "cycles", s)) {
+            out = net::resp::bulk(s);
+        } else {
+            out = "-ERR syntax error\r\n";
+        }
+    } else {
+        out = "-ERR unknown subcommand '" + std::string(cmd.argv[1]) + "'\r\n";
+    }
+    net::write_stream(fd, out.c_str(), out.size());
+    return true;
+}
+
+void attach(net::resp::Redis& r) {
+    using Chain = ChainOfResponsibility::Chain<int, net::resp::Redis::T&&>;
+    r.attach([] (int connfd, net::resp::Redis::T&& msg, Chain next) {
+        if (auto* node = std::get_if<std::unique_ptr<data::Node>>(&msg)) {
+            auto cmd = net::resp::as_command(node->get());
+            if (cmd.has_value() && handle(connfd, *cmd)) return;
+        }
+        next(connfd, std::move(msg));
+    });
+}
+
+} // namespace profile
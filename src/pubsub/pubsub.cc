@@ -0,0 +1,509 @@
+#include "pubsub/pubsub.h"
+#include "datastructures/mpsc_queue.h"
+#include "resp/resp_utils.h"
+#include "utils/glob.h"
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <atomic>
+#include <cerrno>
+#include <deque>
+#include <mutex>
+#include <unordered_set>
+
+namespace pubsub {
+
+// a subscriber that lets more than this pile up gets disconnected
+static constexpr size_t k_max_queued = 32 * 1024 * 1024;
+static constexpr int k_max_iov = 64;
+
+struct Subscriber {
+    explicit Subscriber(int fd) : fd(fd) {}
+
+    const int fd;
+
+    // producer side : any thread publishing or replying
+    data::MPSCQueue<Frame> outbox;
+    std::atomic<size_t> queued{0};
+    std::atomic<bool> scheduled{false};
+    std::atomic<bool> overflow{false};
+    // shut the socket down once the outbox is empty
+    std::atomic<bool> ending{false};
+
+    // courier side, closed is also set by the connection thread
+    std::mutex io;
+    bool closed = false;
+    bool armed = false;
+    std::deque<Frame> inflight;
+    size_t offset = 0;
+
+    // guarded by PubSub::_m
+    std::unordered_set<std::string> channels;
+    std::unordered_set<std::string> patterns;
+};
+
+// Single thread owning every write to subscribed sockets. Subscribers with
+// something to send are handed over through a lock-free queue, the ones whose
+// socket buffer is full wait for EPOLLOUT.
+class Courier {
+public:
+    Courier() {
+        _epfd = epoll_create1(EPOLL_CLOEXEC);
+        if (_epfd < 0) net::die("epoll_create1()");
+        _evfd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (_evfd < 0) net::die("eventfd()");
+        epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.ptr = nullptr;
+        if (epoll_ctl(_epfd, EPOLL_CTL_ADD, _evfd, &ev) < 0) net::die("epoll_ctl()");
+        _t = std::thread([this] { run(); });
+    }
+
+    ~Courier() {
+        _stop.store(true, std::memory_order_release);
+        wake();
+        _t.join();
+        close(_evfd);
+        close(_epfd);
+    }
+
+    void schedule(std::shared_ptr<Subscriber> sub) {
+        _ready.push(std::move(sub));
+    }
+
+    void wake() {
+        uint64_t one = 1;
+        ssize_t rv = write(_evfd, &one, sizeof(one));
+        profile::syscall();
+        (void)rv;
+    }
+
+private:
+    void run() {
+        epoll_event events[64];
+        while (!_stop.load(std::memory_order_acquire)) {
+            int n = epoll_wait(_epfd, events, 64, -1);
+            for (int k = 0 ; k < n ; ++k) {
+                if (events[k].data.ptr == nullptr) {
+                    uint64_t v;
+                    ssize_t rv = read(_evfd, &v, sizeof(v));
+                    (void)rv;
+                    continue;
+                }
+                auto it = _blocked.find(static_cast<Subscriber*>(events[k].data.ptr));
+                if (it == _blocked.end()) continue;
+                auto sub = std::move(it->second);
+                _blocked.erase(it);
+                flush(sub);
+            }
+            while (auto sub = _ready.pop()) {
+                flush(*sub);
+            }
+        }
+    }
+
+    void discard(Subscriber& sub) {
+        sub.inflight.clear();
+        sub.offset = 0;
+        while (sub.outbox.pop().has_value()) {}
+    }
+
+    void arm(const std::shared_ptr<Subscriber>& sub) {
+        epoll_event ev = {};
+        ev.events = EPOLLOUT | EPOLLONESHOT;
+        ev.data.ptr = sub.get();
+        int rv = epoll_ctl(_epfd, sub->armed ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, sub->fd, &ev);
+        if (rv < 0 && errno == ENOENT) {
+            rv = epoll_ctl(_epfd, EPOLL_CTL_ADD, sub->fd, &ev);
+        }
+        if (rv < 0) {
+            discard(*sub);
+            return;
+        }
+        sub->armed = true;
+        _blocked[sub.get()] = sub;
+    }
+
+    void flush(const std::shared_ptr<Subscriber>& sub) {
+        // holding io guarantees the fd is not closed (and reused) under us
+        std::lock_guard<std::mutex> l(sub->io);
+        if (sub->closed) {
+            _blocked.erase(sub.get());
+            discard(*sub);
+            return;
+        }
+        if (sub->overflow.load(std::memory_order_acquire)) {
+            // the connection thread sees EOF and drops the subscriber
+            shutdown(sub->fd, SHUT_RDWR);
+            discard(*sub);
+            return;
+        }
+        while (true) {
+            while (sub->inflight.size() < k_max_iov) {
+                auto f = sub->outbox.pop();
+                if (!f.has_value()) break;
+                sub->inflight.push_back(std::move(*f));
+            }
+            if (sub->inflight.empty()) {
+                if (sub->ending.load(std::memory_order_acquire)) {
+                    // what was queued before end() may have landed after
+                    // our last pop
+                    if (!sub->outbox.empty()) continue;
+                    shutdown(sub->fd, SHUT_RDWR);
+                    discard(*sub);
+                    return;
+                }
+                sub->scheduled.store(false, std::memory_order_seq_cst);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                // a producer may have pushed (or end() been called) after our
+                // last pop but before seeing scheduled go down : take the
+                // job back if so
+                bool idle = sub->outbox.empty() && !sub->ending.load(std::memory_order_seq_cst);
+                if (idle || sub->scheduled.exchange(true)) return;
+                continue;
+            }
+
+            iovec iov[k_max_iov];
+            int n = 0;
+            size_t off = sub->offset;
+            for (auto& f : sub->inflight) {
+                iov[n].iov_base = const_cast<char*>(f->data() + off);
+                iov[n].iov_len = f->size() - off;
+                off = 0;
+                ++n;
+            }
+            msghdr mh = {};
+            mh.msg_iov = iov;
+            mh.msg_iovlen = n;
+            ssize_t rv = sendmsg(sub->fd, &mh, MSG_DONTWAIT | MSG_NOSIGNAL);
+            if (rv < 0) {
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    arm(sub);
+                    return;
+                }
+                // broken connection, its own thread is about to drop it
+                discard(*sub);
+                return;
+            }
+            sub->queued.fetch_sub(static_cast<size_t>(rv), std::memory_order_relaxed);
+            size_t left = static_cast<size_t>(rv);
+            while (left > 0) {
+                size_t rem = sub->inflight.front()->size() - sub->offset;
+                if (left < rem) {
+                    sub->offset += left;
+                    break;
+                }
+                left -= rem;
+                sub->offset = 0;
+                sub->inflight.pop_front();
+            }
+        }
+    }
+
+    int _epfd;
+    int _evfd;
+    std::atomic<bool> _stop{false};
+    data::MPSCQueue<std::shared_ptr<Subscriber>> _ready;
+    // only touched by the courier thread
+    std::unordered_map<Subscriber*, std::shared_ptr<Subscriber>> _blocked;
+    std::thread _t;
+};
+
+static void append_bulk(std::string& s, std::string_view v) {
+    s += '$';
+    s += std::to_string(v.size());
+    s += "\r\n";
+    s.append(v);
+    s += "\r\n";
+}
+
+static std::string message_frame(std::string_view channel, std::string_view message) {
+    std::string s = ">3\r\n$7\r\nmessage\r\n";
+    append_bulk(s, channel);
+    append_bulk(s, message);
+    return s;
+}
+
+static std::string pmessage_frame(std::string_view pattern, std::string_view channel,
+                                  std::string_view message) {
+    std::string s = ">4\r\n$8\r\npmessage\r\n";
+    append_bulk(s, pattern);
+    append_bulk(s, channel);
+    append_bulk(s, message);
+    return s;
+}
+
+// confirmation of a (p)(un)subscribe, a null name when there was nothing to drop
+static std::string confirm_frame(std::string_view kind, const std::string_view* name, size_t count) {
+    std::string s = ">3\r\n";
+    append_bulk(s, kind);
+    if (name != nullptr) {
+        append_bulk(s, *name);
+    } else {
+        s += "_\r\n";
+    }
+    s += ':';
+    s += std::to_string(count);
+    s += "\r\n";
+    return s;
+}
+
+PubSub::PubSub()
+    : _courier(std::make_unique<Courier>()),
+      _outbox{[this] (int fd, std::string_view bytes) { queue(fd, bytes); },
+              [this] (int fd) { end(fd); }} {}
+
+PubSub::~PubSub() {
+    for (auto& [fd, sub] : _subscribers) net::use_outbox(fd, nullptr);
+}
+
+std::shared_ptr<Subscriber> PubSub::subscriber(int fd) {
+    auto& sub = _subscribers[fd];
+    if (!sub) {
+        sub = std::make_shared<Subscriber>(fd);
+        net::use_outbox(fd, &_outbox);
+    }
+    return sub;
+}
+
+static void unlink(Registry& r, std::string_view name, const Subscriber* sub) {
+    auto it = r.find(name);
+    if (it == r.end()) return;
+    auto& subs = it->second;
+    for (size_t k = 0 ; k < subs.size() ; ++k) {
+        if (subs[k].get() == sub) {
+            subs[k] = std::move(subs.back());
+            subs.pop_back();
+            break;
+        }
+    }
+    if (subs.empty()) r.erase(it);
+}
+
+static void link(Registry& r, std::string_view name, const std::shared_ptr<Subscriber>& sub) {
+    auto it = r.find(name);
+    if (it == r.end()) {
+        it = r.emplace(std::string(name), Subscribers{}).first;
+    }
+    it->second.push_back(sub);
+}
+
+size_t PubSub::subscribe(int fd, std::string_view channel) {
+    std::unique_lock l(_m);
+    auto sub = subscriber(fd);
+    if (sub->channels.emplace(channel).second) link(_channels, channel, sub);
+    return sub->channels.size() + sub->patterns.size();
+}
+
+size_t PubSub::unsubscribe(int fd, std::string_view channel) {
+    std::unique_lock l(_m);
+    auto it = _subscribers.find(fd);
+    if (it == _subscribers.end()) return 0;
+    auto& sub = it->second;
+    if (sub->channels.erase(std::string(channel)) > 0) unlink(_channels, channel, sub.get());
+    return sub->channels.size() + sub->patterns.size();
+}
+
+size_t PubSub::psubscribe(int fd, std::string_view pattern) {
+    std::unique_lock l(_m);
+    auto sub = subscriber(fd);
+    if (sub->patterns.emplace(pattern).second) link(_patterns, pattern, sub);
+    return sub->channels.size() + sub->patterns.size();
+}
+
+size_t PubSub::punsubscribe(int fd, std::string_view pattern) {
+    std::unique_lock l(_m);
+    auto it = _subscribers.find(fd);
+    if (it == _subscribers.end()) return 0;
+    auto& sub = it->second;
+    if (sub->patterns.erase(std::string(pattern)) > 0) unlink(_patterns, pattern, sub.get());
+    return sub->channels.size() + sub->patterns.size();
+}
+
+std::vector<std::string> PubSub::channels(int fd) {
+    std::shared_lock l(_m);
+    auto it = _subscribers.find(fd);
+    if (it == _subscribers.end()) return {};
+    return {it->second->channels.begin(), it->second->channels.end()};
+}
+
+std::vector<std::string> PubSub::patterns(int fd) {
+    std::shared_lock l(_m);
+    auto it = _subscribers.find(fd);
+    if (it == _subscribers.end()) return {};
+    return {it->second->patterns.begin(), it->second->patterns.end()};
+}
+
+size_t PubSub::subscriptions(int fd) {
+    std::shared_lock l(_m);
+    auto it = _subscribers.find(fd);
+    if (it == _subscribers.end()) return 0;
+    return it->second->channels.size() + it->second->patterns.size();
+}
+
+void PubSub::deliver(const std::shared_ptr<Subscriber>& sub, const Frame& f, bool& wake) {
+    if (sub->overflow.load(std::memory_order_relaxed)) return;
+    if (sub->queued.fetch_add(f->size(), std::memory_order_relaxed) + f->size() > k_max_queued) {
+        sub->overflow.store(true, std::memory_order_release);
+    } else {
+        sub->outbox.push(f);
+    }
+    if (!sub->scheduled.exchange(true)) {
+        _courier->schedule(sub);
+        wake = true;
+    }
+}
+
+size_t PubSub::publish(std::string_view channel, std::string_view message) {
+    size_t n = 0;
+    bool wake = false;
+    {
+        std::shared_lock l(_m);
+        auto it = _channels.find(channel);
+        if (it != _channels.end()) {
+            Frame f = std::make_shared<const std::string>(message_frame(channel, message));
+            for (auto& sub : it->second) {
+                deliver(sub, f, wake);
+            }
+            n += it->second.size();
+        }
+        for (auto& [pattern, subs] : _patterns) {
+            if (!utils::glob_match(pattern, channel)) continue;
+            Frame f = std::make_shared<const std::string>(pmessage_frame(pattern, channel, message));
+            for (auto& sub : subs) {
+                deliver(sub, f, wake);
+            }
+            n += subs.size();
+        }
+    }
+    if (wake) _courier->wake();
+    return n;
+}
+
+void PubSub::reply(int fd, std::string frame) {
+    // queued when fd has an outbox
+    net::write_stream(fd, frame.c_str(), frame.size());
+}
+
+void PubSub::queue(int fd, std::string_view bytes) {
+    push(fd, std::make_shared<const std::string>(bytes));
+}
+
+void PubSub::end(int fd) {
+    bool wake = false;
+    {
+        std::shared_lock l(_m);
+        auto it = _subscribers.find(fd);
+        if (it == _subscribers.end()) return;
+        auto& sub = it->second;
+        sub->ending.store(true, std::memory_order_seq_cst);
+        if (!sub->scheduled.exchange(true)) {
+            _courier->schedule(sub);
+            wake = true;
+        }
+    }
+    if (wake) _courier->wake();
+}
+
+void PubSub::open(int fd) {
+    std::unique_lock l(_m);
+    subscriber(fd);
+}
+
+void PubSub::push(int fd, const Frame& f) {
+    bool wake = false;
+    {
+        std::shared_lock l(_m);
+        auto it = _subscribers.find(fd);
+        if (it == _subscribers.end()) return;
+        deliver(it->second, f, wake);
+    }
+    if (wake) _courier->wake();
+}
+
+void PubSub::drop(int fd) {
+    std::shared_ptr<Subscriber> sub;
+    {
+        std::unique_lock l(_m);
+        auto it = _subscribers.find(fd);
+        if (it == _subscribers.end()) return;
+        net::use_outbox(fd, nullptr);
+        sub = std::move(it->second);
+        _subscribers.erase(it);
+        for (auto& c : sub->channels) unlink(_channels, c, sub.get());
+        for (auto& p : sub->patterns) unlink(_patterns, p, sub.get());
+    }
+    {
+        std::lock_guard<std::mutex> l(sub->io);
+        sub->closed = true;
+    }
+    // always hand it over, even if already scheduled, so the courier lets go of it
+    _courier->schedule(std::move(sub));
+    _courier->wake();
+}
+
+bool PubSub::handle(int fd, const net::resp::Command& cmd) {
+    bool pattern = cmd.is("PSUBSCRIBE") || cmd.is("PUNSUBSCRIBE");
+    if (cmd.is("SUBSCRIBE") || cmd.is("PSUBSCRIBE")) {
+        if (cmd.argc() < 2) {
+            reply(fd, net::resp::wrong_arity(pattern ? "psubscribe" : "subscribe"));
+            return true;
+        }
+        for (size_t k = 1 ; k < cmd.argc() ; ++k) {
+            auto& name = cmd.argv[k];
+            size_t n = pattern ? psubscribe(fd, name) : subscribe(fd, name);
+            reply(fd, confirm_frame(pattern ? "psubscribe" : "subscribe", &name, n));
+        }
+        return true;
+    }
+    if (cmd.is("UNSUBSCRIBE") || cmd.is("PUNSUBSCRIBE")) {
+        std::string_view kind = pattern ? "punsubscribe" : "unsubscribe";
+        if (cmd.argc() < 2) {
+            // no argument : drop every subscription of that kind
+            auto names = pattern ? patterns(fd) : channels(fd);
+            if (names.empty()) {
+                reply(fd, confirm_frame(kind, nullptr, subscriptions(fd)));
+            }
+            for (auto& s : names) {
+                std::string_view name = s;
+                size_t n = pattern ? punsubscribe(fd, name) : unsubscribe(fd, name);
+                reply(fd, confirm_frame(kind, &name, n));
+            }
+            return true;
+        }
+        for (size_t k = 1 ; k < cmd.argc() ; ++k) {
+            auto& name = cmd.argv[k];
+            size_t n = pattern ? punsubscribe(fd, name) : unsubscribe(fd, name);
+            reply(fd, confirm_frame(kind, &name, n));
+        }
+        return true;
+    }
+    if (cmd.is("PUBLISH")) {
+        if (cmd.argc() != 3) {
+            reply(fd, net::resp::wrong_arity("publish"));
+            return true;
+        }
+        size_t n = publish(cmd.argv[1], cmd.argv[2]);
+        reply(fd, net::resp::integer(static_cast<int64_t>(n)));
+        return true;
+    }
+    return false;
+}
+
+void PubSub::attach(net::resp::Redis& r) {
+    using Chain = ChainOfResponsibility::Chain<int, net::resp::Redis::T&&>;
+    r.attach([this] (int connfd, net::resp::Redis::T&& msg, Chain next) {
+        if (auto* node = std::get_if<std::unique_ptr<data::Node>>(&msg)) {
+            auto cmd = net::resp::as_command(node->get());
+            if (cmd.has_value() && handle(connfd, *cmd)) return;
+        }
+        next(connfd, std::move(msg));
+    });
+    r.on_close([this] (int connfd) {
+        drop(connfd);
+    });
+}
+
+} // namespace pubsub
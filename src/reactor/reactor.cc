@@ -0,0 +1,376 @@
+#include "reactor/reactor.h"
+#include <pthread.h>
+#include <sched.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <deque>
+#include <thread>
+#include <utility>
+#include "datastructures/mpsc_queue.h"
+#include "datastructures/spsc_ring.h"
+#include "resp/resp_utils.h"
+
+namespace reactor {
+
+static constexpr size_t k_ring = 1024;
+
+struct Part;
+
+// a command waiting for its reply, in the frame of the awaiting coroutine
+struct Request {
+    // the client that sent it, -1 for none
+    int fd = -1;
+    const commands::Spec* spec;
+    const commands::Args* argv;
+    std::string_view raw;
+    std::string* out;
+    // only touched by the home reactor
+    std::vector<Part*> parts;
+    size_t pending = 0;
+    coro::Event done;
+};
+
+// the share of a request run by one reactor, sent there and back
+struct Part {
+    Request* req;
+    size_t home;
+    commands::Args argv;
+    // position in the request of each key of argv, empty when argv is the
+    // whole request
+    std::vector<size_t> keys;
+    std::string out;
+};
+
+// how the replies of a command split per owner are put back together
+enum class Merge {
+    NONE,
+    SUM,
+    ARRAY
+};
+
+static Merge merge_of(const commands::Spec& spec) {
+    std::string_view name = spec.name;
+    if (name == "MGET") return Merge::ARRAY;
+    if (name == "DEL" || name == "UNLINK" || name == "EXISTS") return Merge::SUM;
+    return Merge::NONE;
+}
+
+// end of the reply starting at s[at], replies to split are flat
+static size_t skip(std::string_view s, size_t at) {
+    size_t eol = s.find("\r\n", at);
+    if (s[at] != '$') return eol + 2;
+    long long len = std::strtoll(s.data() + at + 1, nullptr, 10);
+    return len < 0 ? eol + 2 : eol + 2 + static_cast<size_t>(len) + 2;
+}
+
+class Core {
+public:
+    Core(commands::Table& table, std::vector<std::unique_ptr<Core>>& cores, size_t id)
+        : _table(table), _cores(cores), _id(id) {}
+
+    // one per sender, every reactor has to exist before the first start()
+    void connect(size_t n) {
+        for (size_t k = 0 ; k < n ; ++k) {
+            _in.push_back(std::make_unique<data::SPSCRing<Part*>>(k_ring));
+        }
+    }
+
+    void start() {
+        _t = std::thread([this] { run(); });
+    }
+
+    void stop() {
+        _stop.store(true, std::memory_order_release);
+        _signal.fetch_add(1, std::memory_order_seq_cst);
+        _signal.notify_one();
+        _t.join();
+    }
+
+    // from any thread
+    void submit(Request* r) {
+        _inbox.push(r);
+        wake();
+    }
+
+    void wake() {
+        _signal.fetch_add(1, std::memory_order_seq_cst);
+        if (_sleeping.load(std::memory_order_seq_cst)) _signal.notify_one();
+    }
+
+    size_t forwarded() const {
+        return _forwarded.load(std::memory_order_relaxed);
+    }
+
+private:
+    void run() {
+        pin();
+        while (!_stop.load(std::memory_order_acquire)) {
+            uint32_t seen = _signal.load(std::memory_order_seq_cst);
+            bool worked = flush();
+            for (auto& ring : _in) {
+                while (auto p = ring->pop()) {
+                    worked = true;
+                    received(*p);
+                }
+            }
+            while (auto r = _inbox.pop()) {
+                worked = true;
+                dispatch(*r);
+            }
+            if (worked) continue;
+            if (!_backlog.empty()) {
+                // a peer's ring is full, it is busy draining it
+                std::this_thread::yield();
+                continue;
+            }
+            // a push after seen was read changes _signal, so this can't miss it
+            _sleeping.store(true, std::memory_order_seq_cst);
+            _signal.wait(seen, std::memory_order_seq_cst);
+            _sleeping.store(false, std::memory_order_relaxed);
+        }
+    }
+
+    // best effort, reactor k on core k
+    void pin() {
+        unsigned cpus = std::thread::hardware_concurrency();
+        if (cpus == 0) return;
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(_id % cpus, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+
+    size_t owner_of(std::string_view key) const {
+        return store::Keyspace::shard_index(store::Keyspace::hash(key)) % _cores.size();
+    }
+
+    void dispatch(Request* r) {
+        const commands::Spec& spec = *r->spec;
+        const commands::Args& argv = *r->argv;
+        uint64_t owners = 0;
+        if (!(spec.flags & commands::ALL_KEYS)) {
+            uint64_t mask = commands::Table::shards(spec, argv);
+            for (size_t k = 0 ; k < store::Keyspace::k_shards ; ++k) {
+                if (mask & (uint64_t(1) << k)) owners |= uint64_t(1) << (k % _cores.size());
+            }
+        }
+        if (owners == 0 || owners == (uint64_t(1) << _id)) {
+            serve(r, *r->out);
+            finish(r);
+            return;
+        }
+        if ((owners & (owners - 1)) == 0) {
+            r->parts.push_back(new Part{r, _id, argv, {}, {}});
+            r->pending = 1;
+            send(static_cast<size_t>(__builtin_ctzll(owners)), r->parts.back());
+            return;
+        }
+        // a guard sees the command whole, -CROSSSLOT spans owners
+        if (merge_of(spec) == Merge::NONE || _table.guarded()) {
+            // not splittable, the locks keep it atomic
+            serve(r, *r->out);
+            finish(r);
+            return;
+        }
+
+        std::vector<Part*> by_owner(_cores.size(), nullptr);
+        int argc = static_cast<int>(argv.size());
+        commands::KeyRange keys = commands::key_range(spec, argv);
+        for (int k = keys.first ; k <= keys.last ; k += keys.step) {
+            Part*& p = by_owner[owner_of(argv[k])];
+            if (p == nullptr) {
+                p = new Part{r, _id, {argv[0]}, {}, {}};
+                r->parts.push_back(p);
+            }
+            for (int j = k ; j < k + spec.step && j < argc ; ++j) p->argv.push_back(argv[j]);
+            p->keys.push_back(static_cast<size_t>(k));
+        }
+        r->pending = r->parts.size();
+        for (size_t o = 0 ; o < by_owner.size() ; ++o) {
+            if (by_owner[o] != nullptr && o != _id) send(o, by_owner[o]);
+        }
+        if (Part* mine = by_owner[_id]) {
+            _table.serve(r->fd, spec, mine->argv, mine->out);
+            answered(mine);
+        }
+    }
+
+    void received(Part* p) {
+        if (p->home == _id) {
+            answered(p);
+            return;
+        }
+        if (p->keys.empty()) {
+            serve(p->req, p->out);
+        } else {
+            // a share of a split command is not what the client sent
+            _table.serve(p->req->fd, *p->req->spec, p->argv, p->out);
+        }
+        send(p->home, p);
+    }
+
+    // the whole of r
+    void serve(Request* r, std::string& out) {
+        _table.serve(r->fd, *r->spec, *r->argv, out, r->raw);
+    }
+
+    void answered(Part* p) {
+        Request* r = p->req;
+        if (--r->pending > 0) return;
+        gather(r);
+        for (Part* q : r->parts) delete q;
+        r->parts.clear();
+        finish(r);
+    }
+
+    void gather(Request* r) {
+        std::string& out = *r->out;
+        if (r->parts.size() == 1 && r->parts[0]->keys.empty()) {
+            out += r->parts[0]->out;
+            return;
+        }
+        for (Part* p : r->parts) {
+            if (!p->out.empty() && p->out[0] == '-') {
+                out += p->out;
+                return;
+            }
+        }
+        if (merge_of(*r->spec) == Merge::SUM) {
+            long long n = 0;
+            for (Part* p : r->parts) n += std::strtoll(p->out.c_str() + 1, nullptr, 10);
+            out += net::resp::integer(n);
+            return;
+        }
+        // one element per key, back in the order of the request
+        std::vector<std::string_view> elems(r->argv->size());
+        size_t count = 0;
+        for (Part* p : r->parts) {
+            std::string_view s = p->out;
+            size_t at = s.find("\r\n") + 2;
+            for (size_t key : p->keys) {
+                size_t end = skip(s, at);
+                elems[key] = s.substr(at, end - at);
+                at = end;
+                ++count;
+            }
+        }
+        data::write_header(out, data::Type::Array, count);
+        for (auto e : elems) out.append(e);
+    }
+
+    void finish(Request* r) {
+        r->done.set();
+    }
+
+    void send(size_t to, Part* p) {
+        if (p->home == _id) _forwarded.fetch_add(1, std::memory_order_relaxed);
+        // behind the parts already waiting, so that none overtakes another
+        if (!_backlog.empty() || !_cores[to]->_in[_id]->push(p)) {
+            _backlog.emplace_back(to, p);
+            return;
+        }
+        _cores[to]->wake();
+    }
+
+    // retries the parts that found a full ring, returns whether any left
+    bool flush() {
+        bool moved = false;
+        while (!_backlog.empty()) {
+            auto [to, p] = _backlog.front();
+            if (!_cores[to]->_in[_id]->push(p)) break;
+            _cores[to]->wake();
+            _backlog.pop_front();
+            moved = true;
+        }
+        return moved;
+    }
+
+    commands::Table& _table;
+    std::vector<std::unique_ptr<Core>>& _cores;
+    const size_t _id;
+
+    // requests of the connections living here
+    data::MPSCQueue<Request*> _inbox;
+    // _in[k] : the parts reactor k sent here, to run or answered
+    std::vector<std::unique_ptr<data::SPSCRing<Part*>>> _in;
+    std::deque<std::pair<size_t, Part*>> _backlog;
+
+    std::atomic<uint32_t> _signal{0};
+    std::atomic<bool> _sleeping{false};
+    std::atomic<bool> _stop{false};
+    std::atomic<size_t> _forwarded{0};
+    std::thread _t;
+};
+
+Reactors::Reactors(commands::Table& table, size_t n) : _table(table) {
+    n = std::clamp<size_t>(n, 1, store::Keyspace::k_shards);
+    for (size_t k = 0 ; k < n ; ++k) {
+        _cores.push_back(std::make_unique<Core>(table, _cores, k));
+    }
+    for (auto& c : _cores) c->connect(n);
+    for (auto& c : _cores) c->start();
+}
+
+Reactors::~Reactors() {
+    for (auto& c : _cores) c->stop();
+}
+
+coro::Task<> Reactors::call(size_t home, const commands::Spec& spec, const commands::Args& argv,
+                            std::string& out, std::string_view raw, int fd) {
+    Request r;
+    r.fd = fd;
+    r.spec = &spec;
+    r.argv = &argv;
+    r.raw = raw;
+    r.out = &out;
+    _cores[home % _cores.size()]->submit(&r);
+    co_await r.done;
+}
+
+void Reactors::execute(size_t home, const commands::Spec& spec, const commands::Args& argv,
+                       std::string& out, std::string_view raw) {
+    call(home, spec, argv, out, raw).run();
+}
+
+size_t Reactors::forwarded() const {
+    size_t n = 0;
+    for (auto& c : _cores) n += c->forwarded();
+    return n;
+}
+
+// left to commands::Blocking : BLPOP and the like, and whatever has a
+// BLOCK option
+static bool blocks(const net::resp::Command& cmd) {
+    if (cmd.is("BLPOP") || cmd.is("BRPOP") || cmd.is("BLMOVE")) return true;
+    for (size_t k = 1 ; k < cmd.argc() ; ++k) {
+        if (net::resp::Command{{cmd.argv[k]}}.is("BLOCK")) return true;
+    }
+    return false;
+}
+
+coro::Task<bool> Reactors::handle(int fd, const net::resp::Command& cmd) {
+    const commands::Spec* spec = _table.lookup(cmd.argv[0]);
+    if (spec == nullptr || blocks(cmd)) co_return false;
+    std::string out;
+    if (!commands::Table::arity_ok(*spec, cmd.argc())) {
+        out = net::resp::wrong_arity(cmd.argv[0]);
+    } else {
+        co_await call(static_cast<size_t>(fd), *spec, cmd.argv, out, cmd.raw, fd);
+    }
+    net::write_stream(fd, out.c_str(), out.size());
+    co_return true;
+}
+
+void Reactors::attach(net::resp::Redis& r) {
+    r.attach_async([this] (int connfd, net::resp::Redis::T& msg) -> coro::Task<bool> {
+        auto* node = std::get_if<std::unique_ptr<data::Node>>(&msg);
+        if (node == nullptr) co_return false;
+        auto cmd = net::resp::as_command(node->get());
+        if (!cmd.has_value()) co_return false;
+        cmd->raw = net::resp::RESPServer::last_request();
+        co_return co_await handle(connfd, *cmd);
+    });
+}
+
+} // namespace reactor
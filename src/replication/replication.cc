@@ -0,0 +1,567 @@
+#include "replication/replication.h"
+#include "resp/resp_utils.h"
+
+#include <arpa/inet.h>
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <random>
+
+namespace replication {
+
+// bytes copied to a replica socket per round
+static constexpr size_t k_chunk = 64 * 1024;
+// delay before a lost master link is retried
+static constexpr auto k_retry = std::chrono::milliseconds(100);
+
+// set on the replica link thread : what it applies is fed to the backlog
+// by the link itself, with the master's bytes
+static thread_local bool t_applying = false;
+
+static bool parse_int(std::string_view s, int64_t& v) {
+    auto res = std::from_chars(s.data(), s.data() + s.size(), v);
+    return !s.empty() && res.ec == std::errc() && res.ptr == s.data() + s.size();
+}
+
+static std::string new_replid() {
+    static const char* k_hex = "0123456789abcdef";
+    std::random_device rd;
+    std::mt19937_64 gen((uint64_t(rd()) << 32) | rd());
+    std::string id(40, '0');
+    for (auto& c : id) c = k_hex[gen() & 15];
+    return id;
+}
+
+static void encode(const commands::Args& argv, std::string& out) {
+    data::write_header(out, data::Type::Array, argv.size());
+    for (auto a : argv) out += net::resp::bulk(a);
+}
+
+// Buffered reader for what a master sends : status lines, the snapshot and
+// the commands of the stream. Without a fd it reads from memory only.
+class Reader {
+public:
+    explicit Reader(int fd) : _fd(fd) {}
+    explicit Reader(std::string_view data) : _fd(-1), _buf(data) {}
+
+    // a line without its \r\n
+    bool line(std::string& out) {
+        size_t b, e;
+        if (!line_span(b, e)) return false;
+        out.assign(_buf, b, e - b);
+        return true;
+    }
+
+    bool bytes(size_t n, std::string& out) {
+        if (!need(n)) return false;
+        out.assign(_buf, _pos, n);
+        _pos += n;
+        return true;
+    }
+
+    // an array of bulk (or simple) strings, raw views its bytes
+    bool command(commands::Args& argv, std::string_view& raw) {
+        if (_pos > 0 && (_pos == _buf.size() || _pos > k_chunk)) {
+            _buf.erase(0, _pos);
+            _pos = 0;
+        }
+        size_t start = _pos;
+        int64_t n;
+        if (!header('*', n) || n <= 0) return false;
+        _spans.clear();
+        for (int64_t k = 0 ; k < n ; ++k) {
+            if (!need(1)) return false;
+            if (_buf[_pos] == '+') {
+                size_t b, e;
+                if (!line_span(b, e)) return false;
+                _spans.emplace_back(b + 1, e - b - 1);
+                continue;
+            }
+            int64_t len;
+            if (!header('$', len) || len < 0 || !need(len + 2)) return false;
+            _spans.emplace_back(_pos, len);
+            _pos += len + 2;
+        }
+        // views only once the buffer stopped growing
+        argv.clear();
+        for (auto [b, len] : _spans) argv.emplace_back(_buf.data() + b, len);
+        raw = std::string_view(_buf.data() + start, _pos - start);
+        return true;
+    }
+
+private:
+    bool fill() {
+        if (_fd < 0) return false;
+        char tmp[k_chunk];
+        ssize_t rv = read(_fd, tmp, sizeof(tmp));
+        if (rv <= 0) return false;
+        _buf.append(tmp, rv);
+        return true;
+    }
+
+    bool need(size_t n) {
+        while (_buf.size() - _pos < n) {
+            if (!fill()) return false;
+        }
+        return true;
+    }
+
+    bool line_span(size_t& b, size_t& e) {
+        size_t from = _pos;
+        while (true) {
+            size_t p = _buf.find("\r\n", from);
+            if (p != std::string::npos) {
+                b = _pos;
+                e = p;
+                _pos = p + 2;
+                return true;
+            }
+            from = _buf.size() > _pos ? _buf.size() - 1 : _pos;
+            if (!fill()) return false;
+        }
+    }
+
+    bool header(char type, int64_t& v) {
+        size_t b, e;
+        if (!line_span(b, e)) return false;
+        return e > b && _buf[b] == type && parse_int(std::string_view(_buf).substr(b + 1, e - b - 1), v);
+    }
+
+    int _fd;
+    std::string _buf;
+    size_t _pos = 0;
+    std::vector<std::pair<size_t, size_t>> _spans;
+};
+
+// reads what follows "+FULLRESYNC <replid> <offset>" : $<len>\r\n and the
+// snapshot
+static bool full_resync(Reader& r, const std::string& line, std::string& replid, int64_t& off,
+                        std::string& payload) {
+    size_t sp = line.find(' ', 12);
+    std::string len_line;
+    int64_t len;
+    if (sp == std::string::npos || !parse_int(std::string_view(line).substr(sp + 1), off)) return false;
+    if (!r.line(len_line) || len_line.empty() || len_line[0] != '$') return false;
+    if (!parse_int(std::string_view(len_line).substr(1), len) || len < 0) return false;
+    replid = line.substr(12, sp - 12);
+    return r.bytes(len, payload);
+}
+
+Replication::Replication(commands::Table& table, size_t backlog)
+    : _table(table), _replid(new_replid()), _backlog(backlog) {
+    _table.on_write([this] (const commands::Args& argv, std::string_view raw) {
+        if (!t_applying) feed(argv, raw);
+    });
+}
+
+Replication::~Replication() {
+    stop_link();
+    stop_takeover();
+    _table.on_write({});
+}
+
+void Replication::feed(const commands::Args& argv, std::string_view raw) {
+    if (!raw.empty()) {
+        feed_raw(raw);
+        return;
+    }
+    std::string bytes;
+    encode(argv, bytes);
+    feed_raw(bytes);
+}
+
+void Replication::feed_raw(std::string_view bytes) {
+    bool wake;
+    {
+        std::lock_guard<std::mutex> l(_m);
+        size_t n = _backlog.size();
+        // only the tail of what does not fit is kept
+        size_t skip = bytes.size() > n ? bytes.size() - n : 0;
+        size_t pos = (_offset + skip) % n;
+        size_t len = bytes.size() - skip;
+        size_t first = std::min(len, n - pos);
+        std::memcpy(_backlog.data() + pos, bytes.data() + skip, first);
+        std::memcpy(_backlog.data(), bytes.data() + skip + first, len - first);
+        _offset += bytes.size();
+        _backlog_len = std::min(n, _backlog_len + bytes.size());
+        wake = !_followers.empty();
+    }
+    if (wake) _cv.notify_all();
+}
+
+void Replication::reset(const std::string& replid, uint64_t offset) {
+    {
+        std::lock_guard<std::mutex> l(_m);
+        _replid = replid;
+        _offset = offset;
+        _backlog_len = 0;
+        ++_epoch;
+    }
+    _cv.notify_all();
+}
+
+bool Replication::copy(uint64_t from, size_t max, std::string& out) {
+    if (from > _offset || _offset - from > _backlog_len) return false;
+    size_t n = _backlog.size();
+    size_t len = std::min<uint64_t>(_offset - from, max);
+    size_t pos = from % n;
+    size_t first = std::min(len, n - pos);
+    out.append(_backlog.data() + pos, first);
+    out.append(_backlog.data(), len - first);
+    return true;
+}
+
+std::string Replication::replid() {
+    std::lock_guard<std::mutex> l(_m);
+    return _replid;
+}
+
+uint64_t Replication::offset() {
+    std::lock_guard<std::mutex> l(_m);
+    return _offset;
+}
+
+bool Replication::is_replica() {
+    return _replica.load();
+}
+
+std::string Replication::snapshot(uint64_t& offset) {
+    // every shard stays locked while the keyspace is serialized, so that the
+    // snapshot is exactly the state at offset
+    uint64_t all = (uint64_t(1) << store::Keyspace::k_shards) - 1;
+    std::string out;
+    _table.lock(all);
+    for (size_t k = 0 ; k < store::Keyspace::k_shards ; ++k) {
+        auto& shard = _table.keyspace().shard(k);
+        for (auto& [key, entry] : shard.map) {
+            auto e = shard.expires.find(key);
+            commands::recreate(key, entry.value, e == shard.expires.end() ? -1 : e->second,
+                               [&out] (const commands::Args& argv) { encode(argv, out); });
+        }
+    }
+    {
+        std::lock_guard<std::mutex> l(_m);
+        offset = _offset;
+    }
+    _table.unlock(all);
+    return out;
+}
+
+void Replication::psync(int fd, const net::resp::Command& cmd, const std::function<void()>& sent) {
+    // PSYNC <replid> <offset>, "? -1" asks for a full resync
+    int64_t wanted;
+    if (!parse_int(cmd.argv[2], wanted)) wanted = -1;
+
+    std::string addr = "?";
+    sockaddr_in peer = {};
+    socklen_t len = sizeof(peer);
+    if (getpeername(fd, reinterpret_cast<sockaddr*>(&peer), &len) == 0) {
+        char ip[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &peer.sin_addr, ip, sizeof(ip));
+        addr = std::string(ip) + ":" + std::to_string(ntohs(peer.sin_port));
+    }
+
+    std::string reply;
+    uint64_t off = 0;
+    uint64_t epoch;
+    std::list<Follower>::iterator self;
+    {
+        std::lock_guard<std::mutex> l(_m);
+        uint64_t w = static_cast<uint64_t>(wanted);
+        if (wanted >= 0 && cmd.argv[1] == _replid && w <= _offset && _offset - w <= _backlog_len) {
+            off = w;
+            reply = "+CONTINUE " + _replid + "\r\n";
+        }
+    }
+    if (reply.empty()) {
+        std::string payload = snapshot(off);
+        reply = "+FULLRESYNC " + replid() + " " + std::to_string(off) + "\r\n";
+        data::write_header(reply, data::Type::BulkString, payload.size());
+        reply += payload;
+    }
+    {
+        std::lock_guard<std::mutex> l(_m);
+        epoch = _epoch;
+        self = _followers.insert(_followers.end(), {fd, addr, off});
+    }
+    bool alive = net::write_stream(fd, reply.data(), reply.size()) == 0;
+    if (alive && sent) sent();
+
+    std::string chunk;
+    while (alive) {
+        chunk.clear();
+        {
+            std::unique_lock<std::mutex> l(_m);
+            self->offset = off;
+            bool ready = _cv.wait_for(l, std::chrono::seconds(1), [&] {
+                return _offset != off || _epoch != epoch;
+            });
+            // lagging further than the backlog, or a new history began
+            if (_epoch != epoch || (ready && !copy(off, k_chunk, chunk))) break;
+        }
+        if (chunk.empty()) {
+            // idle : drain what the replica sends and notice when it leaves
+            char buf[256];
+            ssize_t rv = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+            alive = rv > 0 || (rv < 0 && (errno == EAGAIN || errno == EWOULDBLOCK));
+            continue;
+        }
+        alive = net::write_stream(fd, chunk.data(), chunk.size()) == 0;
+        off += chunk.size();
+    }
+    {
+        std::lock_guard<std::mutex> l(_m);
+        _followers.erase(self);
+    }
+    // the connection loop sees the disconnect and closes fd
+    shutdown(fd, SHUT_RDWR);
+}
+
+void Replication::replicaof(const std::string& host, unsigned short port) {
+    {
+        std::lock_guard<std::mutex> l(_m);
+        if (!host.empty() && _replica && host == _master_host && port == _master_port) return;
+    }
+    stop_link();
+    if (host.empty()) {
+        {
+            std::lock_guard<std::mutex> l(_m);
+            _master_host.clear();
+            _master_port = 0;
+        }
+        _replica = false;
+        // the data stays, but it is a new history
+        reset(new_replid(), offset());
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> l(_m);
+        _master_host = host;
+        _master_port = port;
+        _link_state = "connect";
+    }
+    _replica = true;
+    uint64_t gen = ++_generation;
+    _link = std::thread(&Replication::link, this, gen, host, port);
+}
+
+void Replication::stop_link() {
+    ++_generation;
+    {
+        std::lock_guard<std::mutex> l(_m);
+        if (_master_fd >= 0) shutdown(_master_fd, SHUT_RDWR);
+    }
+    if (_link.joinable()) _link.join();
+}
+
+void Replication::link(uint64_t generation, std::string host, unsigned short port) {
+    t_applying = true;
+    while (_generation == generation) {
+        int fd = net::dial(host, port);
+        if (fd >= 0) {
+            bool current;
+            {
+                std::lock_guard<std::mutex> l(_m);
+                current = _generation == generation;
+                if (current) {
+                    _master_fd = fd;
+                    _link_state = "sync";
+                }
+            }
+            if (current) sync(fd);
+            {
+                std::lock_guard<std::mutex> l(_m);
+                if (current) {
+                    _master_fd = -1;
+                    _link_state = "connect";
+                }
+            }
+            close(fd);
+        }
+        if (_generation != generation) break;
+        std::this_thread::sleep_for(k_retry);
+    }
+}
+
+void Replication::sync(int fd) {
+    Reader r(fd);
+    std::string line;
+    const char* hello = "HELLO 3\r\n";
+    if (net::write_stream(fd, hello, std::strlen(hello)) < 0 || !r.line(line) || line != "+OK") return;
+
+    std::string req;
+    {
+        std::lock_guard<std::mutex> l(_m);
+        encode({"PSYNC", _replid, std::to_string(_offset)}, req);
+    }
+    if (net::write_stream(fd, req.data(), req.size()) < 0 || !r.line(line)) return;
+
+    if (line.rfind("+FULLRESYNC ", 0) == 0) {
+        std::string replid, payload;
+        int64_t off;
+        if (!full_resync(r, line, replid, off, payload)) return;
+        load(payload, replid, off);
+        ++_full_syncs;
+    } else if (line.rfind("+CONTINUE", 0) == 0) {
+        ++_partial_syncs;
+    } else {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> l(_m);
+        _link_state = "connected";
+    }
+
+    commands::Args argv;
+    std::string_view raw;
+    while (r.command(argv, raw)) {
+        apply(argv, raw);
+    }
+}
+
+void Replication::hand_over(int fd, const std::function<void()>& sent) {
+    psync(fd, net::resp::Command{{"PSYNC", "?", "-1"}}, sent);
+}
+
+bool Replication::take_over(int fd) {
+    auto r = std::make_shared<Reader>(fd);
+    std::string line, replid, payload;
+    int64_t off;
+    if (!r->line(line) || line.rfind("+FULLRESYNC ", 0) != 0) return false;
+    if (!full_resync(*r, line, replid, off, payload)) return false;
+    // a history of our own : replicas of the old process resync in full
+    load(payload, new_replid(), 0);
+    std::lock_guard<std::mutex> l(_m);
+    _takeover_fd = fd;
+    _takeover = std::thread([this, r] {
+        t_applying = true;
+        commands::Args argv;
+        std::string_view raw;
+        while (r->command(argv, raw)) {
+            apply(argv, raw);
+        }
+        // the old process is gone
+        std::lock_guard<std::mutex> l(_m);
+        close(_takeover_fd);
+        _takeover_fd = -1;
+    });
+    return true;
+}
+
+void Replication::stop_takeover() {
+    {
+        std::lock_guard<std::mutex> l(_m);
+        if (_takeover_fd >= 0) shutdown(_takeover_fd, SHUT_RDWR);
+    }
+    if (_takeover.joinable()) _takeover.join();
+}
+
+uint64_t Replication::lag() {
+    std::lock_guard<std::mutex> l(_m);
+    uint64_t lag = 0;
+    for (auto& f : _followers) lag = std::max(lag, _offset - f.offset);
+    return lag;
+}
+
+void Replication::apply(const commands::Args& argv, std::string_view raw) {
+    // applied and fed under the same locks, a snapshot taken for a replica of
+    // ours never sees a write without its offset
+    const commands::Spec* spec = _table.lookup(argv[0]);
+    uint64_t mask = spec == nullptr ? 0 : commands::Table::shards(*spec, argv);
+    std::string out;
+    _table.lock(mask);
+    if (spec != nullptr && commands::Table::arity_ok(*spec, argv.size())) {
+        _table.call_locked(*spec, argv, out);
+    }
+    feed_raw(raw);
+    _table.unlock(mask);
+}
+
+void Replication::load(std::string_view payload, const std::string& replid, uint64_t offset) {
+    uint64_t all = (uint64_t(1) << store::Keyspace::k_shards) - 1;
+    Reader r(payload);
+    commands::Args argv;
+    std::string_view raw;
+    std::string out;
+    _table.lock(all);
+    _table.keyspace().clear();
+    while (r.command(argv, raw)) {
+        const commands::Spec* spec = _table.lookup(argv[0]);
+        if (spec != nullptr && commands::Table::arity_ok(*spec, argv.size())) {
+            out.clear();
+            _table.call_locked(*spec, argv, out);
+        }
+    }
+    reset(replid, offset);
+    _table.unlock(all);
+}
+
+bool Replication::handle(int fd, const net::resp::Command& cmd) {
+    std::string reply;
+    if (cmd.is("PSYNC")) {
+        if (cmd.argc() != 3) {
+            reply = net::resp::wrong_arity("psync");
+        } else {
+            psync(fd, cmd);
+            return true;
+        }
+    } else if (cmd.is("REPLCONF")) {
+        reply = net::resp::ok();
+    } else if (cmd.is("REPLICAOF") || cmd.is("SLAVEOF")) {
+        int64_t port;
+        net::resp::Command no{{cmd.argc() == 3 ? cmd.argv[1] : ""}};
+        net::resp::Command one{{cmd.argc() == 3 ? cmd.argv[2] : ""}};
+        if (cmd.argc() != 3) {
+            reply = net::resp::wrong_arity("replicaof");
+        } else if (no.is("NO") && one.is("ONE")) {
+            replicaof("", 0);
+            reply = net::resp::ok();
+        } else if (!parse_int(cmd.argv[2], port) || port <= 0 || port > 65535) {
+            reply = "-ERR Invalid master port\r\n";
+        } else {
+            replicaof(std::string(cmd.argv[1]), static_cast<unsigned short>(port));
+            reply = net::resp::ok();
+        }
+    } else if (cmd.is("ROLE")) {
+        std::lock_guard<std::mutex> l(_m);
+        if (_replica) {
+            reply = "*5\r\n" + net::resp::bulk("slave") + net::resp::bulk(_master_host)
+                  + net::resp::integer(_master_port) + net::resp::bulk(_link_state)
+                  + net::resp::integer(static_cast<int64_t>(_offset));
+        } else {
+            reply = "*3\r\n" + net::resp::bulk("master") + net::resp::integer(static_cast<int64_t>(_offset));
+            data::write_header(reply, data::Type::Array, _followers.size());
+            for (auto& f : _followers) {
+                size_t colon = f.addr.rfind(':');
+                reply += "*3\r\n" + net::resp::bulk(f.addr.substr(0, colon))
+                       + net::resp::bulk(colon == std::string::npos ? "" : f.addr.substr(colon + 1))
+                       + net::resp::bulk(std::to_string(f.offset));
+            }
+        }
+    } else if (_replica) {
+        // only the master writes to a replica
+        const commands::Spec* spec = _table.lookup(cmd.argv[0]);
+        if (spec == nullptr || !(spec->flags & commands::WRITE)) return false;
+        reply = "-READONLY You can't write against a read only replica.\r\n";
+    } else {
+        return false;
+    }
+    net::write_stream(fd, reply.c_str(), reply.size());
+    return true;
+}
+
+void Replication::attach(net::resp::Redis& r) {
+    using Chain = ChainOfResponsibility::Chain<int, net::resp::Redis::T&&>;
+    r.attach([this] (int connfd, net::resp::Redis::T&& msg, Chain next) {
+        if (auto* node = std::get_if<std::unique_ptr<data::Node>>(&msg)) {
+            auto cmd = net::resp::as_command(node->get());
+            if (cmd.has_value() && handle(connfd, *cmd)) return;
+        }
+        next(connfd, std::move(msg));
+    });
+}
+
+} // namespace replication
@@ -1,4 +1,19 @@
 #include "resp/server.h"
+#include "datastructures/fd_table.h"
+#include "resp/resp_utils.h"
+
+#include <netdb.h>
+#include <sys/uio.h>
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <type_traits>
+
+static thread_local std::string_view t_last_request;
+
+static data::FdTable<const net::Outbox*> s_outboxes;
 
 void net::die(const std::string& msg) {
     std::cerr << "\033[1;31mfailure : " 
@@ -6,31 +21,64 @@ void net::die(const std::string& msg) {
     exit(1);
 }
 
-std::variant<net::resp::RESPError, std::unique_ptr<data::Node>>
-net::resp::RESPServer::read_string(int connfd, char* body, int& i) {
-    // eg.: a simple string corresponding to response code "OK" :
-    // +OK\r\n         (for simple string)
-    // -ERR blabla\r\n (for simple error)
+void net::use_outbox(int fd, const Outbox* o) {
+    if (o != nullptr) {
+        s_outboxes.at(fd) = o;
+    } else {
+        s_outboxes.reset(fd);
+    }
+}
+
+const net::Outbox* net::outbox(int fd) {
+    auto* o = s_outboxes.get(fd);
+    return o == nullptr ? nullptr : *o;
+}
+
+void net::end_stream(int fd) {
+    if (auto* o = outbox(fd)) {
+        o->end(fd);
+    } else {
+        shutdown(fd, SHUT_RDWR);
+    }
+}
+
+int net::dial(const std::string& host, unsigned short port) {
+    addrinfo hints = {};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* res = nullptr;
+    if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &res) != 0) return -1;
+    int fd = -1;
+    for (auto* ai = res ; ai != nullptr ; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0) continue;
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) break;
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    return fd;
+}
+
+std::variant<net::resp::RESPError, std::string_view>
+net::resp::RESPServer::read_line(int connfd, char* body, int& i) {
     ssize_t rv;
     char* str = body + i;
     int i_base = i;
     while (i < net::resp::RESPServer::k_max_msg()) {
         rv = read(connfd, str, 1);
+        profile::syscall();
         if (rv <= 0) return {net::resp::ErrKind::END_OF_STREAM};
-        // we potentially matched the end of the string \r\n
+        // we potentially matched the end of the line \r\n
         if ((*str == '\r') && (i + 1 < net::resp::RESPServer::k_max_msg())) {
             str += 1;
             ++i;
             rv = read(connfd, str, 1);
+            profile::syscall();
             if (rv <= 0) return {net::resp::ErrKind::END_OF_STREAM};
-            if (*str == '\n') {
-                std::string s(body + i_base, i - i_base + 1 - 2);
-                ++i;
-                std::clog << "Parsed string : " << s << '\n';
-                return {std::make_unique<data::String>(s)};
-            } else {
-                return {net::resp::ErrKind::INVALID_CHARACTER};
-            }
+            if (*str != '\n') return {net::resp::ErrKind::INVALID_CHARACTER};
+            ++i;
+            return {std::string_view(body + i_base, i - i_base - 2)};
         }
         ++i;
         str += 1;
@@ -38,159 +86,443 @@ net::resp::RESPServer::read_string(int connfd, char* body, int& i) {
     return {net::resp::ErrKind::END_OF_STREAM};
 }
 
+// [+-]?[0-9]+ as an int64_t
+static std::optional<int64_t> parse_int(std::string_view s) {
+    if (!s.empty() && s[0] == '+') s.remove_prefix(1);
+    int64_t v;
+    auto res = std::from_chars(s.data(), s.data() + s.size(), v);
+    if (s.empty() || res.ec != std::errc() || res.ptr != s.data() + s.size()) return {};
+    return v;
+}
+
+std::variant<net::resp::RESPError, int64_t>
+net::resp::RESPServer::read_len(int connfd, char* body, int& i) {
+    auto line = read_line(connfd, body, i);
+    if (auto* err = std::get_if<net::resp::RESPError>(&line)) return {*err};
+    auto v = parse_int(std::get<std::string_view>(line));
+    if (!v.has_value()) return {net::resp::ErrKind::INVALID_CHARACTER};
+    return {*v};
+}
+
+std::variant<net::resp::RESPError, std::unique_ptr<data::Node>>
+net::resp::RESPServer::read_string(int connfd, char* body, int& i) {
+    // eg.: a simple string corresponding to response code "OK" :
+    // +OK\r\n
+    auto line = read_line(connfd, body, i);
+    if (auto* err = std::get_if<net::resp::RESPError>(&line)) return {*err};
+    std::string s(std::get<std::string_view>(line));
+    std::clog << "Parsed string : " << s << '\n';
+    return {std::make_unique<data::String>(std::move(s))};
+}
+
+std::variant<net::resp::RESPError, std::unique_ptr<data::Node>>
+net::resp::RESPServer::read_error(int connfd, char* body, int& i) {
+    // eg.: -ERR blabla\r\n (for simple error)
+    auto line = read_line(connfd, body, i);
+    if (auto* err = std::get_if<net::resp::RESPError>(&line)) return {*err};
+    return {std::make_unique<data::SimpleError>(std::string(std::get<std::string_view>(line)))};
+}
+
 std::variant<net::resp::RESPError, std::unique_ptr<data::Node>>
 net::resp::RESPServer::read_int(int connfd, char* body, int& i) {
     // eg.: a request corresponding to number 124
     // :124\r\n
     // :+124\r\n (would also work)
-    ssize_t rv;
-    char* str = body + i;
-    std::optional<bool> negative{};
-    int i_base = i;
-    while (i < net::resp::RESPServer::k_max_msg()) {
-        rv = read(connfd, str, 1);
-        if (rv <= 0) return {net::resp::ErrKind::END_OF_STREAM};
-        // we potentially matched the end of the string \r\n
-        if ((*str == '\r') && (i + 1 < net::resp::RESPServer::k_max_msg())) {
-            str += 1;
-            ++i;
-            rv = read(connfd, str, 1);
-            if (rv <= 0) return {net::resp::ErrKind::END_OF_STREAM};
-            if (*str == '\n' && i > 2) {
-                std::string s(body + i_base, i - i_base + 1 - 2);
-                ++i;
-                if (negative.has_value() && negative.emplace()) {
-                    std::clog << "Parsed int : " << s << '\n';
-                    return {std::unique_ptr<data::Node>(
-                        dynamic_cast<data::Node*>(new data::Integer(-static_cast<int64_t>(stoi(s))))
-                    )};
-                } else {
-                    return {std::unique_ptr<data::Node>(
-                        dynamic_cast<data::Node*>(new data::Integer(static_cast<int64_t>(stoi(s))))
-                    )};
-                }
-            }
-        } else if ((*str == '-' || *str == '+') && (i == i_base)) {
-            // beginning with +/-
-            negative = (*str == '-');
-        } else if ((*str < '0') || (*str > '9')) {
-            return {net::resp::ErrKind::INVALID_CHARACTER};
+    auto len = read_len(connfd, body, i);
+    if (auto* err = std::get_if<net::resp::RESPError>(&len)) return {*err};
+    return {std::make_unique<data::Integer>(std::get<int64_t>(len))};
+}
+
+// longer bulks are refused, as Redis does by default
+static constexpr int64_t k_max_bulk = 512 * 1024 * 1024;
+
+template<typename B>
+static std::variant<net::resp::RESPError, std::unique_ptr<data::Node>>
+read_blob(net::resp::RESPServer& s, int connfd, char* body, int& i) {
+    // eg.: a request corresponding to "test"
+    // $4\r\ntest\r\n
+    // NOTE: $0\r\n\r\n == "" and $-1\r\n is null
+    auto len_variant = s.read_len(connfd, body, i);
+    if (auto* err = std::get_if<net::resp::RESPError>(&len_variant)) return {*err};
+    int64_t len = std::get<int64_t>(len_variant);
+    if (len < 0) return {std::make_unique<B>()};
+    if (len > k_max_bulk) return {net::resp::ErrKind::INVALID_BULK_LENGTH};
+    // the payload and its \r\n must fit in what is left of body, else they
+    // are read and dropped : left in the socket they would be parsed as the
+    // next requests
+    if (len > s.k_max_msg() - i - 2) {
+        char scratch[4096];
+        for (int64_t left = len + 2 ; left > 0 ; ) {
+            size_t n = std::min<int64_t>(left, sizeof(scratch));
+            if (net::read_stream(connfd, scratch, n) < 0) return {net::resp::ErrKind::CONNECTION_CLOSED};
+            left -= n;
         }
-        ++i;
-        str += 1;
+        return {net::resp::ErrKind::BULK_TOO_LARGE};
     }
-    return {net::resp::ErrKind::END_OF_STREAM};
+
+    char* str = body + i;
+    if (net::read_stream(connfd, str, len + 2) < 0) return {net::resp::ErrKind::END_OF_STREAM};
+    i += len + 2;
+    if (str[len] != '\r' || str[len + 1] != '\n') {
+        std::cout << "invalid character : " << (int)str[len] << '\n';
+        return {net::resp::ErrKind::INVALID_CHARACTER};
+    }
+    return {std::make_unique<B>(std::string(str, len))};
 }
 
 std::variant<net::resp::RESPError, std::unique_ptr<data::Node>>
 net::resp::RESPServer::read_bulk_string(int connfd, char* body, int& i) {
-    // eg.: a request corresponding to "test"
-    // $4\r\ntest\r\n
-    // NOTE: $0\r\n\r\n == ""
-    ssize_t rv;
-    char* str;
-    
-    // reading string length
-    auto len_variant = read_int(connfd, body, i);
-    int64_t len = 0;
-    if (std::holds_alternative<net::resp::RESPError>(len_variant)) {
-        return std::get<net::resp::RESPError>(len_variant);
-    }
-    if (auto* len_variant_ptr = std::get_if<std::unique_ptr<data::Node>>(&len_variant)) {
-        if (data::Integer* len_node = dynamic_cast<data::Integer*>(len_variant_ptr->get())) {
-            len = len_node->get();
-        } else {
-            return {net::resp::ErrKind::INVALID_TYPE};
-        }
-    } else {
-        return {net::resp::ErrKind::INVALID_TYPE};
+    return read_blob<data::BulkString>(*this, connfd, body, i);
+}
+
+std::variant<net::resp::RESPError, std::unique_ptr<data::Node>>
+net::resp::RESPServer::read_bulk_error(int connfd, char* body, int& i) {
+    // eg.: !21\r\nSYNTAX invalid syntax\r\n
+    return read_blob<data::BulkError>(*this, connfd, body, i);
+}
+
+std::variant<net::resp::RESPError, std::unique_ptr<data::Node>>
+net::resp::RESPServer::read_verbatim(int connfd, char* body, int& i) {
+    // eg.: =15\r\ntxt:Some string\r\n
+    auto res = read_blob<data::BulkString>(*this, connfd, body, i);
+    if (auto* err = std::get_if<net::resp::RESPError>(&res)) return {*err};
+    auto& blob = static_cast<data::BulkString&>(*std::get<std::unique_ptr<data::Node>>(res));
+    if (!blob.get().has_value() || blob.get()->size() < 4 || (*blob.get())[3] != ':') {
+        return {net::resp::ErrKind::INVALID_CHARACTER};
     }
+    auto& s = blob.get().value();
+    return {std::make_unique<data::VerbatimString>(s.substr(0, 3), s.substr(4))};
+}
 
-    str = body + i;
-    int i_base = i;
-    rv = read(connfd, str, len);
-    if (rv != len) return net::resp::ErrKind::END_OF_STREAM;
-    i += len;
-    str += len;
-    rv = read(connfd, str, 1);
-    if (rv <= 0) return net::resp::ErrKind::END_OF_STREAM;
-    if (*str == '\r' && i + 1 < net::resp::RESPServer::k_max_msg()) {
-        str += 1;
-        ++i;
-        rv = read(connfd, str, 1);
-        if (rv <= 0) return net::resp::ErrKind::END_OF_STREAM;
-        if (*str == '\n') {
-            std::string s(body + i_base, i - i_base + 1 - 2);
-            ++i;
-            return {std::unique_ptr<data::Node>(
-                dynamic_cast<data::Node*>(new data::BulkString(s))
-            )};
+std::variant<net::resp::RESPError, std::unique_ptr<data::Node>>
+net::resp::RESPServer::read_null(int connfd, char* body, int& i) {
+    // _\r\n
+    auto line = read_line(connfd, body, i);
+    if (auto* err = std::get_if<net::resp::RESPError>(&line)) return {*err};
+    if (!std::get<std::string_view>(line).empty()) return {net::resp::ErrKind::INVALID_CHARACTER};
+    return {std::make_unique<data::Null>()};
+}
+
+std::variant<net::resp::RESPError, std::unique_ptr<data::Node>>
+net::resp::RESPServer::read_boolean(int connfd, char* body, int& i) {
+    // #t\r\n or #f\r\n
+    auto line = read_line(connfd, body, i);
+    if (auto* err = std::get_if<net::resp::RESPError>(&line)) return {*err};
+    auto s = std::get<std::string_view>(line);
+    if (s == "t") return {std::make_unique<data::Boolean>(true)};
+    if (s == "f") return {std::make_unique<data::Boolean>(false)};
+    return {net::resp::ErrKind::INVALID_CHARACTER};
+}
+
+std::variant<net::resp::RESPError, std::unique_ptr<data::Node>>
+net::resp::RESPServer::read_double(int connfd, char* body, int& i) {
+    // eg.: ,1.23\r\n ,-1.5e10\r\n ,inf\r\n ,-inf\r\n ,nan\r\n
+    auto line = read_line(connfd, body, i);
+    if (auto* err = std::get_if<net::resp::RESPError>(&line)) return {*err};
+    auto s = std::get<std::string_view>(line);
+    if (s == "inf") return {std::make_unique<data::Double>(HUGE_VAL)};
+    if (s == "-inf") return {std::make_unique<data::Double>(-HUGE_VAL)};
+    if (s == "nan") return {std::make_unique<data::Double>(NAN)};
+    if (!s.empty() && s[0] == '+') s.remove_prefix(1);
+    double d;
+    auto res = std::from_chars(s.data(), s.data() + s.size(), d);
+    if (s.empty() || res.ec != std::errc() || res.ptr != s.data() + s.size()) {
+        return {net::resp::ErrKind::INVALID_CHARACTER};
+    }
+    return {std::make_unique<data::Double>(d)};
+}
+
+std::variant<net::resp::RESPError, std::unique_ptr<data::Node>>
+net::resp::RESPServer::read_big_number(int connfd, char* body, int& i) {
+    // eg.: (3492890328409238509324850943850943825024385\r\n
+    auto line = read_line(connfd, body, i);
+    if (auto* err = std::get_if<net::resp::RESPError>(&line)) return {*err};
+    auto s = std::get<std::string_view>(line);
+    size_t k = (!s.empty() && (s[0] == '-' || s[0] == '+')) ? 1 : 0;
+    if (k == s.size()) return {net::resp::ErrKind::INVALID_CHARACTER};
+    for (; k < s.size() ; ++k) {
+        if (s[k] < '0' || s[k] > '9') return {net::resp::ErrKind::INVALID_CHARACTER};
+    }
+    return {std::make_unique<data::BigNumber>(std::string(s))};
+}
+
+// parses and drops the n elements left of an aggregate after one of them
+// was too large, so that the next request starts where this one ends.
+// Returns what the aggregate is answered with
+static net::resp::RESPError skip(net::resp::RESPServer& s, int connfd, char* body, int& i, int64_t n) {
+    for (; n > 0 ; --n) {
+        auto req = s.one_request(connfd, body, i);
+        auto* err = std::get_if<net::resp::RESPError>(&req);
+        if (err && err->_err != net::resp::ErrKind::BULK_TOO_LARGE) return *err;
+    }
+    return {net::resp::ErrKind::BULK_TOO_LARGE};
+}
+
+// whether n elements may follow at i : each takes 3 bytes at least ("_\r\n")
+// and they all have to fit in what is left of body. Checked before
+// anything is allocated for them
+static bool fits(net::resp::RESPServer& s, int i, int64_t n) {
+    return n <= (s.k_max_msg() - i) / 3;
+}
+
+template<typename A>
+static std::variant<net::resp::RESPError, std::unique_ptr<data::Node>>
+read_aggregate(net::resp::RESPServer& s, int connfd, char* body, int& i) {
+    auto len_variant = s.read_len(connfd, body, i);
+    if (auto* err = std::get_if<net::resp::RESPError>(&len_variant)) return {*err};
+    int64_t len = std::get<int64_t>(len_variant);
+    // only arrays have a null form
+    if (len < 0 && !std::is_same_v<A, data::Array>) return {net::resp::ErrKind::INVALID_CHARACTER};
+    if (len < -1 || !fits(s, i, len)) return {net::resp::ErrKind::INVALID_LENGTH};
+
+    auto a = std::make_unique<A>(static_cast<int>(len));
+    for (int64_t k = 0 ; k < len ; ++k) {
+        auto req = s.one_request(connfd, body, i);
+        if (auto node_ptr = std::get_if<std::unique_ptr<data::Node>>(&req)) {
+            a->push_back(std::move(*node_ptr));
+        } else if (auto& err = std::get<net::resp::RESPError>(req) ; err._err == net::resp::ErrKind::BULK_TOO_LARGE) {
+            return {skip(s, connfd, body, i, len - k - 1)};
         } else {
-            std::cout << "invalid character : " << (int)*str << '\n';
-            return {net::resp::ErrKind::INVALID_CHARACTER};
+            return {err};
         }
-    } else {
-        std::cout << "invalid character : " << (int)*str << '\n';
-        return {net::resp::ErrKind::INVALID_CHARACTER};
     }
+    return {std::unique_ptr<data::Node>(std::move(a))};
 }
 
 std::variant<net::resp::RESPError, std::unique_ptr<data::Node>>
 net::resp::RESPServer::read_array(int connfd, char* body, int& i) {
-    int64_t len;
-    auto len_variant = read_int(connfd, body, i);
-    if (std::holds_alternative<net::resp::RESPError>(len_variant)) {
-        return std::get<net::resp::RESPError>(len_variant);
-    }
-    if (auto* len_variant_ptr = std::get_if<std::unique_ptr<data::Node>>(&len_variant)) {
-        if (data::Integer* len_node = dynamic_cast<data::Integer*>(len_variant_ptr->get())) {
-            len = len_node->get();
-        } else {
-            return {net::resp::ErrKind::INVALID_TYPE};
+    return read_aggregate<data::Array>(*this, connfd, body, i);
+}
+
+std::variant<net::resp::RESPError, std::unique_ptr<data::Node>>
+net::resp::RESPServer::read_set(int connfd, char* body, int& i) {
+    return read_aggregate<data::Set>(*this, connfd, body, i);
+}
+
+std::variant<net::resp::RESPError, std::unique_ptr<data::Node>>
+net::resp::RESPServer::read_push(int connfd, char* body, int& i) {
+    return read_aggregate<data::Push>(*this, connfd, body, i);
+}
+
+template<typename M>
+static std::variant<net::resp::RESPError, std::unique_ptr<M>>
+read_pairs(net::resp::RESPServer& s, int connfd, char* body, int& i) {
+    // the length is a number of key/value pairs
+    auto len_variant = s.read_len(connfd, body, i);
+    if (auto* err = std::get_if<net::resp::RESPError>(&len_variant)) return {*err};
+    int64_t len = std::get<int64_t>(len_variant);
+    if (len < 0) return {net::resp::ErrKind::INVALID_CHARACTER};
+    if (len > INT64_MAX / 2 || !fits(s, i, 2 * len)) return {net::resp::ErrKind::INVALID_LENGTH};
+
+    auto m = std::make_unique<M>(static_cast<int>(len));
+    for (int64_t k = 0 ; k < len ; ++k) {
+        auto key = s.one_request(connfd, body, i);
+        if (auto* err = std::get_if<net::resp::RESPError>(&key)) {
+            if (err->_err != net::resp::ErrKind::BULK_TOO_LARGE) return {*err};
+            return {skip(s, connfd, body, i, 2 * (len - k) - 1)};
         }
-    } else {
-        return {net::resp::ErrKind::INVALID_TYPE};
+        auto value = s.one_request(connfd, body, i);
+        if (auto* err = std::get_if<net::resp::RESPError>(&value)) {
+            if (err->_err != net::resp::ErrKind::BULK_TOO_LARGE) return {*err};
+            return {skip(s, connfd, body, i, 2 * (len - k - 1))};
+        }
+        m->emplace_back(std::move(std::get<std::unique_ptr<data::Node>>(key)),
+                        std::move(std::get<std::unique_ptr<data::Node>>(value)));
     }
+    return {std::move(m)};
+}
 
-    data::Array* a = new data::Array(len);
-    for (int k = 0 ; k < len ; ++k) {
-        auto req = one_request(connfd, body, i);
-        if (auto node_ptr = std::get_if<std::unique_ptr<data::Node>>(&req)) {
-            a->push_back(std::move(*node_ptr));
+std::variant<net::resp::RESPError, std::unique_ptr<data::Node>>
+net::resp::RESPServer::read_map(int connfd, char* body, int& i) {
+    // eg.: %1\r\n+first\r\n:1\r\n
+    auto res = read_pairs<data::Map>(*this, connfd, body, i);
+    if (auto* err = std::get_if<net::resp::RESPError>(&res)) return {*err};
+    return {std::unique_ptr<data::Node>(std::move(std::get<std::unique_ptr<data::Map>>(res)))};
+}
+
+std::variant<net::resp::RESPError, std::unique_ptr<data::Node>>
+net::resp::RESPServer::read_attribute(int connfd, char* body, int& i) {
+    // eg.: |1\r\n+ttl\r\n:3600\r\n$3\r\nfoo\r\n, the attribute then its value
+    auto res = read_pairs<data::Attribute>(*this, connfd, body, i);
+    if (auto* err = std::get_if<net::resp::RESPError>(&res)) {
+        if (err->_err != net::resp::ErrKind::BULK_TOO_LARGE) return {*err};
+        return {skip(*this, connfd, body, i, 1)};
+    }
+    auto attr = std::move(std::get<std::unique_ptr<data::Attribute>>(res));
+    auto value = one_request(connfd, body, i);
+    if (auto* err = std::get_if<net::resp::RESPError>(&value)) return {*err};
+    attr->set_value(std::move(std::get<std::unique_ptr<data::Node>>(value)));
+    return {std::unique_ptr<data::Node>(std::move(attr))};
+}
+
+bool net::resp::parse_hello(const Command& cmd, Hello& h) {
+    if (cmd.argc() < 2) return false;
+    h.version = cmd.argv[1];
+    for (size_t k = 2 ; k < cmd.argc() ; ++k) {
+        Command opt{{cmd.argv[k]}};
+        if (opt.is("AUTH") && k + 2 < cmd.argc()) {
+            h.auth = true;
+            h.user = cmd.argv[++k];
+            h.pass = cmd.argv[++k];
+        } else if (opt.is("SETNAME") && k + 1 < cmd.argc()) {
+            h.name = cmd.argv[++k];
         } else {
-            return std::get<net::resp::RESPError>(req);
+            return false;
         }
     }
-    auto res = std::unique_ptr<data::Node>(
-        dynamic_cast<data::Node*>(a)
-    );
-    return {std::move(res)};
+    return true;
 }
 
 std::optional<net::resp::RESPError> 
 net::resp::RESPServer::handshake(int connfd) {
-    // TOCHANGE : more proper parsing including authentification
+    // HELLO 3 [AUTH username password] [SETNAME clientname], inline or as an
+    // array of bulk strings. Anything else closes the connection
     char body[k_max_msg()];
-    const char* expected = "HELLO 3\r\n";
-    int32_t rv;
-
     int i = 0;
-    while (i < 9) {
-        int rv = read_stream(connfd, body + i, 1);
-        if (rv < 0) {
-            return {net::resp::ErrKind::END_OF_STREAM};
-        }
-        if (expected[i] != body[i]) {
-            return {net::resp::ErrKind::INVALID_CHARACTER};
-        }
-        ++i;
+    auto req = one_request(connfd, body, i);
+    if (auto* err = std::get_if<net::resp::RESPError>(&req)) return {*err};
+    auto cmd = as_command(std::get<std::unique_ptr<data::Node>>(req).get());
+    Hello hello;
+    if (!cmd.has_value() || !cmd->is("HELLO") || !parse_hello(*cmd, hello)) {
+        return {net::resp::ErrKind::INVALID_CHARACTER};
+    }
+    if (hello.version != "3") {
+        const char* noproto = "-NOPROTO unsupported protocol version\r\n";
+        write_stream(connfd, noproto, strlen(noproto));
+        return {net::resp::ErrKind::UNHANDLED};
+    }
+    std::string reply = "+OK\r\n";
+    if (_hello) {
+        reply = _hello(connfd, hello);
+    } else if (hello.auth) {
+        reply = "-ERR AUTH called without any password configured for the default user\r\n";
     }
-    if (write_stream(connfd, "+OK\r\n", sizeof("+OK\r\n") - 1) < 0) {
+    if (write_stream(connfd, reply.c_str(), reply.size()) < 0) {
         return {net::resp::ErrKind::SEND_FAILURE};
     }
     return {};
 }
 
+// next whitespace separated token of line starting at pos, empty at the end
+static std::string_view next_token(std::string_view line, size_t& pos) {
+    while (pos < line.size() && (line[pos] == ' ' || line[pos] == '\t')) ++pos;
+    size_t start = pos;
+    while (pos < line.size() && line[pos] != ' ' && line[pos] != '\t') ++pos;
+    return line.substr(start, pos - start);
+}
+
+static bool same_command(std::string_view s, std::string_view upper) {
+    if (s.size() != upper.size()) return false;
+    for (size_t k = 0 ; k < s.size() ; ++k) {
+        char c = s[k];
+        if (c >= 'a' && c <= 'z') c -= 'a' - 'A';
+        if (c != upper[k]) return false;
+    }
+    return true;
+}
+
+// answers "$<n>\r\n<s>\r\n" with a single syscall and no allocation
+static int32_t write_bulk(int connfd, std::string_view s) {
+    if (net::outbox(connfd) != nullptr) {
+        std::string reply = net::resp::bulk(s);
+        return net::write_stream(connfd, reply.c_str(), reply.size());
+    }
+    char hdr[24];
+    hdr[0] = '$';
+    auto res = std::to_chars(hdr + 1, hdr + sizeof(hdr) - 2, s.size());
+    *res.ptr++ = '\r';
+    *res.ptr++ = '\n';
+    struct iovec iov[3] = {
+        {hdr, static_cast<size_t>(res.ptr - hdr)},
+        {const_cast<char*>(s.data()), s.size()},
+        {const_cast<char*>("\r\n"), 2}
+    };
+    size_t total = iov[0].iov_len + iov[1].iov_len + 2;
+    ssize_t rv = writev(connfd, iov, 3);
+    profile::syscall();
+    if (rv == static_cast<ssize_t>(total)) return 0;
+    if (rv < 0) return -1;
+    // short write, finish it the slow way
+    std::string rest = std::string(hdr, iov[0].iov_len) + std::string(s) + "\r\n";
+    return net::write_stream(connfd, rest.c_str() + rv, total - rv);
+}
+
+std::variant<net::resp::RESPError, std::unique_ptr<data::Node>>
+net::resp::RESPServer::read_inline(int connfd, char* body, int& i) {
+    // eg.: PING\r\n or "SET key value\n" typed in telnet
+    // the first letter was already consumed by one_request
+    int i_base = i - 1;
+    while (true) {
+        if (i >= net::resp::RESPServer::k_max_msg()) return {net::resp::ErrKind::END_OF_STREAM};
+        if (read_stream(connfd, body + i, 1) < 0) return {net::resp::ErrKind::END_OF_STREAM};
+        if (body[i++] == '\n') break;
+    }
+    std::string_view line(body + i_base, i - i_base - 1);
+    if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+
+    // health checks are answered right here, without building any node
+    size_t pos = 0;
+    std::string_view name = next_token(line, pos);
+    std::string_view arg = next_token(line, pos);
+    bool more = !next_token(line, pos).empty();
+    if (!more) {
+        if (same_command(name, "PING")) {
+            int32_t rv = arg.empty() ? write_stream(connfd, "+PONG\r\n", 7) : write_bulk(connfd, arg);
+            if (rv < 0) return {net::resp::ErrKind::SEND_FAILURE};
+            return {net::resp::ErrKind::REPLIED};
+        }
+        if (same_command(name, "ECHO") && !arg.empty()) {
+            if (write_bulk(connfd, arg) < 0) return {net::resp::ErrKind::SEND_FAILURE};
+            return {net::resp::ErrKind::REPLIED};
+        }
+        if (same_command(name, "QUIT") && arg.empty()) {
+            // read on until EOF : +OK may still be waiting in an outbox
+            write_stream(connfd, "+OK\r\n", 5);
+            end_stream(connfd);
+            return {net::resp::ErrKind::REPLIED};
+        }
+    }
+
+    // anything else becomes the same array of bulk strings a RESP client sends
+    size_t argc = 0;
+    pos = 0;
+    while (!next_token(line, pos).empty()) ++argc;
+    if (argc == 0) return {net::resp::ErrKind::REPLIED};
+    auto a = std::make_unique<data::Array>(argc);
+    pos = 0;
+    for (size_t k = 0 ; k < argc ; ++k) {
+        a->push_back(std::make_unique<data::BulkString>(std::string(next_token(line, pos))));
+    }
+    return {std::unique_ptr<data::Node>(std::move(a))};
+}
+
+using reader_t = std::variant<net::resp::RESPError, std::unique_ptr<data::Node>>
+    (net::resp::RESPServer::*)(int, char*, int&);
+
+// readers indexed by the type byte
+static constexpr std::array<reader_t, 256> k_readers = [] {
+    using S = net::resp::RESPServer;
+    std::array<reader_t, 256> t = {};
+    t['+'] = &S::read_string;
+    t['-'] = &S::read_error;
+    t[':'] = &S::read_int;
+    t['$'] = &S::read_bulk_string;
+    t['*'] = &S::read_array;
+    t['_'] = &S::read_null;
+    t['#'] = &S::read_boolean;
+    t[','] = &S::read_double;
+    t['('] = &S::read_big_number;
+    t['!'] = &S::read_bulk_error;
+    t['='] = &S::read_verbatim;
+    t['%'] = &S::read_map;
+    t['~'] = &S::read_set;
+    t['|'] = &S::read_attribute;
+    t['>'] = &S::read_push;
+    for (int c = 'a' ; c <= 'z' ; ++c) t[c] = &S::read_inline;
+    for (int c = 'A' ; c <= 'Z' ; ++c) t[c] = &S::read_inline;
+    return t;
+}();
+
 std::variant<net::resp::RESPError, std::unique_ptr<data::Node>>
 net::resp::RESPServer::one_request(
     int connfd,
@@ -202,25 +534,31 @@ net::resp::RESPServer::one_request(
     */
     int32_t err = read_stream(connfd, body + i, 1);
     i += 1;
-    if (err) return {net::resp::ErrKind::END_OF_STREAM};
-    switch (body[i - 1]) {
-        // simple string
-        case '+':
-            return net::resp::RESPServer::read_string(connfd, body, i);
-        // simple error
-        case '-':
-            return net::resp::RESPServer::read_string(connfd, body, i);
-        // integer
-        case ':':
-            return net::resp::RESPServer::read_int(connfd, body, i);
-        // bulk string
-        case '$':
-            return net::resp::RESPServer::read_bulk_string(connfd, body, i);
-        // array
-        case '*':
-            return net::resp::RESPServer::read_array(connfd, body, i);
-        // unknown
-        default:
-            return {net::resp::ErrKind::UNHANDLED};
-    } 
-}
\ No newline at end of file
+    if (err) {
+        // nothing left to read at a message boundary : the peer is gone
+        return {i == 1 ? net::resp::ErrKind::CONNECTION_CLOSED : net::resp::ErrKind::END_OF_STREAM};
+    }
+    // one indirect call whatever the type, unknown types have no reader
+    auto reader = k_readers[static_cast<unsigned char>(body[i - 1])];
+    if (reader == nullptr) return {net::resp::ErrKind::UNHANDLED};
+    int start = i - 1;
+    // nested calls, from the aggregate readers, start past the type byte
+    // of their parent
+    bool top = start == 0;
+    bool inline_cmd = reader == &RESPServer::read_inline;
+    // an element starting with a letter : a client not speaking RESP
+    if (inline_cmd && !top) return {net::resp::ErrKind::UNEXPECTED_INLINE};
+    // top-level requests only, from their first byte : waiting for it is
+    // not parsing
+    char type = body[start];
+    profile::Sample sample(type == '*' ? "parse;array" : inline_cmd ? "parse;inline" : "parse;other", top);
+    auto res = (this->*reader)(connfd, body, i);
+    // the bytes stay in body until the next request, replication forwards them as is
+    bool array = body[start] == '*' && std::holds_alternative<std::unique_ptr<data::Node>>(res);
+    t_last_request = array ? std::string_view(body + start, i - start) : std::string_view();
+    return res;
+}
+
+std::string_view net::resp::RESPServer::last_request() {
+    return t_last_request;
+}
@@ -0,0 +1,135 @@
+#include "store/cold_store.h"
+#include "resp/server.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <cerrno>
+
+namespace store {
+
+// address space reserved for the log, the file grows into it
+static constexpr uint64_t k_reserve = uint64_t(1) << 40;
+static constexpr uint64_t k_page = 4096;
+// written under one shard lock hold at most, before letting clients in
+static constexpr size_t k_batch_bytes = 4 << 20;
+
+static uint32_t seconds() {
+    return static_cast<uint32_t>(now_ms() / 1000);
+}
+
+ColdStore::ColdStore(Keyspace& ks, Timers& timers, Options opts)
+    : _ks(ks), _timers(timers), _opts(std::move(opts)) {
+    _fd = open(_opts.path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (_fd < 0) net::die("open(" + _opts.path + ")");
+    void* p = mmap(nullptr, k_reserve, PROT_READ, MAP_SHARED | MAP_NORESERVE, _fd, 0);
+    if (p == MAP_FAILED) net::die("mmap()");
+    _base = static_cast<char*>(p);
+    _sweeper = std::make_shared<Sweeper>();
+    _sweeper->store = this;
+    _ks.tick(seconds());
+    _ks.cold_store(this);
+    schedule();
+}
+
+ColdStore::~ColdStore() {
+    {
+        std::lock_guard<std::mutex> l(_sweeper->m);
+        _sweeper->store = nullptr;
+    }
+    _ks.cold_store(nullptr);
+    munmap(_base, k_reserve);
+    close(_fd);
+}
+
+void ColdStore::schedule() {
+    _timers.after(std::chrono::milliseconds(_opts.sweep_ms), [s = _sweeper] {
+        std::lock_guard<std::mutex> l(s->m);
+        if (s->store == nullptr) return;
+        s->store->sweep();
+        s->store->schedule();
+    });
+}
+
+std::optional<Cold> ColdStore::append(std::string_view v) {
+    if (v.size() > UINT32_MAX) return {};
+    uint64_t at;
+    {
+        std::lock_guard<std::mutex> l(_m);
+        // whole pages, so that all of it can be punched out later
+        if (v.size() >= k_page) _end = (_end + k_page - 1) & ~(k_page - 1);
+        if (_end + v.size() > k_reserve) return {};
+        at = _end;
+        _end += v.size();
+    }
+    size_t done = 0;
+    while (done < v.size()) {
+        ssize_t rv = pwrite(_fd, v.data() + done, v.size() - done, static_cast<off_t>(at + done));
+        profile::syscall();
+        if (rv < 0 && errno == EINTR) continue;
+        // out of disk : the value stays in memory, its hole in the log too
+        if (rv <= 0) return {};
+        done += static_cast<size_t>(rv);
+    }
+    _values.fetch_add(1, std::memory_order_relaxed);
+    _bytes.fetch_add(v.size(), std::memory_order_relaxed);
+    return Cold{this, at, static_cast<uint32_t>(v.size())};
+}
+
+void ColdStore::release(const Cold& c) {
+    _values.fetch_sub(1, std::memory_order_relaxed);
+    _bytes.fetch_sub(c.size, std::memory_order_relaxed);
+    uint64_t start = (c.offset + k_page - 1) & ~(k_page - 1);
+    uint64_t end = (c.offset + c.size) & ~(k_page - 1);
+    if (end > start) {
+        // best effort, the space is only wasted where punching holes fails
+        fallocate(_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                  static_cast<off_t>(start), static_cast<off_t>(end - start));
+    }
+}
+
+void ColdStore::reset() {
+    std::lock_guard<std::mutex> l(_m);
+    if (ftruncate(_fd, 0) < 0) net::die("ftruncate()");
+    _end = 0;
+    _values.store(0, std::memory_order_relaxed);
+    _bytes.store(0, std::memory_order_relaxed);
+}
+
+size_t ColdStore::sweep() {
+    uint32_t now = seconds();
+    _ks.tick(now);
+    uint32_t idle = static_cast<uint32_t>(_opts.idle_ms / 1000);
+    size_t moved = 0;
+    for (size_t k = 0 ; k < Keyspace::k_shards ; ++k) {
+        auto& shard = _ks.shard(k);
+        // a pass over the shard ends when its cursor comes back to 0, one
+        // stopped by a full disk resumes where it was
+        do {
+            std::lock_guard<std::mutex> l(shard.m);
+            size_t batch = 0;
+            bool full = false;
+            for (size_t n = 0 ; n < k_batch && batch < k_batch_bytes ; ++n) {
+                uint64_t next = shard.map.scan(_cursors[k], [&] (Map::value_type& kv) {
+                    auto* s = std::get_if<std::string>(&kv.second.value);
+                    if (full || s == nullptr || s->size() < k_min_cold) return;
+                    if (s->size() < _opts.min_size && now - kv.second.used < idle) return;
+                    auto c = append(*s);
+                    if (!c.has_value()) {
+                        full = true;
+                        return;
+                    }
+                    moved += s->size();
+                    batch += s->size();
+                    kv.second.value = *c;
+                });
+                if (full) return moved;
+                _cursors[k] = next;
+                if (next == 0) break;
+            }
+        } while (_cursors[k] != 0);
+    }
+    return moved;
+}
+
+} // namespace store
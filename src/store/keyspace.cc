@@ -0,0 +1,332 @@
+#include "store/keyspace.h"
+#include "store/cold_store.h"
+#include "store/reclaimer.h"
+#include "store/timers.h"
+#include "utils/lz.h"
+
+#include <cstring>
+#include <ctime>
+
+namespace store {
+
+// compressed values must save at least 1/k_min_saving of their size
+static constexpr size_t k_min_saving = 5;
+
+static uint64_t cpu_ns() {
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + static_cast<uint64_t>(ts.tv_nsec);
+}
+
+void Keyspace::inflate(const Compressed& c, std::string& out) {
+    uint64_t t = cpu_ns();
+    size_t at = out.size();
+    out.resize(at + c.size);
+    // only ever fed what encode() produced
+    utils::lz_decompress(c.data(), out.data() + at, c.size);
+    _compression.decompress_ns.fetch_add(cpu_ns() - t, std::memory_order_relaxed);
+}
+
+// whether s is an integer that prints back as s : no sign, no leading zero
+static bool integer(const std::string& s, int64_t& n) {
+    if (s.empty() || s.size() > 20) return false;
+    auto res = std::from_chars(s.data(), s.data() + s.size(), n);
+    if (res.ec != std::errc() || res.ptr != s.data() + s.size()) return false;
+    char buf[20];
+    return format(n, buf) == s;
+}
+
+void Keyspace::encode(Value& v) {
+    auto* s = std::get_if<std::string>(&v);
+    if (s == nullptr) return;
+    if (int64_t n ; integer(*s, n)) {
+        v = n;
+        return;
+    }
+    if (s->size() <= Inline::k_capacity) {
+        Inline i;
+        std::memcpy(i.data, s->data(), s->size());
+        i.size = static_cast<uint8_t>(s->size());
+        v = i;
+        return;
+    }
+    if (_compress_min == 0 || s->size() < _compress_min || s->size() > UINT32_MAX) return;
+    uint64_t t = cpu_ns();
+    std::string z;
+    utils::lz_compress(*s, z);
+    _compression.compress_ns.fetch_add(cpu_ns() - t, std::memory_order_relaxed);
+    if (z.size() > s->size() - s->size() / k_min_saving) {
+        _compression.rejected.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    Compressed c{std::make_unique<char[]>(z.size()), static_cast<uint32_t>(z.size()), static_cast<uint32_t>(s->size())};
+    std::memcpy(c.bytes.get(), z.data(), z.size());
+    _compression.values.fetch_add(1, std::memory_order_relaxed);
+    _compression.raw_bytes.fetch_add(c.size, std::memory_order_relaxed);
+    _compression.bytes.fetch_add(c.stored, std::memory_order_relaxed);
+    v = std::move(c);
+}
+
+bool Keyspace::reap(Shard& s, std::string_view key, uint64_t h) {
+    if (s.expires.empty()) return false;
+    auto it = s.expires.find(key, h);
+    if (it == s.expires.end() || it->second > now_ms()) return false;
+    remove(s, key, h);
+    if (_on_reap) _on_reap(key);
+    return true;
+}
+
+Value& Keyspace::use(Entry& e, bool decoding) {
+    e.used = clock();
+    if (auto* c = std::get_if<Cold>(&e.value)) {
+        Cold cold = *c;
+        e.value = std::string(cold.store->read(cold));
+        cold.store->release(cold);
+    }
+    if (!decoding) return e.value;
+    if (auto* n = std::get_if<int64_t>(&e.value)) {
+        char buf[20];
+        e.value = std::string(format(*n, buf));
+    } else if (auto* i = std::get_if<Inline>(&e.value)) {
+        e.value = std::string(i->view());
+    } else if (auto* c = std::get_if<Compressed>(&e.value)) {
+        std::string s;
+        s.reserve(c->size);
+        inflate(*c, s);
+        release(e.value);
+        e.value = std::move(s);
+    }
+    return e.value;
+}
+
+void Keyspace::release(const Value& v) {
+    if (auto* c = std::get_if<Cold>(&v)) {
+        c->store->release(*c);
+    } else if (auto* c = std::get_if<Compressed>(&v)) {
+        _compression.values.fetch_sub(1, std::memory_order_relaxed);
+        _compression.raw_bytes.fetch_sub(c->size, std::memory_order_relaxed);
+        _compression.bytes.fetch_sub(c->stored, std::memory_order_relaxed);
+    }
+}
+
+void Keyspace::grouped(Shard& s, std::string_view key) {
+    if (_group != nullptr) s.groups[_group(key)].insert(key);
+}
+
+void Keyspace::ungrouped(Shard& s, std::string_view key) {
+    if (_group == nullptr) return;
+    auto g = s.groups.find(_group(key));
+    g->second.erase(key);
+    if (g->second.empty()) s.groups.erase(g);
+}
+
+void Keyspace::resized(Shard& s) {
+    if ((!s.map.rehashing() && !s.expires.rehashing()) || !_on_rehash || _rehash_told.load(std::memory_order_relaxed)) return;
+    if (!_rehash_told.exchange(true)) _on_rehash();
+}
+
+bool Keyspace::rehash(size_t steps) {
+    bool more = false;
+    for (auto& s : _shards) {
+        std::lock_guard<std::mutex> l(s.m);
+        more |= s.map.rehash(steps);
+        more |= s.expires.rehash(steps);
+    }
+    // a table that starts rehashing from now on tells the hook again
+    if (!more) _rehash_told.store(false);
+    return more;
+}
+
+// about how many frees destroying v takes
+static size_t effort(const Value& v) {
+    if (auto* l = std::get_if<ListPtr>(&v)) return (*l)->size();
+    if (auto* s = std::get_if<std::string>(&v)) return s->size() >> 16;
+    if (auto* c = std::get_if<Compressed>(&v)) return c->stored >> 16;
+    if (auto* b = std::get_if<BloomPtr>(&v)) return (*b)->bytes() >> 16;
+    if (auto* s = std::get_if<StreamPtr>(&v)) return (*s)->blocks();
+    return 1;
+}
+
+void Keyspace::dispose(Value& v) {
+    if (_reclaimer != nullptr && effort(v) > k_lazy_effort) _reclaimer->dispose(std::move(v));
+}
+
+Value* Keyspace::find(std::string_view key) {
+    uint64_t h = hash(key);
+    auto& s = _shards[shard_index(h)];
+    if (reap(s, key, h)) return nullptr;
+    auto it = s.map.find(key, h);
+    return it == s.map.end() ? nullptr : &use(it->second, true);
+}
+
+Value* Keyspace::peek(std::string_view key, uint64_t h) {
+    auto& s = _shards[shard_index(h)];
+    if (reap(s, key, h)) return nullptr;
+    auto it = s.map.find(key, h);
+    return it == s.map.end() ? nullptr : &use(it->second, false);
+}
+
+Value& Keyspace::emplace(std::string_view key, bool decoding) {
+    uint64_t h = hash(key);
+    auto& s = _shards[shard_index(h)];
+    reap(s, key, h);
+    ++s.versions[slot_index(h)];
+    auto it = s.map.find(key, h);
+    if (it == s.map.end()) {
+        it = s.map.emplace(h, std::string(key), Entry{}).first;
+        grouped(s, it->first);
+        resized(s);
+    }
+    return use(it->second, decoding);
+}
+
+Value& Keyspace::write(std::string_view key) {
+    return emplace(key, true);
+}
+
+Value& Keyspace::poke(std::string_view key) {
+    return emplace(key, false);
+}
+
+void Keyspace::set(std::string_view key, uint64_t h, Value v) {
+    auto& s = _shards[shard_index(h)];
+    reap(s, key, h);
+    ++s.versions[slot_index(h)];
+    auto it = s.map.find(key, h);
+    if (it == s.map.end()) {
+        it = s.map.emplace(h, std::string(key), Entry{}).first;
+        grouped(s, it->first);
+        resized(s);
+    } else {
+        // no need to read back what gets overwritten
+        release(it->second.value);
+        dispose(it->second.value);
+    }
+    encode(v);
+    it->second.value = std::move(v);
+    it->second.used = clock();
+    if (!s.expires.empty()) {
+        auto it = s.expires.find(key, h);
+        if (it != s.expires.end()) s.expires.erase(it);
+    }
+}
+
+bool Keyspace::erase(std::string_view key, uint64_t h) {
+    auto& s = _shards[shard_index(h)];
+    // a key past its deadline goes all the same, but was not there anymore
+    if (reap(s, key, h)) return false;
+    return remove(s, key, h);
+}
+
+bool Keyspace::remove(Shard& s, std::string_view key, uint64_t h) {
+    auto it = s.map.find(key, h);
+    if (it == s.map.end()) return false;
+    ++s.versions[slot_index(h)];
+    release(it->second.value);
+    dispose(it->second.value);
+    ungrouped(s, it->first);
+    s.map.erase(it);
+    resized(s);
+    if (!s.expires.empty()) {
+        auto e = s.expires.find(key, h);
+        if (e != s.expires.end()) s.expires.erase(e);
+    }
+    return true;
+}
+
+bool Keyspace::expire(std::string_view key, int64_t at) {
+    uint64_t h = hash(key);
+    auto& s = _shards[shard_index(h)];
+    if (reap(s, key, h)) return false;
+    auto it = s.map.find(key, h);
+    if (it == s.map.end()) return false;
+    ++s.versions[slot_index(h)];
+    auto e = s.expires.find(key, h);
+    if (e == s.expires.end()) {
+        s.expires.emplace(h, it->first, at);
+        resized(s);
+    } else {
+        e->second = at;
+    }
+    if (_on_expire) _on_expire(key, at);
+    return true;
+}
+
+bool Keyspace::persist(std::string_view key) {
+    uint64_t h = hash(key);
+    auto& s = _shards[shard_index(h)];
+    if (reap(s, key, h)) return false;
+    auto e = s.expires.find(key, h);
+    if (e == s.expires.end()) return false;
+    ++s.versions[slot_index(h)];
+    s.expires.erase(e);
+    return true;
+}
+
+int64_t Keyspace::deadline(std::string_view key) {
+    uint64_t h = hash(key);
+    auto& s = _shards[shard_index(h)];
+    if (reap(s, key, h) || s.map.find(key, h) == s.map.end()) return -2;
+    auto e = s.expires.find(key, h);
+    return e == s.expires.end() ? -1 : e->second;
+}
+
+bool Keyspace::reap(std::string_view key) {
+    uint64_t h = hash(key);
+    return reap(_shards[shard_index(h)], key, h);
+}
+
+void Keyspace::touch(std::string_view key) {
+    uint64_t h = hash(key);
+    ++_shards[shard_index(h)].versions[slot_index(h)];
+}
+
+size_t Keyspace::size() {
+    size_t n = 0;
+    for (auto& s : _shards) {
+        n += s.map.size();
+    }
+    return n;
+}
+
+void Keyspace::clear(bool lazy) {
+    // the whole log goes at once
+    if (_cold != nullptr) _cold->reset();
+    _compression.values.store(0, std::memory_order_relaxed);
+    _compression.raw_bytes.store(0, std::memory_order_relaxed);
+    _compression.bytes.store(0, std::memory_order_relaxed);
+    for (auto& s : _shards) {
+        // moved-from tables are left to clear, in O(1)
+        if (lazy && _reclaimer != nullptr) {
+            _reclaimer->dispose(std::move(s.map));
+            _reclaimer->dispose(std::move(s.expires));
+        }
+        s.groups.clear();
+        s.map.clear();
+        s.expires.clear();
+        for (auto& v : s.versions) ++v;
+    }
+}
+
+uint64_t Keyspace::scan(uint64_t cursor, size_t count, const ScanFn& fn) {
+    // the low bits name the shard, the others the cursor of its table
+    size_t idx = cursor & (k_shards - 1);
+    uint64_t c = cursor >> k_shard_bits;
+    size_t seen = 0;
+    int64_t now = now_ms();
+    for (size_t visits = 0 ; visits < 10 * count && seen < count ; ++visits) {
+        auto& s = _shards[idx];
+        c = s.map.scan(c, [&] (Map::value_type& kv) {
+            if (!s.expires.empty()) {
+                auto e = s.expires.find(kv.first);
+                if (e != s.expires.end() && e->second <= now) return;
+            }
+            fn(kv.first, kv.second.value);
+            ++seen;
+        });
+        if (c == 0 && ++idx == k_shards) return 0;
+    }
+    return (c << k_shard_bits) | idx;
+}
+
+} // namespace store
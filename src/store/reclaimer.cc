@@ -0,0 +1,34 @@
+#include "store/reclaimer.h"
+
+namespace store {
+
+Reclaimer::Reclaimer() : _t([this] { run(); }) {}
+
+Reclaimer::~Reclaimer() {
+    _stop.store(true, std::memory_order_release);
+    _pushed.fetch_add(1, std::memory_order_release);
+    _pushed.notify_one();
+    _t.join();
+}
+
+void Reclaimer::dispose(Garbage g) {
+    _queue.push(std::move(g));
+    _disposed.fetch_add(1, std::memory_order_relaxed);
+    _pushed.fetch_add(1, std::memory_order_release);
+    _pushed.notify_one();
+}
+
+void Reclaimer::run() {
+    while (true) {
+        uint32_t seen = _pushed.load(std::memory_order_acquire);
+        // what was pushed before seen is poppable by now
+        while (auto g = _queue.pop()) {
+            g.reset();
+            _freed.fetch_add(1, std::memory_order_relaxed);
+        }
+        if (_stop.load(std::memory_order_acquire)) return;
+        _pushed.wait(seen, std::memory_order_acquire);
+    }
+}
+
+} // namespace store
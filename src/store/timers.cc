@@ -0,0 +1,64 @@
+#include "store/timers.h"
+#include <vector>
+
+namespace store {
+
+Timers::~Timers() {
+    {
+        std::lock_guard<std::mutex> l(_m);
+        _stop = true;
+    }
+    _cv.notify_one();
+    if (_t.joinable()) _t.join();
+}
+
+Timers::Id Timers::at(int64_t deadline, std::function<void()> fn) {
+    Id id;
+    bool sooner;
+    {
+        std::lock_guard<std::mutex> l(_m);
+        if (!_t.joinable()) _t = std::thread([this] { run(); });
+        uint64_t before = _wheel.next();
+        id = _wheel.add(static_cast<uint64_t>(deadline < 0 ? 0 : deadline), std::move(fn));
+        sooner = _wheel.next() < before;
+    }
+    // the thread sleeps until the previous first timer otherwise
+    if (sooner) _cv.notify_one();
+    return id;
+}
+
+bool Timers::cancel(Id id) {
+    std::lock_guard<std::mutex> l(_m);
+    return _wheel.cancel(id);
+}
+
+size_t Timers::pending() {
+    std::lock_guard<std::mutex> l(_m);
+    return _wheel.size();
+}
+
+void Timers::run() {
+    std::vector<std::function<void()>> due;
+    std::unique_lock<std::mutex> l(_m);
+    while (!_stop) {
+        _wheel.advance(static_cast<uint64_t>(now_ms()), [&] (std::function<void()> fn) {
+            due.push_back(std::move(fn));
+        });
+        if (!due.empty()) {
+            l.unlock();
+            for (auto& fn : due) fn();
+            due.clear();
+            l.lock();
+            continue;
+        }
+        uint64_t next = _wheel.next();
+        if (next == _wheel.k_never) {
+            _cv.wait(l);
+        } else {
+            auto wake = std::chrono::system_clock::time_point(std::chrono::milliseconds(next));
+            _cv.wait_until(l, wake);
+        }
+    }
+}
+
+} // namespace store
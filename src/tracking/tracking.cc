@@ -0,0 +1,236 @@
+#include "tracking/tracking.h"
+#include "resp/resp_utils.h"
+
+#include <algorithm>
+
+namespace tracking {
+
+static std::string invalidate_frame(std::string_view key) {
+    std::string s = ">2\r\n$10\r\ninvalidate\r\n*1\r\n";
+    s += net::resp::bulk(key);
+    return s;
+}
+
+// sent on FLUSHALL : every cached key is gone
+static const char* k_flush_frame = ">2\r\n$10\r\ninvalidate\r\n_\r\n";
+
+static size_t shard_of(std::string_view key) {
+    return store::Keyspace::shard_index(store::Keyspace::hash(key));
+}
+
+static bool matches(const std::vector<std::string>& prefixes, std::string_view key) {
+    if (prefixes.empty()) return true;
+    for (auto& p : prefixes) {
+        if (key.substr(0, p.size()) == p) return true;
+    }
+    return false;
+}
+
+Tracking::Tracking(commands::Table& table, pubsub::PubSub& ps, size_t max_keys)
+    : _table(table), _ps(ps),
+      _max_per_shard(std::max<size_t>(max_keys / store::Keyspace::k_shards, 1)) {
+    _hook = _table.after_write([this] (const commands::Spec& spec, const commands::Args& argv) {
+        written(spec, argv);
+    });
+    _table.on_read([this] (int fd, const commands::Spec& spec, const commands::Args& argv) {
+        read(fd, spec, argv);
+    });
+}
+
+Tracking::~Tracking() {
+    _table.drop_after_write(_hook);
+    _table.on_read({});
+}
+
+void Tracking::read(int fd, const commands::Spec& spec, const commands::Args& argv) {
+    if (_on.load(std::memory_order_relaxed) == 0) return;
+    if ((spec.flags & commands::ALL_KEYS) || spec.first_key == 0) return;
+    uint32_t id;
+    {
+        std::shared_lock l(_m);
+        auto it = _clients.find(fd);
+        if (it == _clients.end() || it->second.bcast) return;
+        id = it->second.id;
+    }
+    commands::KeyRange keys = commands::key_range(spec, argv);
+    for (int k = keys.first ; k <= keys.last ; k += keys.step) {
+        remember(_shards[shard_of(argv[k])], argv[k], id);
+    }
+}
+
+void Tracking::remember(Shard& shard, std::string_view key, uint32_t id) {
+    auto it = shard.index.find(key);
+    if (it != shard.index.end()) {
+        auto& readers = it->second->readers;
+        if (std::find(readers.begin(), readers.end(), id) == readers.end()) readers.push_back(id);
+        return;
+    }
+    shard.order.push_back(Entry{std::string(key), {id}});
+    auto e = std::prev(shard.order.end());
+    shard.index.emplace(e->key, e);
+    _tracked.fetch_add(1, std::memory_order_relaxed);
+    if (shard.order.size() <= _max_per_shard) return;
+
+    // full : the oldest key is invalidated as if written, its readers drop
+    // it from their cache and read it again if they still care
+    Entry& oldest = shard.order.front();
+    {
+        std::shared_lock l(_m);
+        invalidate(&oldest, oldest.key, -1, false);
+    }
+    shard.index.erase(oldest.key);
+    shard.order.pop_front();
+    _tracked.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void Tracking::written(const commands::Spec& spec, const commands::Args& argv) {
+    if (_on.load(std::memory_order_relaxed) == 0) return;
+    if (spec.flags & commands::ALL_KEYS) {
+        flushed();
+        return;
+    }
+    if (spec.first_key == 0) return;
+    int writer = commands::Table::client();
+    bool bcast = _broadcasting.load(std::memory_order_relaxed) > 0;
+    commands::KeyRange keys = commands::key_range(spec, argv);
+    for (int k = keys.first ; k <= keys.last ; k += keys.step) {
+        auto& shard = _shards[shard_of(argv[k])];
+        auto it = shard.index.find(argv[k]);
+        if (it == shard.index.end() && !bcast) continue;
+        {
+            std::shared_lock l(_m);
+            invalidate(it == shard.index.end() ? nullptr : &*it->second, argv[k], writer, bcast);
+        }
+        if (it != shard.index.end()) {
+            auto e = it->second;
+            shard.index.erase(it);
+            shard.order.erase(e);
+            _tracked.fetch_sub(1, std::memory_order_relaxed);
+        }
+    }
+}
+
+void Tracking::invalidate(const Entry* e, std::string_view key, int writer, bool bcast) {
+    pubsub::Frame f;
+    auto send = [&] (int fd, const Client& c) {
+        if (c.noloop && fd == writer) return;
+        if (!f) f = std::make_shared<const std::string>(invalidate_frame(key));
+        _ps.push(fd, f);
+    };
+    if (e != nullptr) {
+        for (uint32_t id : e->readers) {
+            // gone or turned tracking off since
+            auto it = _ids.find(id);
+            if (it != _ids.end()) send(it->second, _clients.at(it->second));
+        }
+    }
+    if (!bcast) return;
+    for (int fd : _bcast) {
+        auto& c = _clients.at(fd);
+        if (matches(c.prefixes, key)) send(fd, c);
+    }
+}
+
+void Tracking::flushed() {
+    // every shard is locked
+    for (auto& shard : _shards) {
+        shard.index.clear();
+        shard.order.clear();
+    }
+    _tracked.store(0, std::memory_order_relaxed);
+    auto f = std::make_shared<const std::string>(k_flush_frame);
+    std::shared_lock l(_m);
+    for (auto& [fd, c] : _clients) _ps.push(fd, f);
+}
+
+bool Tracking::unlink(int fd) {
+    auto it = _clients.find(fd);
+    if (it == _clients.end()) return false;
+    _ids.erase(it->second.id);
+    if (it->second.bcast) {
+        _bcast.erase(std::find(_bcast.begin(), _bcast.end(), fd));
+        _broadcasting.fetch_sub(1, std::memory_order_relaxed);
+    }
+    _clients.erase(it);
+    _on.fetch_sub(1, std::memory_order_relaxed);
+    return true;
+}
+
+void Tracking::forget(int fd) {
+    bool was;
+    {
+        std::unique_lock l(_m);
+        was = unlink(fd);
+    }
+    // the outbox handle() opened
+    if (was) _ps.drop(fd);
+}
+
+bool Tracking::handle(int fd, const net::resp::Command& cmd) {
+    if (!cmd.is("CLIENT") || cmd.argc() < 2) return false;
+    if (!net::resp::Command{{cmd.argv[1]}}.is("TRACKING")) return false;
+
+    std::string out;
+    if (cmd.argc() < 3) {
+        out = net::resp::wrong_arity("client|tracking");
+        _ps.reply(fd, std::move(out));
+        return true;
+    }
+    net::resp::Command mode{{cmd.argv[2]}};
+    bool on = mode.is("ON");
+    bool ok = on || mode.is("OFF");
+    Client c;
+    for (size_t k = 3 ; k < cmd.argc() && ok ; ++k) {
+        net::resp::Command opt{{cmd.argv[k]}};
+        if (opt.is("BCAST")) {
+            c.bcast = true;
+        } else if (opt.is("NOLOOP")) {
+            c.noloop = true;
+        } else if (opt.is("PREFIX") && k + 1 < cmd.argc()) {
+            c.prefixes.emplace_back(cmd.argv[++k]);
+        } else {
+            ok = false;
+        }
+    }
+    if (!ok) {
+        out = "-ERR syntax error\r\n";
+    } else if (!c.prefixes.empty() && !c.bcast) {
+        out = "-ERR PREFIX option requires BCAST mode to be enabled\r\n";
+    } else {
+        std::unique_lock l(_m);
+        // a new id : keys read before don't come back to haunt the client
+        unlink(fd);
+        if (on) {
+            // invalidations and replies share it from now on
+            _ps.open(fd);
+            c.id = _next_id++;
+            _ids[c.id] = fd;
+            if (c.bcast) {
+                _bcast.push_back(fd);
+                _broadcasting.fetch_add(1, std::memory_order_relaxed);
+            }
+            _clients.emplace(fd, std::move(c));
+            _on.fetch_add(1, std::memory_order_relaxed);
+        }
+        out = net::resp::ok();
+    }
+    // ordered after the invalidations already queued for fd
+    _ps.reply(fd, std::move(out));
+    return true;
+}
+
+void Tracking::attach(net::resp::Redis& r) {
+    using Chain = ChainOfResponsibility::Chain<int, net::resp::Redis::T&&>;
+    r.attach([this] (int connfd, net::resp::Redis::T&& msg, Chain next) {
+        if (auto* node = std::get_if<std::unique_ptr<data::Node>>(&msg)) {
+            auto cmd = net::resp::as_command(node->get());
+            if (cmd.has_value() && handle(connfd, *cmd)) return;
+        }
+        next(connfd, std::move(msg));
+    });
+    r.on_close([this] (int connfd) {
+        forget(connfd);
+    });
+}
+
+} // namespace tracking
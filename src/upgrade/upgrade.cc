@@ -0,0 +1,116 @@
+#include "upgrade/upgrade.h"
+
+#include <sys/un.h>
+#include <cstring>
+#include <iostream>
+
+namespace upgrade {
+
+static bool unix_address(const std::string& path, sockaddr_un& addr) {
+    addr = {};
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) return false;
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    return true;
+}
+
+// one byte carrying fd as ancillary data
+static bool send_fd(int sock, int fd) {
+    char byte = 0;
+    iovec iov = {&byte, 1};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+    msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    cmsghdr* c = CMSG_FIRSTHDR(&msg);
+    c->cmsg_level = SOL_SOCKET;
+    c->cmsg_type = SCM_RIGHTS;
+    c->cmsg_len = CMSG_LEN(sizeof(int));
+    std::memcpy(CMSG_DATA(c), &fd, sizeof(int));
+    return sendmsg(sock, &msg, MSG_NOSIGNAL) == 1;
+}
+
+static int recv_fd(int sock) {
+    char byte;
+    iovec iov = {&byte, 1};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+    msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    if (recvmsg(sock, &msg, MSG_CMSG_CLOEXEC) != 1) return -1;
+    cmsghdr* c = CMSG_FIRSTHDR(&msg);
+    if (c == nullptr || c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS) return -1;
+    int fd;
+    std::memcpy(&fd, CMSG_DATA(c), sizeof(int));
+    return fd;
+}
+
+Handoff::Handoff(net::resp::Redis& r, replication::Replication& repl, const std::string& path)
+    : _r(r), _repl(repl) {
+    sockaddr_un addr;
+    if (!unix_address(path, addr)) net::die("upgrade socket path too long");
+    _listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (_listener < 0) net::die("socket()");
+    // the previous process's socket, it already handed over
+    unlink(path.c_str());
+    if (bind(_listener, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) net::die("bind()");
+    listen(_listener, 1);
+    _t = std::thread(&Handoff::run, this);
+}
+
+Handoff::~Handoff() {
+    // wakes accept() up when nobody came
+    shutdown(_listener, SHUT_RDWR);
+    int link = _link.load();
+    if (link >= 0) shutdown(link, SHUT_RDWR);
+    if (_t.joinable()) _t.join();
+    if ((link = _link.load()) >= 0) close(link);
+    close(_listener);
+}
+
+void Handoff::run() {
+    int link = accept4(_listener, nullptr, nullptr, SOCK_CLOEXEC);
+    if (link < 0) return;
+    // clients wait in the kernel's queue from now on, until the new process
+    // accepts them
+    _r.stop();
+    if (!send_fd(link, _r.listen_fd())) {
+        std::cerr << "hot restart : could not hand the listening socket over\n";
+        close(link);
+        return;
+    }
+    _link = link;
+    // until finish() or the destructor shut the link down
+    _repl.hand_over(link, [this] { _streaming = true; });
+}
+
+void Handoff::finish(std::chrono::milliseconds timeout) {
+    auto until = std::chrono::steady_clock::now() + timeout;
+    while (!_streaming || _repl.lag() > 0) {
+        if (std::chrono::steady_clock::now() >= until) break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    int link = _link.load();
+    if (link >= 0) shutdown(link, SHUT_RDWR);
+    if (_t.joinable()) _t.join();
+}
+
+int take_over(const std::string& path, int& link) {
+    sockaddr_un addr;
+    if (!unix_address(path, addr)) return -1;
+    link = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (link < 0) return -1;
+    int fd = -1;
+    if (connect(link, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0) fd = recv_fd(link);
+    if (fd < 0) {
+        close(link);
+        link = -1;
+    }
+    return fd;
+}
+
+} // namespace upgrade
@@ -0,0 +1,81 @@
+#include "utils/glob.h"
+
+#include <utility>
+
+namespace utils {
+
+static bool match_class(std::string_view p, size_t& pi, char c) {
+    // p[pi] is right after '[', leaves pi on the closing ']'
+    bool negate = false;
+    bool matched = false;
+    if (pi < p.size() && p[pi] == '^') {
+        negate = true;
+        ++pi;
+    }
+    while (pi < p.size() && p[pi] != ']') {
+        if (p[pi] == '\\' && pi + 1 < p.size()) {
+            ++pi;
+            if (p[pi] == c) matched = true;
+        } else if (pi + 2 < p.size() && p[pi + 1] == '-' && p[pi + 2] != ']') {
+            char lo = p[pi], hi = p[pi + 2];
+            if (lo > hi) std::swap(lo, hi);
+            if (c >= lo && c <= hi) matched = true;
+            pi += 2;
+        } else if (p[pi] == c) {
+            matched = true;
+        }
+        ++pi;
+    }
+    return matched != negate;
+}
+
+bool glob_match(std::string_view p, std::string_view s) {
+    // iterative matcher with single-star backtracking, linear in practice
+    size_t pi = 0, si = 0;
+    size_t star_p = std::string_view::npos, star_s = 0;
+    while (si < s.size()) {
+        if (pi < p.size()) {
+            switch (p[pi]) {
+                case '*':
+                    star_p = pi++;
+                    star_s = si;
+                    continue;
+                case '?':
+                    ++pi;
+                    ++si;
+                    continue;
+                case '[': {
+                    size_t end = pi + 1;
+                    if (match_class(p, end, s[si])) {
+                        pi = end < p.size() ? end + 1 : end;
+                        ++si;
+                        continue;
+                    }
+                    break;
+                }
+                case '\\':
+                    if (pi + 1 < p.size() && p[pi + 1] == s[si]) {
+                        pi += 2;
+                        ++si;
+                        continue;
+                    }
+                    break;
+                default:
+                    if (p[pi] == s[si]) {
+                        ++pi;
+                        ++si;
+                        continue;
+                    }
+                    break;
+            }
+        }
+        if (star_p == std::string_view::npos) return false;
+        // let the last star swallow one more character
+        pi = star_p + 1;
+        si = ++star_s;
+    }
+    while (pi < p.size() && p[pi] == '*') ++pi;
+    return pi == p.size();
+}
+
+} // namespace utils
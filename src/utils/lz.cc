@@ -0,0 +1,126 @@
+#include "utils/lz.h"
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+
+namespace utils {
+
+static constexpr size_t k_min_match = 4;
+// the format ends with literals : no match starts in the last 12 bytes nor
+// covers the last 5
+static constexpr size_t k_match_limit = 12;
+static constexpr size_t k_last_literals = 5;
+static constexpr size_t k_max_offset = 65535;
+static constexpr unsigned k_hash_log = 12;
+// misses in a row before the matcher starts skipping bytes, incompressible
+// input goes through quickly
+static constexpr unsigned k_skip_trigger = 6;
+
+static uint32_t read32(const char* p) {
+    uint32_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint32_t hash4(uint32_t v) {
+    return (v * 2654435761u) >> (32 - k_hash_log);
+}
+
+// 15 in a nibble, then 255s and a final byte below 255
+static void put_length(std::string& dst, size_t len) {
+    for (; len >= 255 ; len -= 255) dst += static_cast<char>(255);
+    dst += static_cast<char>(len);
+}
+
+static void put_sequence(std::string& dst, const char* lit, size_t lit_len, size_t offset, size_t match_len) {
+    size_t m = match_len - k_min_match;
+    dst += static_cast<char>(((lit_len < 15 ? lit_len : 15) << 4) | (m < 15 ? m : 15));
+    if (lit_len >= 15) put_length(dst, lit_len - 15);
+    dst.append(lit, lit_len);
+    dst += static_cast<char>(offset & 0xff);
+    dst += static_cast<char>(offset >> 8);
+    if (m >= 15) put_length(dst, m - 15);
+}
+
+void lz_compress(std::string_view src, std::string& dst) {
+    const char* base = src.data();
+    size_t n = src.size();
+    size_t anchor = 0;
+    if (n > k_match_limit) {
+        std::array<uint32_t, 1 << k_hash_log> table;
+        table.fill(UINT32_MAX);
+        size_t limit = n - k_match_limit;
+        size_t i = 0;
+        unsigned misses = 0;
+        while (i < limit) {
+            uint32_t seq = read32(base + i);
+            uint32_t h = hash4(seq);
+            uint32_t cand = table[h];
+            table[h] = static_cast<uint32_t>(i);
+            if (cand == UINT32_MAX || i - cand > k_max_offset || read32(base + cand) != seq) {
+                i += 1 + (misses++ >> k_skip_trigger);
+                continue;
+            }
+            misses = 0;
+            size_t len = k_min_match;
+            size_t max = n - k_last_literals - i;
+            while (len < max && base[cand + len] == base[i + len]) ++len;
+            put_sequence(dst, base + anchor, i - anchor, i - cand, len);
+            i += len;
+            anchor = i;
+        }
+    }
+    size_t lit_len = n - anchor;
+    dst += static_cast<char>((lit_len < 15 ? lit_len : 15) << 4);
+    if (lit_len >= 15) put_length(dst, lit_len - 15);
+    dst.append(base + anchor, lit_len);
+}
+
+// reads the extra bytes of a length, false past the end of the input
+static bool get_length(const uint8_t*& ip, const uint8_t* end, size_t& len) {
+    uint8_t b;
+    do {
+        if (ip == end) return false;
+        b = *ip++;
+        len += b;
+    } while (b == 255);
+    return true;
+}
+
+bool lz_decompress(std::string_view src, char* dst, size_t n) {
+    auto* ip = reinterpret_cast<const uint8_t*>(src.data());
+    auto* end = ip + src.size();
+    char* op = dst;
+    char* oend = dst + n;
+    while (ip < end) {
+        uint8_t token = *ip++;
+        size_t lit_len = token >> 4;
+        if (lit_len == 15 && !get_length(ip, end, lit_len)) return false;
+        if (lit_len > static_cast<size_t>(end - ip) || lit_len > static_cast<size_t>(oend - op)) return false;
+        std::memcpy(op, ip, lit_len);
+        op += lit_len;
+        ip += lit_len;
+        // the last sequence has no match
+        if (ip == end) break;
+        if (end - ip < 2) return false;
+        size_t offset = ip[0] | (static_cast<size_t>(ip[1]) << 8);
+        ip += 2;
+        if (offset == 0 || offset > static_cast<size_t>(op - dst)) return false;
+        size_t len = token & 15;
+        if (len == 15 && !get_length(ip, end, len)) return false;
+        len += k_min_match;
+        if (len > static_cast<size_t>(oend - op)) return false;
+        const char* match = op - offset;
+        if (offset >= len) {
+            std::memcpy(op, match, len);
+        } else {
+            // overlapping : the match repeats what it is producing
+            for (size_t k = 0 ; k < len ; ++k) op[k] = match[k];
+        }
+        op += len;
+    }
+    return op == oend;
+}
+
+} // namespace utils
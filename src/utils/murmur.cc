@@ -0,0 +1,42 @@
+#include "utils/murmur.h"
+
+#include <cstring>
+
+namespace utils {
+
+uint64_t murmur64(std::string_view s, uint64_t seed) {
+    const uint64_t m = 0xc6a4a7935bd1e995ull;
+    const int r = 47;
+    uint64_t h = seed ^ (s.size() * m);
+    auto* data = reinterpret_cast<const unsigned char*>(s.data());
+    const unsigned char* end = data + (s.size() & ~size_t(7));
+    for (; data != end ; data += 8) {
+        uint64_t k;
+        std::memcpy(&k, data, 8);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        k = __builtin_bswap64(k);
+#endif
+        k *= m;
+        k ^= k >> r;
+        k *= m;
+        h ^= k;
+        h *= m;
+    }
+    switch (s.size() & 7) {
+    case 7: h ^= uint64_t(data[6]) << 48; [[fallthrough]];
+    case 6: h ^= uint64_t(data[5]) << 40; [[fallthrough]];
+    case 5: h ^= uint64_t(data[4]) << 32; [[fallthrough]];
+    case 4: h ^= uint64_t(data[3]) << 24; [[fallthrough]];
+    case 3: h ^= uint64_t(data[2]) << 16; [[fallthrough]];
+    case 2: h ^= uint64_t(data[1]) << 8; [[fallthrough]];
+    case 1:
+        h ^= uint64_t(data[0]);
+        h *= m;
+    }
+    h ^= h >> r;
+    h *= m;
+    h ^= h >> r;
+    return h;
+}
+
+} // namespace utils
@@ -0,0 +1,87 @@
+#include "utils/sha256.h"
+
+#include <cstring>
+
+namespace utils {
+
+static constexpr uint32_t k_rounds[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static uint32_t rotr(uint32_t v, int n) {
+    return (v >> n) | (v << (32 - n));
+}
+
+// mixes one 64-byte block into h
+static void compress(uint32_t (&h)[8], const uint8_t* block) {
+    uint32_t w[64];
+    for (int k = 0 ; k < 16 ; ++k) {
+        w[k] = (uint32_t(block[4 * k]) << 24) | (uint32_t(block[4 * k + 1]) << 16)
+             | (uint32_t(block[4 * k + 2]) << 8) | block[4 * k + 3];
+    }
+    for (int k = 16 ; k < 64 ; ++k) {
+        uint32_t s0 = rotr(w[k - 15], 7) ^ rotr(w[k - 15], 18) ^ (w[k - 15] >> 3);
+        uint32_t s1 = rotr(w[k - 2], 17) ^ rotr(w[k - 2], 19) ^ (w[k - 2] >> 10);
+        w[k] = w[k - 16] + s0 + w[k - 7] + s1;
+    }
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4], f = h[5], g = h[6], x = h[7];
+    for (int k = 0 ; k < 64 ; ++k) {
+        uint32_t t1 = x + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + k_rounds[k] + w[k];
+        uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        x = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    h[0] += a; h[1] += b; h[2] += c; h[3] += d;
+    h[4] += e; h[5] += f; h[6] += g; h[7] += x;
+}
+
+Digest sha256(std::string_view s) {
+    uint32_t h[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                     0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+    auto* p = reinterpret_cast<const uint8_t*>(s.data());
+    size_t n = s.size();
+    for (; n >= 64 ; p += 64, n -= 64) compress(h, p);
+    // the rest, a 1 bit, zeroes and the length in bits on the last 8 bytes
+    uint8_t tail[128] = {};
+    std::memcpy(tail, p, n);
+    tail[n] = 0x80;
+    size_t len = n + 9 <= 64 ? 64 : 128;
+    uint64_t bits = static_cast<uint64_t>(s.size()) * 8;
+    for (int k = 0 ; k < 8 ; ++k) tail[len - 1 - k] = static_cast<uint8_t>(bits >> (8 * k));
+    compress(h, tail);
+    if (len == 128) compress(h, tail + 64);
+    Digest d;
+    for (int k = 0 ; k < 8 ; ++k) {
+        d[4 * k] = static_cast<uint8_t>(h[k] >> 24);
+        d[4 * k + 1] = static_cast<uint8_t>(h[k] >> 16);
+        d[4 * k + 2] = static_cast<uint8_t>(h[k] >> 8);
+        d[4 * k + 3] = static_cast<uint8_t>(h[k]);
+    }
+    return d;
+}
+
+std::string hex(const Digest& d) {
+    static constexpr char k_digits[] = "0123456789abcdef";
+    std::string s;
+    s.reserve(2 * d.size());
+    for (uint8_t b : d) {
+        s += k_digits[b >> 4];
+        s += k_digits[b & 15];
+    }
+    return s;
+}
+
+} // namespace utils
@@ -0,0 +1,135 @@
+#include <gtest/gtest.h>
+#include "acl/acl.h"
+#include "utils/sha256.h"
+#include <poll.h>
+#include <sys/socket.h>
+#include <string>
+
+TEST(Sha256Test, KnownDigests) {
+    EXPECT_EQ(utils::hex(utils::sha256("")),
+              "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+    EXPECT_EQ(utils::hex(utils::sha256("abc")),
+              "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+    // two blocks of padding
+    EXPECT_EQ(utils::hex(utils::sha256("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq")),
+              "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1");
+}
+
+class AclTest : public testing::Test {
+protected:
+    void SetUp() override {
+        int sv[2];
+        ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+        _srv = sv[0];
+        _cli = sv[1];
+    }
+
+    void TearDown() override {
+        close(_srv);
+        close(_cli);
+    }
+
+    // what the handshake answers to HELLO 3 with these credentials
+    std::string hello(std::string_view user = {}, std::string_view pass = {}) {
+        net::resp::Hello h;
+        h.version = "3";
+        h.auth = !user.empty();
+        h.user = user;
+        h.pass = pass;
+        return acl.hello(_srv, h);
+    }
+
+    std::string run(net::resp::Command cmd) {
+        if (!acl.handle(_srv, cmd)) {
+            EXPECT_TRUE(table.handle(_srv, cmd));
+        }
+        std::string s;
+        char buf[4096];
+        struct pollfd p = {_cli, POLLIN, 0};
+        while (poll(&p, 1, s.empty() ? 1000 : 0) > 0) {
+            ssize_t rv = read(_cli, buf, sizeof(buf));
+            if (rv <= 0) break;
+            s.append(buf, rv);
+        }
+        return s;
+    }
+
+    store::Keyspace ks;
+    commands::Table table{ks};
+    acl::Acl acl;
+
+private:
+    int _srv = -1;
+    int _cli = -1;
+};
+
+TEST_F(AclTest, DefaultUser) {
+    EXPECT_EQ(hello(), "+OK\r\n");
+    EXPECT_EQ(run({{"SET", "k", "v"}}), "+OK\r\n");
+    EXPECT_EQ(run({{"ACL", "WHOAMI"}}), "$7\r\ndefault\r\n");
+    EXPECT_EQ(run({{"ACL", "LIST"}}), "*1\r\n$31\r\nuser default on nopass ~* +@all\r\n");
+
+    EXPECT_EQ(run({{"ACL", "SETUSER", "default", "resetpass", ">secret"}}), "+OK\r\n");
+    // the connection keeps what it logged in with
+    EXPECT_EQ(run({{"GET", "k"}}), "$1\r\nv\r\n");
+    EXPECT_EQ(run({{"AUTH", "wrong"}}), "-WRONGPASS invalid username-password pair or user is disabled.\r\n");
+    EXPECT_EQ(run({{"AUTH", "secret"}}), "+OK\r\n");
+    EXPECT_EQ(run({{"HELLO", "2"}}), "-NOPROTO unsupported protocol version\r\n");
+    EXPECT_EQ(run({{"HELLO", "3", "AUTH", "default", "secret", "SETNAME", "c"}}), "+OK\r\n");
+}
+
+TEST_F(AclTest, RequiresAuthentication) {
+    acl.setuser("default", {"resetpass", ">secret"});
+    EXPECT_EQ(hello().substr(0, 7), "-NOAUTH");
+    EXPECT_EQ(run({{"GET", "k"}}), "-NOAUTH Authentication required.\r\n");
+    EXPECT_EQ(run({{"NOSUCHCOMMAND"}}), "-NOAUTH Authentication required.\r\n");
+    EXPECT_EQ(hello("default", "wrong").substr(0, 10), "-WRONGPASS");
+    EXPECT_EQ(hello("default", "secret"), "+OK\r\n");
+    EXPECT_EQ(run({{"GET", "k"}}), "_\r\n");
+}
+
+TEST_F(AclTest, CommandsAndKeys) {
+    EXPECT_EQ(hello(), "+OK\r\n");
+    EXPECT_EQ(run({{"ACL", "SETUSER", "reader", "on", ">pw", "~cache:*", "+@read", "-@all"}}),
+              "+OK\r\n");
+    EXPECT_EQ(run({{"ACL", "SETUSER", "reader", "+get", "+mget", "+set", "-ping"}}), "+OK\r\n");
+    EXPECT_EQ(run({{"ACL", "SETUSER", "reader", "+nosuchcommand"}}),
+              "-ERR Error in ACL SETUSER modifier '+nosuchcommand': Syntax error\r\n");
+    EXPECT_EQ(run({{"ACL", "USERS"}}), "*2\r\n$7\r\ndefault\r\n$6\r\nreader\r\n");
+    EXPECT_EQ(run({{"SET", "cache:1", "v"}}), "+OK\r\n");
+
+    EXPECT_EQ(hello("reader", "pw"), "+OK\r\n");
+    EXPECT_EQ(run({{"GET", "cache:1"}}), "$1\r\nv\r\n");
+    EXPECT_EQ(run({{"SET", "cache:2", "w"}}), "+OK\r\n");
+    EXPECT_EQ(run({{"GET", "other"}}), "-NOPERM No permissions to access a key\r\n");
+    EXPECT_EQ(run({{"MGET", "cache:1", "other"}}), "-NOPERM No permissions to access a key\r\n");
+    EXPECT_EQ(run({{"DEL", "cache:1"}}), "-NOPERM User reader has no permissions to run the 'del' command\r\n");
+    EXPECT_EQ(run({{"PING"}}), "-NOPERM User reader has no permissions to run the 'ping' command\r\n");
+    EXPECT_EQ(run({{"ACL", "WHOAMI"}}), "-NOPERM User reader has no permissions to run the 'acl' command\r\n");
+    // spans every key, changes apply from the next login
+    EXPECT_EQ(acl.setuser("reader", {"+dbsize"}), "");
+    EXPECT_EQ(run({{"DBSIZE"}}), "-NOPERM User reader has no permissions to run the 'dbsize' command\r\n");
+    EXPECT_EQ(hello("reader", "pw"), "+OK\r\n");
+    EXPECT_EQ(run({{"DBSIZE"}}), "-NOPERM No permissions to access a key\r\n");
+
+    // off, and gone
+    EXPECT_EQ(acl.setuser("reader", {"off"}), "");
+    EXPECT_EQ(hello("reader", "pw").substr(0, 10), "-WRONGPASS");
+    EXPECT_EQ(hello("default", "any"), "+OK\r\n");
+    EXPECT_EQ(run({{"ACL", "DELUSER", "reader", "nobody"}}), ":1\r\n");
+    EXPECT_EQ(run({{"ACL", "DELUSER", "default"}}), "-ERR The 'default' user cannot be removed\r\n");
+}
+
+TEST_F(AclTest, ListRoundTrips) {
+    EXPECT_EQ(acl.setuser("app", {"on", ">pw", "~a:*", "~b:*", "-@all", "+get", "+set"}), "");
+    EXPECT_EQ(hello(), "+OK\r\n");
+    std::string list = run({{"ACL", "LIST"}});
+    std::string line = "user app on #" + utils::hex(utils::sha256("pw")) + " ~a:* ~b:* -@all +get +set";
+    EXPECT_NE(list.find(line), std::string::npos) << list;
+    // its rules recreate it
+    std::string hash = "#";
+    hash += utils::hex(utils::sha256("pw"));
+    EXPECT_EQ(acl.setuser("copy", {"on", hash, "~a:*"}), "");
+    EXPECT_NE(acl.login("copy", "pw"), nullptr);
+    EXPECT_EQ(acl.login("copy", "nope"), nullptr);
+}
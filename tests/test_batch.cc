@@ -0,0 +1,96 @@
+#include <gtest/gtest.h>
+#include "commands/batch.h"
+#include <string>
+
+using namespace commands;
+
+class BatchTest : public testing::Test {
+protected:
+    std::string run(Args argv) {
+        std::string out;
+        table.call(*table.lookup(argv[0]), argv, out);
+        return out;
+    }
+
+    store::Keyspace ks;
+    Table table{ks};
+    Batches batches{table};
+};
+
+TEST_F(BatchTest, GetComputeSet) {
+    const char* src =
+        "$v = GET KEYS[1]\n"
+        "IF $v\n"
+        "  $n = ADD $v ARGV[1]\n"
+        "ELSE\n"
+        "  $n = ARGV[1]\n"
+        "END\n"
+        "SET KEYS[1] $n\n"
+        "RETURN $n\n";
+    ASSERT_EQ(batches.define("incr_by", src), std::nullopt);
+    EXPECT_EQ(batches.call("incr_by", {"k"}, {"5"}), "$1\r\n5\r\n");
+    EXPECT_EQ(batches.call("incr_by", {"k"}, {"37"}), ":42\r\n");
+    EXPECT_EQ(run({"GET", "k"}), "$2\r\n42\r\n");
+
+    // too few keys or arguments, unknown batch
+    EXPECT_EQ(batches.call("incr_by", {}, {"1"}).substr(0, 4), "-ERR");
+    EXPECT_EQ(batches.call("incr_by", {"k"}, {}).substr(0, 4), "-ERR");
+    EXPECT_EQ(batches.call("nope", {}, {}).substr(0, 4), "-ERR");
+    EXPECT_TRUE(batches.drop("incr_by"));
+    EXPECT_FALSE(batches.drop("incr_by"));
+}
+
+TEST_F(BatchTest, Conditions) {
+    // compare-and-set, ';' separates statements
+    ASSERT_EQ(batches.define("cas",
+        "$v = GET KEYS[1]; IF $v == ARGV[1]; SET KEYS[1] ARGV[2]; RETURN 1; END; RETURN 0"), std::nullopt);
+    run({"SET", "k", "a"});
+    EXPECT_EQ(batches.call("cas", {"k"}, {"b", "c"}), "$1\r\n0\r\n");
+    EXPECT_EQ(batches.call("cas", {"k"}, {"a", "c"}), "$1\r\n1\r\n");
+    EXPECT_EQ(run({"GET", "k"}), "$1\r\nc\r\n");
+
+    ASSERT_EQ(batches.define("cap",
+        "$n = INCR KEYS[1]\nIF $n > ARGV[1]\n DECR KEYS[1]\n RETURN \"over limit\"\nEND"), std::nullopt);
+    EXPECT_EQ(batches.call("cap", {"c"}, {"2"}), ":1\r\n");
+    EXPECT_EQ(batches.call("cap", {"c"}, {"2"}), ":2\r\n");
+    EXPECT_EQ(batches.call("cap", {"c"}, {"2"}), "$10\r\nover limit\r\n");
+    EXPECT_EQ(run({"GET", "c"}), "$1\r\n2\r\n");
+}
+
+TEST_F(BatchTest, Errors) {
+    auto compile_error = [&] (const char* src) {
+        return batches.define("b", src).has_value();
+    };
+    EXPECT_TRUE(compile_error("NOPE KEYS[1]"));
+    EXPECT_TRUE(compile_error("GET k"));
+    EXPECT_TRUE(compile_error("GET KEYS[1] extra"));
+    EXPECT_TRUE(compile_error("FLUSHALL"));
+    EXPECT_TRUE(compile_error("IF $a\nGET KEYS[1]"));
+    EXPECT_TRUE(compile_error("ELSE"));
+    EXPECT_TRUE(compile_error("END"));
+    EXPECT_TRUE(compile_error("IF $a ~ 1\nEND"));
+    EXPECT_TRUE(compile_error("ADD 1 2"));
+    EXPECT_TRUE(compile_error("SET KEYS[1] \"open"));
+    EXPECT_EQ(batches.define("b", "IF $a\nELSE\nEND").value_or(""), "");
+
+    // a failing command stops the batch, earlier writes stay
+    ASSERT_EQ(batches.define("b", "SET KEYS[1] x\nINCR KEYS[1]\nSET KEYS[1] y"), std::nullopt);
+    EXPECT_EQ(batches.call("b", {"k"}, {}), "-ERR value is not an integer or out of range\r\n");
+    EXPECT_EQ(run({"GET", "k"}), "$1\r\nx\r\n");
+
+    ASSERT_EQ(batches.define("b", "$v = GET KEYS[1]\n$n = ADD $v 1"), std::nullopt);
+    EXPECT_EQ(batches.call("b", {"k"}, {}).substr(0, 4), "-ERR");
+    ASSERT_EQ(batches.define("b", "$v = GET KEYS[1]\nSET KEYS[2] $v"), std::nullopt);
+    EXPECT_EQ(batches.call("b", {"missing", "k"}, {}).substr(0, 4), "-ERR");
+}
+
+TEST_F(BatchTest, MultiKey) {
+    // keys on several shards are locked together, aggregates pass through
+    ASSERT_EQ(batches.define("swap",
+        "$a = GET KEYS[1]\n$b = GET KEYS[2]\nSET KEYS[1] $b\nSET KEYS[2] $a\nMGET KEYS[1] KEYS[2]"), std::nullopt);
+    run({"MSET", "x", "1", "y", "2"});
+    EXPECT_EQ(batches.call("swap", {"x", "y"}, {}), "*2\r\n$1\r\n2\r\n$1\r\n1\r\n");
+
+    ASSERT_EQ(batches.define("raw", "$r = MGET KEYS[1]\nRETURN $r"), std::nullopt);
+    EXPECT_EQ(batches.call("raw", {"x"}, {}), "*1\r\n$1\r\n2\r\n");
+}
@@ -0,0 +1,274 @@
+#include <gtest/gtest.h>
+#include "commands/blocking.h"
+#include "datastructures/timer_wheel.h"
+#include <poll.h>
+#include <sys/socket.h>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+TEST(TimerWheelTest, FiresInDeadlineOrder) {
+    data::TimerWheel<int> wheel(1000);
+    std::vector<int> fired;
+    auto fire = [&] (int v) { fired.push_back(v); };
+    wheel.add(1005, 1);
+    wheel.add(1002, 2);
+    // more than a turn of the wheel away
+    wheel.add(1000 + 5000, 3);
+    auto cancelled = wheel.add(1003, 4);
+    EXPECT_EQ(wheel.size(), 4u);
+    EXPECT_TRUE(wheel.cancel(cancelled));
+    EXPECT_FALSE(wheel.cancel(cancelled));
+    EXPECT_EQ(wheel.next(), 1002u);
+
+    wheel.advance(1003, fire);
+    EXPECT_EQ(fired, std::vector<int>({2}));
+    wheel.advance(1010, fire);
+    EXPECT_EQ(fired, std::vector<int>({2, 1}));
+    // its slot came round, not its deadline
+    wheel.advance(1000 + 4096 + 10, fire);
+    EXPECT_EQ(fired, std::vector<int>({2, 1}));
+    wheel.advance(1000 + 5000, fire);
+    EXPECT_EQ(fired, std::vector<int>({2, 1, 3}));
+    EXPECT_EQ(wheel.size(), 0u);
+    EXPECT_EQ(wheel.next(), wheel.k_never);
+}
+
+TEST(TimerWheelTest, PastDeadlinesFireNext) {
+    data::TimerWheel<int> wheel(1000);
+    int fired = 0;
+    auto id = wheel.add(10, 7);
+    EXPECT_EQ(wheel.next(), 1001u);
+    wheel.advance(1001, [&] (int v) { fired = v; });
+    EXPECT_EQ(fired, 7);
+    // the slab slot is reused, the old id stays dead
+    auto other = wheel.add(2000, 8);
+    EXPECT_NE(id, other);
+    EXPECT_FALSE(wheel.cancel(id));
+    EXPECT_TRUE(wheel.cancel(other));
+}
+
+class BlockingTest : public testing::Test {
+protected:
+    void SetUp() override {
+        for (auto& c : _clients) {
+            int sv[2];
+            ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+            c = {sv[0], sv[1]};
+        }
+    }
+
+    void TearDown() override {
+        for (auto& [srv, cli] : _clients) {
+            close(srv);
+            if (cli >= 0) close(cli);
+        }
+    }
+
+    // runs argv as client k, parking the calling thread if it blocks
+    void send(int k, net::resp::Command cmd) {
+        ASSERT_TRUE(blocking.handle(_clients[k].first, cmd).run());
+    }
+
+    // waits up to a second for client k's reply
+    std::string reply(int k) {
+        std::string s;
+        char buf[4096];
+        struct pollfd p = {_clients[k].second, POLLIN, 0};
+        int wait = 1000;
+        while (poll(&p, 1, wait) > 0) {
+            ssize_t rv = read(_clients[k].second, buf, sizeof(buf));
+            if (rv <= 0) break;
+            s.append(buf, rv);
+            wait = 0;
+        }
+        return s;
+    }
+
+    std::string run(commands::Args argv) {
+        std::string out;
+        table.call(*table.lookup(argv[0]), argv, out);
+        return out;
+    }
+
+    void wait_blocked(size_t n) {
+        while (blocking.blocked() != n) std::this_thread::yield();
+    }
+
+    void hang_up(int k) {
+        close(_clients[k].second);
+        _clients[k].second = -1;
+    }
+
+    store::Keyspace ks;
+    commands::Table table{ks};
+    commands::Blocking blocking{table};
+
+private:
+    std::pair<int, int> _clients[3];
+};
+
+TEST_F(BlockingTest, PopsRightAway) {
+    EXPECT_EQ(run({"RPUSH", "l", "a", "b"}), ":2\r\n");
+    send(0, {{"BLPOP", "nope", "l", "0"}});
+    EXPECT_EQ(reply(0), "*2\r\n$1\r\nl\r\n$1\r\na\r\n");
+    send(0, {{"BRPOP", "l", "1.5"}});
+    EXPECT_EQ(reply(0), "*2\r\n$1\r\nl\r\n$1\r\nb\r\n");
+    EXPECT_EQ(run({"EXISTS", "l"}), ":0\r\n");
+
+    EXPECT_EQ(run({"SET", "s", "v"}), "+OK\r\n");
+    send(0, {{"BLPOP", "s", "0"}});
+    EXPECT_EQ(reply(0), "-WRONGTYPE Operation against a key holding the wrong kind of value\r\n");
+    send(0, {{"BLPOP", "l", "-1"}});
+    EXPECT_EQ(reply(0), "-ERR timeout is negative\r\n");
+    send(0, {{"BLPOP", "l", "soon"}});
+    EXPECT_EQ(reply(0), "-ERR timeout is not a float or out of range\r\n");
+    send(0, {{"BLPOP", "l"}});
+    EXPECT_EQ(reply(0), "-ERR wrong number of arguments for 'BLPOP' command\r\n");
+    EXPECT_EQ(blocking.blocked(), 0u);
+}
+
+TEST_F(BlockingTest, ServesInArrivalOrder) {
+    std::thread first([&] { send(0, {{"BLPOP", "q", "other", "0"}}); });
+    wait_blocked(1);
+    std::thread second([&] { send(1, {{"BLPOP", "q", "0"}}); });
+    wait_blocked(2);
+
+    // a write to an unrelated key wakes nobody
+    EXPECT_EQ(run({"RPUSH", "unrelated", "z"}), ":1\r\n");
+    EXPECT_EQ(blocking.blocked(), 2u);
+
+    EXPECT_EQ(run({"RPUSH", "q", "x", "y", "z"}), ":3\r\n");
+    first.join();
+    second.join();
+    EXPECT_EQ(reply(0), "*2\r\n$1\r\nq\r\n$1\r\nx\r\n");
+    EXPECT_EQ(reply(1), "*2\r\n$1\r\nq\r\n$1\r\ny\r\n");
+    EXPECT_EQ(run({"LRANGE", "q", "0", "-1"}), "*1\r\n$1\r\nz\r\n");
+    EXPECT_EQ(blocking.blocked(), 0u);
+}
+
+TEST_F(BlockingTest, TimesOut) {
+    auto start = std::chrono::steady_clock::now();
+    send(0, {{"BLPOP", "q", "0.05"}});
+    EXPECT_GE(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(50));
+    EXPECT_EQ(reply(0), "_\r\n");
+    EXPECT_EQ(blocking.blocked(), 0u);
+    // the timed out client left no trace in the queue
+    EXPECT_EQ(run({"RPUSH", "q", "x"}), ":1\r\n");
+    EXPECT_EQ(run({"LLEN", "q"}), ":1\r\n");
+}
+
+TEST_F(BlockingTest, MovesOnWake) {
+    std::thread client([&] { send(0, {{"BLMOVE", "src", "dst", "RIGHT", "LEFT", "0"}}); });
+    wait_blocked(1);
+    EXPECT_EQ(run({"LPUSH", "src", "a", "b"}), ":2\r\n");
+    client.join();
+    EXPECT_EQ(reply(0), "$1\r\na\r\n");
+    EXPECT_EQ(run({"LRANGE", "src", "0", "-1"}), "*1\r\n$1\r\nb\r\n");
+    EXPECT_EQ(run({"LRANGE", "dst", "0", "-1"}), "*1\r\n$1\r\na\r\n");
+
+    send(0, {{"BLMOVE", "src", "dst", "UP", "LEFT", "0"}});
+    EXPECT_EQ(reply(0), "-ERR syntax error\r\n");
+}
+
+TEST_F(BlockingTest, MovesUnderBothLocks) {
+    // the element moved wakes the client waiting on the destination
+    std::thread popper([&] { send(1, {{"BLPOP", "dst", "0"}}); });
+    wait_blocked(1);
+    std::thread mover([&] { send(0, {{"BLMOVE", "src", "dst", "LEFT", "RIGHT", "0"}}); });
+    wait_blocked(2);
+    EXPECT_EQ(run({"RPUSH", "src", "a"}), ":1\r\n");
+    mover.join();
+    popper.join();
+    EXPECT_EQ(reply(0), "$1\r\na\r\n");
+    EXPECT_EQ(reply(1), "*2\r\n$3\r\ndst\r\n$1\r\na\r\n");
+
+    // nothing leaves the source for a destination of the wrong type
+    EXPECT_EQ(run({"SET", "str", "x"}), "+OK\r\n");
+    std::thread wrong([&] { send(0, {{"BLMOVE", "src", "str", "LEFT", "RIGHT", "0"}}); });
+    wait_blocked(1);
+    EXPECT_EQ(run({"RPUSH", "src", "b"}), ":1\r\n");
+    wrong.join();
+    EXPECT_EQ(reply(0), "-WRONGTYPE Operation against a key holding the wrong kind of value\r\n");
+    EXPECT_EQ(run({"LRANGE", "src", "0", "-1"}), "*1\r\n$1\r\nb\r\n");
+    EXPECT_EQ(run({"DEL", "src"}), ":1\r\n");
+
+    // the destination's shard is busy when the source fills : the client
+    // moves the element once it is free
+    auto shard = [] (const std::string& key) {
+        return store::Keyspace::shard_index(store::Keyspace::hash(key));
+    };
+    std::string dst = "to";
+    for (int k = 0 ; shard(dst) >= shard("src") ; ++k) dst = "to" + std::to_string(k);
+    std::thread busy([&] { send(0, {{"BLMOVE", "src", dst, "LEFT", "RIGHT", "0"}}); });
+    wait_blocked(1);
+    uint64_t bit = uint64_t(1) << shard(dst);
+    table.lock(bit);
+    std::thread writer([&] { run({"RPUSH", "src", "c"}); });
+    writer.join();
+    table.unlock(bit);
+    busy.join();
+    EXPECT_EQ(reply(0), "$1\r\nc\r\n");
+    EXPECT_EQ(run({"LRANGE", dst, "0", "-1"}), "*1\r\n$1\r\nc\r\n");
+    EXPECT_EQ(run({"EXISTS", "src"}), ":0\r\n");
+    EXPECT_EQ(blocking.blocked(), 0u);
+}
+
+TEST_F(BlockingTest, ForgetsClientsThatHangUp) {
+    std::thread client([&] { send(2, {{"BLPOP", "q", "0"}}); });
+    wait_blocked(1);
+    hang_up(2);
+    client.join();
+    EXPECT_EQ(blocking.blocked(), 0u);
+    EXPECT_EQ(run({"RPUSH", "q", "x"}), ":1\r\n");
+    EXPECT_EQ(run({"LLEN", "q"}), ":1\r\n");
+}
+
+TEST_F(BlockingTest, StreamReadersWakeOnAdd) {
+    EXPECT_EQ(run({"XADD", "s", "1-1", "f", "old"}), "$3\r\n1-1\r\n");
+    // nothing to wait for : the table answers
+    EXPECT_FALSE(blocking.handle(-1, {{"XREAD", "STREAMS", "s", "0"}}).run());
+    send(0, {{"XREAD", "BLOCK", "0", "STREAMS", "s", "0"}});
+    EXPECT_EQ(reply(0), "%1\r\n$1\r\ns\r\n*1\r\n*2\r\n$3\r\n1-1\r\n*2\r\n$1\r\nf\r\n$3\r\nold\r\n");
+
+    std::thread first([&] { send(0, {{"XREAD", "BLOCK", "0", "STREAMS", "s", "$"}}); });
+    wait_blocked(1);
+    std::thread second([&] { send(1, {{"XREAD", "COUNT", "5", "BLOCK", "0", "STREAMS", "other", "s", "$", "1-1"}}); });
+    wait_blocked(2);
+    // a write that adds nothing : they read again, and park again
+    EXPECT_EQ(run({"XTRIM", "s", "MAXLEN", "5"}), ":0\r\n");
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    wait_blocked(2);
+
+    EXPECT_EQ(run({"XADD", "s", "2-1", "f", "new"}), "$3\r\n2-1\r\n");
+    first.join();
+    second.join();
+    std::string added = "%1\r\n$1\r\ns\r\n*1\r\n*2\r\n$3\r\n2-1\r\n*2\r\n$1\r\nf\r\n$3\r\nnew\r\n";
+    EXPECT_EQ(reply(0), added);
+    EXPECT_EQ(reply(1), added);
+    EXPECT_EQ(blocking.blocked(), 0u);
+}
+
+TEST_F(BlockingTest, StreamGroupsBlockAndTimeOut) {
+    EXPECT_EQ(run({"XGROUP", "CREATE", "s", "g", "$", "MKSTREAM"}), "+OK\r\n");
+    auto start = std::chrono::steady_clock::now();
+    send(0, {{"XREADGROUP", "GROUP", "g", "alice", "BLOCK", "50", "STREAMS", "s", ">"}});
+    EXPECT_GE(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(50));
+    EXPECT_EQ(reply(0), "_\r\n");
+
+    std::thread client([&] { send(0, {{"XREADGROUP", "GROUP", "g", "alice", "BLOCK", "0", "STREAMS", "s", ">"}}); });
+    wait_blocked(1);
+    EXPECT_EQ(run({"XADD", "s", "5-0", "f", "v"}), "$3\r\n5-0\r\n");
+    client.join();
+    EXPECT_EQ(reply(0), "%1\r\n$1\r\ns\r\n*1\r\n*2\r\n$3\r\n5-0\r\n*2\r\n$1\r\nf\r\n$1\r\nv\r\n");
+    EXPECT_EQ(run({"XPENDING", "s", "g"}), "*4\r\n:1\r\n$3\r\n5-0\r\n$3\r\n5-0\r\n*1\r\n*2\r\n$5\r\nalice\r\n$1\r\n1\r\n");
+    // a consumer's history never blocks
+    EXPECT_FALSE(blocking.handle(-1, {{"XREADGROUP", "GROUP", "g", "alice", "BLOCK", "0", "STREAMS", "s", "0"}}).run());
+
+    std::thread gone([&] { send(2, {{"XREAD", "BLOCK", "0", "STREAMS", "s", "$"}}); });
+    wait_blocked(1);
+    hang_up(2);
+    gone.join();
+    EXPECT_EQ(blocking.blocked(), 0u);
+}
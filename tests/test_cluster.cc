@@ -0,0 +1,212 @@
+#include <gtest/gtest.h>
+#include "cluster/cluster.h"
+#include "commands/batch.h"
+#include "commands/blocking.h"
+#include "commands/transaction.h"
+#include "utils/crc16.h"
+#include <poll.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <chrono>
+#include <string>
+#include <thread>
+
+// 127.0.0.1
+#define IP        ntohl(INADDR_LOOPBACK)
+#define K_MAX_MSG 4096
+
+static const unsigned short k_ports[] = {1340, 1341};
+
+TEST(ClusterSlots, KeySlot) {
+    EXPECT_EQ(utils::crc16("123456789"), 0x31c3);
+    EXPECT_EQ(cluster::key_slot("foo"), 12182);
+    EXPECT_EQ(cluster::key_slot("bar"), 5061);
+    EXPECT_EQ(cluster::key_slot("{user1000}.following"), cluster::key_slot("{user1000}.followers"));
+    EXPECT_EQ(cluster::key_slot("foo{bar}{zap}"), cluster::key_slot("bar"));
+    EXPECT_EQ(cluster::key_slot("foo{{bar}}zap"), cluster::key_slot("{bar"));
+    // an empty tag does not count
+    EXPECT_EQ(cluster::key_slot("foo{}{bar}"), utils::crc16("foo{}{bar}") % 16384);
+}
+
+// every node runs in its own process on localhost
+class ClusterTest : public testing::Test {
+protected:
+    void SetUp() override {
+        for (size_t k = 0 ; k < 2 ; ++k) {
+            _nodes[k] = fork();
+            ASSERT_GE(_nodes[k], 0);
+            if (_nodes[k] == 0) {
+                signal(SIGPIPE, SIG_IGN);
+                net::resp::Redis redis(IP, htons(k_ports[k]), K_MAX_MSG);
+                store::Keyspace ks;
+                commands::Table table(ks);
+                table.attach(redis);
+                commands::Blocking blocking(table);
+                blocking.attach(redis);
+                cluster::Cluster cl(table, "127.0.0.1", k_ports[k], std::chrono::milliseconds(20));
+                cl.attach(redis);
+                commands::Batches batches(table);
+                batches.attach(redis);
+                commands::Transactions txs(table);
+                txs.attach(redis);
+                redis.accept_all();
+                _exit(0);
+            }
+        }
+    }
+
+    void TearDown() override {
+        for (auto pid : _nodes) {
+            kill(pid, SIGKILL);
+            waitpid(pid, nullptr, 0);
+        }
+    }
+
+    // a connection to node k, past the handshake
+    int client(size_t k) {
+        for (int tries = 0 ; tries < 100 ; ++tries) {
+            int fd = net::dial("127.0.0.1", k_ports[k]);
+            if (fd >= 0) {
+                EXPECT_EQ(send(fd, "HELLO 3\r\n"), "+OK\r\n");
+                return fd;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        ADD_FAILURE() << "node not reachable";
+        return -1;
+    }
+
+    // writes req and returns what arrives until the line goes quiet
+    static std::string send(int fd, const std::string& req) {
+        net::write_stream(fd, req.data(), req.size());
+        std::string s;
+        char buf[4096];
+        struct pollfd p = {fd, POLLIN, 0};
+        int timeout = 1000;
+        while (poll(&p, 1, timeout) > 0) {
+            ssize_t rv = read(fd, buf, sizeof(buf));
+            if (rv <= 0) break;
+            s.append(buf, rv);
+            timeout = 20;
+        }
+        return s;
+    }
+
+private:
+    pid_t _nodes[2] = {-1, -1};
+};
+
+TEST_F(ClusterTest, Redirections) {
+    int a = client(0), b = client(1);
+    ASSERT_GE(a, 0);
+    ASSERT_GE(b, 0);
+    EXPECT_EQ(send(a, "SET foo 1\r\n"), "-CLUSTERDOWN Hash slot not served\r\n");
+    EXPECT_EQ(send(a, "CLUSTER ADDSLOTSRANGE 0 8191\r\n"), "+OK\r\n");
+    EXPECT_EQ(send(b, "CLUSTER ADDSLOTSRANGE 8192 16383\r\n"), "+OK\r\n");
+    EXPECT_EQ(send(b, "CLUSTER ADDSLOTS 8192\r\n"), "-ERR Slot 8192 is already busy\r\n");
+    EXPECT_EQ(send(a, "CLUSTER MEET 127.0.0.1 1341\r\n"), "+OK\r\n");
+
+    // both nodes learn about each other's slots through gossip
+    std::string expected = "*2\r\n";
+    for (int k = 0 ; k < 200 ; ++k) {
+        if (send(a, "CLUSTER SLOTS\r\n").substr(0, 4) == expected
+            && send(b, "CLUSTER SLOTS\r\n").substr(0, 4) == expected) break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    std::string b_id = send(b, "CLUSTER MYID\r\n").substr(5, 40);
+    std::string slots = send(a, "CLUSTER SLOTS\r\n");
+    EXPECT_EQ(slots.substr(0, 4), expected);
+    EXPECT_NE(slots.find(b_id), std::string::npos);
+    EXPECT_NE(send(a, "CLUSTER SHARDS\r\n").find(b_id), std::string::npos);
+
+    EXPECT_EQ(send(a, "CLUSTER KEYSLOT foo\r\n"), ":12182\r\n");
+    EXPECT_EQ(send(a, "SET foo 1\r\n"), "-MOVED 12182 127.0.0.1:1341\r\n");
+    EXPECT_EQ(send(b, "SET foo 1\r\n"), "+OK\r\n");
+    EXPECT_EQ(send(a, "SET bar 2\r\n"), "+OK\r\n");
+    EXPECT_EQ(send(b, "GET bar\r\n"), "-MOVED 5061 127.0.0.1:1340\r\n");
+    EXPECT_EQ(send(a, "MSET bar 1 foo 2\r\n"), "-CROSSSLOT Keys in request don't hash to the same slot\r\n");
+    EXPECT_EQ(send(a, "MSET {bar}x 1 bar 3\r\n"), "+OK\r\n");
+
+    // ASK while a slot moves : missing keys are served by the importing node
+    std::string a_id = send(a, "CLUSTER MYID\r\n").substr(5, 40);
+    EXPECT_EQ(send(b, "CLUSTER SETSLOT 5061 IMPORTING " + a_id + "\r\n"), "+OK\r\n");
+    EXPECT_EQ(send(a, "CLUSTER SETSLOT 5061 MIGRATING " + b_id + "\r\n"), "+OK\r\n");
+    EXPECT_EQ(send(a, "GET bar\r\n"), "$1\r\n3\r\n");
+    EXPECT_EQ(send(a, "GET {bar}new\r\n"), "-ASK 5061 127.0.0.1:1341\r\n");
+    EXPECT_EQ(send(a, "MGET bar {bar}new\r\n"), "-TRYAGAIN Multiple keys request during rehashing of slot\r\n");
+    EXPECT_EQ(send(b, "GET {bar}new\r\n"), "-MOVED 5061 127.0.0.1:1340\r\n");
+    EXPECT_EQ(send(b, "ASKING\r\n"), "+OK\r\n");
+    EXPECT_EQ(send(b, "GET {bar}new\r\n"), "_\r\n");
+    EXPECT_EQ(send(a, "CLUSTER SETSLOT 5061 STABLE\r\n"), "+OK\r\n");
+    EXPECT_EQ(send(b, "CLUSTER SETSLOT 5061 STABLE\r\n"), "+OK\r\n");
+    close(a);
+    close(b);
+}
+
+TEST_F(ClusterTest, MoveSlot) {
+    int a = client(0), b = client(1);
+    ASSERT_GE(a, 0);
+    ASSERT_GE(b, 0);
+    EXPECT_EQ(send(a, "CLUSTER ADDSLOTSRANGE 0 8191\r\n"), "+OK\r\n");
+    EXPECT_EQ(send(b, "CLUSTER ADDSLOTSRANGE 8192 16383\r\n"), "+OK\r\n");
+    EXPECT_EQ(send(b, "CLUSTER MEET 127.0.0.1 1340\r\n"), "+OK\r\n");
+    std::string b_id = send(b, "CLUSTER MYID\r\n").substr(5, 40);
+    for (int k = 0 ; k < 200 && send(a, "CLUSTER NODES\r\n").find(b_id) == std::string::npos ; ++k) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    std::string sets;
+    for (int k = 0 ; k < 250 ; ++k) {
+        sets += "SET {bar}" + std::to_string(k) + " " + std::to_string(k) + "\r\n";
+    }
+    std::string replies = send(a, sets), ok;
+    for (int k = 0 ; k < 250 ; ++k) ok += "+OK\r\n";
+    for (int k = 0 ; k < 100 && replies.size() < ok.size() ; ++k) replies += send(a, "");
+    EXPECT_EQ(replies, ok);
+    EXPECT_EQ(send(a, "SET baz other\r\n"), "+OK\r\n");
+    EXPECT_EQ(send(a, "CLUSTER COUNTKEYSINSLOT 5061\r\n"), ":250\r\n");
+    EXPECT_EQ(send(a, "CLUSTER MOVESLOT 5061 " + b_id + " 64\r\n"), ":250\r\n");
+
+    EXPECT_EQ(send(a, "CLUSTER COUNTKEYSINSLOT 5061\r\n"), ":0\r\n");
+    EXPECT_EQ(send(b, "CLUSTER COUNTKEYSINSLOT 5061\r\n"), ":250\r\n");
+    EXPECT_EQ(send(a, "GET {bar}42\r\n"), "-MOVED 5061 127.0.0.1:1341\r\n");
+    EXPECT_EQ(send(b, "GET {bar}42\r\n"), "$2\r\n42\r\n");
+    EXPECT_EQ(send(a, "GET baz\r\n"), "$5\r\nother\r\n");
+    EXPECT_EQ(send(b, "CLUSTER GETKEYSINSLOT 5061 1\r\n").substr(0, 4), "*1\r\n");
+
+    // the new owner bumped its config epoch so that its claim wins
+    EXPECT_NE(send(b, "CLUSTER NODES\r\n").find("myself,master - 0 0 1 connected 5061 8192-16383"),
+              std::string::npos);
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    // 0-5060, 5061, 5062-8191 and 8192-16383
+    EXPECT_EQ(send(a, "CLUSTER SLOTS\r\n").substr(0, 4), "*4\r\n");
+    close(a);
+    close(b);
+}
+
+TEST_F(ClusterTest, GuardsEveryEntryPoint) {
+    int a = client(0);
+    ASSERT_GE(a, 0);
+    EXPECT_EQ(send(a, "CLUSTER ADDSLOTSRANGE 0 8191\r\n"), "+OK\r\n");
+    const std::string down = "-CLUSTERDOWN Hash slot not served\r\n";
+    const std::string cross = "-CROSSSLOT Keys in request don't hash to the same slot\r\n";
+
+    // refused when queued, as Redis does, and the whole transaction with it
+    EXPECT_EQ(send(a, "MULTI\r\n"), "+OK\r\n");
+    EXPECT_EQ(send(a, "SET bar 1\r\n"), "+QUEUED\r\n");
+    EXPECT_EQ(send(a, "SET foo 1\r\n"), down);
+    EXPECT_EQ(send(a, "EXEC\r\n"), "-EXECABORT Transaction discarded because of previous errors.\r\n");
+    EXPECT_EQ(send(a, "GET bar\r\n"), "_\r\n");
+
+    EXPECT_EQ(send(a, "*3\r\n$12\r\nBATCH.DEFINE\r\n$1\r\nb\r\n$19\r\nSET KEYS[1] ARGV[1]\r\n"), "+OK\r\n");
+    EXPECT_EQ(send(a, "BATCH.CALL b 1 foo 1\r\n"), down);
+    EXPECT_EQ(send(a, "BATCH.CALL b 2 bar {bar}x 1\r\n"), "+OK\r\n");
+    EXPECT_EQ(send(a, "BATCH.CALL b 2 bar baz 1\r\n"), cross);
+
+    // before parking, a client waiting on another node's key would wait forever
+    EXPECT_EQ(send(a, "BLPOP foo 0\r\n"), down);
+    EXPECT_EQ(send(a, "BLMOVE bar baz LEFT LEFT 0\r\n"), cross);
+    EXPECT_EQ(send(a, "XREAD BLOCK 0 STREAMS foo $\r\n"), down);
+    EXPECT_EQ(send(a, "BLPOP bar 0.01\r\n"), "-WRONGTYPE Operation against a key holding the wrong kind of value\r\n");
+    close(a);
+}
@@ -0,0 +1,105 @@
+#include <gtest/gtest.h>
+#include "commands/table.h"
+#include "store/cold_store.h"
+#include <unistd.h>
+#include <memory>
+#include <string>
+
+class ColdStoreTest : public testing::Test {
+protected:
+    void TearDown() override {
+        cold.reset();
+        unlink(path().c_str());
+    }
+
+    static std::string path() {
+        return "/tmp/ridics_cold_" + std::to_string(getpid());
+    }
+
+    // sweeps only run when the test says so
+    void open(size_t min_size, int64_t idle_ms) {
+        store::ColdStore::Options opts;
+        opts.path = path();
+        opts.min_size = min_size;
+        opts.idle_ms = idle_ms;
+        opts.sweep_ms = 3600 * 1000;
+        cold = std::make_unique<store::ColdStore>(ks, table.timers(), opts);
+    }
+
+    std::string run(commands::Args argv) {
+        std::string out;
+        table.call(*table.lookup(argv[0]), argv, out);
+        return out;
+    }
+
+    bool is_cold(const std::string& key) {
+        auto& map = ks.shard_of(key).map;
+        auto it = map.find(key);
+        return it != map.end() && std::holds_alternative<store::Cold>(it->second.value);
+    }
+
+    store::Keyspace ks;
+    commands::Table table{ks};
+    std::unique_ptr<store::ColdStore> cold;
+};
+
+TEST_F(ColdStoreTest, MovesLargeValuesOut) {
+    open(64 * 1024, 3600 * 1000);
+    std::string big(100 * 1024, 'b');
+    big[4242] = 'x';
+    std::string medium(1024, 'm');
+    EXPECT_EQ(run({"SET", "big", big}), "+OK\r\n");
+    EXPECT_EQ(run({"SET", "medium", medium}), "+OK\r\n");
+    EXPECT_EQ(run({"RPUSH", "list", big}), ":1\r\n");
+
+    EXPECT_EQ(cold->sweep(), big.size());
+    EXPECT_TRUE(is_cold("big"));
+    EXPECT_FALSE(is_cold("medium"));
+    EXPECT_EQ(cold->values(), 1u);
+    EXPECT_EQ(cold->bytes(), big.size());
+
+    // snapshots read it from the log as is
+    std::string seen;
+    commands::recreate("big", ks.shard_of("big").map.find("big")->second.value, -1,
+                       [&] (const commands::Args& argv) { seen = argv[2]; });
+    EXPECT_EQ(seen, big);
+    EXPECT_TRUE(is_cold("big"));
+
+    // read back transparently, and hot again
+    EXPECT_EQ(run({"STRLEN", "big"}), ":102400\r\n");
+    EXPECT_FALSE(is_cold("big"));
+    EXPECT_EQ(cold->values(), 0u);
+    EXPECT_EQ(run({"GET", "big"}), "$102400\r\n" + big + "\r\n");
+
+    // until the next sweep
+    EXPECT_EQ(cold->sweep(), big.size());
+    EXPECT_EQ(run({"APPEND", "big", "!"}), ":102401\r\n");
+    EXPECT_EQ(run({"GET", "big"}), "$102401\r\n" + big + "!\r\n");
+}
+
+TEST_F(ColdStoreTest, MovesIdleValuesOut) {
+    open(64 * 1024, 0);
+    std::string medium(1024, 'm');
+    EXPECT_EQ(run({"SET", "a", medium}), "+OK\r\n");
+    EXPECT_EQ(run({"SET", "b", medium}), "+OK\r\n");
+    EXPECT_EQ(run({"SET", "c", medium}), "+OK\r\n");
+    EXPECT_EQ(run({"SET", "tiny", "v"}), "+OK\r\n");
+    EXPECT_EQ(cold->sweep(), 3 * medium.size());
+    EXPECT_FALSE(is_cold("tiny"));
+    EXPECT_EQ(cold->values(), 3u);
+
+    // overwritten or deleted without being read back
+    EXPECT_EQ(run({"SET", "a", "new"}), "+OK\r\n");
+    EXPECT_EQ(run({"DEL", "b"}), ":1\r\n");
+    EXPECT_EQ(cold->values(), 1u);
+    EXPECT_EQ(run({"GET", "a"}), "$3\r\nnew\r\n");
+    EXPECT_EQ(run({"TYPE", "c"}), "+string\r\n");
+
+    EXPECT_EQ(cold->sweep(), medium.size());
+    EXPECT_EQ(run({"FLUSHALL"}), "+OK\r\n");
+    EXPECT_EQ(cold->values(), 0u);
+    EXPECT_EQ(cold->bytes(), 0u);
+    EXPECT_EQ(run({"SET", "d", medium}), "+OK\r\n");
+    EXPECT_EQ(cold->sweep(), medium.size());
+    EXPECT_EQ(run({"GET", "d"}), "$1024\r\n" + medium + "\r\n");
+}
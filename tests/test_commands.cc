@@ -0,0 +1,362 @@
+#include <gtest/gtest.h>
+#include "commands/table.h"
+#include "commands/transaction.h"
+#include <poll.h>
+#include <sys/socket.h>
+#include <chrono>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace commands;
+
+class CommandsTest : public testing::Test {
+protected:
+    void SetUp() override {
+        for (auto& c : _clients) {
+            int sv[2];
+            ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+            c = {sv[0], sv[1]};
+        }
+    }
+
+    void TearDown() override {
+        for (auto& [srv, cli] : _clients) {
+            close(srv);
+            close(cli);
+        }
+    }
+
+    // sends argv as client k and returns the reply
+    std::string run(int k, net::resp::Command cmd) {
+        int srv = _clients[k].first;
+        if (!txs.handle(srv, cmd) && !table.handle(srv, cmd)) return "<unhandled>";
+        std::string s;
+        char buf[4096];
+        struct pollfd p = {_clients[k].second, POLLIN, 0};
+        while (poll(&p, 1, 0) > 0) {
+            ssize_t rv = read(_clients[k].second, buf, sizeof(buf));
+            if (rv <= 0) break;
+            s.append(buf, rv);
+        }
+        return s;
+    }
+
+    store::Keyspace ks;
+    Table table{ks};
+    Transactions txs{table};
+
+private:
+    std::pair<int, int> _clients[2];
+};
+
+TEST_F(CommandsTest, Strings) {
+    EXPECT_EQ(run(0, {{"PING"}}), "+PONG\r\n");
+    EXPECT_EQ(run(0, {{"get", "k"}}), "_\r\n");
+    EXPECT_EQ(run(0, {{"SET", "k", "v"}}), "+OK\r\n");
+    EXPECT_EQ(run(0, {{"GET", "k"}}), "$1\r\nv\r\n");
+    EXPECT_EQ(run(0, {{"SET", "k", "w", "NX"}}), "_\r\n");
+    EXPECT_EQ(run(0, {{"SET", "k", "w", "XX", "GET"}}), "$1\r\nv\r\n");
+    EXPECT_EQ(run(0, {{"APPEND", "k", "xyz"}}), ":4\r\n");
+    EXPECT_EQ(run(0, {{"INCR", "k"}}), "-ERR value is not an integer or out of range\r\n");
+    EXPECT_EQ(run(0, {{"INCRBY", "n", "41"}}), ":41\r\n");
+    EXPECT_EQ(run(0, {{"INCR", "n"}}), ":42\r\n");
+    EXPECT_EQ(run(0, {{"DECRBY", "n", "2"}}), ":40\r\n");
+    EXPECT_EQ(run(0, {{"MSET", "a", "1", "b", "2"}}), "+OK\r\n");
+    EXPECT_EQ(run(0, {{"MGET", "a", "nope", "b"}}), "*3\r\n$1\r\n1\r\n_\r\n$1\r\n2\r\n");
+    EXPECT_EQ(run(0, {{"EXISTS", "a", "b", "nope"}}), ":2\r\n");
+    EXPECT_EQ(run(0, {{"DBSIZE"}}), ":4\r\n");
+    EXPECT_EQ(run(0, {{"DEL", "a", "b", "nope"}}), ":2\r\n");
+    EXPECT_EQ(run(0, {{"GET"}}), "-ERR wrong number of arguments for 'GET' command\r\n");
+    EXPECT_EQ(run(0, {{"FLUSHALL"}}), "+OK\r\n");
+    EXPECT_EQ(run(0, {{"DBSIZE"}}), ":0\r\n");
+    EXPECT_EQ(run(0, {{"NOSUCHCOMMAND"}}), "<unhandled>");
+}
+
+TEST_F(CommandsTest, Encodings) {
+    std::string medium(store::Inline::k_capacity, 'm');
+    EXPECT_EQ(run(0, {{"MSET", "n", "-42", "z", "007", "m", medium, "l", medium + "+"}}), "+OK\r\n");
+    EXPECT_TRUE(std::holds_alternative<int64_t>(ks.shard_of("n").map.find("n")->second.value));
+    EXPECT_TRUE(std::holds_alternative<store::Inline>(ks.shard_of("z").map.find("z")->second.value));
+    EXPECT_TRUE(std::holds_alternative<store::Inline>(ks.shard_of("m").map.find("m")->second.value));
+    EXPECT_TRUE(std::holds_alternative<std::string>(ks.shard_of("l").map.find("l")->second.value));
+    EXPECT_EQ(run(0, {{"GET", "n"}}), "$3\r\n-42\r\n");
+    EXPECT_EQ(run(0, {{"GET", "z"}}), "$3\r\n007\r\n");
+    EXPECT_EQ(run(0, {{"MGET", "m", "l"}}), "*2\r\n$31\r\n" + medium + "\r\n$32\r\n" + medium + "+\r\n");
+    EXPECT_EQ(run(0, {{"STRLEN", "n"}}), ":3\r\n");
+
+    // counters stay integers, from the shared replies or not
+    EXPECT_EQ(run(0, {{"INCRBY", "n", "9999"}}), ":9957\r\n");
+    EXPECT_EQ(run(0, {{"GET", "n"}}), "$4\r\n9957\r\n");
+    EXPECT_EQ(run(0, {{"INCRBY", "n", "43"}}), ":10000\r\n");
+    EXPECT_EQ(run(0, {{"GET", "n"}}), "$5\r\n10000\r\n");
+    EXPECT_EQ(run(0, {{"INCR", "z"}}), ":8\r\n");
+    EXPECT_TRUE(std::holds_alternative<int64_t>(ks.shard_of("z").map.find("z")->second.value));
+    EXPECT_EQ(run(0, {{"INCR", "m"}}), "-ERR value is not an integer or out of range\r\n");
+    EXPECT_EQ(run(0, {{"SET", "n", "9223372036854775807"}}), "+OK\r\n");
+    EXPECT_EQ(run(0, {{"INCR", "n"}}), "-ERR increment or decrement would overflow\r\n");
+
+    // in place writes turn them back into plain strings
+    EXPECT_EQ(run(0, {{"APPEND", "z", "0"}}), ":2\r\n");
+    EXPECT_EQ(run(0, {{"GET", "z"}}), "$2\r\n80\r\n");
+    EXPECT_TRUE(std::holds_alternative<std::string>(ks.shard_of("z").map.find("z")->second.value));
+    EXPECT_EQ(run(0, {{"INCR", "z"}}), ":81\r\n");
+}
+
+TEST_F(CommandsTest, Scan) {
+    for (int k = 0 ; k < 300 ; ++k) {
+        EXPECT_EQ(run(0, {{"SET", "key:" + std::to_string(k), "v"}}), "+OK\r\n");
+    }
+    EXPECT_EQ(run(0, {{"RPUSH", "list:0", "x"}}), ":1\r\n");
+
+    // parses what SCAN replies, returns the cursor
+    auto scan = [&] (std::vector<std::string> argv, std::set<std::string>& keys) {
+        std::vector<std::string_view> args(argv.begin(), argv.end());
+        std::string reply = run(0, {args});
+        size_t at = reply.find("\r\n", 4) + 2;
+        std::string cursor = reply.substr(at, reply.find("\r\n", at) - at);
+        at = reply.find('*', at) ;
+        size_t n = std::stoul(reply.substr(at + 1));
+        at = reply.find("\r\n", at) + 2;
+        for (size_t k = 0 ; k < n ; ++k) {
+            at = reply.find("\r\n", at) + 2;
+            size_t end = reply.find("\r\n", at);
+            keys.insert(reply.substr(at, end - at));
+            at = end + 2;
+        }
+        return cursor;
+    };
+    std::set<std::string> keys;
+    std::string cursor = "0";
+    int calls = 0;
+    do {
+        cursor = scan({"SCAN", cursor, "COUNT", "20", "MATCH", "key:1*"}, keys);
+        ++calls;
+    } while (cursor != "0");
+    // 1, 10-19, 100-199
+    EXPECT_EQ(keys.size(), 111u);
+    EXPECT_GT(calls, 1);
+
+    keys.clear();
+    cursor = "0";
+    do {
+        cursor = scan({"SCAN", cursor, "TYPE", "LIST", "COUNT", "1000"}, keys);
+    } while (cursor != "0");
+    EXPECT_EQ(keys, std::set<std::string>{"list:0"});
+    EXPECT_EQ(run(0, {{"SCAN", "x"}}), "-ERR invalid cursor\r\n");
+    EXPECT_EQ(run(0, {{"SCAN", "0", "COUNT", "0"}}), "-ERR syntax error\r\n");
+    EXPECT_EQ(run(0, {{"SCAN", "0", "MATCH"}}), "-ERR syntax error\r\n");
+}
+
+// more keys than Keyspace::batch() prefetches ahead, in order all the same
+TEST_F(CommandsTest, MultiKeyBatches) {
+    std::vector<std::string> argv = {"MSET"};
+    for (int k = 0 ; k < 50 ; ++k) {
+        argv.push_back("key:" + std::to_string(k));
+        argv.push_back("v" + std::to_string(k));
+    }
+    // the last one wins
+    argv.push_back("key:3");
+    argv.push_back("again");
+    EXPECT_EQ(run(0, {{argv.begin(), argv.end()}}), "+OK\r\n");
+    EXPECT_EQ(run(0, {{"RPUSH", "list", "x"}}), ":1\r\n");
+
+    argv = {"MGET"};
+    std::string expected = "*60\r\n";
+    for (int k = 0 ; k < 59 ; ++k) {
+        argv.push_back("key:" + std::to_string(k));
+        std::string v = k == 3 ? "again" : "v" + std::to_string(k);
+        expected += k < 50 ? "$" + std::to_string(v.size()) + "\r\n" + v + "\r\n" : "_\r\n";
+    }
+    argv.push_back("list");
+    expected += "_\r\n";
+    EXPECT_EQ(run(0, {{argv.begin(), argv.end()}}), expected);
+
+    argv[0] = "EXISTS";
+    argv.push_back("key:0");
+    EXPECT_EQ(run(0, {{argv.begin(), argv.end()}}), ":52\r\n");
+    argv[0] = "DEL";
+    EXPECT_EQ(run(0, {{argv.begin(), argv.end()}}), ":51\r\n");
+    EXPECT_EQ(run(0, {{"DBSIZE"}}), ":0\r\n");
+}
+
+TEST_F(CommandsTest, MultiExec) {
+    EXPECT_EQ(run(0, {{"MULTI"}}), "+OK\r\n");
+    EXPECT_EQ(run(0, {{"SET", "k", "1"}}), "+QUEUED\r\n");
+    EXPECT_EQ(run(0, {{"INCR", "k"}}), "+QUEUED\r\n");
+    EXPECT_EQ(run(0, {{"MGET", "k", "other"}}), "+QUEUED\r\n");
+    // nothing ran yet
+    EXPECT_EQ(run(1, {{"GET", "k"}}), "_\r\n");
+    EXPECT_EQ(run(0, {{"EXEC"}}), "*3\r\n+OK\r\n:2\r\n*2\r\n$1\r\n2\r\n_\r\n");
+    EXPECT_EQ(run(0, {{"EXEC"}}), "-ERR EXEC without MULTI\r\n");
+
+    EXPECT_EQ(run(0, {{"MULTI"}}), "+OK\r\n");
+    EXPECT_EQ(run(0, {{"SET", "k", "3"}}), "+QUEUED\r\n");
+    EXPECT_EQ(run(0, {{"DISCARD"}}), "+OK\r\n");
+    EXPECT_EQ(run(0, {{"GET", "k"}}), "$1\r\n2\r\n");
+}
+
+TEST_F(CommandsTest, ExecAbort) {
+    EXPECT_EQ(run(0, {{"MULTI"}}), "+OK\r\n");
+    EXPECT_EQ(run(0, {{"SET", "k"}}), "-ERR wrong number of arguments for 'SET' command\r\n");
+    EXPECT_EQ(run(0, {{"SET", "k", "v"}}), "+QUEUED\r\n");
+    EXPECT_EQ(run(0, {{"EXEC"}}), "-EXECABORT Transaction discarded because of previous errors.\r\n");
+    EXPECT_EQ(run(0, {{"GET", "k"}}), "_\r\n");
+
+    // commands outside the table are not queued
+    EXPECT_EQ(run(0, {{"MULTI"}}), "+OK\r\n");
+    EXPECT_EQ(run(0, {{"SET", "k", "v"}}), "+QUEUED\r\n");
+    EXPECT_EQ(run(0, {{"PUBLISH", "ch", "m"}}),
+              "-ERR 'PUBLISH' is not a keyspace command, only those can be queued inside MULTI\r\n");
+    EXPECT_EQ(run(0, {{"EXEC"}}), "-EXECABORT Transaction discarded because of previous errors.\r\n");
+    EXPECT_EQ(run(0, {{"GET", "k"}}), "_\r\n");
+}
+
+TEST_F(CommandsTest, Watch) {
+    EXPECT_EQ(run(0, {{"SET", "k", "1"}}), "+OK\r\n");
+
+    // untouched watched key : EXEC goes through
+    EXPECT_EQ(run(0, {{"WATCH", "k"}}), "+OK\r\n");
+    EXPECT_EQ(run(0, {{"MULTI"}}), "+OK\r\n");
+    EXPECT_EQ(run(0, {{"INCR", "k"}}), "+QUEUED\r\n");
+    EXPECT_EQ(run(0, {{"EXEC"}}), "*1\r\n:2\r\n");
+
+    // another client writes it in between : EXEC aborts with a null
+    EXPECT_EQ(run(0, {{"WATCH", "k"}}), "+OK\r\n");
+    EXPECT_EQ(run(1, {{"SET", "k", "10"}}), "+OK\r\n");
+    EXPECT_EQ(run(0, {{"MULTI"}}), "+OK\r\n");
+    EXPECT_EQ(run(0, {{"INCR", "k"}}), "+QUEUED\r\n");
+    EXPECT_EQ(run(0, {{"EXEC"}}), "_\r\n");
+    EXPECT_EQ(run(0, {{"GET", "k"}}), "$2\r\n10\r\n");
+
+    // EXEC forgets the watched keys
+    EXPECT_EQ(run(1, {{"SET", "k", "11"}}), "+OK\r\n");
+    EXPECT_EQ(run(0, {{"MULTI"}}), "+OK\r\n");
+    EXPECT_EQ(run(0, {{"INCR", "k"}}), "+QUEUED\r\n");
+    EXPECT_EQ(run(0, {{"EXEC"}}), "*1\r\n:12\r\n");
+
+    EXPECT_EQ(run(0, {{"MULTI"}}), "+OK\r\n");
+    EXPECT_EQ(run(0, {{"WATCH", "k"}}), "-ERR WATCH inside MULTI is not allowed\r\n");
+    EXPECT_EQ(run(0, {{"DISCARD"}}), "+OK\r\n");
+}
+
+TEST_F(CommandsTest, Lists) {
+    EXPECT_EQ(run(0, {{"RPUSH", "l", "b", "c"}}), ":2\r\n");
+    EXPECT_EQ(run(0, {{"LPUSH", "l", "a"}}), ":3\r\n");
+    EXPECT_EQ(run(0, {{"TYPE", "l"}}), "+list\r\n");
+    EXPECT_EQ(run(0, {{"LRANGE", "l", "0", "-1"}}), "*3\r\n$1\r\na\r\n$1\r\nb\r\n$1\r\nc\r\n");
+    EXPECT_EQ(run(0, {{"LINDEX", "l", "-1"}}), "$1\r\nc\r\n");
+    EXPECT_EQ(run(0, {{"LMOVE", "l", "m", "RIGHT", "LEFT"}}), "$1\r\nc\r\n");
+    EXPECT_EQ(run(0, {{"LPOP", "l", "5"}}), "*2\r\n$1\r\na\r\n$1\r\nb\r\n");
+    // the last element takes the key with it
+    EXPECT_EQ(run(0, {{"EXISTS", "l"}}), ":0\r\n");
+    EXPECT_EQ(run(0, {{"RPOP", "l"}}), "_\r\n");
+    EXPECT_EQ(run(0, {{"LLEN", "m"}}), ":1\r\n");
+    EXPECT_EQ(run(0, {{"SET", "s", "v"}}), "+OK\r\n");
+    EXPECT_EQ(run(0, {{"LPUSH", "s", "x"}}), "-WRONGTYPE Operation against a key holding the wrong kind of value\r\n");
+    EXPECT_EQ(run(0, {{"GET", "m"}}), "-WRONGTYPE Operation against a key holding the wrong kind of value\r\n");
+}
+
+TEST_F(CommandsTest, Groups) {
+    ks.group_by([] (std::string_view key) { return static_cast<uint16_t>(key[0]); });
+    // the keys of group g, over every shard
+    auto group = [&] (char g) {
+        std::set<std::string> keys;
+        for (size_t k = 0 ; k < store::Keyspace::k_shards ; ++k) {
+            auto& groups = ks.shard(k).groups;
+            auto it = groups.find(static_cast<uint16_t>(g));
+            if (it != groups.end()) keys.insert(it->second.begin(), it->second.end());
+        }
+        return keys;
+    };
+    for (int k = 0 ; k < 20 ; ++k) {
+        std::string key = "a";
+        key += std::to_string(k);
+        EXPECT_EQ(run(0, {{"SET", key, "v"}}), "+OK\r\n");
+    }
+    EXPECT_EQ(run(0, {{"RPUSH", "b", "x"}}), ":1\r\n");
+    EXPECT_EQ(run(0, {{"SET", "a0", "w"}}), "+OK\r\n");
+    EXPECT_EQ(group('a').size(), 20u);
+    EXPECT_EQ(group('b'), std::set<std::string>{"b"});
+    EXPECT_EQ(run(0, {{"DEL", "a0", "a1"}}), ":2\r\n");
+    EXPECT_EQ(run(0, {{"LPOP", "b"}}), "$1\r\nx\r\n");
+    EXPECT_EQ(group('a').size(), 18u);
+    EXPECT_EQ(group('a').count("a0"), 0u);
+    EXPECT_TRUE(group('b').empty());
+    EXPECT_EQ(run(0, {{"FLUSHALL"}}), "+OK\r\n");
+    EXPECT_TRUE(group('a').empty());
+}
+
+TEST_F(CommandsTest, Expiry) {
+    EXPECT_EQ(run(0, {{"SET", "k", "v", "EX", "100"}}), "+OK\r\n");
+    EXPECT_EQ(run(0, {{"TTL", "k"}}), ":100\r\n");
+    // INCR-like rewrites keep the deadline, SET drops it
+    EXPECT_EQ(run(0, {{"APPEND", "k", "w"}}), ":2\r\n");
+    EXPECT_EQ(run(0, {{"TTL", "k"}}), ":100\r\n");
+    EXPECT_EQ(run(0, {{"PERSIST", "k"}}), ":1\r\n");
+    EXPECT_EQ(run(0, {{"TTL", "k"}}), ":-1\r\n");
+    EXPECT_EQ(run(0, {{"EXPIRE", "k", "10"}}), ":1\r\n");
+    EXPECT_EQ(run(0, {{"SET", "k", "v"}}), "+OK\r\n");
+    EXPECT_EQ(run(0, {{"PTTL", "k"}}), ":-1\r\n");
+    EXPECT_EQ(run(0, {{"TTL", "nope"}}), ":-2\r\n");
+    EXPECT_EQ(run(0, {{"EXPIRE", "nope", "10"}}), ":0\r\n");
+
+    // gone on access, and reaped by the timer without one
+    EXPECT_EQ(run(0, {{"PEXPIRE", "k", "20"}}), ":1\r\n");
+    EXPECT_EQ(run(0, {{"RPUSH", "l", "x"}}), ":1\r\n");
+    EXPECT_EQ(run(0, {{"PEXPIRE", "l", "20"}}), ":1\r\n");
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    EXPECT_EQ(run(0, {{"GET", "k"}}), "_\r\n");
+    EXPECT_EQ(ks.size(), 0u);
+    EXPECT_EQ(run(0, {{"EXPIRE", "k", "-1"}}), ":0\r\n");
+    EXPECT_EQ(run(0, {{"SET", "k", "v", "EX", "0"}}), "-ERR invalid expire time in 'set' command\r\n");
+
+    // deadlines follow their keys while the expires tables grow and shrink
+    std::vector<std::string> keys;
+    for (int k = 0 ; k < 2000 ; ++k) {
+        keys.emplace_back("e");
+        keys.back() += std::to_string(k);
+        EXPECT_EQ(run(0, {{"SET", keys.back(), "v", "EX", "100"}}), "+OK\r\n");
+    }
+    for (size_t k = 1 ; k < keys.size() ; k += 2) EXPECT_EQ(run(0, {{"PERSIST", keys[k]}}), ":1\r\n");
+    for (size_t k = 0 ; k < keys.size() ; ++k) {
+        EXPECT_EQ(run(0, {{"TTL", keys[k]}}), k % 2 == 0 ? ":100\r\n" : ":-1\r\n") << keys[k];
+    }
+}
+
+TEST_F(CommandsTest, ExpiredKeysAreGone) {
+    // without the timer, keys past their deadline stay until accessed
+    ks.on_expire({});
+    EXPECT_EQ(run(0, {{"SET", "a", "v"}}), "+OK\r\n");
+    EXPECT_EQ(run(0, {{"SET", "b", "v"}}), "+OK\r\n");
+    EXPECT_EQ(run(0, {{"SET", "c", "v"}}), "+OK\r\n");
+    EXPECT_EQ(run(0, {{"PEXPIRE", "a", "10"}}), ":1\r\n");
+    EXPECT_EQ(run(0, {{"PEXPIRE", "c", "10"}}), ":1\r\n");
+    std::this_thread::sleep_for(std::chrono::milliseconds(30));
+    EXPECT_EQ(ks.size(), 3u);
+
+    EXPECT_EQ(run(0, {{"DEL", "a", "b"}}), ":1\r\n");
+    EXPECT_EQ(run(0, {{"EXPIRE", "c", "-1"}}), ":0\r\n");
+    EXPECT_EQ(ks.size(), 0u);
+}
+
+TEST_F(CommandsTest, ExpiryIsWrittenOnce) {
+    std::vector<std::string> dels;
+    table.on_write([&dels] (const Args& argv, std::string_view) {
+        if (argv[0] == "DEL") dels.emplace_back(argv[1]);
+    });
+    // one read past the deadline, one left to the timer, one deleted before
+    EXPECT_EQ(run(0, {{"SET", "read", "v", "PX", "20"}}), "+OK\r\n");
+    EXPECT_EQ(run(0, {{"SET", "timer", "v", "PX", "20"}}), "+OK\r\n");
+    EXPECT_EQ(run(0, {{"SET", "gone", "v", "PX", "20"}}), "+OK\r\n");
+    EXPECT_EQ(run(0, {{"DEL", "gone"}}), ":1\r\n");
+    dels.clear();
+    table.lock(~uint64_t(0));
+    std::this_thread::sleep_for(std::chrono::milliseconds(40));
+    EXPECT_EQ(ks.find("read"), nullptr);
+    table.unlock(~uint64_t(0));
+    std::this_thread::sleep_for(std::chrono::milliseconds(60));
+    std::multiset<std::string> seen(dels.begin(), dels.end());
+    EXPECT_EQ(seen, (std::multiset<std::string>{"read", "timer"}));
+}
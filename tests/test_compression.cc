@@ -0,0 +1,105 @@
+#include <gtest/gtest.h>
+#include "commands/table.h"
+#include "utils/lz.h"
+#include <random>
+#include <string>
+
+static std::string round_trip(const std::string& s) {
+    std::string z;
+    utils::lz_compress(s, z);
+    std::string back(s.size(), '\0');
+    EXPECT_TRUE(utils::lz_decompress(z, back.data(), back.size()));
+    return back;
+}
+
+TEST(LzTest, RoundTrips) {
+    std::mt19937 rng(7);
+    std::string random(100000, '\0');
+    for (auto& c : random) c = static_cast<char>(rng());
+    std::string text;
+    while (text.size() < 200000) text += "{\"id\":" + std::to_string(text.size() % 977) + ",\"name\":\"ridics\"},";
+    for (const std::string& s : {std::string(), std::string("a"), std::string("abcdefghijklm"),
+                                 std::string(70000, 'z'), random, text}) {
+        EXPECT_EQ(round_trip(s), s);
+    }
+
+    std::string z;
+    utils::lz_compress(text, z);
+    EXPECT_LT(z.size(), text.size() / 4);
+    // corrupt or truncated input is refused, not overrun
+    std::string back(text.size(), '\0');
+    EXPECT_FALSE(utils::lz_decompress(std::string_view(z).substr(0, z.size() / 2), back.data(), back.size()));
+    EXPECT_FALSE(utils::lz_decompress(z, back.data(), back.size() - 1));
+    z[1] = static_cast<char>(0xff);
+    z[2] = static_cast<char>(0xff);
+    utils::lz_decompress(z, back.data(), back.size());
+}
+
+class CompressionTest : public testing::Test {
+protected:
+    void SetUp() override {
+        ks.compression(1024);
+    }
+
+    std::string run(commands::Args argv) {
+        std::string out;
+        table.call(*table.lookup(argv[0]), argv, out);
+        return out;
+    }
+
+    bool is_compressed(const std::string& key) {
+        auto& map = ks.shard_of(key).map;
+        auto it = map.find(key);
+        return it != map.end() && std::holds_alternative<store::Compressed>(it->second.value);
+    }
+
+    store::Keyspace ks;
+    commands::Table table{ks};
+};
+
+TEST_F(CompressionTest, ReadsThrough) {
+    std::string big(10000, 'a');
+    big[5000] = 'b';
+    std::mt19937 rng(7);
+    std::string noise(2000, '\0');
+    for (auto& c : noise) c = static_cast<char>(rng());
+    EXPECT_EQ(run({"SET", "big", big}), "+OK\r\n");
+    EXPECT_EQ(run({"SET", "small", "abc"}), "+OK\r\n");
+    EXPECT_EQ(run({"MSET", "noise", noise}), "+OK\r\n");
+    EXPECT_TRUE(is_compressed("big"));
+    EXPECT_FALSE(is_compressed("small"));
+    EXPECT_FALSE(is_compressed("noise"));
+    auto& stats = ks.compression_stats();
+    EXPECT_EQ(stats.values.load(), 1u);
+    EXPECT_EQ(stats.raw_bytes.load(), big.size());
+    EXPECT_EQ(stats.rejected.load(), 1u);
+
+    // reads leave it compressed
+    std::string bulk = "$10000\r\n" + big + "\r\n";
+    EXPECT_EQ(run({"GET", "big"}), bulk);
+    EXPECT_EQ(run({"MGET", "small", "big"}), "*2\r\n$3\r\nabc\r\n" + bulk);
+    EXPECT_EQ(run({"STRLEN", "big"}), ":10000\r\n");
+    EXPECT_EQ(run({"TYPE", "big"}), "+string\r\n");
+    EXPECT_EQ(run({"EXISTS", "big"}), ":1\r\n");
+    EXPECT_EQ(run({"SET", "big", "x", "NX", "GET"}), bulk);
+    EXPECT_TRUE(is_compressed("big"));
+    std::string info = run({"INFO", "compression"});
+    EXPECT_NE(info.find("compressed_values:1\r\n"), std::string::npos);
+    EXPECT_NE(info.find("compressed_raw_bytes:10000\r\n"), std::string::npos);
+
+    // snapshots get the original
+    std::string seen;
+    commands::recreate("big", ks.shard_of("big").map.find("big")->second.value, -1,
+                       [&] (const commands::Args& argv) { seen = argv[2]; });
+    EXPECT_EQ(seen, big);
+
+    // writes inflate it for good
+    EXPECT_EQ(run({"APPEND", "big", "!"}), ":10001\r\n");
+    EXPECT_FALSE(is_compressed("big"));
+    EXPECT_EQ(stats.values.load(), 0u);
+    EXPECT_EQ(run({"GETSET", "big", big}), "$10001\r\n" + big + "!\r\n");
+    EXPECT_TRUE(is_compressed("big"));
+    EXPECT_EQ(run({"DEL", "big"}), ":1\r\n");
+    EXPECT_EQ(stats.values.load(), 0u);
+    EXPECT_EQ(stats.bytes.load(), 0u);
+}
@@ -0,0 +1,79 @@
+#include <gtest/gtest.h>
+#include "coro/task.h"
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+static coro::Task<int> add(int a, int b) {
+    co_return a + b;
+}
+
+static coro::Task<int> sum(int n) {
+    int s = 0;
+    for (int k = 0 ; k < n ; ++k) s += co_await add(k, 1);
+    co_return s;
+}
+
+static coro::Task<> fail() {
+    throw std::runtime_error("boom");
+    co_return;
+}
+
+TEST(CoroTest, Nested) {
+    EXPECT_EQ(sum(10).run(), 55);
+    EXPECT_THROW(fail().run(), std::runtime_error);
+    EXPECT_EQ(coro::FramePool::live(), 0u);
+}
+
+TEST(CoroTest, FramesAreRecycled) {
+    void* a = coro::FramePool::allocate(100);
+    EXPECT_EQ(coro::FramePool::live(), 1u);
+    coro::FramePool::deallocate(a);
+    void* b = coro::FramePool::allocate(110);
+    EXPECT_EQ(a, b);
+    coro::FramePool::deallocate(b);
+
+    // freed elsewhere, back to this thread's pool once its own list is empty
+    void* c = coro::FramePool::allocate(100);
+    std::thread([c] { coro::FramePool::deallocate(c); }).join();
+    EXPECT_EQ(coro::FramePool::live(), 0u);
+    std::vector<void*> frames;
+    while (frames.size() < 64 && (frames.empty() || frames.back() != c)) {
+        frames.push_back(coro::FramePool::allocate(100));
+    }
+    EXPECT_EQ(frames.back(), c);
+    for (void* f : frames) coro::FramePool::deallocate(f);
+
+    // too large to be pooled
+    void* big = coro::FramePool::allocate(coro::FramePool::k_max);
+    EXPECT_EQ(coro::FramePool::live(), 0u);
+    coro::FramePool::deallocate(big);
+}
+
+static coro::Task<std::thread::id> wait_for(coro::Event& e) {
+    co_await e;
+    co_return std::this_thread::get_id();
+}
+
+TEST(CoroTest, ResumedOnItsLoop) {
+    coro::Event e;
+    std::thread setter([&] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        e.set();
+    });
+    EXPECT_EQ(wait_for(e).run(), std::this_thread::get_id());
+    setter.join();
+    // already set : no suspension
+    EXPECT_TRUE(e.is_set());
+    EXPECT_EQ(wait_for(e).run(), std::this_thread::get_id());
+}
+
+TEST(CoroTest, ManyWaiters) {
+    std::vector<coro::Event> events(64);
+    std::thread setter([&] {
+        for (auto& e : events) e.set();
+    });
+    for (auto& e : events) wait_for(e).run();
+    setter.join();
+}
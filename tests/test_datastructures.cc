@@ -0,0 +1,242 @@
+#include <gtest/gtest.h>
+#include "datastructures/dict.h"
+#include "datastructures/node.h"
+#include "datastructures/radix.h"
+#include "datastructures/stream.h"
+#include <cmath>
+#include <map>
+#include <memory>
+#include <random>
+#include <set>
+#include <string>
+#include <string_view>
+
+using namespace data;
+
+TEST(NodeTest, Types) {
+    EXPECT_EQ(String("OK").type(), Type::SimpleString);
+    EXPECT_EQ(BulkString("x").type(), Type::BulkString);
+    EXPECT_EQ(Array(0).type(), Type::Array);
+    EXPECT_EQ(Push(0).type(), Type::Push);
+    EXPECT_EQ(Map(0).type(), Type::Map);
+    for (auto t : {Type::SimpleString, Type::Array, Type::Map, Type::Push}) {
+        EXPECT_NE(prefix(t), '\0');
+    }
+    EXPECT_EQ(prefix(Type::Set), '~');
+}
+
+TEST(NodeTest, Scalars) {
+    EXPECT_EQ(String("OK").to_resp(), "+OK\r\n");
+    EXPECT_EQ(SimpleError("ERR x").to_resp(), "-ERR x\r\n");
+    EXPECT_EQ(Integer(-12).to_resp(), ":-12\r\n");
+    EXPECT_EQ(BulkString("test").to_resp(), "$4\r\ntest\r\n");
+    EXPECT_EQ(BulkString().to_resp(), "$-1\r\n");
+    EXPECT_EQ(BulkError("SYNTAX x").to_resp(), "!8\r\nSYNTAX x\r\n");
+    EXPECT_EQ(Null().to_resp(), "_\r\n");
+    EXPECT_EQ(Boolean(true).to_resp(), "#t\r\n");
+    EXPECT_EQ(Double(1.5).to_resp(), ",1.5\r\n");
+    EXPECT_EQ(Double(INFINITY).to_resp(), ",inf\r\n");
+    EXPECT_EQ(Double(-INFINITY).to_resp(), ",-inf\r\n");
+    EXPECT_EQ(Double(NAN).to_resp(), ",nan\r\n");
+    EXPECT_EQ(BigNumber("123456789012345678901234567890").to_resp(), "(123456789012345678901234567890\r\n");
+    EXPECT_EQ(VerbatimString("txt", "Some string").to_resp(), "=15\r\ntxt:Some string\r\n");
+}
+
+TEST(NodeTest, Aggregates) {
+    Array null(-1);
+    EXPECT_EQ(null.to_resp(), "*-1\r\n");
+
+    Set s(2);
+    s.push_back(std::make_unique<Integer>(1));
+    s.push_back(std::make_unique<Boolean>(false));
+    EXPECT_EQ(s.to_resp(), "~2\r\n:1\r\n#f\r\n");
+
+    Map m(1);
+    m.emplace_back(std::make_unique<String>("key"), std::make_unique<Double>(0.25));
+    EXPECT_EQ(m.to_resp(), "%1\r\n+key\r\n,0.25\r\n");
+
+    Attribute a(1);
+    a.emplace_back(std::make_unique<String>("ttl"), std::make_unique<Integer>(10));
+    a.set_value(std::make_unique<BulkString>("v"));
+    EXPECT_EQ(a.to_resp(), "|1\r\n+ttl\r\n:10\r\n$1\r\nv\r\n");
+
+    Push p(2);
+    p.push_back(std::make_unique<BulkString>("message"));
+    auto inner = std::make_unique<Array>(1);
+    inner->push_back(std::make_unique<Null>());
+    p.push_back(std::move(inner));
+    EXPECT_EQ(p.to_resp(), ">2\r\n$7\r\nmessage\r\n*1\r\n_\r\n");
+}
+
+struct StringHash {
+    size_t operator()(std::string_view s) const {
+        return std::hash<std::string_view>{}(s);
+    }
+};
+
+TEST(DictTest, GrowsAndShrinks) {
+    Dict<int, StringHash> d;
+    for (int k = 0 ; k < 10000 ; ++k) {
+        EXPECT_TRUE(d.emplace(std::to_string(k), k).second);
+    }
+    EXPECT_FALSE(d.emplace("42", 0).second);
+    EXPECT_EQ(d.size(), 10000u);
+    size_t n = 0;
+    for (auto& [key, v] : d) {
+        EXPECT_EQ(key, std::to_string(v));
+        ++n;
+    }
+    EXPECT_EQ(n, 10000u);
+    for (int k = 0 ; k < 10000 ; k += 2) d.erase(d.find(std::to_string(k)));
+    for (int k = 0 ; k < 9990 ; ++k) {
+        if (k % 2 == 0) d.erase(d.find(std::to_string(k + 1)));
+    }
+    EXPECT_EQ(d.size(), 5u);
+    while (d.rehash(100)) {}
+    EXPECT_EQ(d.bucket_count(), 16u);
+    EXPECT_EQ(d.find("9999")->second, 9999);
+    EXPECT_TRUE(d.find("0") == d.end());
+}
+
+TEST(DictTest, ScanSurvivesResizes) {
+    Dict<int, StringHash> d;
+    auto name = [] (char prefix, int k) {
+        std::string s(1, prefix);
+        s += std::to_string(k);
+        return s;
+    };
+    for (int k = 0 ; k < 1000 ; ++k) d.emplace(name('k', k), k);
+    // the first 500 keys stay for the whole scan, the others come and go
+    // while the table grows and shrinks under the cursor
+    std::map<std::string, int> seen;
+    uint64_t cursor = 0;
+    int step = 0;
+    do {
+        cursor = d.scan(cursor, [&] (auto& kv) { ++seen[kv.first]; });
+        if (++step % 2 == 0 && step < 400) {
+            for (int k = 0 ; k < 50 ; ++k) d.emplace(name('x', step * 50 + k), 0);
+        } else if (step >= 400 && step < 800) {
+            for (int k = 500 ; k < 1000 ; ++k) {
+                auto it = d.find(name('k', k));
+                if (it != d.end()) d.erase(it);
+            }
+            while (d.size() > 500) {
+                auto it = d.begin();
+                while (it->first[0] == 'k' && std::stoi(it->first.substr(1)) < 500) ++it;
+                d.erase(it);
+            }
+        }
+    } while (cursor != 0);
+    for (int k = 0 ; k < 500 ; ++k) {
+        EXPECT_GE(seen[name('k', k)], 1) << k;
+    }
+}
+
+TEST(RadixTest, OrderedLikeAMap) {
+    data::Radix<int> r;
+    std::map<std::string, int> m;
+    std::mt19937 rng(7);
+    // short keys over few bytes, so that edges split and join all the time
+    auto key = [&rng] {
+        std::string k(rng() % 5, 'a');
+        for (auto& c : k) c = static_cast<char>('a' + rng() % 3);
+        return k;
+    };
+    for (int round = 0 ; round < 5000 ; ++round) {
+        std::string k = key();
+        if (rng() % 3 == 0) {
+            EXPECT_EQ(r.erase(k), m.erase(k) == 1) << k;
+        } else {
+            auto [v, added] = r.insert(k, round);
+            auto [it, inserted] = m.emplace(k, round);
+            ASSERT_EQ(added, inserted) << k;
+            EXPECT_EQ(*v, it->second);
+        }
+        ASSERT_EQ(r.size(), m.size());
+
+        std::string probe = key();
+        std::string found;
+        auto it = m.lower_bound(probe);
+        int* v = r.seek_ge(probe, false, &found);
+        ASSERT_EQ(v == nullptr, it == m.end()) << probe;
+        if (v != nullptr) {
+            EXPECT_EQ(found, it->first);
+        }
+        it = m.upper_bound(probe);
+        v = r.seek_ge(probe, true, &found);
+        ASSERT_EQ(v == nullptr, it == m.end()) << probe;
+        if (v != nullptr) {
+            EXPECT_EQ(found, it->first);
+        }
+        it = m.upper_bound(probe);
+        v = r.seek_le(probe, false, &found);
+        ASSERT_EQ(v == nullptr, it == m.begin()) << probe;
+        if (v != nullptr) {
+            EXPECT_EQ(found, std::prev(it)->first);
+        }
+        it = m.lower_bound(probe);
+        v = r.seek_le(probe, true, &found);
+        ASSERT_EQ(v == nullptr, it == m.begin()) << probe;
+        if (v != nullptr) {
+            EXPECT_EQ(found, std::prev(it)->first);
+        }
+    }
+    std::vector<std::string> keys;
+    r.each([&keys] (std::string_view k, int&) {
+        keys.emplace_back(k);
+        return true;
+    });
+    std::vector<std::string> expected;
+    for (auto& kv : m) expected.push_back(kv.first);
+    EXPECT_EQ(keys, expected);
+}
+
+TEST(StreamTest, BlocksRangesAndTrim) {
+    data::Stream s;
+    const size_t n = 1000;
+    for (size_t k = 1 ; k <= n ; ++k) {
+        std::string v = std::to_string(k);
+        // every tenth entry has fields of its own
+        std::string_view fv[] = {k % 10 ? "field" : "other", v};
+        s.append({k / 3, k}, fv, 2);
+    }
+    EXPECT_EQ(s.size(), n);
+    EXPECT_EQ(s.blocks(), (n + data::Stream::k_block_entries - 1) / data::Stream::k_block_entries);
+    EXPECT_EQ(s.first_id(), (data::StreamID{0, 1}));
+    EXPECT_EQ(s.last_id(), (data::StreamID{n / 3, n}));
+
+    data::Stream::Fields fv;
+    ASSERT_TRUE(s.get({500 / 3, 500}, fv));
+    EXPECT_EQ(fv, (data::Stream::Fields{"other", "500"}));
+    EXPECT_FALSE(s.get({500 / 3, 501}, fv));
+
+    std::vector<uint64_t> seqs;
+    s.range({100, 0}, {200, 0}, [&] (data::StreamID id, const data::Stream::Fields& f) {
+        seqs.push_back(id.seq);
+        EXPECT_EQ(f[1], std::to_string(id.seq));
+        return true;
+    });
+    ASSERT_EQ(seqs.size(), 300u);
+    EXPECT_EQ(seqs.front(), 300u);
+    EXPECT_EQ(seqs.back(), 599u);
+    seqs.clear();
+    s.reverse_range(data::k_max_id, {}, [&] (data::StreamID id, const data::Stream::Fields&) {
+        seqs.push_back(id.seq);
+        return seqs.size() < 200;
+    });
+    ASSERT_EQ(seqs.size(), 200u);
+    EXPECT_EQ(seqs.front(), n);
+    EXPECT_EQ(seqs.back(), n - 199);
+
+    // whole blocks only, then down to the entry
+    EXPECT_EQ(s.trim(n - 200, true), 128u);
+    EXPECT_EQ(s.trim(n - 200, false), 72u);
+    EXPECT_EQ(s.size(), n - 200);
+    EXPECT_EQ(s.first_id(), (data::StreamID{201 / 3, 201}));
+    EXPECT_FALSE(s.get({200 / 3, 200}, fv));
+    EXPECT_EQ(s.trim(0, false), n - 200);
+    EXPECT_EQ(s.blocks(), 0u);
+    std::string_view more[] = {"f", "v"};
+    s.append({n, 0}, more, 2);
+    EXPECT_EQ(s.first_id(), (data::StreamID{n, 0}));
+}
@@ -0,0 +1,170 @@
+#include <gtest/gtest.h>
+#include "commands/table.h"
+#include "datastructures/bloom.h"
+#include "datastructures/hyperloglog.h"
+#include <cmath>
+#include <string>
+
+namespace hll = data::hll;
+
+class ProbabilisticTest : public testing::Test {
+protected:
+    std::string call(commands::Args argv) {
+        std::string out;
+        table.call(*table.lookup(argv[0]), argv, out);
+        return out;
+    }
+
+    store::Keyspace ks;
+    commands::Table table{ks};
+};
+
+TEST(HyperLogLog, SparseThenDense) {
+    std::string s = hll::create();
+    ASSERT_TRUE(hll::valid(s));
+    EXPECT_EQ(s[4], hll::SPARSE);
+    EXPECT_EQ(hll::count(s), 0);
+    EXPECT_EQ(hll::add(s, "a"), 1);
+    EXPECT_EQ(hll::add(s, "a"), 0);
+    EXPECT_EQ(hll::count(s), 1);
+
+    hll::Raw sparse_raw{};
+    for (int k = 0 ; k < 1000 ; ++k) {
+        std::string e = "e";
+        e += std::to_string(k);
+        hll::add(s, e);
+    }
+    EXPECT_EQ(s[4], hll::SPARSE);
+    EXPECT_LT(s.size(), hll::k_dense_size / 2);
+    int64_t n = hll::count(s);
+    EXPECT_NEAR(n, 1001, 20);
+    // from the cache this time
+    EXPECT_EQ(hll::count(s), n);
+    ASSERT_TRUE(hll::merge(s, sparse_raw));
+    EXPECT_EQ(static_cast<int64_t>(hll::count(sparse_raw)), n);
+
+    // the same registers once dense
+    std::string d = hll::from_raw(sparse_raw);
+    ASSERT_TRUE(hll::valid(d));
+    EXPECT_EQ(d[4], hll::DENSE);
+    EXPECT_EQ(hll::count(d), n);
+    hll::Raw dense_raw{};
+    ASSERT_TRUE(hll::merge(d, dense_raw));
+    EXPECT_EQ(dense_raw, sparse_raw);
+
+    // too many opcodes for sparse
+    for (int k = 0 ; k < 20000 ; ++k) {
+        std::string e = "f";
+        e += std::to_string(k);
+        hll::add(s, e);
+    }
+    EXPECT_EQ(s[4], hll::DENSE);
+    EXPECT_EQ(s.size(), hll::k_dense_size);
+    EXPECT_NEAR(static_cast<double>(hll::count(s)), 21001, 21001 * 0.03);
+}
+
+TEST(HyperLogLog, RejectsCorruption) {
+    EXPECT_FALSE(hll::valid("HYLL"));
+    EXPECT_FALSE(hll::valid("not an hll at all"));
+    std::string s = hll::create();
+    // XZERO of 16384 registers turned into one of 16383
+    s[hll::k_header + 1] = static_cast<char>(0xfe);
+    hll::Raw raw{};
+    EXPECT_FALSE(hll::merge(s, raw));
+    EXPECT_EQ(hll::count(s), -1);
+    std::string d = hll::from_raw(raw);
+    d.pop_back();
+    EXPECT_FALSE(hll::valid(d));
+}
+
+TEST_F(ProbabilisticTest, HllCommands) {
+    EXPECT_EQ(call({"PFADD", "h", "a", "b", "c", "d", "e", "f", "g"}), ":1\r\n");
+    EXPECT_EQ(call({"PFADD", "h", "a"}), ":0\r\n");
+    EXPECT_EQ(call({"PFCOUNT", "h"}), ":7\r\n");
+    EXPECT_EQ(call({"PFADD", "empty"}), ":1\r\n");
+    EXPECT_EQ(call({"PFCOUNT", "empty", "missing"}), ":0\r\n");
+    EXPECT_EQ(call({"PFADD", "h2", "f", "g", "h", "i"}), ":1\r\n");
+    EXPECT_EQ(call({"PFCOUNT", "h", "h2"}), ":9\r\n");
+    EXPECT_EQ(call({"PFMERGE", "m", "h", "h2"}), "+OK\r\n");
+    EXPECT_EQ(call({"PFCOUNT", "m"}), ":9\r\n");
+    EXPECT_EQ(call({"TYPE", "m"}), "+string\r\n");
+
+    // plain strings : they move around like any other
+    std::string copy = call({"GET", "h"});
+    copy = copy.substr(copy.find("\r\n") + 2);
+    copy.resize(copy.size() - 2);
+    EXPECT_EQ(call({"SET", "h3", copy}), "+OK\r\n");
+    EXPECT_EQ(call({"PFCOUNT", "h3"}), ":7\r\n");
+
+    EXPECT_EQ(call({"SET", "s", "hello"}), "+OK\r\n");
+    EXPECT_EQ(call({"PFADD", "s", "a"}), "-WRONGTYPE Key is not a valid HyperLogLog string value.\r\n");
+    EXPECT_EQ(call({"RPUSH", "l", "a"}), ":1\r\n");
+    EXPECT_EQ(call({"PFCOUNT", "h", "l"}), "-WRONGTYPE Operation against a key holding the wrong kind of value\r\n");
+}
+
+TEST(Bloom, NoFalseNegativesAndScales) {
+    data::Bloom b(0.01, 1000);
+    int added = 0;
+    for (int k = 0 ; k < 1000 ; ++k) added += b.add("in:" + std::to_string(k));
+    // a few may look present already
+    EXPECT_GT(added, 980);
+    EXPECT_EQ(b.layers(), 1u);
+    EXPECT_EQ(b.add("in:0"), 0);
+    int fp = 0;
+    for (int k = 0 ; k < 10000 ; ++k) fp += b.contains("out:" + std::to_string(k)) ? 1 : 0;
+    EXPECT_LT(fp, 200);
+
+    for (int k = 1000 ; k < 5000 ; ++k) b.add("in:" + std::to_string(k));
+    EXPECT_EQ(b.layers(), 3u);
+    EXPECT_EQ(b.capacity(), 7000u);
+    for (int k = 0 ; k < 5000 ; ++k) ASSERT_TRUE(b.contains("in:" + std::to_string(k)));
+
+    std::string dump;
+    b.dump(dump);
+    auto copy = data::Bloom::load(dump);
+    ASSERT_NE(copy, nullptr);
+    EXPECT_EQ(copy->size(), b.size());
+    for (int k = 0 ; k < 5000 ; ++k) ASSERT_TRUE(copy->contains("in:" + std::to_string(k)));
+    dump.pop_back();
+    EXPECT_EQ(data::Bloom::load(dump), nullptr);
+
+    data::Bloom fixed(0.01, 2, 0);
+    EXPECT_EQ(fixed.add("a"), 1);
+    EXPECT_EQ(fixed.add("b"), 1);
+    EXPECT_EQ(fixed.add("c"), -1);
+}
+
+TEST_F(ProbabilisticTest, BloomCommands) {
+    EXPECT_EQ(call({"BF.ADD", "b", "x"}), ":1\r\n");
+    EXPECT_EQ(call({"BF.ADD", "b", "x"}), ":0\r\n");
+    EXPECT_EQ(call({"BF.MADD", "b", "x", "y", "z"}), "*3\r\n:0\r\n:1\r\n:1\r\n");
+    EXPECT_EQ(call({"BF.EXISTS", "b", "y"}), ":1\r\n");
+    EXPECT_EQ(call({"BF.EXISTS", "missing", "y"}), ":0\r\n");
+    EXPECT_EQ(call({"BF.MEXISTS", "b", "z", "x"}), "*2\r\n:1\r\n:1\r\n");
+    EXPECT_EQ(call({"TYPE", "b"}), "+MBbloom--\r\n");
+    EXPECT_EQ(call({"GET", "b"}), "-WRONGTYPE Operation against a key holding the wrong kind of value\r\n");
+    EXPECT_EQ(call({"INCR", "b"}), "-WRONGTYPE Operation against a key holding the wrong kind of value\r\n");
+
+    EXPECT_EQ(call({"BF.RESERVE", "b", "0.01", "100"}), "-ERR item exists\r\n");
+    EXPECT_EQ(call({"BF.RESERVE", "r", "1.5", "100"}), "-ERR (0 < error rate range < 1)\r\n");
+    EXPECT_EQ(call({"BF.RESERVE", "r", "0.1", "0"}), "-ERR (capacity should be larger than 0)\r\n");
+    EXPECT_EQ(call({"BF.RESERVE", "r", "0.1", "2", "NONSCALING"}), "+OK\r\n");
+    EXPECT_EQ(call({"BF.MADD", "r", "a", "b", "c"}), "*3\r\n:1\r\n:1\r\n-ERR non scaling filter is full\r\n");
+    EXPECT_EQ(call({"BF.INFO", "r"}), "%5\r\n$8\r\nCapacity\r\n:2\r\n$4\r\nSize\r\n:64\r\n"
+                                     "$17\r\nNumber of filters\r\n:1\r\n$24\r\nNumber of items inserted\r\n:2\r\n"
+                                     "$14\r\nExpansion rate\r\n_\r\n");
+
+    // what replicas and upgrades are sent
+    std::vector<std::string> sent;
+    commands::recreate("b", *ks.peek("b"), -1, [&] (const commands::Args& argv) {
+        for (auto& a : argv) sent.emplace_back(a);
+    });
+    ASSERT_EQ(sent.size(), 4u);
+    EXPECT_EQ(sent[0], "BF.LOADCHUNK");
+    EXPECT_EQ(call({"BF.LOADCHUNK", "copy", sent[2], sent[3]}), "+OK\r\n");
+    EXPECT_EQ(call({"BF.MEXISTS", "copy", "x", "y", "z"}), "*3\r\n:1\r\n:1\r\n:1\r\n");
+    std::string dump = call({"BF.SCANDUMP", "copy", "0"});
+    EXPECT_EQ(dump.substr(0, 8), "*2\r\n:1\r\n");
+    EXPECT_EQ(call({"BF.SCANDUMP", "copy", "1"}), "*2\r\n:0\r\n$0\r\n\r\n");
+    EXPECT_EQ(call({"BF.LOADCHUNK", "copy", "1", "junk"}), "-ERR received bad data\r\n");
+}
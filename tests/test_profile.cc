@@ -0,0 +1,88 @@
+#include <gtest/gtest.h>
+#include "commands/table.h"
+#include "profile/profile.h"
+#include <string>
+
+// out of the compiler's sight, or it may drop a new / delete pair
+static void* g_sink;
+
+// one allocation of n bytes : operator new called as a function, which
+// optimized builds may not elide the way they do new-expressions
+static void churn(size_t n) {
+    g_sink = ::operator new(n);
+    ::operator delete(g_sink);
+}
+
+class ProfileTest : public testing::Test {
+protected:
+    void SetUp() override {
+        profile::reset();
+    }
+
+    void TearDown() override {
+        profile::stop();
+        profile::reset();
+    }
+
+    static std::string folded(std::string_view metric) {
+        std::string out;
+        EXPECT_TRUE(profile::folded(metric, out));
+        return out;
+    }
+};
+
+TEST_F(ProfileTest, NestedSamplesCountTheirOwnShare) {
+    profile::start();
+    {
+        profile::Sample outer("outer");
+        churn(64);
+        {
+            profile::Sample inner("inner");
+            churn(16);
+            churn(16);
+        }
+    }
+    EXPECT_EQ(folded("allocs"), "outer 1\nouter;inner 2\n");
+    EXPECT_EQ(folded("bytes"), "outer 64\nouter;inner 32\n");
+    EXPECT_EQ(folded("CALLS"), "outer;inner 1\n");
+    // inclusive totals
+    std::string json = profile::json();
+    EXPECT_NE(json.find("{\"stack\":\"outer\",\"calls\":1,"), std::string::npos);
+    EXPECT_NE(json.find("\"allocs\":3,\"bytes\":96,\"syscalls\":0}"), std::string::npos);
+    std::string out;
+    EXPECT_FALSE(profile::folded("instructions", out));
+}
+
+TEST_F(ProfileTest, NothingRecordedWhenOff) {
+    {
+        profile::Sample s("off");
+        churn(8);
+    }
+    profile::start();
+    {
+        profile::Sample s("skipped", false);
+    }
+    profile::stop();
+    EXPECT_EQ(folded("calls"), "");
+}
+
+TEST_F(ProfileTest, CommandsAndSyscalls) {
+    store::Keyspace ks;
+    commands::Table table(ks);
+    int sv[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+    profile::start();
+    {
+        profile::Sample s(profile::CommandFrame{"set"});
+        std::string out;
+        commands::Args argv = {"SET", "k", "v"};
+        table.call(*table.lookup("SET"), argv, out);
+        net::write_stream(sv[0], out.data(), out.size());
+    }
+    EXPECT_EQ(folded("calls"), "command;SET;keyspace 1\n");
+    EXPECT_EQ(folded("syscalls"), "command;SET 1\n");
+    EXPECT_EQ(profile::command_frame("x y\"z"), "command;X?Y?Z");
+    EXPECT_EQ(profile::command_frame(""), "command;?");
+    close(sv[0]);
+    close(sv[1]);
+}
@@ -0,0 +1,175 @@
+#include <gtest/gtest.h>
+#include "pubsub/pubsub.h"
+#include "commands/connection.h"
+#include "utils/glob.h"
+#include <poll.h>
+#include <sys/socket.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+using namespace pubsub;
+
+// reads exactly n bytes from fd, or whatever arrived before the timeout
+static std::string read_frame(int fd, size_t n, int timeout_ms = 1000) {
+    std::string s;
+    auto start = std::chrono::steady_clock::now();
+    while (s.size() < n) {
+        struct pollfd p = {fd, POLLIN, 0};
+        if (poll(&p, 1, 50) > 0) {
+            char buf[4096];
+            ssize_t rv = read(fd, buf, std::min(sizeof(buf), n - s.size()));
+            if (rv <= 0) break;
+            s.append(buf, rv);
+        }
+        if (std::chrono::steady_clock::now() - start > std::chrono::milliseconds(timeout_ms)) break;
+    }
+    return s;
+}
+
+class PubSubTest : public testing::Test {
+protected:
+    // returns {server side, client side}
+    std::pair<int, int> pair() {
+        int sv[2];
+        EXPECT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+        _fds.push_back(sv[0]);
+        _fds.push_back(sv[1]);
+        return {sv[0], sv[1]};
+    }
+
+    void TearDown() override {
+        for (int fd : _fds) close(fd);
+    }
+
+    PubSub ps;
+
+private:
+    std::vector<int> _fds;
+};
+
+TEST(GlobTest, Match) {
+    EXPECT_TRUE(utils::glob_match("*", ""));
+    EXPECT_TRUE(utils::glob_match("news.*", "news.tech"));
+    EXPECT_FALSE(utils::glob_match("news.*", "weather"));
+    EXPECT_TRUE(utils::glob_match("h?llo", "hello"));
+    EXPECT_TRUE(utils::glob_match("h[ae]llo", "hallo"));
+    EXPECT_FALSE(utils::glob_match("h[^e]llo", "hello"));
+    EXPECT_TRUE(utils::glob_match("h[a-c]llo", "hbllo"));
+    EXPECT_TRUE(utils::glob_match("a*b*c", "axxbyyc"));
+    EXPECT_FALSE(utils::glob_match("a*b*c", "axxbyy"));
+    EXPECT_TRUE(utils::glob_match("\\*", "*"));
+    EXPECT_FALSE(utils::glob_match("\\*", "a"));
+}
+
+TEST_F(PubSubTest, PublishToChannel) {
+    auto [srv, cli] = pair();
+    EXPECT_EQ(ps.subscribe(srv, "news"), 1u);
+    EXPECT_EQ(ps.publish("news", "hello"), 1u);
+    EXPECT_EQ(ps.publish("weather", "rain"), 0u);
+
+    const std::string expected = ">3\r\n$7\r\nmessage\r\n$4\r\nnews\r\n$5\r\nhello\r\n";
+    EXPECT_EQ(read_frame(cli, expected.size()), expected);
+}
+
+TEST_F(PubSubTest, PublishToPattern) {
+    auto [srv, cli] = pair();
+    EXPECT_EQ(ps.psubscribe(srv, "news.*"), 1u);
+    EXPECT_EQ(ps.publish("news.tech", "x"), 1u);
+
+    const std::string expected =
+        ">4\r\n$8\r\npmessage\r\n$6\r\nnews.*\r\n$9\r\nnews.tech\r\n$1\r\nx\r\n";
+    EXPECT_EQ(read_frame(cli, expected.size()), expected);
+}
+
+TEST_F(PubSubTest, FanOutKeepsOrder) {
+    std::vector<int> clients;
+    for (int k = 0 ; k < 200 ; ++k) {
+        auto [srv, cli] = pair();
+        ps.subscribe(srv, "jobs");
+        clients.push_back(cli);
+    }
+    std::string expected;
+    for (int m = 0 ; m < 50 ; ++m) {
+        std::string payload = std::to_string(m);
+        EXPECT_EQ(ps.publish("jobs", payload), 200u);
+        expected += ">3\r\n$7\r\nmessage\r\n$4\r\njobs\r\n$" +
+            std::to_string(payload.size()) + "\r\n" + payload + "\r\n";
+    }
+    for (int cli : clients) {
+        ASSERT_EQ(read_frame(cli, expected.size()), expected);
+    }
+}
+
+TEST_F(PubSubTest, UnsubscribeAndDrop) {
+    auto [a, cli_a] = pair();
+    auto [b, cli_b] = pair();
+    ps.subscribe(a, "c1");
+    EXPECT_EQ(ps.subscribe(a, "c2"), 2u);
+    ps.subscribe(b, "c1");
+    EXPECT_EQ(ps.unsubscribe(a, "c1"), 1u);
+    EXPECT_EQ(ps.publish("c1", "m"), 1u);
+    ps.drop(b);
+    EXPECT_EQ(ps.publish("c1", "m"), 0u);
+    EXPECT_EQ(ps.subscriptions(b), 0u);
+    EXPECT_EQ(ps.channels(a), std::vector<std::string>{"c2"});
+}
+
+TEST_F(PubSubTest, Commands) {
+    auto [srv, cli] = pair();
+    net::resp::Command sub{{"subscribe", "a", "b"}};
+    ASSERT_TRUE(ps.handle(srv, sub));
+    std::string expected =
+        ">3\r\n$9\r\nsubscribe\r\n$1\r\na\r\n:1\r\n"
+        ">3\r\n$9\r\nsubscribe\r\n$1\r\nb\r\n:2\r\n";
+    EXPECT_EQ(read_frame(cli, expected.size()), expected);
+
+    // the publisher is subscribed too : its reply goes after the message
+    net::resp::Command pub{{"PUBLISH", "a", "hi"}};
+    ASSERT_TRUE(ps.handle(srv, pub));
+    expected = ">3\r\n$7\r\nmessage\r\n$1\r\na\r\n$2\r\nhi\r\n:1\r\n";
+    EXPECT_EQ(read_frame(cli, expected.size()), expected);
+
+    net::resp::Command unsub{{"UNSUBSCRIBE"}};
+    ASSERT_TRUE(ps.handle(srv, unsub));
+    EXPECT_EQ(ps.subscriptions(srv), 0u);
+
+    net::resp::Command get{{"GET", "a"}};
+    EXPECT_FALSE(ps.handle(srv, get));
+}
+
+TEST_F(PubSubTest, OutboxTakesEveryWrite) {
+    auto [srv, cli] = pair();
+    ps.open(srv);
+    // bigger than the socket buffer : the courier sends it in several goes
+    std::string big = ">2\r\n$4\r\nlong\r\n$" + std::to_string(1 << 22) + "\r\n" + std::string(1 << 22, 'x') + "\r\n";
+    ps.push(srv, std::make_shared<const std::string>(big));
+    net::write_stream(srv, "+OK\r\n", 5);
+    std::string expected = big + "+OK\r\n";
+    EXPECT_TRUE(read_frame(cli, expected.size()) == expected);
+
+    ps.drop(srv);
+    ps.push(srv, std::make_shared<const std::string>(big));
+    net::write_stream(srv, "+OK\r\n", 5);
+    EXPECT_EQ(read_frame(cli, 5), "+OK\r\n");
+}
+
+TEST_F(PubSubTest, QuitAfterSubscribe) {
+    auto [srv, cli] = pair();
+    net::resp::Command sub{{"SUBSCRIBE", "a"}};
+    ASSERT_TRUE(ps.handle(srv, sub));
+    std::string expected = ">3\r\n$9\r\nsubscribe\r\n$1\r\na\r\n:1\r\n";
+    EXPECT_EQ(read_frame(cli, expected.size()), expected);
+
+    // +OK waits behind a message the courier sends in several goes, the
+    // socket is only shut down after it
+    std::string big(1 << 22, 'x');
+    ps.publish("a", big);
+    net::resp::Command quit{{"QUIT"}};
+    ASSERT_TRUE(commands::connection(srv, quit));
+    expected = ">3\r\n$7\r\nmessage\r\n$1\r\na\r\n$" + std::to_string(big.size()) + "\r\n" + big + "\r\n+OK\r\n";
+    EXPECT_TRUE(read_frame(cli, expected.size()) == expected);
+    char c;
+    EXPECT_EQ(read(cli, &c, 1), 0) << "connection should be closed after QUIT";
+    EXPECT_EQ(read(srv, &c, 1), 0) << "the serving thread should read EOF";
+}
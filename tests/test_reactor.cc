@@ -0,0 +1,218 @@
+#include <gtest/gtest.h>
+#include "datastructures/spsc_ring.h"
+#include "commands/blocking.h"
+#include "reactor/reactor.h"
+#include "resp/resp_utils.h"
+#include <poll.h>
+#include <sys/socket.h>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+TEST(SPSCRingTest, Bounded) {
+    data::SPSCRing<int> ring(3);
+    EXPECT_EQ(ring.capacity(), 4u);
+    for (int k = 0 ; k < 4 ; ++k) EXPECT_TRUE(ring.push(k));
+    EXPECT_FALSE(ring.push(4));
+    EXPECT_EQ(ring.pop(), 0);
+    EXPECT_TRUE(ring.push(4));
+    for (int k = 1 ; k < 5 ; ++k) EXPECT_EQ(ring.pop(), k);
+    EXPECT_FALSE(ring.pop().has_value());
+}
+
+TEST(SPSCRingTest, KeepsOrderAcrossThreads) {
+    data::SPSCRing<size_t> ring(64);
+    constexpr size_t n = 100000;
+    std::thread producer([&] {
+        for (size_t k = 0 ; k < n ; ++k) {
+            while (!ring.push(k)) std::this_thread::yield();
+        }
+    });
+    size_t expected = 0;
+    while (expected < n) {
+        if (auto v = ring.pop()) {
+            ASSERT_EQ(*v, expected);
+            ++expected;
+        } else {
+            std::this_thread::yield();
+        }
+    }
+    producer.join();
+}
+
+class ReactorTest : public testing::Test {
+protected:
+    // runs argv through reactor home
+    std::string run(size_t home, commands::Args argv) {
+        std::string out;
+        reactors.execute(home, *table.lookup(argv[0]), argv, out);
+        return out;
+    }
+
+    store::Keyspace ks;
+    commands::Table table{ks};
+    reactor::Reactors reactors{table, 4};
+};
+
+TEST_F(ReactorTest, ForwardsToOwner) {
+    EXPECT_EQ(reactors.size(), 4u);
+    EXPECT_EQ(reactors.owner(5), 1u);
+    // whatever reactor a key lands on, every home sees the same value
+    for (size_t home = 0 ; home < 4 ; ++home) {
+        EXPECT_EQ(run(home, {"INCR", "counter"}), net::resp::integer(static_cast<int64_t>(home + 1)));
+    }
+    EXPECT_EQ(run(2, {"GET", "counter"}), "$1\r\n4\r\n");
+    EXPECT_GT(reactors.forwarded(), 0u);
+    EXPECT_EQ(run(1, {"PING"}), "+PONG\r\n");
+    EXPECT_EQ(run(3, {"SET", "text", "abc"}), "+OK\r\n");
+    EXPECT_EQ(run(0, {"INCR", "text"}).substr(0, 4), "-ERR");
+}
+
+TEST_F(ReactorTest, ScatterGather) {
+    std::vector<std::string> keys;
+    commands::Args mset = {"MSET"}, mget = {"MGET"}, del = {"DEL"};
+    for (int k = 0 ; k < 64 ; ++k) keys.push_back("key:" + std::to_string(k));
+    for (auto& k : keys) {
+        mset.push_back(k);
+        mset.push_back(k);
+        mget.push_back(k);
+    }
+    mget.push_back("missing");
+    EXPECT_EQ(run(0, mset), "+OK\r\n");
+
+    std::string expected = "*65\r\n";
+    for (auto& k : keys) expected += net::resp::bulk(k);
+    expected += "_\r\n";
+    EXPECT_EQ(run(1, mget), expected);
+
+    EXPECT_EQ(run(2, {"EXISTS", "key:1", "key:2", "missing", "key:1"}), ":3\r\n");
+    for (int k = 0 ; k < 32 ; ++k) del.push_back(keys[k]);
+    del.push_back("missing");
+    EXPECT_EQ(run(3, del), ":32\r\n");
+    EXPECT_EQ(run(0, {"DBSIZE"}), ":32\r\n");
+}
+
+TEST_F(ReactorTest, ConcurrentClients) {
+    std::vector<std::thread> clients;
+    for (size_t c = 0 ; c < 8 ; ++c) {
+        clients.emplace_back([this, c] {
+            for (int k = 0 ; k < 2000 ; ++k) {
+                std::string key = "n:" + std::to_string(k % 16);
+                run(c, {"INCR", key});
+            }
+        });
+    }
+    for (auto& t : clients) t.join();
+    for (int k = 0 ; k < 16 ; ++k) {
+        std::string key = "n:" + std::to_string(k);
+        EXPECT_EQ(run(0, {"GET", key}), "$4\r\n1000\r\n");
+    }
+}
+
+TEST_F(ReactorTest, Guard) {
+    // refuses client 7's commands on keys starting with "no", and counts the
+    // keys it saw
+    std::atomic<int> seen{0};
+    table.guard([&seen] (int fd, const commands::Spec& spec, const commands::Args& argv, std::string& out) {
+        commands::KeyRange keys = commands::key_range(spec, argv);
+        bool ok = true;
+        for (int k = keys.first ; k <= keys.last ; k += keys.step) {
+            ++seen;
+            if (fd == 7 && argv[k].substr(0, 2) == "no") ok = false;
+        }
+        if (!ok) out += "-ERR refused\r\n";
+        return ok;
+    });
+    auto call = [this] (size_t home, commands::Args argv, int fd) {
+        std::string out;
+        reactors.call(home, *table.lookup(argv[0]), argv, out, {}, fd).run();
+        return out;
+    };
+    for (size_t home = 0 ; home < 4 ; ++home) {
+        EXPECT_EQ(call(home, {"SET", "nope", "1"}, 7), "-ERR refused\r\n");
+        EXPECT_EQ(call(home, {"SET", "yes", "1"}, 7), "+OK\r\n");
+    }
+    EXPECT_EQ(call(0, {"SET", "nope", "1"}, 8), "+OK\r\n");
+    EXPECT_EQ(run(0, {"GET", "nope"}), "$1\r\n1\r\n");
+
+    // not split per owner : the guard sees every key at once
+    commands::Args mget = {"MGET"};
+    std::vector<std::string> keys;
+    for (int k = 0 ; k < 32 ; ++k) keys.push_back("key:" + std::to_string(k));
+    for (auto& k : keys) mget.push_back(k);
+    mget.push_back("nope");
+    size_t forwarded = reactors.forwarded();
+    seen = 0;
+    EXPECT_EQ(call(1, mget, 7), "-ERR refused\r\n");
+    EXPECT_EQ(seen.load(), 33);
+    EXPECT_EQ(reactors.forwarded(), forwarded);
+    table.guard({});
+}
+
+TEST_F(ReactorTest, ClientHooks) {
+    // what the read hook saw, and the client writes ran for
+    std::mutex m;
+    std::vector<std::pair<int, std::string>> reads;
+    std::vector<int> writers;
+    table.on_read([&] (int fd, const commands::Spec& spec, const commands::Args& argv) {
+        commands::KeyRange keys = commands::key_range(spec, argv);
+        std::lock_guard<std::mutex> l(m);
+        for (int k = keys.first ; k <= keys.last ; k += keys.step) reads.emplace_back(fd, argv[k]);
+    });
+    size_t hook = table.after_write([&] (const commands::Spec&, const commands::Args&) {
+        std::lock_guard<std::mutex> l(m);
+        writers.push_back(commands::Table::client());
+    });
+    std::string out;
+    for (size_t home = 0 ; home < 4 ; ++home) {
+        commands::Args set = {"SET", "k", "v"};
+        reactors.call(home, *table.lookup("SET"), set, out, {}, 7).run();
+    }
+    EXPECT_EQ(writers, std::vector<int>(4, 7));
+
+    // split per owner, every share is shown as client 7's
+    commands::Args mget = {"MGET"};
+    std::vector<std::string> keys;
+    for (int k = 0 ; k < 32 ; ++k) keys.push_back("key:" + std::to_string(k));
+    for (auto& k : keys) mget.push_back(k);
+    size_t forwarded = reactors.forwarded();
+    reactors.call(1, *table.lookup("MGET"), mget, out, {}, 7).run();
+    EXPECT_GT(reactors.forwarded(), forwarded);
+    std::sort(reads.begin(), reads.end());
+    std::vector<std::pair<int, std::string>> expected;
+    for (auto& k : keys) expected.emplace_back(7, k);
+    std::sort(expected.begin(), expected.end());
+    EXPECT_EQ(reads, expected);
+    EXPECT_EQ(commands::Table::client(), -1);
+
+    table.drop_after_write(hook);
+    table.on_read({});
+}
+
+TEST_F(ReactorTest, LeavesBlockingCommands) {
+    commands::Blocking blocking(table);
+    int sv[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+    EXPECT_FALSE(reactors.handle(sv[0], {{"BLPOP", "l", "0"}}).run());
+    EXPECT_FALSE(reactors.handle(sv[0], {{"BLMOVE", "a", "b", "LEFT", "RIGHT", "0"}}).run());
+    EXPECT_FALSE(reactors.handle(sv[0], {{"XREADGROUP", "GROUP", "g", "c", "block", "0", "STREAMS", "s", ">"}}).run());
+
+    net::resp::Command xread{{"XREAD", "BLOCK", "0", "STREAMS", "s", "$"}};
+    ASSERT_FALSE(reactors.handle(sv[0], xread).run());
+    std::thread reader([&] { EXPECT_TRUE(blocking.handle(sv[0], xread).run()); });
+    while (blocking.blocked() != 1) std::this_thread::yield();
+    // written on another core than the reader's
+    EXPECT_EQ(run(3, {"XADD", "s", "1-1", "f", "v"}), "$3\r\n1-1\r\n");
+    reader.join();
+    std::string expected = "%1\r\n$1\r\ns\r\n*1\r\n*2\r\n$3\r\n1-1\r\n*2\r\n$1\r\nf\r\n$1\r\nv\r\n";
+    std::string got(expected.size(), '\0');
+    struct pollfd p = {sv[1], POLLIN, 0};
+    ASSERT_GT(poll(&p, 1, 1000), 0);
+    EXPECT_EQ(read(sv[1], got.data(), got.size()), static_cast<ssize_t>(expected.size()));
+    EXPECT_EQ(got, expected);
+    close(sv[0]);
+    close(sv[1]);
+}
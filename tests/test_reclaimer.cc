@@ -0,0 +1,70 @@
+#include <gtest/gtest.h>
+#include "commands/table.h"
+#include "store/reclaimer.h"
+#include <chrono>
+#include <string>
+#include <thread>
+
+class ReclaimerTest : public testing::Test {
+protected:
+    void SetUp() override {
+        ks.reclaimer(&reclaimer);
+    }
+
+    std::string run(commands::Args argv) {
+        std::string out;
+        table.call(*table.lookup(argv[0]), argv, out);
+        return out;
+    }
+
+    // pushes n elements in one command
+    void fill(const std::string& key, size_t n) {
+        commands::Args argv = {"RPUSH", key};
+        std::string e = "element";
+        for (size_t k = 0 ; k < n ; ++k) argv.push_back(e);
+        run(argv);
+    }
+
+    bool freed(uint64_t n) {
+        for (int k = 0 ; k < 1000 && reclaimer.freed() < n ; ++k) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return reclaimer.freed() == n && reclaimer.pending() == 0;
+    }
+
+    store::Reclaimer reclaimer;
+    store::Keyspace ks;
+    commands::Table table{ks};
+};
+
+TEST_F(ReclaimerTest, FreesLargeValuesInTheBackground) {
+    fill("big", 10000);
+    fill("small", 10);
+    EXPECT_EQ(run({"UNLINK", "big", "small"}), ":2\r\n");
+    EXPECT_TRUE(freed(1));
+    EXPECT_EQ(run({"EXISTS", "big"}), ":0\r\n");
+
+    // overwritten, and deleted by DEL
+    fill("big", 10000);
+    EXPECT_EQ(run({"SET", "big", "v"}), "+OK\r\n");
+    EXPECT_TRUE(freed(2));
+    fill("other", 10000);
+    EXPECT_EQ(run({"DEL", "other"}), ":1\r\n");
+    EXPECT_TRUE(freed(3));
+    std::string info = run({"INFO", "lazyfree"});
+    EXPECT_NE(info.find("lazyfreed_objects:3\r\n"), std::string::npos);
+}
+
+TEST_F(ReclaimerTest, FlushAllAsync) {
+    for (int k = 0 ; k < 1000 ; ++k) run({"SET", "key:" + std::to_string(k), "v", "EX", "100"});
+    EXPECT_EQ(run({"FLUSHALL", "ASYNC"}), "+OK\r\n");
+    // a table and its deadlines per shard
+    EXPECT_TRUE(freed(2 * store::Keyspace::k_shards));
+    EXPECT_EQ(run({"DBSIZE"}), ":0\r\n");
+    EXPECT_EQ(run({"TTL", "key:1"}), ":-2\r\n");
+    EXPECT_EQ(run({"SET", "key:1", "w"}), "+OK\r\n");
+    EXPECT_EQ(run({"GET", "key:1"}), "$1\r\nw\r\n");
+    EXPECT_EQ(run({"FLUSHALL", "SYNC"}), "+OK\r\n");
+    EXPECT_EQ(run({"FLUSHALL", "LATER"}), "-ERR syntax error\r\n");
+    EXPECT_EQ(reclaimer.freed(), 2 * store::Keyspace::k_shards);
+}
@@ -0,0 +1,194 @@
+#include <gtest/gtest.h>
+#include "replication/replication.h"
+#include "resp/resp_utils.h"
+#include <dirent.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <chrono>
+#include <string>
+#include <thread>
+
+#define PORT      ntohs(1339)
+// 127.0.0.1
+#define IP        ntohl(INADDR_LOOPBACK)
+#define K_MAX_MSG 4096
+
+// the master runs in its own process, like a real deployment on loopback
+class ReplicationTest : public testing::Test {
+protected:
+    void SetUp() override {
+        _master = fork();
+        ASSERT_GE(_master, 0);
+        if (_master == 0) {
+            signal(SIGPIPE, SIG_IGN);
+            net::resp::Redis redis(IP, PORT, K_MAX_MSG);
+            store::Keyspace ks;
+            commands::Table table(ks);
+            table.attach(redis);
+            replication::Replication repl(table);
+            repl.attach(redis);
+            redis.accept_all();
+            _exit(0);
+        }
+    }
+
+    void TearDown() override {
+        kill(_master, SIGKILL);
+        waitpid(_master, nullptr, 0);
+    }
+
+    // a connection to the master, past the handshake
+    int client() {
+        for (int tries = 0 ; tries < 100 ; ++tries) {
+            int fd = socket(AF_INET, SOCK_STREAM, 0);
+            struct sockaddr_in addr = {};
+            addr.sin_family = AF_INET;
+            addr.sin_port = PORT;
+            addr.sin_addr.s_addr = IP;
+            if (connect(fd, (const struct sockaddr*)&addr, sizeof(addr)) == 0) {
+                EXPECT_EQ(send(fd, "HELLO 3\r\n"), "+OK\r\n");
+                return fd;
+            }
+            close(fd);
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        ADD_FAILURE() << "master not reachable";
+        return -1;
+    }
+
+    // writes req and returns what arrives until the line goes quiet
+    static std::string send(int fd, const std::string& req) {
+        net::write_stream(fd, req.data(), req.size());
+        return receive(fd);
+    }
+
+    static std::string receive(int fd) {
+        std::string s;
+        char buf[4096];
+        struct pollfd p = {fd, POLLIN, 0};
+        int timeout = 1000;
+        while (poll(&p, 1, timeout) > 0) {
+            ssize_t rv = read(fd, buf, sizeof(buf));
+            if (rv <= 0) break;
+            s.append(buf, rv);
+            timeout = 50;
+        }
+        return s;
+    }
+
+private:
+    pid_t _master = -1;
+};
+
+static std::string resp(std::initializer_list<std::string> argv) {
+    std::string s;
+    data::write_header(s, data::Type::Array, argv.size());
+    for (auto& a : argv) s += net::resp::bulk(a);
+    return s;
+}
+
+TEST_F(ReplicationTest, PartialResync) {
+    int c = client();
+    ASSERT_GE(c, 0);
+    std::string set_a = resp({"set", "a", "1"});
+    EXPECT_EQ(send(c, set_a), "+OK\r\n");
+
+    // full resync : the snapshot, then the stream
+    int r = client();
+    std::string full = send(r, resp({"PSYNC", "?", "-1"}));
+    ASSERT_EQ(full.substr(0, 12), "+FULLRESYNC ");
+    std::string replid = full.substr(12, 40);
+    size_t eol = full.find("\r\n");
+    uint64_t offset = std::stoull(full.substr(53, eol - 53));
+    EXPECT_EQ(offset, set_a.size());
+    std::string snapshot = resp({"SET", "a", "1"});
+    EXPECT_EQ(full.substr(eol + 2), "$" + std::to_string(snapshot.size()) + "\r\n" + snapshot);
+
+    // the bytes the client sent are forwarded as is
+    std::string set_b = resp({"sEt", "b", "2"});
+    EXPECT_EQ(send(c, set_b), "+OK\r\n");
+    EXPECT_EQ(receive(r), set_b);
+    offset += set_b.size();
+    close(r);
+
+    // failed writes are not propagated, the others are picked up on reconnect
+    EXPECT_EQ(send(c, resp({"INCR", "a"})), ":2\r\n");
+    EXPECT_EQ(send(c, resp({"INCR", "b2", "x"})).substr(0, 4), "-ERR");
+    EXPECT_EQ(send(c, "SET c 3\r\n"), "+OK\r\n");
+    r = client();
+    EXPECT_EQ(send(r, resp({"PSYNC", replid, std::to_string(offset)})),
+              "+CONTINUE " + replid + "\r\n" + resp({"INCR", "a"}) + resp({"SET", "c", "3"}));
+    close(r);
+
+    // unknown history or offset
+    r = client();
+    EXPECT_EQ(send(r, resp({"PSYNC", "nope", "0"})).substr(0, 12), "+FULLRESYNC ");
+    close(r);
+    r = client();
+    EXPECT_EQ(send(r, resp({"PSYNC", replid, std::to_string(offset + 1000)})).substr(0, 12), "+FULLRESYNC ");
+    close(r);
+    close(c);
+}
+
+TEST_F(ReplicationTest, Replica) {
+    int c = client();
+    ASSERT_GE(c, 0);
+    EXPECT_EQ(send(c, resp({"SET", "before", "1"})), "+OK\r\n");
+
+    store::Keyspace ks;
+    commands::Table table(ks);
+    replication::Replication repl(table);
+    repl.replicaof("127.0.0.1", ntohs(PORT));
+
+    auto get = [&] (std::string_view key) {
+        std::string out;
+        table.call(*table.lookup("GET"), {"GET", key}, out);
+        return out;
+    };
+    auto wait_for = [&] (std::string_view key, const std::string& expected) {
+        for (int k = 0 ; k < 200 && get(key) != expected ; ++k) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        return get(key);
+    };
+
+    EXPECT_EQ(wait_for("before", "$1\r\n1\r\n"), "$1\r\n1\r\n");
+    send(c, resp({"INCR", "n"}));
+    send(c, resp({"INCR", "n"}));
+    EXPECT_EQ(wait_for("n", "$1\r\n2\r\n"), "$1\r\n2\r\n");
+    EXPECT_EQ(repl.full_syncs(), 1u);
+
+    // writes from clients of a replica are refused
+    int sv[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+    EXPECT_TRUE(repl.handle(sv[0], {{"SET", "k", "v"}}));
+    EXPECT_EQ(receive(sv[1]).substr(0, 9), "-READONLY");
+    EXPECT_FALSE(repl.handle(sv[0], {{"GET", "k"}}));
+    close(sv[0]);
+    close(sv[1]);
+
+    // cut the link : the replica comes back with a partial resync
+    DIR* d = opendir("/proc/self/fd");
+    ASSERT_NE(d, nullptr);
+    while (auto* e = readdir(d)) {
+        int fd = atoi(e->d_name);
+        struct sockaddr_in peer = {};
+        socklen_t len = sizeof(peer);
+        if (fd != c && getpeername(fd, (struct sockaddr*)&peer, &len) == 0
+            && peer.sin_family == AF_INET && peer.sin_port == PORT) {
+            shutdown(fd, SHUT_RDWR);
+        }
+    }
+    closedir(d);
+    send(c, resp({"INCR", "n"}));
+    EXPECT_EQ(wait_for("n", "$1\r\n3\r\n"), "$1\r\n3\r\n");
+    EXPECT_EQ(repl.full_syncs(), 1u);
+    EXPECT_EQ(repl.partial_syncs(), 1u);
+
+    // a former replica keeps its data
+    repl.replicaof("", 0);
+    EXPECT_FALSE(repl.is_replica());
+    EXPECT_EQ(get("n"), "$1\r\n3\r\n");
+    close(c);
+}
@@ -103,11 +103,12 @@ static inline std::string generate_random(size_t max_sz) {
                 break;
             case 1:
                 // bulk string
-                bs_len = rand();
+                bs.clear();
+                bs_len = rand() % 16;
                 for (int j = 0 ; j < bs_len ; ++j) {
                     bs += std::to_string(rand());
                 }
-                res += bs;
+                res += std::format("${}\r\n{}\r\n", bs.size(), bs);
                 break;
             case 2:
                 // array
@@ -345,4 +346,217 @@ TEST_F(RESPTest, StressRESP) {
     }
 
     close(fd);
-}
\ No newline at end of file
+}
+TEST_F(RESPTest, ParseRESP3) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    ASSERT_GE(fd, 0) << "socket() failed";
+
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = PORT;
+    addr.sin_addr.s_addr = IP;
+
+    int rv = connect(fd, (const struct sockaddr*)&addr, sizeof(addr));
+    ASSERT_EQ(rv, 0) << "connect() failed";
+
+    // handshake
+    write_view(fd, "HELLO 3\r\n", sizeof("HELLO 3\r\n") - 1);
+    std::string hresp = read_n(fd, 5);
+    ASSERT_EQ(hresp, "+OK\r\n") << "Handshake failed: " << hresp;
+
+    const std::vector<std::string> sent = {
+        "-ERR bad\r\n",
+        "_\r\n",
+        "#t\r\n",
+        "#f\r\n",
+        ",1.5\r\n",
+        ",-inf\r\n",
+        "(3492890328409238509324850943850943825024385\r\n",
+        "!21\r\nSYNTAX invalid syntax\r\n",
+        "=15\r\ntxt:Some string\r\n",
+        "$-1\r\n",
+        "%2\r\n+first\r\n:1\r\n$6\r\nsecond\r\n#f\r\n",
+        "~3\r\n:1\r\n:2\r\n,3.25\r\n",
+        "|1\r\n+ttl\r\n:3600\r\n*1\r\n$3\r\nfoo\r\n",
+        ">2\r\n$7\r\nmessage\r\n%0\r\n",
+        ":9223372036854775807\r\n",
+    };
+    for (auto& s : sent) {
+        write_view(fd, s, s.size());
+        std::string ack = read_n(fd, 5);
+        ASSERT_EQ(ack, "+OK\r\n") << "Server did not ack " << s << ": " << ack;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    while (received_count_resp.load(std::memory_order_acquire) < (int)sent.size()) {
+        if (std::chrono::steady_clock::now() - start > std::chrono::seconds(2)) break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+
+    ASSERT_EQ(received_count_resp.load(), (int)sent.size()) << "Server did not receive everything";
+    for (size_t k = 0 ; k < sent.size() ; ++k) {
+        auto &node = buf_resp[k];
+        ASSERT_NE(node, nullptr);
+        EXPECT_EQ(node->to_resp(), sent[k]);
+    }
+
+    close(fd);
+}
+
+TEST_F(RESPTest, InlineCommands) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    ASSERT_GE(fd, 0) << "socket() failed";
+
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = PORT;
+    addr.sin_addr.s_addr = IP;
+
+    int rv = connect(fd, (const struct sockaddr*)&addr, sizeof(addr));
+    ASSERT_EQ(rv, 0) << "connect() failed";
+
+    // handshake
+    write_view(fd, "HELLO 3\r\n", sizeof("HELLO 3\r\n") - 1);
+    std::string hresp = read_n(fd, 5);
+    ASSERT_EQ(hresp, "+OK\r\n") << "Handshake failed: " << hresp;
+
+    // answered by the parser itself, the worker never sees them
+    write_view(fd, "PING\r\n", 6);
+    EXPECT_EQ(read_n(fd, 7), "+PONG\r\n");
+    write_view(fd, "ping hello\n", 11);
+    EXPECT_EQ(read_n(fd, 11), "$5\r\nhello\r\n");
+    write_view(fd, "ECHO  hi \r\n", 11);
+    EXPECT_EQ(read_n(fd, 8), "$2\r\nhi\r\n");
+    EXPECT_EQ(received_count_resp.load(), 0);
+
+    // other inline commands are handed over as arrays of bulk strings
+    const std::string sent = "SET key\tvalue\r\n";
+    write_view(fd, sent, sent.size());
+    std::string ack = read_n(fd, 5);
+    ASSERT_EQ(ack, "+OK\r\n") << "Server did not ack inline command: " << ack;
+    ASSERT_EQ(received_count_resp.load(), 1);
+    auto &node = buf_resp[0];
+    ASSERT_NE(node, nullptr);
+    EXPECT_EQ(node->to_resp(), "*3\r\n$3\r\nSET\r\n$3\r\nkey\r\n$5\r\nvalue\r\n");
+
+    write_view(fd, "QUIT\r\n", 6);
+    EXPECT_EQ(read_n(fd, 5), "+OK\r\n");
+    char c;
+    EXPECT_EQ(read(fd, &c, 1), 0) << "connection should be closed after QUIT";
+
+    close(fd);
+}
+
+TEST_F(RESPTest, InlineOnlyAtTopLevel) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    ASSERT_GE(fd, 0) << "socket() failed";
+
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = PORT;
+    addr.sin_addr.s_addr = IP;
+
+    int rv = connect(fd, (const struct sockaddr*)&addr, sizeof(addr));
+    ASSERT_EQ(rv, 0) << "connect() failed";
+
+    // handshake
+    write_view(fd, "HELLO 3\r\n", sizeof("HELLO 3\r\n") - 1);
+    std::string hresp = read_n(fd, 5);
+    ASSERT_EQ(hresp, "+OK\r\n") << "Handshake failed: " << hresp;
+
+    // elements of an array are never inline, the connection is closed
+    const std::string sent = "*2\r\nGET\r\nfoo\r\n";
+    write_view(fd, sent, sent.size());
+    const std::string refused = "-ERR Protocol error: expected a RESP type, got an inline command\r\n";
+    EXPECT_EQ(read_n(fd, refused.size()), refused);
+    char c;
+    // reset rather than closed : the rest of the array was left unread
+    EXPECT_LE(read(fd, &c, 1), 0) << "connection should be closed after a protocol error";
+    EXPECT_EQ(received_count_resp.load(), 0);
+    close(fd);
+}
+
+TEST_F(RESPTest, RejectsHugeAggregates) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    ASSERT_GE(fd, 0) << "socket() failed";
+
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = PORT;
+    addr.sin_addr.s_addr = IP;
+
+    int rv = connect(fd, (const struct sockaddr*)&addr, sizeof(addr));
+    ASSERT_EQ(rv, 0) << "connect() failed";
+
+    // handshake
+    write_view(fd, "HELLO 3\r\n", sizeof("HELLO 3\r\n") - 1);
+    std::string hresp = read_n(fd, 5);
+    ASSERT_EQ(hresp, "+OK\r\n") << "Handshake failed: " << hresp;
+
+    // refused before anything is allocated for them, the server goes on
+    const std::string refused = "-ERR Protocol error: invalid aggregate length\r\n";
+    for (std::string sent : {"*2000000000\r\n", "%1000000000\r\n", "~9223372036854775807\r\n", "*-5\r\n",
+                             "%4611686018427387904\r\n", "*200\r\n"}) {
+        write_view(fd, sent, sent.size());
+        EXPECT_EQ(read_n(fd, refused.size()), refused) << sent;
+    }
+    EXPECT_EQ(received_count_resp.load(), 0);
+
+    const std::string sent = "*2\r\n:1\r\n_\r\n";
+    write_view(fd, sent, sent.size());
+    std::string ack = read_n(fd, 5);
+    ASSERT_EQ(ack, "+OK\r\n") << "Server did not ack array: " << ack;
+    close(fd);
+}
+
+TEST_F(RESPTest, SkipsOversizeBulks) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    ASSERT_GE(fd, 0) << "socket() failed";
+
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = PORT;
+    addr.sin_addr.s_addr = IP;
+
+    int rv = connect(fd, (const struct sockaddr*)&addr, sizeof(addr));
+    ASSERT_EQ(rv, 0) << "connect() failed";
+
+    // handshake
+    write_view(fd, "HELLO 3\r\n", sizeof("HELLO 3\r\n") - 1);
+    std::string hresp = read_n(fd, 5);
+    ASSERT_EQ(hresp, "+OK\r\n") << "Handshake failed: " << hresp;
+
+    // a value longer than a message, made of requests : none of them is run
+    std::string value;
+    while (value.size() < 4 * K_MAX_MSG) value += "*1\r\n$8\r\nFLUSHALL\r\n";
+    std::string sent = "*3\r\n$3\r\nSET\r\n$3\r\nkey\r\n$";
+    sent += std::to_string(value.size());
+    sent += "\r\n";
+    sent += value;
+    sent += "\r\n";
+    // the elements following the oversize one are dropped with it
+    sent += "%2\r\n+a\r\n$";
+    sent += std::to_string(value.size());
+    sent += "\r\n";
+    sent += value;
+    sent += "\r\n+b\r\n:2\r\n";
+    sent += "PING\r\n";
+    write_view(fd, sent, sent.size());
+
+    const std::string refused = "-ERR Protocol error: bulk string too large for a request\r\n";
+    EXPECT_EQ(read_n(fd, refused.size()), refused);
+    EXPECT_EQ(read_n(fd, refused.size()), refused);
+    EXPECT_EQ(read_n(fd, 7), "+PONG\r\n");
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    char c;
+    EXPECT_EQ(recv(fd, &c, 1, MSG_DONTWAIT), -1) << "PING should get a single reply";
+    EXPECT_EQ(received_count_resp.load(), 0);
+
+    // past what is ever accepted, the connection is closed without reading on
+    sent = "$1000000000\r\n";
+    write_view(fd, sent, sent.size());
+    const std::string invalid = "-ERR Protocol error: invalid bulk length\r\n";
+    EXPECT_EQ(read_n(fd, invalid.size()), invalid);
+    EXPECT_EQ(read(fd, &c, 1), 0) << "connection should be closed after an invalid bulk length";
+    close(fd);
+}
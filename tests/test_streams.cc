@@ -0,0 +1,167 @@
+#include <gtest/gtest.h>
+#include "commands/table.h"
+#include <string>
+#include <vector>
+
+class StreamsTest : public testing::Test {
+protected:
+    std::string call(commands::Args argv) {
+        std::string out;
+        table.call(*table.lookup(argv[0]), argv, out);
+        return out;
+    }
+
+    store::Keyspace ks;
+    commands::Table table{ks};
+};
+
+TEST_F(StreamsTest, AddAndRange) {
+    EXPECT_EQ(call({"XADD", "s", "1-1", "a", "1"}), "$3\r\n1-1\r\n");
+    EXPECT_EQ(call({"XADD", "s", "1-*", "a", "2"}), "$3\r\n1-2\r\n");
+    EXPECT_EQ(call({"XADD", "s", "2", "b", "3", "c", "4"}), "$3\r\n2-0\r\n");
+    EXPECT_EQ(call({"XADD", "s", "2-0", "a", "5"}),
+              "-ERR The ID specified in XADD is equal or smaller than the target stream top item\r\n");
+    EXPECT_EQ(call({"XADD", "s", "1-*", "a", "5"}),
+              "-ERR The ID specified in XADD is equal or smaller than the target stream top item\r\n");
+    EXPECT_EQ(call({"XADD", "new", "0-0", "a", "5"}), "-ERR The ID specified in XADD must be greater than 0-0\r\n");
+    EXPECT_EQ(call({"XADD", "s", "3-x", "a", "5"}), "-ERR Invalid stream ID specified as stream command argument\r\n");
+    EXPECT_EQ(call({"XADD", "s", "*", "a"}), "-ERR wrong number of arguments for 'xadd' command\r\n");
+    EXPECT_EQ(call({"XADD", "none", "NOMKSTREAM", "*", "a", "1"}), "_\r\n");
+    EXPECT_EQ(call({"EXISTS", "none"}), ":0\r\n");
+    EXPECT_EQ(call({"XLEN", "s"}), ":3\r\n");
+    EXPECT_EQ(call({"TYPE", "s"}), "+stream\r\n");
+    EXPECT_EQ(call({"GET", "s"}), "-WRONGTYPE Operation against a key holding the wrong kind of value\r\n");
+    EXPECT_EQ(call({"INCR", "s"}), "-WRONGTYPE Operation against a key holding the wrong kind of value\r\n");
+
+    std::string first = "*2\r\n$3\r\n1-1\r\n*2\r\n$1\r\na\r\n$1\r\n1\r\n";
+    std::string second = "*2\r\n$3\r\n1-2\r\n*2\r\n$1\r\na\r\n$1\r\n2\r\n";
+    std::string third = "*2\r\n$3\r\n2-0\r\n*4\r\n$1\r\nb\r\n$1\r\n3\r\n$1\r\nc\r\n$1\r\n4\r\n";
+    EXPECT_EQ(call({"XRANGE", "s", "-", "+"}), "*3\r\n" + first + second + third);
+    EXPECT_EQ(call({"XRANGE", "s", "1", "1"}), "*2\r\n" + first + second);
+    EXPECT_EQ(call({"XRANGE", "s", "(1-1", "+", "COUNT", "1"}), "*1\r\n" + second);
+    EXPECT_EQ(call({"XRANGE", "s", "-", "+", "COUNT", "0"}), "*0\r\n");
+    EXPECT_EQ(call({"XREVRANGE", "s", "+", "-", "COUNT", "2"}), "*2\r\n" + third + second);
+    EXPECT_EQ(call({"XREVRANGE", "s", "(2-0", "(1-1"}), "*1\r\n" + second);
+    EXPECT_EQ(call({"XRANGE", "missing", "-", "+"}), "*0\r\n");
+
+    // replicas get the ID that was picked
+    std::vector<std::string> sent;
+    table.on_write([&] (const commands::Args& argv, std::string_view) {
+        sent.assign(argv.begin(), argv.end());
+    });
+    std::string picked = call({"XADD", "s", "MAXLEN", "2", "*", "d", "6"});
+    picked = picked.substr(picked.find("\r\n") + 2);
+    picked.resize(picked.size() - 2);
+    EXPECT_EQ(sent, (std::vector<std::string>{"XADD", "s", "MAXLEN", "2", picked, "d", "6"}));
+    table.on_write({});
+    EXPECT_EQ(call({"XLEN", "s"}), ":2\r\n");
+    EXPECT_EQ(call({"XTRIM", "s", "MAXLEN", "=", "1"}), ":1\r\n");
+    EXPECT_EQ(call({"XLEN", "s"}), ":1\r\n");
+    EXPECT_EQ(call({"XSETID", "s", "1-0"}),
+              "-ERR The ID specified in XSETID is smaller than the target stream top item\r\n");
+    EXPECT_EQ(call({"XSETID", "s", "99999999999999-0"}), "+OK\r\n");
+    EXPECT_EQ(call({"XADD", "s", "*", "e", "7"}), "$16\r\n99999999999999-1\r\n");
+}
+
+TEST_F(StreamsTest, ReadsAndGroups) {
+    EXPECT_EQ(call({"XADD", "s", "1-0", "f", "a"}), "$3\r\n1-0\r\n");
+    EXPECT_EQ(call({"XADD", "s", "2-0", "f", "b"}), "$3\r\n2-0\r\n");
+    std::string a = "*2\r\n$3\r\n1-0\r\n*2\r\n$1\r\nf\r\n$1\r\na\r\n";
+    std::string b = "*2\r\n$3\r\n2-0\r\n*2\r\n$1\r\nf\r\n$1\r\nb\r\n";
+    EXPECT_EQ(call({"XREAD", "COUNT", "1", "STREAMS", "s", "missing", "0", "0"}), "%1\r\n$1\r\ns\r\n*1\r\n" + a);
+    EXPECT_EQ(call({"XREAD", "STREAMS", "s", "1-0"}), "%1\r\n$1\r\ns\r\n*1\r\n" + b);
+    EXPECT_EQ(call({"XREAD", "STREAMS", "s", "$"}), "_\r\n");
+    EXPECT_EQ(call({"XREAD", "STREAMS", "s", "t", "0"}),
+              "-ERR Unbalanced 'xread' list of streams: for each stream key an ID or '$' must be specified.\r\n");
+
+    EXPECT_EQ(call({"XREADGROUP", "GROUP", "g", "alice", "STREAMS", "s", ">"}),
+              "-NOGROUP No such key 's' or consumer group 'g' in XREADGROUP with GROUP option\r\n");
+    EXPECT_EQ(call({"XGROUP", "CREATE", "s", "g", "0"}), "+OK\r\n");
+    EXPECT_EQ(call({"XGROUP", "CREATE", "s", "g", "$"}), "-BUSYGROUP Consumer Group name already exists\r\n");
+    EXPECT_EQ(call({"XGROUP", "CREATE", "nope", "g", "$"}).substr(0, 45), "-ERR The XGROUP subcommand requires the key t");
+    EXPECT_EQ(call({"XGROUP", "CREATE", "empty", "g", "$", "MKSTREAM"}), "+OK\r\n");
+    EXPECT_EQ(call({"XLEN", "empty"}), ":0\r\n");
+
+    EXPECT_EQ(call({"XREADGROUP", "GROUP", "g", "alice", "COUNT", "1", "STREAMS", "s", ">"}),
+              "%1\r\n$1\r\ns\r\n*1\r\n" + a);
+    EXPECT_EQ(call({"XREADGROUP", "GROUP", "g", "bob", "STREAMS", "s", ">"}), "%1\r\n$1\r\ns\r\n*1\r\n" + b);
+    EXPECT_EQ(call({"XREADGROUP", "GROUP", "g", "bob", "STREAMS", "s", ">"}), "_\r\n");
+    // history, what alice was given
+    EXPECT_EQ(call({"XREADGROUP", "GROUP", "g", "alice", "STREAMS", "s", "0"}), "%1\r\n$1\r\ns\r\n*1\r\n" + a);
+    EXPECT_EQ(call({"XPENDING", "s", "g"}), "*4\r\n:2\r\n$3\r\n1-0\r\n$3\r\n2-0\r\n*2\r\n"
+                                            "*2\r\n$5\r\nalice\r\n$1\r\n1\r\n*2\r\n$3\r\nbob\r\n$1\r\n1\r\n");
+    std::string pending = call({"XPENDING", "s", "g", "-", "+", "10", "alice"});
+    EXPECT_EQ(pending.substr(0, 29), "*1\r\n*4\r\n$3\r\n1-0\r\n$5\r\nalice\r\n:");
+    // delivered twice : once new, once from its history
+    EXPECT_EQ(pending.substr(pending.size() - 4), ":2\r\n");
+
+    EXPECT_EQ(call({"XCLAIM", "s", "g", "bob", "0", "1-0", "JUSTID"}), "*1\r\n$3\r\n1-0\r\n");
+    EXPECT_EQ(call({"XCLAIM", "s", "g", "bob", "3600000", "1-0"}), "*0\r\n");
+    EXPECT_EQ(call({"XPENDING", "s", "g"}), "*4\r\n:2\r\n$3\r\n1-0\r\n$3\r\n2-0\r\n*1\r\n"
+                                            "*2\r\n$3\r\nbob\r\n$1\r\n2\r\n");
+    EXPECT_EQ(call({"XACK", "s", "g", "1-0", "9-0"}), ":1\r\n");
+    EXPECT_EQ(call({"XACK", "s", "g", "x"}), "-ERR Invalid stream ID specified as stream command argument\r\n");
+    EXPECT_EQ(call({"XGROUP", "CREATECONSUMER", "s", "g", "carol"}), ":1\r\n");
+    EXPECT_EQ(call({"XGROUP", "DELCONSUMER", "s", "g", "bob"}), ":1\r\n");
+    EXPECT_EQ(call({"XPENDING", "s", "g"}), "*4\r\n:0\r\n_\r\n_\r\n_\r\n");
+    EXPECT_EQ(call({"XGROUP", "DESTROY", "s", "g"}), ":1\r\n");
+    EXPECT_EQ(call({"XPENDING", "s", "g"}), "-NOGROUP No such key 's' or consumer group 'g'\r\n");
+}
+
+TEST_F(StreamsTest, KeysAfterStreams) {
+    commands::Args read = {"XREAD", "COUNT", "2", "BLOCK", "0", "STREAMS", "a", "b", "0", "0"};
+    commands::KeyRange keys = commands::key_range(*table.lookup("XREAD"), read);
+    EXPECT_EQ(keys.first, 6);
+    EXPECT_EQ(keys.last, 7);
+    commands::Args group = {"XREADGROUP", "GROUP", "streams", "c", "NOACK", "STREAMS", "k", ">"};
+    keys = commands::key_range(*table.lookup("XREADGROUP"), group);
+    EXPECT_EQ(keys.first, 6);
+    EXPECT_EQ(keys.last, 6);
+    commands::Args unbalanced = {"XREAD", "STREAMS", "a", "b", "0"};
+    keys = commands::key_range(*table.lookup("XREAD"), unbalanced);
+    EXPECT_GT(keys.first, keys.last);
+    EXPECT_EQ(commands::Table::shards(*table.lookup("XREAD"), read),
+              commands::Table::shards(*table.lookup("MGET"), {"MGET", "a", "b"}));
+}
+
+TEST_F(StreamsTest, Recreates) {
+    for (int k = 1 ; k <= 300 ; ++k) {
+        std::string id = std::to_string(k) + "-1";
+        call({"XADD", "s", id, "n", std::to_string(k)});
+    }
+    EXPECT_EQ(call({"XTRIM", "s", "MAXLEN", "250"}), ":50\r\n");
+    call({"XGROUP", "CREATE", "s", "g", "0"});
+    call({"XREADGROUP", "GROUP", "g", "alice", "COUNT", "3", "STREAMS", "s", ">"});
+    call({"XGROUP", "CREATECONSUMER", "s", "g", "idle"});
+    call({"XGROUP", "CREATE", "e", "g2", "$", "MKSTREAM"});
+    call({"XSETID", "e", "7-7"});
+    // emptied, without any group
+    call({"XADD", "t", "3-1", "a", "b"});
+    call({"XTRIM", "t", "MAXLEN", "0"});
+
+    store::Keyspace copy_ks;
+    commands::Table copy{copy_ks};
+    for (auto key : {"s", "e", "t"}) {
+        commands::recreate(key, *ks.peek(key), -1, [&] (const commands::Args& argv) {
+            std::string out;
+            copy.call(*copy.lookup(argv[0]), argv, out);
+            ASSERT_NE(out[0], '-') << argv[0] << " " << out;
+        });
+    }
+    auto both = [&] (commands::Args argv) {
+        std::string a, b;
+        table.call(*table.lookup(argv[0]), argv, a);
+        copy.call(*copy.lookup(argv[0]), argv, b);
+        EXPECT_EQ(a, b) << argv[0];
+    };
+    both({"XRANGE", "s", "-", "+"});
+    both({"XLEN", "e"});
+    both({"XPENDING", "s", "g"});
+    both({"XREADGROUP", "GROUP", "g", "alice", "STREAMS", "s", "0"});
+    both({"XREADGROUP", "GROUP", "g", "bob", "COUNT", "1", "STREAMS", "s", ">"});
+    both({"XADD", "e", "7-*", "x", "y"});
+    both({"XGROUP", "CREATECONSUMER", "s", "g", "idle"});
+    both({"XLEN", "t"});
+    both({"XGROUP", "CREATE", "t", "_", "$"});
+    both({"XADD", "t", "3-*", "x", "y"});
+}
@@ -0,0 +1,131 @@
+#include <gtest/gtest.h>
+#include "tracking/tracking.h"
+#include <poll.h>
+#include <sys/socket.h>
+#include <string>
+
+class TrackingTest : public testing::Test {
+protected:
+    void SetUp() override {
+        for (auto& c : _clients) {
+            int sv[2];
+            ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+            c = {sv[0], sv[1]};
+        }
+    }
+
+    void TearDown() override {
+        for (auto& [srv, cli] : _clients) {
+            ps.drop(srv);
+            close(srv);
+            close(cli);
+        }
+    }
+
+    // sends argv as client k, the reply is read with received()
+    void send(int k, net::resp::Command cmd) {
+        int srv = _clients[k].first;
+        ASSERT_TRUE(tracking.handle(srv, cmd) || table.handle(srv, cmd));
+    }
+
+    // whatever client k got within wait_ms, pushes come from another thread
+    std::string received(int k, int wait_ms = 1000) {
+        std::string s;
+        char buf[4096];
+        struct pollfd p = {_clients[k].second, POLLIN, 0};
+        while (poll(&p, 1, wait_ms) > 0) {
+            ssize_t rv = read(_clients[k].second, buf, sizeof(buf));
+            if (rv <= 0) break;
+            s.append(buf, rv);
+            wait_ms = 20;
+        }
+        return s;
+    }
+
+    std::string run(int k, net::resp::Command cmd) {
+        send(k, std::move(cmd));
+        return received(k);
+    }
+
+    store::Keyspace ks;
+    commands::Table table{ks};
+    pubsub::PubSub ps;
+    // a single key per shard
+    tracking::Tracking tracking{table, ps, store::Keyspace::k_shards};
+
+private:
+    std::pair<int, int> _clients[2];
+};
+
+static const std::string k_invalidate_k = ">2\r\n$10\r\ninvalidate\r\n*1\r\n$1\r\nk\r\n";
+
+TEST_F(TrackingTest, InvalidatesReaders) {
+    EXPECT_EQ(run(0, {{"CLIENT", "TRACKING", "on"}}), "+OK\r\n");
+    EXPECT_EQ(run(0, {{"GET", "k"}}), "_\r\n");
+    EXPECT_EQ(tracking.tracked(), 1u);
+    EXPECT_EQ(run(1, {{"SET", "k", "v"}}), "+OK\r\n");
+    EXPECT_EQ(received(0), k_invalidate_k);
+    EXPECT_EQ(tracking.tracked(), 0u);
+
+    // once per read
+    EXPECT_EQ(run(1, {{"SET", "k", "w"}}), "+OK\r\n");
+    EXPECT_EQ(received(0, 50), "");
+
+    EXPECT_EQ(run(0, {{"MGET", "k", "other"}}), "*2\r\n$1\r\nw\r\n_\r\n");
+    EXPECT_EQ(run(0, {{"CLIENT", "TRACKING", "off"}}), "+OK\r\n");
+    EXPECT_EQ(run(1, {{"DEL", "k"}}), ":1\r\n");
+    EXPECT_EQ(received(0, 50), "");
+
+    EXPECT_EQ(run(0, {{"CLIENT", "TRACKING", "maybe"}}), "-ERR syntax error\r\n");
+    EXPECT_EQ(run(0, {{"CLIENT", "TRACKING", "on", "PREFIX", "a"}}),
+              "-ERR PREFIX option requires BCAST mode to be enabled\r\n");
+}
+
+TEST_F(TrackingTest, NoLoop) {
+    EXPECT_EQ(run(0, {{"CLIENT", "TRACKING", "on", "NOLOOP"}}), "+OK\r\n");
+    EXPECT_EQ(run(0, {{"GET", "k"}}), "_\r\n");
+    // its own write tells it nothing
+    EXPECT_EQ(run(0, {{"SET", "k", "v"}}), "+OK\r\n");
+    EXPECT_EQ(received(0, 50), "");
+    EXPECT_EQ(tracking.tracked(), 0u);
+}
+
+TEST_F(TrackingTest, Broadcast) {
+    EXPECT_EQ(run(0, {{"CLIENT", "TRACKING", "on", "BCAST", "PREFIX", "user:", "PREFIX", "k"}}), "+OK\r\n");
+    // nothing read is remembered
+    EXPECT_EQ(run(0, {{"GET", "user:1"}}), "_\r\n");
+    EXPECT_EQ(tracking.tracked(), 0u);
+    EXPECT_EQ(run(1, {{"SET", "user:1", "v"}}), "+OK\r\n");
+    EXPECT_EQ(received(0), ">2\r\n$10\r\ninvalidate\r\n*1\r\n$6\r\nuser:1\r\n");
+    EXPECT_EQ(run(1, {{"SET", "k", "v"}}), "+OK\r\n");
+    EXPECT_EQ(received(0), k_invalidate_k);
+    EXPECT_EQ(run(1, {{"SET", "other", "v"}}), "+OK\r\n");
+    EXPECT_EQ(received(0, 50), "");
+}
+
+TEST_F(TrackingTest, EvictsOldestKey) {
+    // two keys of the same shard, which holds a single one
+    std::string a = "a", b;
+    for (int n = 0 ; b.empty() ; ++n) {
+        std::string c = "b";
+        c += std::to_string(n);
+        if (store::Keyspace::shard_index(store::Keyspace::hash(c)) ==
+            store::Keyspace::shard_index(store::Keyspace::hash(a))) b = c;
+    }
+    EXPECT_EQ(run(0, {{"CLIENT", "TRACKING", "on"}}), "+OK\r\n");
+    EXPECT_EQ(run(0, {{"GET", a}}), "_\r\n");
+    send(0, {{"GET", b}});
+    // the reply goes through the courier too, behind the invalidation
+    EXPECT_EQ(received(0), ">2\r\n$10\r\ninvalidate\r\n*1\r\n$1\r\na\r\n_\r\n");
+    EXPECT_EQ(tracking.tracked(), 1u);
+    EXPECT_EQ(run(1, {{"SET", a, "v"}}), "+OK\r\n");
+    EXPECT_EQ(received(0, 50), "");
+}
+
+TEST_F(TrackingTest, FlushAll) {
+    EXPECT_EQ(run(0, {{"CLIENT", "TRACKING", "on"}}), "+OK\r\n");
+    EXPECT_EQ(run(0, {{"GET", "k"}}), "_\r\n");
+    EXPECT_EQ(run(1, {{"FLUSHALL"}}), "+OK\r\n");
+    EXPECT_EQ(received(0), ">2\r\n$10\r\ninvalidate\r\n_\r\n");
+    EXPECT_EQ(tracking.tracked(), 0u);
+}
@@ -0,0 +1,141 @@
+#include <gtest/gtest.h>
+#include "upgrade/upgrade.h"
+#include <poll.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <chrono>
+#include <string>
+#include <thread>
+
+#define PORT      ntohs(1342)
+// 127.0.0.1
+#define IP        ntohl(INADDR_LOOPBACK)
+#define K_MAX_MSG 4096
+
+static const char* k_path = "/tmp/ridics_test_upgrade.sock";
+
+// the old server runs in its own process, the test is the new binary
+class UpgradeTest : public testing::Test {
+protected:
+    void SetUp() override {
+        _old = fork();
+        ASSERT_GE(_old, 0);
+        if (_old == 0) {
+            signal(SIGPIPE, SIG_IGN);
+            net::resp::Redis redis(IP, PORT, K_MAX_MSG);
+            store::Keyspace ks;
+            commands::Table table(ks);
+            table.attach(redis);
+            replication::Replication repl(table);
+            repl.attach(redis);
+            upgrade::Handoff handoff(redis, repl, k_path);
+            redis.accept_all();
+            bool drained = redis.drain(std::chrono::seconds(5));
+            handoff.finish(std::chrono::seconds(1));
+            _exit(drained ? 0 : 1);
+        }
+    }
+
+    void TearDown() override {
+        if (_old > 0) {
+            kill(_old, SIGKILL);
+            waitpid(_old, nullptr, 0);
+        }
+    }
+
+    // the old process's exit status, -1 when it is still running after 5 s
+    int exited() {
+        int status;
+        for (int k = 0 ; k < 500 ; ++k) {
+            if (waitpid(_old, &status, WNOHANG) == _old) {
+                _old = -1;
+                return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        return -1;
+    }
+
+    // a connection past the handshake, to whoever accepts it
+    static int client() {
+        for (int tries = 0 ; tries < 100 ; ++tries) {
+            int fd = socket(AF_INET, SOCK_STREAM, 0);
+            struct sockaddr_in addr = {};
+            addr.sin_family = AF_INET;
+            addr.sin_port = PORT;
+            addr.sin_addr.s_addr = IP;
+            if (connect(fd, (const struct sockaddr*)&addr, sizeof(addr)) == 0) {
+                EXPECT_EQ(send(fd, "HELLO 3\r\n"), "+OK\r\n");
+                return fd;
+            }
+            close(fd);
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        ADD_FAILURE() << "server not reachable";
+        return -1;
+    }
+
+    static std::string send(int fd, const std::string& req) {
+        net::write_stream(fd, req.data(), req.size());
+        std::string s;
+        char buf[4096];
+        struct pollfd p = {fd, POLLIN, 0};
+        int timeout = 1000;
+        while (poll(&p, 1, timeout) > 0) {
+            ssize_t rv = read(fd, buf, sizeof(buf));
+            if (rv <= 0) break;
+            s.append(buf, rv);
+            timeout = 50;
+        }
+        return s;
+    }
+
+    pid_t _old = -1;
+};
+
+TEST_F(UpgradeTest, HandsOverSocketAndKeyspace) {
+    int before = client();
+    ASSERT_GE(before, 0);
+    EXPECT_EQ(send(before, "SET a 1\r\n"), "+OK\r\n");
+
+    int link = -1;
+    int fd = -1;
+    for (int tries = 0 ; tries < 100 && fd < 0 ; ++tries) {
+        fd = upgrade::take_over(k_path, link);
+        if (fd < 0) std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    ASSERT_GE(fd, 0);
+    // connecting before the new server accepts : queued, not refused
+    int queued = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = PORT;
+    addr.sin_addr.s_addr = IP;
+    ASSERT_EQ(connect(queued, (const struct sockaddr*)&addr, sizeof(addr)), 0);
+
+    net::resp::Redis redis(IP, PORT, K_MAX_MSG, fd);
+    store::Keyspace ks;
+    commands::Table table(ks);
+    table.attach(redis);
+    replication::Replication repl(table);
+    repl.attach(redis);
+    ASSERT_TRUE(repl.take_over(link));
+    std::thread serving([&redis] { redis.accept_all(); });
+
+    EXPECT_EQ(send(queued, "HELLO 3\r\n"), "+OK\r\n");
+    EXPECT_EQ(send(queued, "GET a\r\n"), "$1\r\n1\r\n");
+    // the old process still serves its client, its writes come over
+    EXPECT_EQ(send(before, "SET b 2\r\n"), "+OK\r\n");
+    EXPECT_EQ(send(queued, "GET b\r\n"), "$1\r\n2\r\n");
+    int after = client();
+    EXPECT_EQ(send(after, "INCR b\r\n"), ":3\r\n");
+
+    // the old process exits once its last client left
+    close(before);
+    EXPECT_EQ(exited(), 0);
+    EXPECT_EQ(send(after, "GET b\r\n"), "$1\r\n3\r\n");
+    close(after);
+    close(queued);
+    redis.stop();
+    serving.join();
+}